@@ -0,0 +1,131 @@
+#include "animation.hpp"
+#include "jobs.hpp"
+#include "bench.hpp"
+#include <random>
+#include <cmath>
+
+#define THISFILE "anim_bench.cpp"
+
+// Times the CPU half of crowd skinning (sampling two clips, blending them and building the skinning palette) per
+// animation LOD, serially and on the job system, as characters per millisecond. The GPU half shows up in the
+// profiler as the "Skinning" zone of the game.
+// Usage: AnimBench [characters] [iterations] [threads]
+// Needs no GPU, only the engine's animation code.
+
+static constexpr uint32_t s_BONE_COUNT = 64;
+static constexpr uint32_t s_KEY_COUNT = 31;
+static constexpr float s_SAMPLE_RATE = 30.0f;
+
+static void s_Report(char const* name, double ms, uint32_t character_count)
+{
+	std::printf("  %-34s %9.3f ms %10.1f characters/ms\n", name, ms, character_count / ms);
+}
+
+// Random rotations of up to about 20 degrees per key, looping.
+static AnimationClip s_MakeClip(std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> dist(-0.17f, 0.17f);
+	AnimationClip clip(s_BONE_COUNT, s_KEY_COUNT, s_SAMPLE_RATE);
+
+	for (uint32_t key = 0; key + 1 < s_KEY_COUNT; key++)
+		for (uint32_t bone = 0; bone < s_BONE_COUNT; bone++)
+		{
+			float q[4] = { dist(rng), dist(rng), dist(rng), 1.0f };
+			float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+			for (float& c : q)
+				c /= length;
+
+			float const translation[3] = { 0.0f, bone ? 0.1f : 1.0f, 0.0f };
+			clip.GetKey(key).SetBone(bone, translation, q);
+		}
+
+	clip.GetKey(s_KEY_COUNT - 1) = clip.GetKey(0);
+	return clip;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t character_count = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 2000;
+	uint32_t iterations = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 50;
+	uint32_t thread_count = argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 0;
+	VALIDATE(character_count > 0 && iterations > 0);
+
+	JobSystem* jobs = new JobSystem(thread_count);
+	std::mt19937 rng(1234);
+
+	// A binary tree of bones, parents first, 10 cm apart.
+	Skeleton skeleton;
+	Pose bind_pose(s_BONE_COUNT);
+	for (uint32_t bone = 0; bone < s_BONE_COUNT; bone++)
+	{
+		skeleton.Parents.push_back(bone ? static_cast<int32_t>((bone - 1) / 2) : -1);
+		float const translation[3] = { 0.0f, bone ? 0.1f : 1.0f, 0.0f };
+		float const rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		bind_pose.SetBone(bone, translation, rotation);
+	}
+	SetBindPose(skeleton, bind_pose);
+
+	AnimationClip walk = s_MakeClip(rng), run = s_MakeClip(rng);
+
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<float> times(character_count), blends(character_count);
+	for (uint32_t i = 0; i < character_count; i++)
+		times[i] = unit(rng) * walk.GetDuration(), blends[i] = unit(rng);
+
+	std::vector<float> palettes(size_t(character_count) * s_BONE_COUNT * 12);
+	std::vector<Pose> scratch(jobs->GetThreadCount() * 2, Pose(s_BONE_COUNT));
+
+	auto pose = [&](uint32_t begin, uint32_t end, uint32_t bone_count, uint32_t thread) {
+		Pose& a = scratch[thread * 2];
+		Pose& b = scratch[thread * 2 + 1];
+		for (uint32_t i = begin; i < end; i++)
+		{
+			walk.Sample(times[i], bone_count, a);
+			run.Sample(times[i] * 1.3f, bone_count, b);
+			BlendPoses(a, b, blends[i], bone_count, a);
+			ComputeSkinningPalette(skeleton, a, bone_count, palettes.data() + size_t(i) * s_BONE_COUNT * 12);
+		}
+	};
+
+	std::printf("AnimBench: %u characters, %u bones, %u iterations, %u threads\n", character_count, s_BONE_COUNT, iterations,
+		jobs->GetThreadCount());
+
+	// The LODs of the game's crowd, scaled to this skeleton: every bone, then the first 24, then the first 8.
+	struct BenchLod { char const* Name; uint32_t BoneCount; };
+	BenchLod const lods[] = { { "64 bones", 64 }, { "24 bones", 24 }, { "8 bones", 8 } };
+
+	for (BenchLod const& lod : lods)
+	{
+		std::printf("Sample, blend and palette, %s\n", lod.Name);
+		s_Report("serial", BenchTime(iterations, [&]() { pose(0, character_count, lod.BoneCount, 0); }), character_count);
+		s_Report("parallel", BenchTime(iterations, [&]() {
+			jobs->ParallelFor(character_count, 16, [&](uint32_t begin, uint32_t end) { pose(begin, end, lod.BoneCount, jobs->GetThreadIndex()); });
+		}), character_count);
+	}
+
+	// A crowd spread evenly over the three LODs, updating every frame, every 2nd and every 4th frame: per frame that is
+	// a third of the crowd at full detail, a sixth at the middle LOD and a twelfth at the lowest.
+	std::printf("Crowd over three LODs (1/1, 1/2, 1/4 update rates), per frame\n");
+	uint32_t frame = 0;
+	s_Report("parallel", BenchTime(iterations, [&]() {
+		frame++;
+		jobs->ParallelFor(character_count, 16, [&](uint32_t begin, uint32_t end) {
+			uint32_t thread = jobs->GetThreadIndex();
+			for (uint32_t i = begin; i < end; i++)
+			{
+				uint32_t lod = i % 3;
+				if ((frame + i) % (1u << lod) == 0)
+					pose(i, i + 1, lods[lod].BoneCount, thread);
+			}
+		});
+	}), character_count);
+
+	// Keeps the palettes from being optimized away.
+	float checksum = 0.0f;
+	for (size_t i = 0; i < palettes.size(); i += 97)
+		checksum += palettes[i];
+	std::printf("  (checksum %f, ignore)\n", checksum);
+
+	delete jobs;
+	return 0;
+}
\ No newline at end of file
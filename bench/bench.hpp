@@ -0,0 +1,21 @@
+#pragma once
+
+#include "core.hpp"
+
+// Shared by the CPU-only benchmarks.
+
+// Median of iterations, in milliseconds.
+template<class F>
+inline double BenchTime(uint32_t iterations, F&& func)
+{
+	std::vector<double> times;
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		func();
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "ecs.hpp"
+#include "jobs.hpp"
+#include "bench.hpp"
+#include <random>
+#include <memory>
+
+#define THISFILE "ecs_bench.cpp"
+
+// Times the same systems over a horde stored three ways: archetype chunks, an array of structs, and an array of
+// pointers to heap-allocated structs, which is what game objects tend to end up as.
+// Usage: EcsBench [entities] [iterations] [threads]
+// Needs no GPU, only the engine's ECS.
+
+struct Position { float X, Y, Z; };
+struct Velocity { float X, Y, Z; };
+struct Health { float Value, Regen; };
+
+// Cold per-zombie state no system below touches, there to take up cache lines as it would in a real game.
+struct Brain
+{
+	uint32_t State;
+	uint32_t Target;
+	float Timer;
+	float Memory[13];
+};
+
+struct Zombie
+{
+	::Position Position;
+	::Velocity Velocity;
+	::Health Health;
+	::Brain Brain;
+};
+
+static constexpr float s_DT = 1.0f / 60.0f;
+
+static void s_Report(char const* name, double ms, uint32_t entity_count)
+{
+	std::printf("  %-34s %9.3f ms %8.2f ns/entity\n", name, ms, ms * 1e6 / entity_count);
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t entity_count = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 100000;
+	uint32_t iterations = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 100;
+	uint32_t thread_count = argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 0;
+	VALIDATE(entity_count > 0 && iterations > 0);
+
+	JobSystem* jobs = new JobSystem(thread_count);
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+	World* world = new World(jobs);
+	std::vector<Entity> entities;
+	std::vector<Zombie> zombies;
+	std::vector<Zombie*> zombie_pointers;
+
+	// Heap objects are allocated in between other allocations, as they would be over a play session, and visited in
+	// spawn order rather than address order.
+	std::vector<std::unique_ptr<char[]>> clutter;
+
+	for (uint32_t i = 0; i < entity_count; i++)
+	{
+		Zombie zombie{ { dist(rng) * 100.0f, 0.0f, dist(rng) * 100.0f }, { dist(rng), 0.0f, dist(rng) }, { 100.0f, 0.1f }, {} };
+
+		entities.push_back(world->Create(zombie.Position, zombie.Velocity, zombie.Health, zombie.Brain));
+		zombies.push_back(zombie);
+		zombie_pointers.push_back(new Zombie(zombie));
+		clutter.emplace_back(new char[16 + rng() % 256]);
+	}
+
+	std::shuffle(zombie_pointers.begin(), zombie_pointers.end(), rng);
+	clutter.clear();
+
+	std::printf("EcsBench: %u entities, %u iterations, %u threads, %zu-byte chunks of %u entities\n", entity_count, iterations,
+		jobs->GetThreadCount(), ECS_CHUNK_SIZE, world->GetArchetypes()[0]->Capacity);
+
+	// Movement: reads velocity, writes position.
+	std::printf("Movement (position += velocity * dt)\n");
+
+	s_Report("AoS, pointers to heap objects", BenchTime(iterations, [&]() {
+		for (Zombie* zombie : zombie_pointers)
+		{
+			zombie->Position.X += zombie->Velocity.X * s_DT;
+			zombie->Position.Y += zombie->Velocity.Y * s_DT;
+			zombie->Position.Z += zombie->Velocity.Z * s_DT;
+		}
+	}), entity_count);
+
+	s_Report("AoS, contiguous array", BenchTime(iterations, [&]() {
+		for (Zombie& zombie : zombies)
+		{
+			zombie.Position.X += zombie.Velocity.X * s_DT;
+			zombie.Position.Y += zombie.Velocity.Y * s_DT;
+			zombie.Position.Z += zombie.Velocity.Z * s_DT;
+		}
+	}), entity_count);
+
+	Query<Position, Velocity const> movement;
+
+	s_Report("ECS, per entity", BenchTime(iterations, [&]() {
+		movement.ForEach(*world, [](Position& position, Velocity const& velocity) {
+			position.X += velocity.X * s_DT;
+			position.Y += velocity.Y * s_DT;
+			position.Z += velocity.Z * s_DT;
+		});
+	}), entity_count);
+
+	auto move_chunk = [](uint32_t count, Entity const*, Position* positions, Velocity const* velocities) {
+		for (uint32_t i = 0; i < count; i++)
+		{
+			positions[i].X += velocities[i].X * s_DT;
+			positions[i].Y += velocities[i].Y * s_DT;
+			positions[i].Z += velocities[i].Z * s_DT;
+		}
+	};
+
+	s_Report("ECS, per chunk", BenchTime(iterations, [&]() { movement.ForEachChunk(*world, move_chunk); }), entity_count);
+	jobs->ResetStats();
+	s_Report("ECS, per chunk, parallel", BenchTime(iterations, [&]() { movement.ParallelForEachChunk(*world, move_chunk); }), entity_count);
+	jobs->PrintStats();
+
+	// Reacting to damage: 1% of the horde is hit each iteration, and only the hit need checking for death.
+	std::printf("Death check after damaging 1%% of entities\n");
+
+	uint32_t hit_count = std::max(1u, entity_count / 100);
+	uint32_t hit_cursor = 0, deaths = 0;
+
+	auto damage = [&]() {
+		for (uint32_t i = 0; i < hit_count; i++, hit_cursor = (hit_cursor + 1) % entity_count)
+		{
+			zombies[hit_cursor].Health.Value -= 1.0f;
+			zombie_pointers[hit_cursor]->Health.Value -= 1.0f;
+			world->Get<Health>(entities[hit_cursor])->Value -= 1.0f;
+		}
+	};
+
+	s_Report("AoS, pointers to heap objects", BenchTime(iterations, [&]() {
+		damage();
+		for (Zombie* zombie : zombie_pointers)
+			deaths += zombie->Health.Value <= 0.0f;
+	}), entity_count);
+
+	s_Report("AoS, contiguous array", BenchTime(iterations, [&]() {
+		damage();
+		for (Zombie& zombie : zombies)
+			deaths += zombie.Health.Value <= 0.0f;
+	}), entity_count);
+
+	Query<Health const> death_check;
+	death_check.WithChanged<Health>();
+	death_check.ForEach(*world, [](Health const&) {}); // Everything is new on the first run
+
+	uint64_t visited = 0;
+	s_Report("ECS, changed chunks only", BenchTime(iterations, [&]() {
+		damage();
+		death_check.ForEachChunk(*world, [&](uint32_t count, Entity const*, Health const* health) {
+			visited++;
+			for (uint32_t i = 0; i < count; i++)
+				deaths += health[i].Value <= 0.0f;
+		});
+	}), entity_count);
+
+	uint64_t chunk_count = 0;
+	for (Archetype const* archetype : world->GetArchetypes())
+		chunk_count += archetype->Chunks.size();
+
+	std::printf("  ECS visited %.1f of %llu chunks per iteration (%u deaths, ignore)\n", static_cast<double>(visited) / iterations,
+		static_cast<unsigned long long>(chunk_count), deaths);
+
+	for (Zombie* zombie : zombie_pointers)
+		delete zombie;
+	delete world;
+	delete jobs;
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "vulkan.hpp"
+#include "window.hpp"
+#include "render.hpp"
+#include "frame.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "sync.hpp"
+#include "asset_pack.hpp"
+#include "recorder.hpp"
+#include "jobs.hpp"
+#include "bindless.hpp"
+#include "frame_ring.hpp"
+
+#define THISFILE "frame_bench.cpp"
+
+// Renders a fixed scene offscreen for N frames and prints frame time statistics.
+// Usage: FrameBench [frames] [draws per frame] [recording threads]
+// With zero recording threads (the default) draws are recorded inline into the primary command buffer, otherwise
+// they are recorded by jobs on a job system with that many threads.
+// Runs without a display, e.g. on CI under lavapipe (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json).
+
+static constexpr uint32_t s_WIDTH = 1920, s_HEIGHT = 1080;
+static constexpr uint32_t s_FRAMES_IN_FLIGHT = 2;
+static constexpr uint32_t s_WARMUP_FRAMES = 16;
+
+// Push constants of the scene shaders, see scene.glsl.
+struct DrawConstants
+{
+	uint32_t MaterialIndex;
+	uint32_t Padding;
+	VkDeviceAddress Frame; // FrameConstants in the frame ring
+};
+
+struct FrameConstants
+{
+	float ViewProjection[16]; // Unused by shader.vert
+	float Tint[4];
+	VkDeviceAddress Textures; // Unused by shader.frag
+};
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1000;
+	uint32_t draw_count = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 64;
+	uint32_t thread_count = argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 0;
+	VALIDATE(frame_count > 0 && draw_count > 0);
+
+	LaunchVulkan(true);
+
+	Window* window = new Window(s_WIDTH, s_HEIGHT, false, true);
+	GraphicsDevice* device = new GraphicsDevice(*window);
+	Swapchain* swapchain = new Swapchain(*window, *device);
+	AssetPack* assets = new AssetPack("assets.pack");
+	GraphicsPipeline* pipeline;
+
+	{
+		GraphicsPipelineCreator creator(*device);
+		creator.SetRenderFormat(swapchain->GetImageFormat());
+		creator.SetDynamicRendering(true);
+		creator.AddShaderModule(VERTEX_SHADER, *assets, "shaders/shader.vert.spv");
+		creator.AddShaderModule(FRAGMENT_SHADER, *assets, "shaders/shader.frag.spv");
+		creator.AddVertexBinding(0, sizeof(float) * 2);
+		creator.AddVertexAttribute(0, 0, VK_FORMAT_R32G32_SFLOAT, 0);
+		pipeline = new GraphicsPipeline(creator);
+	}
+
+	FrameScheduler* scheduler = new FrameScheduler(*device, *swapchain, s_FRAMES_IN_FLIGHT);
+	Uploader* uploader = new Uploader(*device);
+	JobSystem* jobs = thread_count ? new JobSystem(thread_count) : nullptr;
+	ParallelRecorder* recorder = jobs ? new ParallelRecorder(*device, *jobs, s_FRAMES_IN_FLIGHT) : nullptr;
+
+	// Triangle vertices, streamed in through the uploader.
+	float const positions[] = { 0.0f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f };
+
+	VkBufferCreateInfo vbci{};
+	vbci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	vbci.size = sizeof(positions);
+	vbci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	vbci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	Allocation* vertex_memory;
+	VkBuffer vertex_buffer = device->GetAllocator()->CreateBuffer(vbci, GPU_ONLY_MEMORY, &vertex_memory);
+	uploader->UploadBuffer(vertex_buffer, 0, std::vector<char>(reinterpret_cast<char const*>(positions),
+		reinterpret_cast<char const*>(positions) + sizeof(positions)), VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+
+	// Material colour, which the fragment shader finds through the buffer's bindless index.
+	float const color[] = { 1.0f, 0.0f, 0.0f, 1.0f };
+
+	VkBufferCreateInfo mbci{};
+	mbci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	mbci.size = sizeof(color);
+	mbci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	mbci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	Allocation* material_memory;
+	VkBuffer material_buffer = device->GetAllocator()->CreateBuffer(mbci, GPU_ONLY_MEMORY, &material_memory);
+	uploader->UploadBuffer(material_buffer, 0, std::vector<char>(reinterpret_cast<char const*>(color),
+		reinterpret_cast<char const*>(color) + sizeof(color)), VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+	DrawConstants draw_constants{ device->GetBindlessHeap()->AddBuffer(material_buffer) };
+	FrameRing* frame_ring = new FrameRing(*device, s_FRAMES_IN_FLIGHT);
+
+	uploader->Flush(); // The first frame acquires the vertices and material, before any timing starts.
+
+	std::vector<double> frame_times;
+	frame_times.reserve(frame_count);
+	double cpu_wait = 0.0, gpu_wait = 0.0;
+
+	auto last = std::chrono::steady_clock::now();
+
+	for (uint32_t frame = 0; frame < s_WARMUP_FRAMES + frame_count; frame++)
+	{
+		VkCommandBuffer cmd = scheduler->BeginFrame();
+		uploader->BeginFrame(cmd, *scheduler);
+		frame_ring->BeginFrame(scheduler->GetSlotIndex());
+		VkExtent2D extent = swapchain->GetExtent();
+
+		VkClearValue clear{};
+		clear.color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+
+		VkImage image = swapchain->GetImage(scheduler->GetImageIndex());
+		VkImageView view = swapchain->GetImageView(scheduler->GetImageIndex());
+
+		// The acquire semaphore is waited on at colour output, so the transition chains after it.
+		TransitionImage(cmd, image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+
+		VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+		VkRect2D scissor{ { 0, 0 }, extent };
+
+		// State is not inherited by secondaries, every slice binds its own. Each draw pushes its material
+		// and its own constants as a real scene would, which is all the per-draw binding bindless needs.
+		auto record_draws = [&](VkCommandBuffer target, uint32_t begin, uint32_t end) {
+			vkCmdBindPipeline(target, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->GetHandle());
+			device->GetBindlessHeap()->Bind(target, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->GetLayout());
+			vkCmdSetViewport(target, 0, 1, &viewport);
+			vkCmdSetScissor(target, 0, 1, &scissor);
+
+			VkDeviceSize vertex_offset = 0;
+			vkCmdBindVertexBuffers(target, 0, 1, &vertex_buffer, &vertex_offset);
+			for (uint32_t i = begin; i < end; i++) {
+				// Per-draw data straight from the ring, from whichever thread records the draw.
+				FrameSpan<FrameConstants> constants = frame_ring->Allocate<FrameConstants>();
+				std::fill_n(constants.Data->Tint, 4, 1.0f);
+				constants.Data->Textures = 0;
+
+				DrawConstants draw = draw_constants;
+				draw.Frame = constants.Address;
+				PushConstants(target, pipeline->GetLayout(), draw);
+				vkCmdDraw(target, 3, 1, 0, 0);
+			}
+		};
+
+		if (recorder)
+		{
+			recorder->BeginFrame(scheduler->GetSlotIndex());
+			BeginRendering(cmd, view, extent, clear, VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT);
+
+			VkFormat color_format = swapchain->GetImageFormat();
+
+			VkCommandBufferInheritanceRenderingInfo rendering{};
+			rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+			rendering.colorAttachmentCount = 1;
+			rendering.pColorAttachmentFormats = &color_format;
+			rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+			VkCommandBufferInheritanceInfo inheritance{};
+			inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			inheritance.pNext = &rendering;
+			recorder->Record(cmd, inheritance, draw_count, record_draws);
+		}
+		else
+		{
+			BeginRendering(cmd, view, extent, clear);
+			record_draws(cmd, 0, draw_count);
+		}
+
+		vkCmdEndRendering(cmd);
+
+		TransitionImage(cmd, image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, swapchain->GetFinalLayout(),
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE);
+
+		scheduler->EndFrame();
+
+		auto now = std::chrono::steady_clock::now();
+		if (frame >= s_WARMUP_FRAMES)
+		{
+			frame_times.push_back(std::chrono::duration<double, std::milli>(now - last).count());
+			cpu_wait += scheduler->GetStats().CpuWaitMs;
+			gpu_wait += scheduler->GetStats().GpuWaitMs;
+		}
+		last = now;
+	}
+
+	device->GetAllocator()->PrintStats();
+	if (jobs)
+		jobs->PrintStats();
+
+	delete scheduler;
+	delete uploader;
+	delete frame_ring;
+	delete recorder;
+	delete jobs;
+	device->GetAllocator()->DestroyBuffer(material_buffer, material_memory);
+	device->GetAllocator()->DestroyBuffer(vertex_buffer, vertex_memory);
+	delete pipeline;
+	delete assets;
+	delete swapchain;
+	delete device;
+	delete window;
+
+	EndVulkan();
+
+	double total = 0.0;
+	for (double t : frame_times)
+		total += t;
+
+	std::sort(frame_times.begin(), frame_times.end());
+	size_t p99 = std::min(frame_times.size() - 1, static_cast<size_t>(frame_times.size() * 0.99));
+
+	std::cout << "frames " << frame_count << ", draws/frame " << draw_count << ", recording threads " << thread_count
+		<< ", " << s_WIDTH << "x" << s_HEIGHT << "\n";
+	std::cout << "frame time  min " << frame_times.front() << " ms, avg " << total / frame_count
+		<< " ms, p99 " << frame_times[p99] << " ms\n";
+	std::cout << "avg wait    cpu " << cpu_wait / frame_count << " ms, gpu " << gpu_wait / frame_count << " ms\n";
+
+	return 0;
+}
\ No newline at end of file
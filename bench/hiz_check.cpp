@@ -0,0 +1,158 @@
+#include "hiz.hpp"
+#include <random>
+#include <cmath>
+#include <bit>
+
+#define THISFILE "hiz_check.cpp"
+
+// Checks that Hi-Z occlusion culling is conservative at screen sizes that are not powers of two: the pyramid is
+// built on the CPU the way hiz.comp builds it, instances are tested the way cull.comp tests them, and every box
+// culled is checked against the depth of every pixel it touches. The depth is a wall of near pixels with a few
+// single far pixels through it, the detail a pyramid that skips depth texels loses. Rounding level 0 down instead
+// of up is run alongside as the baseline, and should fail.
+// Usage: HiZCheck [boxes per size] [width height...]
+// Needs no GPU. Exits with 1 if the engine's pyramid culls a visible box.
+
+static constexpr float s_WALL_DEPTH = 0.2f;
+static constexpr float s_HOLE_CHANCE = 0.01f;
+
+struct Level
+{
+	uint32_t Width, Height;
+	std::vector<float> Texels;
+};
+
+// One bilinear tap through the max-reduction sampler with clamp to edge: the farthest of the 2x2 texels around uv.
+static float s_SampleMax(Level const& level, float u, float v)
+{
+	float x = u * level.Width - 0.5f, y = v * level.Height - 0.5f;
+	int32_t x0 = static_cast<int32_t>(std::floor(x)), y0 = static_cast<int32_t>(std::floor(y));
+
+	float farthest = 0.0f;
+	for (int32_t dy = 0; dy < 2; dy++)
+	{
+		for (int32_t dx = 0; dx < 2; dx++)
+		{
+			uint32_t tx = static_cast<uint32_t>(std::clamp(x0 + dx, 0, static_cast<int32_t>(level.Width) - 1));
+			uint32_t ty = static_cast<uint32_t>(std::clamp(y0 + dy, 0, static_cast<int32_t>(level.Height) - 1));
+			farthest = std::max(farthest, level.Texels[ty * level.Width + tx]);
+		}
+	}
+	return farthest;
+}
+
+// As HiZPyramid::Build and hiz.comp: each level one tap per texel from the one before, level 0 from the depth.
+static std::vector<Level> s_BuildPyramid(Level const& depth, VkExtent2D extent)
+{
+	uint32_t mip_count = std::bit_width(std::max(extent.width, extent.height));
+	std::vector<Level> levels(mip_count);
+
+	for (uint32_t i = 0; i < mip_count; i++)
+	{
+		Level const& source = i ? levels[i - 1] : depth;
+		Level& target = levels[i];
+		target.Width = std::max(extent.width >> i, 1u);
+		target.Height = std::max(extent.height >> i, 1u);
+		target.Texels.resize(target.Width * target.Height);
+
+		for (uint32_t y = 0; y < target.Height; y++)
+			for (uint32_t x = 0; x < target.Width; x++)
+				target.Texels[y * target.Width + x] = s_SampleMax(source, (x + 0.5f) / target.Width, (y + 0.5f) / target.Height);
+	}
+	return levels;
+}
+
+// As IsOccluded in cull.comp, from the box's screen bounds and nearest depth.
+static bool s_IsOccluded(std::vector<Level> const& pyramid, float const lo[3], float const hi[2])
+{
+	float extent = std::max((hi[0] - lo[0]) * pyramid[0].Width, (hi[1] - lo[1]) * pyramid[0].Height);
+	float level = std::ceil(std::log2(std::max(extent, 1.0f)));
+	Level const& sampled = pyramid[std::min(static_cast<uint32_t>(level), static_cast<uint32_t>(pyramid.size() - 1))];
+	return lo[2] > s_SampleMax(sampled, (lo[0] + hi[0]) * 0.5f, (lo[1] + hi[1]) * 0.5f);
+}
+
+// Farthest depth among the pixels the box touches. Any of them may hold a sample of what the box bounds, whatever
+// the rasterization rules or multisampling.
+static float s_CoveredDepth(Level const& depth, float const lo[2], float const hi[2])
+{
+	int32_t x0 = static_cast<int32_t>(std::floor(lo[0] * depth.Width)), x1 = static_cast<int32_t>(std::ceil(hi[0] * depth.Width)) - 1;
+	int32_t y0 = static_cast<int32_t>(std::floor(lo[1] * depth.Height)), y1 = static_cast<int32_t>(std::ceil(hi[1] * depth.Height)) - 1;
+	x0 = std::max(x0, 0), y0 = std::max(y0, 0);
+	x1 = std::min(x1, static_cast<int32_t>(depth.Width) - 1), y1 = std::min(y1, static_cast<int32_t>(depth.Height) - 1);
+
+	float farthest = -1.0f;
+	for (int32_t y = y0; y <= y1; y++)
+		for (int32_t x = x0; x <= x1; x++)
+			farthest = std::max(farthest, depth.Texels[y * depth.Width + x]);
+	return farthest;
+}
+
+struct CheckResult
+{
+	uint32_t Culled;
+	uint32_t WronglyCulled;
+};
+
+static CheckResult s_Check(Level const& depth, std::vector<Level> const& pyramid, uint32_t box_count)
+{
+	std::mt19937 rng(5678);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	CheckResult result{};
+	for (uint32_t i = 0; i < box_count; i++)
+	{
+		// Boxes from half a pixel to a quarter of the screen across, behind the wall.
+		float size = std::exp2(unit(rng) * 9.0f - 1.0f) / depth.Width;
+		float lo[3] = { unit(rng) * (1.0f - size), unit(rng) * (1.0f - size), s_WALL_DEPTH + 0.05f + unit(rng) * 0.7f };
+		float hi[2] = { lo[0] + size, lo[1] + size * depth.Width / depth.Height * unit(rng) * 2.0f };
+		hi[1] = std::min(hi[1], 1.0f);
+
+		if (!s_IsOccluded(pyramid, lo, hi))
+			continue;
+		result.Culled++;
+		result.WronglyCulled += lo[2] <= s_CoveredDepth(depth, lo, hi);
+	}
+	return result;
+}
+
+static void s_Report(char const* name, VkExtent2D extent, CheckResult const& result, uint32_t box_count)
+{
+	std::printf("  %-22s %5ux%-5u %8u of %u culled, %6u of them visible\n", name, extent.width, extent.height, result.Culled, box_count,
+		result.WronglyCulled);
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t box_count = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 200000;
+	VALIDATE(box_count > 0);
+
+	std::vector<VkExtent2D> sizes;
+	for (int i = 2; i + 1 < argc; i += 2)
+		sizes.push_back({ static_cast<uint32_t>(std::stoul(argv[i])), static_cast<uint32_t>(std::stoul(argv[i + 1])) });
+	if (sizes.empty())
+		sizes = { { 1600, 900 }, { 1920, 1080 }, { 1366, 768 }, { 1280, 720 }, { 1000, 1000 }, { 1024, 1024 } };
+
+	std::printf("HiZCheck: %u boxes per size\n", box_count);
+
+	bool passed = true;
+	for (VkExtent2D size : sizes)
+	{
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		Level depth{ size.width, size.height, std::vector<float>(size.width * size.height) };
+		for (float& texel : depth.Texels)
+			texel = unit(rng) < s_HOLE_CHANCE ? 1.0f : s_WALL_DEPTH;
+
+		VkExtent2D extent = HiZPyramid::GetPyramidExtent(size);
+		CheckResult result = s_Check(depth, s_BuildPyramid(depth, extent), box_count);
+		s_Report("Engine", extent, result, box_count);
+		passed &= result.WronglyCulled == 0;
+
+		VkExtent2D floor_extent = { std::bit_floor(size.width), std::bit_floor(size.height) };
+		s_Report("Rounded down", floor_extent, s_Check(depth, s_BuildPyramid(depth, floor_extent), box_count), box_count);
+	}
+
+	std::printf(passed ? "Passed: nothing visible was culled\n" : "FAILED: visible boxes were culled\n");
+	return passed ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "navigation.hpp"
+#include "jobs.hpp"
+#include "bench.hpp"
+#include <random>
+#include <cmath>
+
+#define THISFILE "nav_bench.cpp"
+
+// Times flow fields over a town of walled blocks, per field: building from scratch when a goal moves, and repairing
+// after doors open and shut. Repaired fields are checked against ones built from scratch on the same grid. Then
+// times steering lookups and local avoidance for hordes of 10k and 100k agents (or the counts given).
+// Usage: NavBench [iterations] [threads] [agent counts...]
+// Needs no GPU, only the engine's navigation module.
+
+static constexpr uint32_t s_GRID_SIZE = 512;
+static constexpr float s_CELL_SIZE = 1.0f;
+static constexpr uint32_t s_FIELD_COUNT = 4;
+static constexpr uint32_t s_BLOCK_SIZE = 24;
+static constexpr float s_SEPARATION_RADIUS = 1.0f;
+
+static void s_ReportField(char const* name, double ms, uint32_t touched_cells)
+{
+	std::printf("  %-34s %9.3f ms per field %9u cells changed\n", name, ms, touched_cells);
+}
+
+static void s_ReportAgents(char const* name, double ms, uint32_t agent_count)
+{
+	std::printf("  %-34s %9.3f ms %9.1f ns per agent\n", name, ms, ms * 1e6 / agent_count);
+}
+
+// A town: blocks of buildings whose walls have a door on each side, streets between them, and rubble that is slow
+// to cross. Returns the cells of the doors.
+static std::vector<uint32_t> s_BuildTown(NavigationGrid& grid, std::mt19937& rng)
+{
+	std::vector<uint32_t> doors;
+	std::uniform_int_distribution<uint32_t> cell(0, s_GRID_SIZE - 1);
+	for (uint32_t by = 0; by + s_BLOCK_SIZE <= s_GRID_SIZE; by += s_BLOCK_SIZE)
+	{
+		for (uint32_t bx = 0; bx + s_BLOCK_SIZE <= s_GRID_SIZE; bx += s_BLOCK_SIZE)
+		{
+			// Four cells of street around each building.
+			uint32_t x0 = bx + 4, y0 = by + 4, x1 = bx + s_BLOCK_SIZE - 5, y1 = by + s_BLOCK_SIZE - 5;
+			for (uint32_t i = x0; i <= x1; i++)
+				grid.SetCost(i, y0, NAV_BLOCKED), grid.SetCost(i, y1, NAV_BLOCKED);
+			for (uint32_t i = y0; i <= y1; i++)
+				grid.SetCost(x0, i, NAV_BLOCKED), grid.SetCost(x1, i, NAV_BLOCKED);
+
+			uint32_t mx = (x0 + x1) / 2, my = (y0 + y1) / 2;
+			for (uint32_t door : { y0 * s_GRID_SIZE + mx, y1 * s_GRID_SIZE + mx, my * s_GRID_SIZE + x0, my * s_GRID_SIZE + x1 })
+			{
+				grid.SetCost(door % s_GRID_SIZE, door / s_GRID_SIZE, NAV_OPEN);
+				doors.push_back(door);
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < s_GRID_SIZE * s_GRID_SIZE / 50; i++)
+	{
+		uint32_t x = cell(rng), y = cell(rng);
+		if (grid.GetCost(x, y) != NAV_BLOCKED)
+			grid.SetCost(x, y, 4);
+	}
+	return doors;
+}
+
+// Flips count random doors shut or open.
+static void s_ToggleDoors(NavigationGrid& grid, std::vector<uint32_t> const& doors, uint32_t count, std::mt19937& rng)
+{
+	std::uniform_int_distribution<size_t> pick(0, doors.size() - 1);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t door = doors[pick(rng)];
+		uint32_t x = door % s_GRID_SIZE, y = door / s_GRID_SIZE;
+		grid.SetCost(x, y, grid.GetCost(x, y) == NAV_BLOCKED ? NAV_OPEN : NAV_BLOCKED);
+	}
+}
+
+static double s_FieldMs(NavigationGrid const& grid, std::vector<FlowFieldHandle> const& fields, uint32_t& touched_cells)
+{
+	double ms = 0.0;
+	touched_cells = 0;
+	for (FlowFieldHandle field : fields)
+	{
+		ms += grid.GetStats(field).UpdateMs;
+		touched_cells += grid.GetStats(field).TouchedCells;
+	}
+	touched_cells /= static_cast<uint32_t>(fields.size());
+	return ms / fields.size();
+}
+
+// Cells whose distance or direction differ between the fields of two grids with the same costs, by sampling
+// every cell centre.
+static uint32_t s_CountMismatches(NavigationGrid const& a, FlowFieldHandle field_a, NavigationGrid const& b, FlowFieldHandle field_b)
+{
+	uint32_t mismatches = 0;
+	for (uint32_t y = 0; y < s_GRID_SIZE; y++)
+	{
+		for (uint32_t x = 0; x < s_GRID_SIZE; x++)
+		{
+			float position[2] = { (x + 0.5f) * s_CELL_SIZE, (y + 0.5f) * s_CELL_SIZE };
+			float direction_a[2], direction_b[2];
+			a.Sample(field_a, position, direction_a);
+			b.Sample(field_b, position, direction_b);
+			float distance_a = a.GetDistance(field_a, position), distance_b = b.GetDistance(field_b, position);
+			mismatches += distance_a != distance_b || direction_a[0] != direction_b[0] || direction_a[1] != direction_b[1];
+		}
+	}
+	return mismatches;
+}
+
+static void s_RunFields(JobSystem* jobs, uint32_t iterations)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> coordinate(0.0f, s_GRID_SIZE * s_CELL_SIZE);
+	float const origin[2] = { 0.0f, 0.0f };
+
+	NavigationGrid* grid = new NavigationGrid(jobs, s_GRID_SIZE, s_GRID_SIZE, s_CELL_SIZE, origin);
+	std::vector<uint32_t> doors = s_BuildTown(*grid, rng);
+
+	// Goals stand in the streets, where a player or a noise would be.
+	float goals[s_FIELD_COUNT][2];
+	auto random_goal = [&](float goal[2]) {
+		float const street = (s_BLOCK_SIZE / 2) * s_CELL_SIZE;
+		goal[0] = std::floor(coordinate(rng) / (s_BLOCK_SIZE * s_CELL_SIZE)) * s_BLOCK_SIZE * s_CELL_SIZE + 1.5f;
+		goal[1] = std::floor(coordinate(rng) / street) * street + 1.5f;
+	};
+
+	std::vector<FlowFieldHandle> fields;
+	for (uint32_t i = 0; i < s_FIELD_COUNT; i++)
+	{
+		random_goal(goals[i]);
+		fields.push_back(grid->AddField(goals[i]));
+	}
+
+	std::printf("%ux%u cells, %zu doors, %u fields\n", s_GRID_SIZE, s_GRID_SIZE, doors.size(), s_FIELD_COUNT);
+
+	uint32_t touched_cells = 0;
+	grid->Update();
+	double ms = s_FieldMs(*grid, fields, touched_cells);
+	s_ReportField("build", ms, touched_cells);
+
+	// Moving every goal, as players do, rebuilds every field, one per job.
+	ms = BenchTime(iterations, [&]() {
+		for (FlowFieldHandle field : fields)
+		{
+			random_goal(goals[field]);
+			grid->SetGoal(field, goals[field]);
+		}
+		grid->Update();
+	});
+	std::printf("  %-34s %9.3f ms for all fields\n", "move goals, rebuild", ms);
+	ms = s_FieldMs(*grid, fields, touched_cells);
+	s_ReportField("  of which one field", ms, touched_cells);
+
+	std::vector<double> repair_times;
+	std::vector<uint32_t> repair_cells;
+	for (uint32_t toggles : { 1u, 16u })
+	{
+		repair_times.clear();
+		repair_cells.clear();
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			s_ToggleDoors(*grid, doors, toggles, rng);
+			grid->Update();
+			repair_times.push_back(s_FieldMs(*grid, fields, touched_cells));
+			repair_cells.push_back(touched_cells);
+		}
+		std::sort(repair_times.begin(), repair_times.end());
+		std::sort(repair_cells.begin(), repair_cells.end());
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "toggle %u door%s, repair", toggles, toggles > 1 ? "s" : "");
+		s_ReportField(name, repair_times[iterations / 2], repair_cells[iterations / 2]);
+	}
+
+	// The same town and goals built from scratch, to check the repairs against.
+	NavigationGrid* reference = new NavigationGrid(nullptr, s_GRID_SIZE, s_GRID_SIZE, s_CELL_SIZE, origin);
+	for (uint32_t y = 0; y < s_GRID_SIZE; y++)
+		for (uint32_t x = 0; x < s_GRID_SIZE; x++)
+			reference->SetCost(x, y, grid->GetCost(x, y));
+
+	uint32_t mismatches = 0;
+	for (FlowFieldHandle field : fields)
+	{
+		FlowFieldHandle reference_field = reference->AddField(goals[field]);
+		reference->Update();
+		mismatches += s_CountMismatches(*grid, field, *reference, reference_field);
+	}
+	std::printf("  %u of %u cells differ between repaired and rebuilt fields\n", mismatches, s_GRID_SIZE * s_GRID_SIZE * s_FIELD_COUNT);
+
+	grid->PrintStats();
+	delete reference;
+	delete grid;
+}
+
+static void s_RunAgents(JobSystem* jobs, uint32_t agent_count, uint32_t iterations)
+{
+	std::mt19937 rng(4321);
+	float const origin[2] = { 0.0f, 0.0f };
+
+	NavigationGrid* grid = new NavigationGrid(jobs, s_GRID_SIZE, s_GRID_SIZE, s_CELL_SIZE, origin);
+	s_BuildTown(*grid, rng);
+	float const goal[2] = { 1.5f, 1.5f };
+	FlowFieldHandle field = grid->AddField(goal);
+	grid->Update();
+
+	// Packed the way a horde ends up, about a square metre each, in the middle of the town.
+	float half_size = std::sqrt(float(agent_count)) * 0.5f;
+	std::uniform_real_distribution<float> coordinate(-half_size, half_size);
+	std::vector<float> positions(agent_count * 2), steering(agent_count * 2), separation(agent_count * 2);
+	for (uint32_t i = 0; i < agent_count * 2; i++)
+		positions[i] = s_GRID_SIZE * s_CELL_SIZE * 0.5f + coordinate(rng);
+
+	std::printf("%u agents in %.0f m square\n", agent_count, half_size * 2.0f);
+
+	s_ReportAgents("sample flow field", BenchTime(iterations, [&]() {
+		for (uint32_t i = 0; i < agent_count; i++)
+			grid->Sample(field, &positions[i * 2], &steering[i * 2]);
+	}), agent_count);
+
+	SeparationSolver* solver = new SeparationSolver(jobs);
+	SeparationSolver* serial = new SeparationSolver(nullptr);
+	s_ReportAgents("separation, serial", BenchTime(iterations, [&]() { serial->Compute(positions.data(), agent_count, s_SEPARATION_RADIUS, separation.data()); }), agent_count);
+	s_ReportAgents("separation, batched", BenchTime(iterations, [&]() { solver->Compute(positions.data(), agent_count, s_SEPARATION_RADIUS, separation.data()); }), agent_count);
+
+	delete serial;
+	delete solver;
+	delete grid;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t iterations = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 20;
+	uint32_t thread_count = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 0;
+	VALIDATE(iterations > 0);
+
+	std::vector<uint32_t> agent_counts;
+	for (int i = 3; i < argc; i++)
+		agent_counts.push_back(static_cast<uint32_t>(std::stoul(argv[i])));
+	if (agent_counts.empty())
+		agent_counts = { 10000, 100000 };
+
+	JobSystem* jobs = new JobSystem(thread_count);
+	std::printf("NavBench: %u iterations, %u threads\n", iterations, jobs->GetThreadCount());
+
+	s_RunFields(jobs, iterations);
+	for (uint32_t agent_count : agent_counts)
+		s_RunAgents(jobs, agent_count, iterations);
+
+	delete jobs;
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "spatial.hpp"
+#include "jobs.hpp"
+#include "bench.hpp"
+#include <random>
+#include <cmath>
+
+#define THISFILE "spatial_bench.cpp"
+
+// Times hitscan raycasts and proximity queries against a moving horde, in queries per second, at 10k and 100k
+// objects (or the counts given), along with the per-frame cost of keeping the index up to date. A brute-force
+// scan checks the answers and gives the baseline.
+// Usage: SpatialBench [iterations] [threads] [object counts...]
+// Needs no GPU, only the engine's spatial index.
+
+static constexpr uint32_t s_RAY_COUNT = 20000;
+static constexpr uint32_t s_SPHERE_COUNT = 20000;
+static constexpr uint32_t s_BRUTE_FORCE_COUNT = 200;
+static constexpr uint32_t s_TURN_UPDATES = 200;
+static constexpr float s_DT = 1.0f / 60.0f;
+
+static void s_ReportUpdate(char const* name, double ms)
+{
+	std::printf("  %-34s %9.3f ms\n", name, ms);
+}
+
+static void s_ReportQueries(char const* name, double ms, uint32_t query_count)
+{
+	std::printf("  %-34s %9.3f ms %12.0f queries/s\n", name, ms, query_count / ms * 1000.0);
+}
+
+// A zombie standing at position, about shoulder wide and head high.
+static SpatialBounds s_ZombieBounds(float const position[2])
+{
+	return { { position[0] - 0.3f, 0.0f, position[1] - 0.3f }, { position[0] + 0.3f, 1.8f, position[1] + 0.3f } };
+}
+
+static void s_Run(JobSystem* jobs, uint32_t object_count, uint32_t iterations)
+{
+	std::mt19937 rng(1234);
+
+	// Ten square metres per zombie, however many there are.
+	float half_size = std::sqrt(object_count * 10.0f) * 0.5f;
+	std::uniform_real_distribution<float> coordinate(-half_size, half_size);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	std::vector<float> positions(object_count * 2), velocities(object_count * 2);
+	for (uint32_t i = 0; i < object_count * 2; i++)
+		positions[i] = coordinate(rng), velocities[i] = unit(rng) * 1.5f;
+
+	SpatialIndex* index = new SpatialIndex(jobs);
+	std::vector<SpatialHandle> handles(object_count);
+	for (uint32_t i = 0; i < object_count; i++)
+		handles[i] = index->Insert(s_ZombieBounds(&positions[i * 2]));
+
+	std::printf("%u objects in %.0f m square\n", object_count, half_size * 2.0f);
+
+	auto begin = std::chrono::steady_clock::now();
+	index->Update();
+	s_ReportUpdate("build", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
+	// Everyone walks, bouncing off the edges.
+	auto move = [&](uint32_t step) {
+		for (uint32_t i = 0; i < object_count; i += step)
+		{
+			for (int axis = 0; axis < 2; axis++)
+			{
+				float& p = positions[i * 2 + axis];
+				float& v = velocities[i * 2 + axis];
+				p += v * s_DT;
+				if (std::abs(p) > half_size)
+					v = -v;
+			}
+			index->Move(handles[i], s_ZombieBounds(&positions[i * 2]));
+		}
+	};
+
+	s_ReportUpdate("move all, refit", BenchTime(iterations, [&]() { move(1); index->Update(); }));
+	s_ReportUpdate("move 1%, refit", BenchTime(iterations, [&]() { move(100); index->Update(); }));
+
+	// A different 5% every frame killed and respawned somewhere else, which only ever refits partially but
+	// loosens the tree as fast as anything does. Unless it is rebuilt in time the queries below slow down.
+	uint32_t turn = 0;
+	s_ReportUpdate("respawn 5% in turn, refit", BenchTime(s_TURN_UPDATES, [&]() {
+		for (uint32_t i = turn++ % 20; i < object_count; i += 20)
+		{
+			positions[i * 2] = coordinate(rng), positions[i * 2 + 1] = coordinate(rng);
+			index->Move(handles[i], s_ZombieBounds(&positions[i * 2]));
+		}
+		index->Update();
+	}));
+
+	// Shots from chest height in random directions, slightly up or down, out to 100 m.
+	std::vector<SpatialRay> rays(s_RAY_COUNT);
+	for (SpatialRay& ray : rays)
+	{
+		float angle = unit(rng) * 3.14159265f, pitch = unit(rng) * 0.05f;
+		ray = { { coordinate(rng), 1.4f, coordinate(rng) }, 100.0f, { std::cos(angle), pitch, std::sin(angle) } };
+	}
+
+	std::vector<SpatialSphere> spheres(s_SPHERE_COUNT);
+	for (SpatialSphere& sphere : spheres)
+		sphere = { { coordinate(rng), 1.0f, coordinate(rng) }, 5.0f };
+
+	std::vector<SpatialHit> hits(s_RAY_COUNT);
+	std::vector<std::vector<SpatialHandle>> results(s_SPHERE_COUNT);
+
+	s_ReportQueries("raycasts, serial", BenchTime(iterations, [&]() {
+		for (uint32_t i = 0; i < s_RAY_COUNT; i++)
+			hits[i] = index->Raycast(rays[i]);
+	}), s_RAY_COUNT);
+	s_ReportQueries("raycasts, batched", BenchTime(iterations, [&]() { index->RaycastBatch(rays.data(), s_RAY_COUNT, hits.data()); }), s_RAY_COUNT);
+
+	s_ReportQueries("5 m spheres, serial", BenchTime(iterations, [&]() {
+		for (uint32_t i = 0; i < s_SPHERE_COUNT; i++)
+		{
+			results[i].clear();
+			index->OverlapSphere(spheres[i], results[i]);
+		}
+	}), s_SPHERE_COUNT);
+	s_ReportQueries("5 m spheres, batched", BenchTime(iterations, [&]() {
+		for (std::vector<SpatialHandle>& result : results)
+			result.clear();
+		index->OverlapSphereBatch(spheres.data(), s_SPHERE_COUNT, results.data());
+	}), s_SPHERE_COUNT);
+
+	// The same queries by testing every object, which is also what the answers above are checked against.
+	uint32_t mismatches = 0;
+	s_ReportQueries("raycasts, brute force", BenchTime(1, [&]() {
+		for (uint32_t i = 0; i < s_BRUTE_FORCE_COUNT; i++)
+		{
+			SpatialRay const& ray = rays[i];
+			float nearest = ray.MaxDistance;
+			for (uint32_t j = 0; j < object_count; j++)
+			{
+				SpatialBounds const& bounds = index->GetBounds(handles[j]);
+				float enter = 0.0f, exit = nearest;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					float inverse = 1.0f / ray.Direction[axis];
+					float a = (bounds.Min[axis] - ray.Origin[axis]) * inverse, b = (bounds.Max[axis] - ray.Origin[axis]) * inverse;
+					enter = std::max(enter, std::min(a, b));
+					exit = std::min(exit, std::max(a, b));
+				}
+				if (enter <= exit)
+					nearest = enter;
+			}
+			bool missed = nearest == ray.MaxDistance;
+			mismatches += missed != (hits[i].Object == SPATIAL_INVALID_HANDLE) || (!missed && std::abs(hits[i].Distance - nearest) > 1e-3f);
+		}
+	}), s_BRUTE_FORCE_COUNT);
+
+	s_ReportQueries("5 m spheres, brute force", BenchTime(1, [&]() {
+		for (uint32_t i = 0; i < s_BRUTE_FORCE_COUNT; i++)
+		{
+			uint32_t count = 0;
+			for (uint32_t j = 0; j < object_count; j++)
+			{
+				SpatialBounds const& bounds = index->GetBounds(handles[j]);
+				float distance_squared = 0.0f;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					float d = std::max(std::max(bounds.Min[axis] - spheres[i].Center[axis], spheres[i].Center[axis] - bounds.Max[axis]), 0.0f);
+					distance_squared += d * d;
+				}
+				count += distance_squared <= spheres[i].Radius * spheres[i].Radius;
+			}
+			mismatches += count != results[i].size();
+		}
+	}), s_BRUTE_FORCE_COUNT);
+
+	std::printf("  %u of %u checked answers differ from brute force\n", mismatches, s_BRUTE_FORCE_COUNT * 2);
+	index->PrintStats();
+	delete index;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t iterations = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 20;
+	uint32_t thread_count = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 0;
+	VALIDATE(iterations > 0);
+
+	std::vector<uint32_t> object_counts;
+	for (int i = 3; i < argc; i++)
+		object_counts.push_back(static_cast<uint32_t>(std::stoul(argv[i])));
+	if (object_counts.empty())
+		object_counts = { 10000, 100000 };
+
+	JobSystem* jobs = new JobSystem(thread_count);
+	std::printf("SpatialBench: %u iterations, %u threads, %u rays and %u spheres per iteration\n", iterations, jobs->GetThreadCount(),
+		s_RAY_COUNT, s_SPHERE_COUNT);
+
+	for (uint32_t object_count : object_counts)
+		s_Run(jobs, object_count, iterations);
+
+	delete jobs;
+	return 0;
+}
\ No newline at end of file
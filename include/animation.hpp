@@ -0,0 +1,92 @@
+#pragma once
+
+#include "core.hpp"
+
+// Channels of a bone's local transform: translation, rotation quaternion and uniform scale.
+enum PoseChannel
+{
+	POSE_TRANSLATION_X,
+	POSE_TRANSLATION_Y,
+	POSE_TRANSLATION_Z,
+	POSE_ROTATION_X,
+	POSE_ROTATION_Y,
+	POSE_ROTATION_Z,
+	POSE_ROTATION_W,
+	POSE_SCALE,
+
+	POSE_CHANNEL_COUNT
+};
+
+// Bones are ordered so that parents come before their children, and more important bones (spine, head, limbs)
+// before less important ones (fingers, face), which makes every prefix of the bones a valid skeleton of its own.
+// Animation LOD animates a prefix and lets the remaining bones follow their parents rigidly.
+struct Skeleton
+{
+	std::vector<int32_t> Parents;	// Parent of each bone, lower than the bone's own index, or -1 for roots
+	std::vector<float> InverseBind;	// Per bone, a row-major 3x4 matrix from model space to bone space in the bind pose
+
+	inline uint32_t GetBoneCount() const { return static_cast<uint32_t>(Parents.size()); }
+};
+
+// Local transforms of every bone relative to its parent, as one array per channel so that SIMD processes four
+// bones per instruction. Arrays are padded to a multiple of four bones.
+class Pose
+{
+public:
+
+	// Starts at the identity.
+	Pose(uint32_t bone_count = 0);
+
+	void Resize(uint32_t bone_count);
+
+	inline uint32_t GetBoneCount() const { return m_bone_count; }
+
+	inline float* GetChannel(PoseChannel channel) { return m_data.data() + channel * m_stride; }
+
+	inline float const* GetChannel(PoseChannel channel) const { return m_data.data() + channel * m_stride; }
+
+	// Set one bone's transform, e.g. while building a bind pose. Quaternions are (x, y, z, w).
+	void SetBone(uint32_t bone, float const translation[3], float const rotation[4], float scale = 1.0f);
+
+private:
+
+	uint32_t m_bone_count;
+	uint32_t m_stride; // Floats per channel
+	std::vector<float> m_data;
+};
+
+// Keys sampled at a fixed rate, each stored like a Pose, so sampling reads two contiguous blocks and needs no
+// search. Looping clips repeat their first key at the end.
+class AnimationClip
+{
+public:
+
+	AnimationClip(uint32_t bone_count, uint32_t key_count, float sample_rate);
+
+	inline uint32_t GetBoneCount() const { return m_key_poses.empty() ? 0 : m_key_poses[0].GetBoneCount(); }
+
+	inline uint32_t GetKeyCount() const { return static_cast<uint32_t>(m_key_poses.size()); }
+
+	inline float GetDuration() const { return (GetKeyCount() - 1) / m_sample_rate; }
+
+	inline Pose& GetKey(uint32_t key) { return m_key_poses[key]; }
+
+	// Local pose of the first bone_count bones at time, which wraps around the clip's duration.
+	void Sample(float time, uint32_t bone_count, Pose& out) const;
+
+private:
+
+	float m_sample_rate;
+	std::vector<Pose> m_key_poses;
+};
+
+// Cross-fade the first bone_count bones from a (weight 0) to b (weight 1). Rotations are normalized lerps along
+// the shorter arc. out may be a or b.
+void BlendPoses(Pose const& a, Pose const& b, float weight, uint32_t bone_count, Pose& out);
+
+// Fill the skeleton's inverse bind matrices from its bind pose.
+void SetBindPose(Skeleton& skeleton, Pose const& bind_pose);
+
+// Skinning matrices (model space, row-major 3x4, 12 floats per bone) for every bone of the skeleton. Only the first
+// bone_count bones are taken from the pose; the others move rigidly with their parents, as in the bind pose.
+void ComputeSkinningPalette(Skeleton const& skeleton, Pose const& pose, uint32_t bone_count, float* palette);
\ No newline at end of file
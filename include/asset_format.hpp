@@ -0,0 +1,62 @@
+#pragma once
+
+// On-disk layout of asset packs, shared by the runtime and the packer tool, which is why this header only uses
+// the standard library.
+//
+//   AssetPackHeader
+//   AssetPackEntry[TableSize]	open-addressed hash table, empty slots have a zero hash
+//   names					null-terminated, referenced by AssetPackEntry::NameOffset
+//   data					each entry aligned as its type requires
+//
+// Offsets are from the start of the file. Everything is little endian, as on every platform Vulkan runs on.
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+enum AssetType : uint32_t
+{
+	ASSET_RAW,
+	ASSET_SPIRV,
+	ASSET_MESH,
+	ASSET_TEXTURE,
+};
+
+struct AssetPackHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t EntryCount;
+	uint32_t TableSize; // Power of two, at least twice EntryCount so probes stay short
+	uint64_t NamesOffset;
+	uint64_t FileSize;
+};
+
+struct AssetPackEntry
+{
+	uint64_t Hash;
+	uint64_t Offset;
+	uint64_t Size;
+	uint32_t NameOffset; // Relative to AssetPackHeader::NamesOffset
+	AssetType Type;
+};
+
+static_assert(sizeof(AssetPackHeader) == 32 && sizeof(AssetPackEntry) == 32, "Pack layout must not depend on the compiler");
+
+inline constexpr uint32_t ASSET_PACK_MAGIC = 0x5054494D; // "MITP"
+inline constexpr uint32_t ASSET_PACK_VERSION = 1;
+
+// SPIR-V is consumed as uint32_t words; everything else may be read with 16-byte vector loads.
+inline constexpr uint64_t AssetAlignment(AssetType type)
+{
+	return type == ASSET_SPIRV ? 4 : 16;
+}
+
+// FNV-1a, never zero since zero marks an empty slot.
+inline constexpr uint64_t AssetNameHash(std::string_view name)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (char c : name)
+		hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+	return hash ? hash : 1;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "core.hpp"
+#include "asset_format.hpp"
+
+struct AssetView
+{
+	void const* Data; // Null if the asset is missing
+	size_t Size;
+	AssetType Type;
+};
+
+// Read-only asset archive built by AssetPacker at build time. The whole file is mapped into memory once and
+// assets are handed out as pointers into the mapping, so loading costs no reads and no copies; pages are only
+// faulted in when first touched. Views stay valid as long as the pack.
+class AssetPack
+{
+public:
+
+	// Throws if the file is missing or not a valid pack.
+	AssetPack(std::string const& filepath);
+	~AssetPack();
+
+	AssetView Find(std::string_view name) const;
+
+	inline uint32_t GetEntryCount() const { return m_header->EntryCount; }
+
+	AssetPack(AssetPack const&) = delete;
+	AssetPack& operator=(AssetPack const&) = delete;
+
+private:
+
+	void Open(std::string const& filepath);
+	void Validate();
+	void Release();
+
+	char const* m_data;
+	size_t m_size;
+	AssetPackHeader const* m_header;
+	AssetPackEntry const* m_table;
+
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "core.hpp"
+#include <mutex>
+
+class GraphicsDevice;
+class FrameScheduler;
+
+// Binding of each resource array in the heap's set, which is set 0 of every pipeline layout. Must match bindless.glsl.
+enum BindlessType
+{
+	BINDLESS_TEXTURE,		// texture2D[]
+	BINDLESS_STORAGE_IMAGE,	// image2D[]
+	BINDLESS_BUFFER,		// storage buffers
+	BINDLESS_SAMPLER,		// sampler[]
+
+	BINDLESS_TYPE_COUNT
+};
+
+// Push constants are how draws find their resources, as indices into the heap. 128 bytes is the smallest
+// maxPushConstantsSize the spec allows, so this works everywhere.
+inline constexpr uint32_t BINDLESS_PUSH_CONSTANT_SIZE = 128;
+
+// Index no resource is ever assigned.
+inline constexpr uint32_t BINDLESS_INVALID_INDEX = UINT32_MAX;
+
+// Owned by GraphicsDevice. One global descriptor set with large, partially bound, update-after-bind arrays of every
+// resource type. Resources get a slot once, when created, and shaders index the arrays with values from push
+// constants, so a draw binds nothing; the set is bound once per command buffer and stays bound across pipelines.
+class BindlessHeap
+{
+public:
+
+	// Capacities are clamped to what the device supports for update-after-bind sets.
+	BindlessHeap(GraphicsDevice const& device, uint32_t max_textures = 1 << 16, uint32_t max_storage_images = 1 << 12,
+		uint32_t max_buffers = 1 << 16, uint32_t max_samplers = 1 << 8);
+	~BindlessHeap();
+
+	inline VkDescriptorSetLayout GetLayout() const { return m_layout; }
+
+	inline VkDescriptorSet GetSet() const { return m_set; }
+
+	inline uint32_t GetCapacity(BindlessType type) const { return m_capacity[type]; }
+
+	// Return the slot the resource is written to, usable by draws recorded from now on. Safe from any thread.
+	uint32_t AddTexture(VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	uint32_t AddStorageImage(VkImageView view);
+	uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	uint32_t AddSampler(VkSampler sampler);
+
+	// The slot is recycled once every frame that may have used it has retired.
+	void Free(BindlessType type, uint32_t index, FrameScheduler& scheduler);
+
+	// Recycle the slot right away, when no frame can be using it any more (e.g. the device is idle).
+	void Free(BindlessType type, uint32_t index);
+
+	// Bind the set for every pipeline recorded afterwards in this command buffer.
+	void Bind(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout layout) const;
+
+	BindlessHeap(BindlessHeap const&) = delete;
+	BindlessHeap& operator=(BindlessHeap const&) = delete;
+
+private:
+
+	VkDevice m_device;
+	VkDescriptorSetLayout m_layout;
+	VkDescriptorPool m_pool;
+	VkDescriptorSet m_set;
+
+	std::mutex m_mutex; // Guards the free lists and descriptor writes, which are externally synchronized on the set
+	std::array<uint32_t, BINDLESS_TYPE_COUNT> m_capacity;
+	std::array<uint32_t, BINDLESS_TYPE_COUNT> m_next;	// Slots below this have been handed out before
+	std::array<std::vector<uint32_t>, BINDLESS_TYPE_COUNT> m_free;
+
+	uint32_t AllocateSlot(BindlessType type);
+	void Write(BindlessType type, uint32_t index, VkDescriptorImageInfo const* image, VkDescriptorBufferInfo const* buffer);
+};
+
+// Write the push constants of a draw or dispatch, typically a struct of heap indices and a few scalars.
+template<class T>
+inline void PushConstants(VkCommandBuffer command_buffer, VkPipelineLayout layout, T const& constants)
+{
+	static_assert(sizeof(T) <= BINDLESS_PUSH_CONSTANT_SIZE && sizeof(T) % 4 == 0, "Push constants must fit the shared range");
+	vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_ALL, 0, sizeof(T), &constants);
+}
\ No newline at end of file
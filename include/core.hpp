@@ -7,6 +7,9 @@
 #include <string>
 #include <unordered_set>
 #include <algorithm>
+#include <cstring>
+#include <limits>
+#include <chrono>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "core.hpp"
+
+class GraphicsDevice;
+class AssetPack;
+class ComputePipeline;
+class FrameRing;
+class HiZPyramid;
+struct Allocation;
+
+// Layouts below are read by cull.comp as std430 and must match it.
+
+inline constexpr uint32_t MAX_MESH_LODS = 4;
+
+// Index range of one level of detail within the shared index buffer.
+struct MeshLod
+{
+	uint32_t IndexCount;
+	uint32_t FirstIndex;
+	int32_t VertexOffset;
+	float MaxDistance; // Used up to this distance from the bounding sphere, scaled by CullView::LodScale
+};
+
+// Levels from the most detailed. Instances further than the last level's MaxDistance are not drawn at all.
+struct CullMesh
+{
+	uint32_t LodCount;
+	uint32_t Padding[3];
+	MeshLod Lods[MAX_MESH_LODS];
+};
+
+// World-space bounding sphere of an instance. Its index in the instance array reaches the vertex shader as
+// gl_InstanceIndex, so per-instance data (transforms and so on) is kept in parallel arrays indexed the same way.
+struct CullInstance
+{
+	float Center[3];
+	float Radius;
+	uint32_t Mesh;
+	uint32_t Padding[3];
+};
+
+struct CullView
+{
+	float Planes[6][4]; // Normalized, pointing inwards
+	float Camera[3];
+	float LodScale; // Above one switches to coarser levels sooner
+
+	// Occlusion culling against a Hi-Z pyramid built at the end of the previous frame, with the view-projection
+	// (column-major) that frame was rendered with. Filled in by GpuCuller::Cull.
+	float OcclusionViewProjection[16];
+	float PyramidSize[2];
+	uint32_t PyramidTexture; // BINDLESS_INVALID_INDEX skips the occlusion test
+	uint32_t PyramidSampler;
+};
+
+static_assert(sizeof(CullMesh) == 80 && sizeof(CullInstance) == 32 && sizeof(CullView) == 192, "Layouts must match cull.comp");
+
+// What happened to the instances of one frame, read back once it has retired. Instances are counted by the first
+// test that rejects them, in the order frustum, distance, occlusion.
+struct CullStats
+{
+	uint64_t FrameIndex;
+	uint32_t Drawn;
+	uint32_t FrustumCulled;
+	uint32_t DistanceCulled; // Beyond the last LOD
+	uint32_t OcclusionCulled;
+};
+
+// Planes of a column-major view-projection matrix with Vulkan's [0, 1] depth range.
+void ExtractFrustumPlanes(float const view_projection[16], float planes[6][4]);
+
+// Frustum, distance and Hi-Z occlusion culling plus LOD selection of instances on the GPU. Occlusion uses the
+// previous frame's depth, so something that just came into view may show up a frame late. A compute pass writes one indexed indirect draw per
+// visible instance, compacted, plus their count; the draws are then submitted with a single
+// vkCmdDrawIndexedIndirectCount, so CPU cost does not depend on the number of instances.
+class GpuCuller
+{
+public:
+
+	GpuCuller(GraphicsDevice const& device, AssetPack const& pack, uint32_t frames_in_flight, uint32_t max_instances);
+	~GpuCuller();
+
+	// Record the culling pass, outside of rendering. Instances and meshes are device addresses of CullInstance and
+	// CullMesh arrays, filled before this point in the command buffer (or from the frame ring). The view is copied
+	// into the ring. Given a valid pyramid and the view-projection of the frame it was built from, instances hidden
+	// behind that frame's depth are rejected as well.
+	void Cull(VkCommandBuffer command_buffer, uint32_t slot, uint64_t frame_index, FrameRing& ring, CullView const& view,
+		VkDeviceAddress instances, VkDeviceAddress meshes, uint32_t instance_count,
+		HiZPyramid const* pyramid = nullptr, float const* previous_view_projection = nullptr);
+
+	// Draw what survived culling in the slot with the bound graphics pipeline, index and vertex buffers.
+	void Draw(VkCommandBuffer command_buffer, uint32_t slot) const;
+
+	inline uint32_t GetMaxInstances() const { return m_max_instances; }
+
+	// Counts of the most recent frame that has retired, lagging by the number of frames in flight.
+	inline CullStats const& GetStats() const { return m_stats; }
+
+	GpuCuller(GpuCuller const&) = delete;
+	GpuCuller& operator=(GpuCuller const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	ComputePipeline* m_pipeline;
+	uint32_t m_max_instances;
+
+	// Per frame slot: the draw count and the other counters of CullStats, then the draw commands. Slots never
+	// overlap, so culling for one frame cannot race with draws of the frame before.
+	VkBuffer m_buffer;
+	Allocation* m_allocation;
+	VkDeviceSize m_slot_size;
+	VkDeviceAddress m_address;
+
+	// Counters copied out per slot, read when the slot comes around again.
+	VkBuffer m_readback;
+	Allocation* m_readback_allocation;
+	std::vector<uint64_t> m_slot_frames; // Frame each slot last culled for, UINT64_MAX if never
+	CullStats m_stats;
+};
\ No newline at end of file
@@ -0,0 +1,344 @@
+#pragma once
+
+#include "core.hpp"
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
+#include <bit>
+#include <atomic>
+
+// Bytes per chunk. Small enough that the arrays a system walks stay in L1/L2, large enough that the per-chunk work
+// (one change check, one pointer per component) disappears next to the per-entity work.
+inline constexpr size_t ECS_CHUNK_SIZE = 16 << 10;
+
+// Signatures are bit masks, one bit per component type.
+inline constexpr uint32_t ECS_MAX_COMPONENTS = 64;
+
+using ComponentMask = uint64_t;
+
+struct Entity
+{
+	uint32_t Index;
+	uint32_t Generation; // Bumped when the index is recycled, so stale handles are told apart
+
+	bool operator==(Entity const&) const = default;
+};
+
+inline constexpr Entity NULL_ENTITY = { UINT32_MAX, 0 };
+
+// Give a component type its id, once per type. Components are plain data: they are moved between chunks with memcpy
+// and never destroyed, which keeps structural changes cheap and is all game state needs.
+uint32_t RegisterComponent(uint32_t size, uint32_t alignment);
+
+template<class T>
+inline uint32_t ComponentId()
+{
+	if constexpr (std::is_const_v<T>)
+		return ComponentId<std::remove_const_t<T>>();
+	else
+	{
+		static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>, "Components must be plain data");
+		static uint32_t const id = RegisterComponent(sizeof(T), alignof(T));
+		return id;
+	}
+}
+
+template<class... Ts>
+inline ComponentMask ComponentMaskOf()
+{
+	return (ComponentMask(0) | ... | (ComponentMask(1) << ComponentId<Ts>()));
+}
+
+// ECS_CHUNK_SIZE bytes holding up to Archetype::Capacity entities: their handles, then one tightly packed array per
+// component (SoA), so a system touching two components streams through exactly two arrays.
+struct Chunk
+{
+	char* Data;
+	uint32_t Count;
+	std::vector<uint64_t> Versions; // World version each component array was last written at, by column
+
+	// Raise a column's version. Atomic, as query threads may write through Get to entities in each other's chunks.
+	inline void MarkWritten(uint32_t column, uint64_t version)
+	{
+		std::atomic_ref<uint64_t> current(Versions[column]);
+		uint64_t last = current.load(std::memory_order_relaxed);
+		while (last < version && !current.compare_exchange_weak(last, version, std::memory_order_relaxed));
+	}
+};
+
+// Every entity with exactly the same set of components. Holes left by removals are filled from the last chunk,
+// so all chunks but the last are full.
+struct Archetype
+{
+	ComponentMask Mask;
+	uint32_t Capacity; // Entities per chunk
+	std::vector<uint32_t> Ids; // Component id of each column, ascending
+	std::vector<uint32_t> Sizes;
+	std::vector<uint32_t> Offsets; // Of each column's array from the start of a chunk
+	std::array<uint8_t, ECS_MAX_COMPONENTS> Columns; // Column of each component id, ABSENT if not in the archetype
+	std::vector<Chunk> Chunks;
+
+	static constexpr uint8_t ABSENT = 0xFF;
+};
+
+class JobSystem;
+
+template<class... Ts>
+class Query;
+
+// Owns entities and their components, grouped by archetype. Structural changes (create, destroy, add, remove) must
+// not happen while a query is running; everything else may be called from a query's function. Components of
+// entities outside the chunk a parallel query's function was given may be another thread's to write, though.
+//
+// Change tracking: every write bumps the version of the written component's array in that chunk, so a system can
+// skip whole chunks nothing wrote to since it last ran, see Query::WithChanged.
+class World
+{
+public:
+
+	// Parallel queries run on the job system, or serially without one.
+	World(JobSystem* jobs = nullptr);
+	~World();
+
+	template<class... Ts>
+	Entity Create(Ts const&... components);
+
+	void Destroy(Entity entity);
+
+	bool IsAlive(Entity entity) const;
+
+	// Null if the entity has no T. Asking for a non-const T marks it changed.
+	template<class T>
+	T* Get(Entity entity);
+
+	// Moves the entity to the archetype with T if it has none yet, then writes the value.
+	template<class T>
+	void Add(Entity entity, T const& component);
+
+	template<class T>
+	void Remove(Entity entity);
+
+	inline uint32_t GetEntityCount() const { return m_entity_count; }
+
+	inline uint64_t GetVersion() const { return m_version; }
+
+	inline std::vector<Archetype*> const& GetArchetypes() const { return m_archetypes; }
+
+	World(World const&) = delete;
+	World& operator=(World const&) = delete;
+
+private:
+
+	template<class... Ts>
+	friend class Query;
+
+	struct EntityRecord
+	{
+		Archetype* Owner; // Null while the index is free
+		uint32_t Chunk;
+		uint32_t Row;
+		uint32_t Generation;
+	};
+
+	JobSystem* m_jobs;
+	std::vector<EntityRecord> m_records;
+	std::vector<uint32_t> m_free_indices;
+	std::vector<Archetype*> m_archetypes;
+	std::unordered_map<ComponentMask, Archetype*> m_archetype_map;
+	uint32_t m_entity_count;
+	uint32_t m_query_depth;
+
+	// Queries run at a fresh version and stamp their writes with it. Writes outside queries are stamped with the
+	// version after the current one, so every query that has not run since sees them, and only once.
+	uint64_t m_version;
+
+	Entity CreateEntity(ComponentMask mask, uint32_t component_count);
+	void* GetComponent(Entity entity, uint32_t id, bool write);
+	void MoveEntity(Entity entity, ComponentMask mask);
+
+	Archetype* GetArchetype(ComponentMask mask);
+	void PlaceEntity(Entity entity, Archetype& archetype);
+	void RemoveRow(Archetype& archetype, uint32_t chunk_index, uint32_t row);
+
+	inline uint64_t BeginQuery() { m_query_depth++; return ++m_version; }
+	inline void EndQuery() { m_query_depth--; }
+
+	// Run body(i) for i in [0, count) across the job system's threads, returning once all are done.
+	void ParallelFor(uint32_t count, std::function<void(uint32_t)> const& body);
+};
+
+// Iterates every entity having all of Ts, chunk by chunk. Components listed const are only read; the others are
+// marked changed in every chunk visited. A query object is meant to live as long as the system using it, since
+// it remembers when it last ran for WithChanged and keeps its scratch memory.
+template<class... Ts>
+class Query
+{
+public:
+
+	static_assert(sizeof...(Ts) > 0, "Queries need at least one component");
+
+	Query() : m_required(ComponentMaskOf<Ts...>()), m_excluded(0), m_changed(0), m_last_version(0) {}
+
+	// Skip entities that also have any of these.
+	template<class... Us>
+	inline Query& Without() { m_excluded = ComponentMaskOf<Us...>(); return *this; }
+
+	// Only visit chunks where one of these was written since this query last ran. The query's own writes do not count.
+	template<class... Us>
+	inline Query& WithChanged() { m_changed = ComponentMaskOf<Us...>(); return *this; }
+
+	// func(uint32_t count, Entity const* entities, Ts*... arrays) once per chunk, for loops the compiler can vectorize.
+	template<class F>
+	void ForEachChunk(World& world, F&& func);
+
+	// func(Ts&...) or func(Entity, Ts&...) once per entity.
+	template<class F>
+	void ForEach(World& world, F&& func);
+
+	// As above with chunks spread across the world's job system. func must be safe to call concurrently for different entities.
+	template<class F>
+	void ParallelForEachChunk(World& world, F&& func);
+
+	template<class F>
+	void ParallelForEach(World& world, F&& func);
+
+private:
+
+	struct Match
+	{
+		Archetype const* Owner;
+		Chunk* Target;
+	};
+
+	ComponentMask m_required, m_excluded, m_changed;
+	uint64_t m_last_version;
+	std::vector<Match> m_matches;
+
+	void Gather(World& world);
+
+	template<class F, size_t... I>
+	static void RunChunk(Match const& match, uint64_t version, F& func, std::index_sequence<I...>);
+
+	template<class F>
+	static inline auto PerEntity(F& func)
+	{
+		return [&func](uint32_t count, Entity const* entities, Ts*... arrays) {
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if constexpr (std::is_invocable_v<F&, Entity, Ts&...>)
+					func(entities[i], arrays[i]...);
+				else
+					func(arrays[i]...);
+			}
+		};
+	}
+};
+
+template<class... Ts>
+inline Entity World::Create(Ts const&... components)
+{
+	Entity entity = CreateEntity(ComponentMaskOf<Ts...>(), sizeof...(Ts));
+	(std::memcpy(GetComponent(entity, ComponentId<Ts>(), false), &components, sizeof(Ts)), ...);
+	return entity;
+}
+
+template<class T>
+inline T* World::Get(Entity entity)
+{
+	return static_cast<T*>(GetComponent(entity, ComponentId<T>(), !std::is_const_v<T>));
+}
+
+template<class T>
+inline void World::Add(Entity entity, T const& component)
+{
+	ComponentMask bit = ComponentMask(1) << ComponentId<T>();
+	if (!(m_records[entity.Index].Owner->Mask & bit))
+		MoveEntity(entity, m_records[entity.Index].Owner->Mask | bit);
+	std::memcpy(GetComponent(entity, ComponentId<T>(), true), &component, sizeof(T));
+}
+
+template<class T>
+inline void World::Remove(Entity entity)
+{
+	ComponentMask bit = ComponentMask(1) << ComponentId<T>();
+	if (m_records[entity.Index].Owner->Mask & bit)
+		MoveEntity(entity, m_records[entity.Index].Owner->Mask & ~bit);
+}
+
+template<class... Ts>
+inline void Query<Ts...>::Gather(World& world)
+{
+	m_matches.clear();
+
+	for (Archetype* archetype : world.m_archetypes)
+	{
+		if ((archetype->Mask & m_required) != m_required || (archetype->Mask & m_excluded))
+			continue;
+
+		for (Chunk& chunk : archetype->Chunks)
+		{
+			bool changed = !m_changed;
+			for (ComponentMask mask = m_changed & archetype->Mask; mask && !changed; mask &= mask - 1)
+				changed = chunk.Versions[archetype->Columns[std::countr_zero(mask)]] > m_last_version;
+
+			if (changed)
+				m_matches.push_back({ archetype, &chunk });
+		}
+	}
+}
+
+template<class... Ts>
+template<class F, size_t... I>
+inline void Query<Ts...>::RunChunk(Match const& match, uint64_t version, F& func, std::index_sequence<I...>)
+{
+	uint32_t const columns[] = { match.Owner->Columns[ComponentId<Ts>()]... };
+	((std::is_const_v<Ts> ? void() : match.Target->MarkWritten(columns[I], version)), ...);
+
+	func(match.Target->Count, reinterpret_cast<Entity const*>(match.Target->Data),
+		reinterpret_cast<Ts*>(match.Target->Data + match.Owner->Offsets[columns[I]])...);
+}
+
+template<class... Ts>
+template<class F>
+inline void Query<Ts...>::ForEachChunk(World& world, F&& func)
+{
+	struct Scope { World& Owner; ~Scope() { Owner.EndQuery(); } } scope{ world };
+	uint64_t version = world.BeginQuery();
+
+	Gather(world);
+	for (Match const& match : m_matches)
+		RunChunk(match, version, func, std::index_sequence_for<Ts...>());
+
+	m_last_version = version;
+}
+
+template<class... Ts>
+template<class F>
+inline void Query<Ts...>::ForEach(World& world, F&& func)
+{
+	ForEachChunk(world, PerEntity(func));
+}
+
+template<class... Ts>
+template<class F>
+inline void Query<Ts...>::ParallelForEachChunk(World& world, F&& func)
+{
+	struct Scope { World& Owner; ~Scope() { Owner.EndQuery(); } } scope{ world };
+	uint64_t version = world.BeginQuery();
+
+	// Each chunk is visited by one thread, so even the version stamps never race.
+	Gather(world);
+	world.ParallelFor(static_cast<uint32_t>(m_matches.size()), [&](uint32_t i) {
+		RunChunk(m_matches[i], version, func, std::index_sequence_for<Ts...>());
+	});
+
+	m_last_version = version;
+}
+
+template<class... Ts>
+template<class F>
+inline void Query<Ts...>::ParallelForEach(World& world, F&& func)
+{
+	ParallelForEachChunk(world, PerEntity(func));
+}
\ No newline at end of file
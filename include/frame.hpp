@@ -0,0 +1,122 @@
+#pragma once
+
+#include "core.hpp"
+#include <functional>
+#include <deque>
+
+class GraphicsDevice;
+class Swapchain;
+class CommandPool;
+
+// Everything one frame needs while being recorded on the CPU and executed on the GPU.
+// Each slot is reused only after its fence signals, so N slots allow N frames in flight.
+struct FrameSlot
+{
+	CommandPool* Pool;
+	VkCommandBuffer CommandBuffer;
+	VkSemaphore ImageAcquired;
+	VkSemaphore RenderFinished;
+	VkFence InFlight;
+	VkQueryPool Timestamps; // Top and bottom of pipe, used to measure GPU idle time.
+	bool Submitted;
+};
+
+struct FrameStats
+{
+	uint64_t FrameIndex;
+
+	// Time the CPU blocked on the slot fence and image acquisition. Dominates when GPU-bound.
+	double CpuWaitMs;
+
+	// Time the GPU sat idle between the previous frame and this one. Dominates when CPU-bound.
+	// GPU figures belong to the slot that just retired, so they lag behind by the number of frames in flight.
+	double GpuWaitMs;
+
+	// Time the GPU spent executing the retired frame.
+	double GpuBusyMs;
+
+	// Time from the start of a frame (after pacing, where input is sampled) until it was on screen. Needs present
+	// wait, zero otherwise. Belongs to the last frame seen presented, and is only exact with WaitForPresent since
+	// otherwise completion is polled once per frame.
+	double PresentLatencyMs;
+};
+
+class FrameScheduler
+{
+public:
+
+	FrameScheduler(GraphicsDevice const& device, Swapchain const& swapchain, uint32_t frames_in_flight = 2);
+	~FrameScheduler();
+
+	// Apply the swapchain's present policy: sleep for the frame limiter and wait for the previous frame to be shown.
+	// Call right before sampling input so the input is as fresh as possible; BeginFrame calls it otherwise.
+	void Pace();
+
+	// Wait for the current slot to retire, acquire the next swapchain image and begin recording.
+	// Returns VK_NULL_HANDLE if the swapchain is out of date; recreate it and try again.
+	VkCommandBuffer BeginFrame();
+
+	// Finish recording, submit to the graphics queue and present.
+	void EndFrame();
+
+	// Run a destructor once every frame submitted so far has retired, instead of waiting for the device to go idle.
+	// Call between frames. Deferred work still pending on destruction runs after the final wait.
+	void Defer(std::function<void()> destroy);
+
+	// True once after acquire or present reported the swapchain out of date or suboptimal, then cleared.
+	bool ConsumeOutOfDate();
+
+	// Make this frame's submission also wait on a semaphore, e.g. a timeline value signaled by another queue.
+	inline void AddWaitSemaphore(VkSemaphoreSubmitInfo const& wait) { m_extra_waits.push_back(wait); }
+
+	inline uint32_t GetImageIndex() const { return m_image_index; }
+
+	inline uint32_t GetSlotIndex() const { return m_slot_index; }
+
+	// Index of the frame being recorded, counting from zero.
+	inline uint64_t GetFrameIndex() const { return m_frame_index; }
+
+	inline uint32_t GetFramesInFlight() const { return static_cast<uint32_t>(m_slots.size()); }
+
+	inline FrameStats const& GetStats() const { return m_stats; }
+
+	FrameScheduler(FrameScheduler const&) = delete;
+	FrameScheduler& operator=(FrameScheduler const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	Swapchain const* m_swapchain;
+	std::vector<FrameSlot> m_slots;
+
+	uint32_t m_slot_index;
+	uint32_t m_image_index;
+	uint64_t m_frame_index;
+
+	std::vector<VkSemaphoreSubmitInfo> m_extra_waits; // Cleared after each submission
+	std::vector<std::pair<uint64_t, std::function<void()>>> m_deferred; // Frame index to wait for, in order
+	bool m_out_of_date;
+
+	float m_timestamp_period; // Nanoseconds per tick
+	uint64_t m_timestamp_mask; // Zero if the graphics queue does not support timestamps
+	uint64_t m_last_gpu_end;
+
+	FrameStats m_stats;
+
+	// Presents carry the frame index plus one as their id, so ids only ever increase.
+	struct PendingPresent
+	{
+		uint64_t Id;
+		VkSwapchainKHR Swapchain;
+		std::chrono::steady_clock::time_point Start;
+	};
+
+	bool m_paced;
+	std::chrono::steady_clock::time_point m_next_deadline;
+	std::chrono::steady_clock::time_point m_frame_start;
+	std::deque<PendingPresent> m_pending_presents;
+
+	void ReadTimestamps(FrameSlot const& slot);
+	void RunDeferred(bool all);
+	void PollPresents(uint64_t wait_id);
+};
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "core.hpp"
+#include <atomic>
+
+class GraphicsDevice;
+class MemoryAllocator;
+struct Allocation;
+
+// Per-frame data written by the CPU: Data is persistently mapped, Offset is from the start of the ring's buffer for
+// dynamic offsets and copies, and Address is what shaders read it through (a buffer_reference in push constants).
+template<class T>
+struct FrameSpan
+{
+	T* Data;
+	VkDeviceSize Offset;
+	VkDeviceAddress Address;
+};
+
+// Ring of per-frame uniform and storage data, one region per frame slot in a single persistently mapped buffer.
+// Allocation is a pointer bump in the current slot's region, so per-draw constants cost neither a heap allocation
+// nor a descriptor update: draws push the address. A region is rewritten only after its slot's fence has signaled.
+class FrameRing
+{
+public:
+
+	FrameRing(GraphicsDevice const& device, uint32_t frames_in_flight, VkDeviceSize slot_size = 4 << 20);
+	~FrameRing();
+
+	// Start allocating from the slot's region, forgetting what it held. Call once the slot has retired,
+	// i.e. after FrameScheduler::BeginFrame.
+	void BeginFrame(uint32_t slot);
+
+	// Space for count values, aligned for use as a uniform or storage buffer. Safe from any thread.
+	template<class T>
+	FrameSpan<T> Allocate(uint32_t count = 1);
+
+	inline VkBuffer GetBuffer() const { return m_buffer; }
+
+	inline VkDeviceSize GetSlotSize() const { return m_slot_size; }
+
+	inline VkDeviceSize GetAlignment() const { return m_alignment; }
+
+	// Bytes handed out from the current slot, to size slot_size against.
+	inline VkDeviceSize GetUsed() const { return m_head.load(std::memory_order_relaxed) - m_slot_begin; }
+
+	FrameRing(FrameRing const&) = delete;
+	FrameRing& operator=(FrameRing const&) = delete;
+
+private:
+
+	MemoryAllocator* m_allocator;
+	VkBuffer m_buffer;
+	Allocation* m_allocation;
+	char* m_mapped;
+	VkDeviceAddress m_address;
+
+	VkDeviceSize m_slot_size;
+	VkDeviceSize m_alignment; // Power of two covering both offset alignment limits
+	uint32_t m_slot_count;
+
+	VkDeviceSize m_slot_begin;
+	std::atomic<VkDeviceSize> m_head; // Offset in the buffer, always a multiple of m_alignment
+
+	[[noreturn]] void Overflow(VkDeviceSize size) const;
+};
+
+template<class T>
+inline FrameSpan<T> FrameRing::Allocate(uint32_t count)
+{
+	static_assert(alignof(T) <= 16, "Frame ring alignment is at least 16 bytes");
+
+	// Sizes are rounded up so the head stays aligned and one atomic add is all a thread has to do.
+	VkDeviceSize size = (static_cast<VkDeviceSize>(sizeof(T)) * count + m_alignment - 1) & ~(m_alignment - 1);
+	VkDeviceSize offset = m_head.fetch_add(size, std::memory_order_relaxed);
+
+	if (offset + size > m_slot_begin + m_slot_size)
+		Overflow(size);
+
+	return { reinterpret_cast<T*>(m_mapped + offset), offset, m_address + offset };
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "core.hpp"
+
+class GraphicsDevice;
+class FrameScheduler;
+class AssetPack;
+class ComputePipeline;
+struct Allocation;
+
+// Hierarchical depth: a mip chain where each texel holds the farthest depth of the area it covers, built from the
+// depth buffer by compute after the frame's depth is final. Culling tests bounding boxes against the level where
+// they span about one texel, so a single fetch tells whether something is hidden behind everything in that area.
+// Level 0 is the depth buffer rounded up to powers of two, so every level halves exactly and each level 0 texel
+// covers at most two depth texels a side, all within the one bilinear tap that reduces them.
+class HiZPyramid
+{
+public:
+
+	HiZPyramid(GraphicsDevice const& device, AssetPack const& pack, VkExtent2D depth_extent);
+	~HiZPyramid();
+
+	// Resize along with the depth buffer. Contents are lost until the next Build.
+	void Recreate(VkExtent2D depth_extent, FrameScheduler& scheduler);
+
+	// Record the build, outside of rendering, from the bindless texture of the depth buffer, which must already be in
+	// READ_ONLY_OPTIMAL and visible to compute. Culling dispatched afterwards, in this or a later frame, may read it.
+	void Build(VkCommandBuffer command_buffer, uint32_t depth_texture);
+
+	// False until built, and again after Recreate; occlusion culling must be skipped meanwhile.
+	inline bool IsValid() const { return m_valid; }
+
+	inline VkExtent2D GetExtent() const { return m_extent; }
+
+	// Size of level 0 for a depth buffer of depth_extent.
+	static VkExtent2D GetPyramidExtent(VkExtent2D depth_extent);
+
+	inline uint32_t GetMipCount() const { return m_mip_count; }
+
+	// Bindless slots for reading the pyramid: the whole chain in GENERAL, and a max-reduction sampler (so a
+	// bilinear tap returns the farthest of its four texels).
+	inline uint32_t GetTextureIndex() const { return m_texture_index; }
+
+	inline uint32_t GetSamplerIndex() const { return m_sampler_index; }
+
+	HiZPyramid(HiZPyramid const&) = delete;
+	HiZPyramid& operator=(HiZPyramid const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	ComputePipeline* m_pipeline;
+	VkSampler m_sampler;
+	uint32_t m_sampler_index;
+
+	VkExtent2D m_extent;
+	uint32_t m_mip_count;
+	VkImage m_image;
+	Allocation* m_allocation;
+	VkImageView m_view; // Every level
+	std::vector<VkImageView> m_mip_views;
+	uint32_t m_texture_index;
+	std::vector<uint32_t> m_mip_indices; // Storage image slots
+	bool m_valid;
+	bool m_initialized; // Moved out of UNDEFINED
+
+	void Create(VkExtent2D depth_extent);
+};
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "core.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+class JobSystem;
+struct Job;
+
+using JobFunction = std::function<void()>;
+
+enum JobAffinity
+{
+	JOB_ANY_THREAD,
+	JOB_MAIN_THREAD, // For work that must stay on the thread owning the window and the queues, e.g. GLFW calls
+};
+
+// Number of jobs not yet finished in a group. Jobs added with a counter raise it when submitted and lower it
+// when done; it can be waited on, or other jobs can be made to start only once it reaches zero.
+class JobCounter
+{
+public:
+
+	JobCounter() : m_value(0) {}
+
+	inline bool IsDone() const { return m_value.load(std::memory_order_acquire) == 0; }
+
+	JobCounter(JobCounter const&) = delete;
+	JobCounter& operator=(JobCounter const&) = delete;
+
+private:
+
+	friend class JobSystem;
+
+	std::atomic<uint32_t> m_value;
+	std::mutex m_mutex;
+	std::vector<Job*> m_dependents; // Held back until the value reaches zero
+};
+
+// Time and contention of one thread since the last ResetStats.
+struct JobThreadStats
+{
+	uint64_t JobsRun;
+	uint64_t Steals;		// Jobs taken from another thread's deque
+	uint64_t StealAttempts;
+	uint64_t StealConflicts; // Steals lost to another thread taking the same job, a measure of contention
+	double BusyMs;
+	double IdleMs;			// Searching for work or asleep
+};
+
+// Engine-wide job scheduler. Every thread owns a Chase-Lev deque: it pushes and pops its own jobs at the bottom
+// without locks, and idle threads steal from the top of the others'. The thread constructing the system is the
+// main thread, thread 0, and takes part whenever it waits; the others sleep when there is nothing to steal.
+//
+// A job's thread index (GetThreadIndex) is stable while it runs, so per-thread resources such as command pools
+// can be indexed by it without locking.
+class JobSystem
+{
+public:
+
+	// A thread count of zero uses every hardware thread, the main thread included. With pin_threads, thread i
+	// runs on core i only, which keeps the main thread's caches warm and its timing steady.
+	JobSystem(uint32_t thread_count = 0, bool pin_threads = true);
+	~JobSystem();
+
+	// Run function on some thread. With a dependency, it only starts once that counter has reached zero. Safe from any
+	// thread, including from jobs.
+	void Submit(JobFunction function, JobCounter* counter = nullptr, JobCounter* dependency = nullptr, JobAffinity affinity = JOB_ANY_THREAD);
+
+	// Run other jobs until the counter reaches zero. Rethrows the first exception thrown by any job since the last wait.
+	void Wait(JobCounter& counter);
+
+	// Split [0, count) into ranges of about grain items (zero picks one from the thread count), run body on each and
+	// wait for all of them.
+	void ParallelFor(uint32_t count, uint32_t grain, std::function<void(uint32_t begin, uint32_t end)> const& body);
+
+	inline uint32_t GetThreadCount() const { return m_thread_count; }
+
+	// Index of the calling thread in this system, or UINT32_MAX if it is not one of its threads.
+	uint32_t GetThreadIndex() const;
+
+	std::vector<JobThreadStats> GetStats() const;
+	void ResetStats();
+
+	// Per-thread busy and idle time, jobs run and steals since the last reset.
+	void PrintStats() const;
+
+	JobSystem(JobSystem const&) = delete;
+	JobSystem& operator=(JobSystem const&) = delete;
+
+private:
+
+	struct Worker;
+
+	uint32_t m_thread_count;
+	std::vector<Worker*> m_workers;
+	std::vector<std::thread> m_threads;
+
+	// Jobs from threads outside the system, and main-thread jobs from any thread.
+	std::mutex m_queue_mutex;
+	std::vector<Job*> m_injected;
+	std::vector<Job*> m_main_jobs;
+
+	// Sleeping threads wake when m_queued goes up.
+	std::atomic<uint32_t> m_queued;
+	std::atomic<uint32_t> m_sleeping;
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_sleep_cv;
+	bool m_stop;
+
+	std::mutex m_error_mutex;
+	std::exception_ptr m_error;
+
+	void WorkerLoop(uint32_t index, bool pin);
+	void Push(Job* job);
+	Job* FindJob(uint32_t index);
+	void Run(Job* job, uint32_t index);
+	void Release(JobCounter& counter);
+};
\ No newline at end of file
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "core.hpp"
+#include <mutex>
+
+class GraphicsDevice;
+struct MemoryBlock;
+
+enum MemoryUsage
+{
+	GPU_ONLY_MEMORY,	// Device local, never touched by the CPU.
+	UPLOAD_MEMORY,		// Host visible and coherent, written by the CPU and copied from (staging).
+	DYNAMIC_MEMORY,		// Host visible and coherent, preferably device local, rewritten every frame.
+	READBACK_MEMORY,	// Host visible, preferably cached, written by the GPU and read by the CPU.
+	TRANSIENT_MEMORY,	// Lazily allocated where supported, for attachments that never leave tile memory.
+
+	MEMORY_USAGE_COUNT
+};
+
+// A sub-range of a VkDeviceMemory. The handle stays valid across defragmentation, which rewrites it in place.
+struct Allocation
+{
+	VkDeviceMemory Memory;
+	VkDeviceSize Offset;
+	VkDeviceSize Size;
+	VkDeviceSize Alignment;
+	void* Mapped; // Persistently mapped pointer to Offset, null unless host visible.
+	uint32_t MemoryType;
+
+	MemoryBlock* Block; // Null for dedicated allocations.
+	uint32_t Node;
+
+	MemoryBlock* MoveBlock; // Destination reserved by BeginDefragmentation, null unless a move is in flight.
+	uint32_t MoveNode;
+};
+
+struct HeapStats
+{
+	VkDeviceSize HeapSize;
+	VkDeviceSize ReservedBytes;	// Device memory allocated from this heap (blocks and dedicated allocations).
+	VkDeviceSize UsedBytes;		// Bytes occupied by live allocations.
+	VkDeviceSize WastedBytes;	// Reserved but unused: free ranges and alignment gaps inside blocks.
+	uint32_t BlockCount;
+	uint32_t AllocationCount;
+	uint32_t DedicatedCount;
+};
+
+struct DefragmentationMove
+{
+	Allocation* Target; // Rewritten to the destination by EndDefragmentation.
+	VkDeviceMemory SrcMemory;
+	VkDeviceSize SrcOffset;
+	VkDeviceMemory DstMemory;
+	VkDeviceSize DstOffset;
+	VkDeviceSize Size;
+
+	MemoryBlock* DstBlock;
+	uint32_t DstNode;
+};
+
+struct DefragmentationPlan
+{
+	std::vector<DefragmentationMove> Moves;
+};
+
+// Device-level sub-allocator. Long-lived resources are placed with a TLSF allocator inside large blocks, one pool of
+// blocks per memory type (and per linear/optimal tiling, so bufferImageGranularity never matters). Resources that
+// prefer their own memory, or are too large for a block, get a dedicated allocation.
+class MemoryAllocator
+{
+public:
+
+	MemoryAllocator(GraphicsDevice const& device);
+	~MemoryAllocator();
+
+	// optimal_image must be set for images with VK_IMAGE_TILING_OPTIMAL, which live in separate blocks from buffers.
+	Allocation* Allocate(VkMemoryRequirements const& requirements, MemoryUsage usage, bool optimal_image = false);
+	void Free(Allocation* allocation);
+
+	// Create the resource, allocate memory for it (dedicated if the driver prefers so) and bind it.
+	VkBuffer CreateBuffer(VkBufferCreateInfo const& create_info, MemoryUsage usage, Allocation** allocation);
+	VkImage CreateImage(VkImageCreateInfo const& create_info, MemoryUsage usage, Allocation** allocation);
+	void DestroyBuffer(VkBuffer buffer, Allocation* allocation);
+
+	// For buffers created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, which shaders reach through push constants.
+	VkDeviceAddress GetDeviceAddress(VkBuffer buffer) const;
+	void DestroyImage(VkImage image, Allocation* allocation);
+
+	// Plan moves that empty the least used blocks into the others, up to max_bytes. New ranges are reserved but the
+	// old ones stay valid: the caller recreates each resource at the destination, copies it on the GPU, and once the
+	// copies have retired calls EndDefragmentation, which frees the old ranges and releases emptied blocks. An
+	// allocation freed meanwhile gives its destination back and is skipped.
+	DefragmentationPlan BeginDefragmentation(VkDeviceSize max_bytes);
+	void EndDefragmentation(DefragmentationPlan const& plan);
+
+	// Make GPU writes to a host visible allocation visible to the CPU once they have completed (e.g. after a fence
+	// wait and a barrier to VK_PIPELINE_STAGE_2_HOST_BIT). Nothing to do on coherent memory.
+	void Invalidate(Allocation const* allocation) const;
+
+	std::vector<HeapStats> GetHeapStats() const;
+	void PrintStats() const;
+
+	uint32_t ChooseMemoryType(uint32_t type_bits, MemoryUsage usage) const;
+
+	MemoryAllocator(MemoryAllocator const&) = delete;
+	MemoryAllocator& operator=(MemoryAllocator const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	VkPhysicalDeviceMemoryProperties m_memory_props;
+	uint32_t m_max_allocation_count;
+	VkDeviceSize m_non_coherent_atom_size;
+	uint32_t m_allocation_count; // Live VkDeviceMemory objects
+
+	std::vector<VkDeviceSize> m_block_sizes; // Per heap
+	std::vector<std::vector<MemoryBlock*>> m_pools; // Per memory type and tiling
+	std::vector<HeapStats> m_heap_stats;
+	std::unordered_set<Allocation*> m_dedicated; // Released by the destructor along with the blocks
+	std::unordered_set<Allocation*> m_moving; // Targets of moves planned but not yet ended
+
+	mutable std::mutex m_mutex;
+
+	Allocation* AllocateDedicated(VkMemoryRequirements const& requirements, uint32_t memory_type, VkBuffer buffer, VkImage image);
+	Allocation* AllocateFromPool(VkMemoryRequirements const& requirements, uint32_t memory_type, bool optimal_image);
+	MemoryBlock* CreateBlock(uint32_t memory_type, uint32_t pool_index);
+	void DestroyBlock(MemoryBlock* block);
+	void FreeNode(MemoryBlock* block, uint32_t node);
+	VkDeviceMemory AllocateMemory(VkDeviceSize size, uint32_t memory_type, VkBuffer buffer, VkImage image, void** mapped);
+};
+
+// Bump allocator over one persistently mapped buffer, used as a ring for transient data. Allocation offsets grow
+// monotonically; the owner records GetHead() when a frame or batch ends and calls Release with that marker once
+// the GPU is done with it.
+class LinearPool
+{
+public:
+
+	LinearPool(MemoryAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memory_usage);
+	~LinearPool();
+
+	// Returns false when the ring is full. The offset is relative to the buffer.
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+
+	inline VkDeviceSize GetHead() const { return m_head; }
+
+	// Everything allocated before the marker may be overwritten.
+	inline void Release(VkDeviceSize marker) { m_tail = marker; }
+
+	inline void Reset() { m_head = m_tail = 0; }
+
+	inline VkBuffer GetBuffer() const { return m_buffer; }
+
+	inline VkDeviceSize GetSize() const { return m_size; }
+
+	inline char* GetMapped() const { return static_cast<char*>(m_allocation->Mapped); }
+
+	inline Allocation const* GetAllocation() const { return m_allocation; }
+
+	LinearPool(LinearPool const&) = delete;
+	LinearPool& operator=(LinearPool const&) = delete;
+
+private:
+
+	MemoryAllocator* m_allocator;
+	VkBuffer m_buffer;
+	Allocation* m_allocation;
+	VkDeviceSize m_size;
+	VkDeviceSize m_head, m_tail; // Monotonic, the position in the buffer is modulo m_size.
+};
\ No newline at end of file
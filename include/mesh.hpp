@@ -0,0 +1,74 @@
+#pragma once
+
+#include "core.hpp"
+#include "mesh_format.hpp"
+#include "upload.hpp"
+
+class GraphicsDevice;
+class AssetPack;
+class GraphicsPipelineCreator;
+struct Allocation;
+struct CullMesh;
+
+// Mesh cooked by MeshCooker (see mesh_format.hpp), in one vertex and one index buffer shared by all its levels.
+// Vertices and indices are streamed straight from the mapped asset pack into staging, with no copy in between.
+// The buffers are usable once IsReady.
+//
+// Vertex shaders get PackedVertex as is: position as snorm16 in the bounding sphere (instance transforms fold in
+// GetCenter and GetRadius, see instance.vert), an octahedral normal and half float UVs.
+class Mesh
+{
+public:
+
+	// Throws if the asset is missing or not a valid mesh.
+	Mesh(GraphicsDevice const& device, AssetPack const& pack, std::string_view name, Uploader& uploader);
+	~Mesh();
+
+	inline bool IsReady(Uploader const& uploader) const { return uploader.IsReady(m_ticket); }
+
+	inline VkBuffer GetVertexBuffer() const { return m_vertex_buffer; }
+
+	// PackedVertex array for shaders, e.g. skin.comp.
+	inline VkDeviceAddress GetVertexAddress() const { return m_vertex_address; }
+
+	inline uint32_t GetVertexCount() const { return m_header->VertexCount; }
+
+	// In the pack's mapping, e.g. to derive skin weights from.
+	inline PackedVertex const* GetVertices() const { return m_vertices; }
+
+	inline VkBuffer GetIndexBuffer() const { return m_index_buffer; }
+
+	inline VkIndexType GetIndexType() const { return m_index_type; }
+
+	inline uint32_t GetLodCount() const { return m_header->LodCount; }
+
+	inline MeshLodRange const& GetLod(uint32_t lod) const { return m_lods[lod]; }
+
+	inline float const* GetCenter() const { return m_header->Center; }
+
+	inline float GetRadius() const { return m_header->Radius; }
+
+	// Levels for GpuCuller. Each level is kept until the next one's error, scaled by distance_per_error, would
+	// be too small to see; the default of 1000 is about a pixel at 1080p with a 60 degree field of view.
+	// The last level is never culled by distance.
+	CullMesh GetCullMesh(float distance_per_error = 1000.0f) const;
+
+	// Vertex binding 0 and attributes 0 (position), 1 (normal) and 2 (UV) of PackedVertex.
+	static void AddVertexInput(GraphicsPipelineCreator& creator);
+
+	Mesh(Mesh const&) = delete;
+	Mesh& operator=(Mesh const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	MeshHeader const* m_header; // In the pack's mapping
+	MeshLodRange const* m_lods;
+	PackedVertex const* m_vertices;
+	VkIndexType m_index_type;
+
+	VkBuffer m_vertex_buffer, m_index_buffer;
+	Allocation* m_vertex_allocation, * m_index_allocation;
+	VkDeviceAddress m_vertex_address;
+	UploadTicket m_ticket; // Of the later upload
+};
\ No newline at end of file
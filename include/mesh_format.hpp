@@ -0,0 +1,49 @@
+#pragma once
+
+// Layout of cooked meshes, shared by the runtime and the mesh cooker, which is why this header only uses the
+// standard library.
+//
+//   MeshHeader
+//   MeshLodRange[LodCount]		from the most detailed
+//   PackedVertex[VertexCount]	at VertexOffset, shared by every level
+//   indices[IndexCount]			at IndexOffset, IndexSize bytes each, one range per level
+//
+// Offsets are from the start of the file, which sits in an asset pack 16-byte aligned.
+
+#include <cstdint>
+
+inline constexpr uint32_t MESH_MAGIC = 0x4D54494D; // "MITM"
+inline constexpr uint32_t MESH_VERSION = 1;
+inline constexpr uint32_t MESH_MAX_LODS = 4;
+
+// 16 bytes instead of the 32 of float position, normal and UV.
+struct PackedVertex
+{
+	int16_t Position[4];	// snorm16 within the bounding sphere: Center + Radius * xyz, w is always 1
+	int16_t Normal[2];		// snorm16 octahedral encoding of the unit normal
+	uint16_t Uv[2];			// Half floats, so UVs may wrap outside [0, 1]
+};
+
+struct MeshLodRange
+{
+	uint32_t IndexCount;
+	uint32_t FirstIndex;
+	float Error;			// Bound on how far the surface moved from the source, in mesh units; zero for the source
+	uint32_t Padding;
+};
+
+struct MeshHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+	uint32_t LodCount;
+	uint32_t IndexSize;		// 2 when every index fits 16 bits, otherwise 4
+	float Center[3];
+	float Radius;
+	uint64_t VertexOffset;
+	uint64_t IndexOffset;
+};
+
+static_assert(sizeof(PackedVertex) == 16 && sizeof(MeshLodRange) == 16 && sizeof(MeshHeader) == 56, "Mesh layout must not depend on the compiler");
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "core.hpp"
+
+class JobSystem;
+
+// Index of a flow field in its NavigationGrid, stable until removed.
+using FlowFieldHandle = uint32_t;
+
+// Cell costs: 1 is open ground, higher is slower to cross (rubble, water), NAV_BLOCKED cannot be entered.
+inline constexpr uint8_t NAV_OPEN = 1;
+inline constexpr uint8_t NAV_BLOCKED = 255;
+
+struct FlowFieldStats
+{
+	double UpdateMs;		// Of the last update that changed the field
+	uint32_t TouchedCells;	// Cells whose distance that update changed
+	bool Rebuilt;			// From scratch (new goal) rather than repaired
+};
+
+// Navigation over a grid of cells on the ground (the xz plane), for hordes all heading to a few shared goals.
+//
+// Each goal, such as a player or a noise, gets a flow field: the cost of the cheapest path from every cell to the
+// goal, found once with Dijkstra, and the direction to the neighbouring cell that continues it. Agents then
+// steer by looking up their cell, whatever their number. When cell costs change (a door shuts, a barricade
+// breaks) fields are repaired rather than rebuilt: the cells whose paths ran through a raised cell are cleared and
+// refilled from their surroundings, and lowered cells spread their gain outwards, which touches only the part of
+// the field that changed. Fields are updated in parallel on the job system.
+class NavigationGrid
+{
+public:
+
+	// The grid covers width by height cells of cell_size from origin (x, z), all open.
+	NavigationGrid(JobSystem* jobs, uint32_t width, uint32_t height, float cell_size, float const origin[2]);
+	~NavigationGrid();
+
+	// Fields see the change on the next Update.
+	void SetCost(uint32_t x, uint32_t y, uint8_t cost);
+
+	inline uint8_t GetCost(uint32_t x, uint32_t y) const { return m_costs[y * m_width + x]; }
+
+	// A field leading to the cell containing goal. A goal in a blocked cell cannot be reached.
+	FlowFieldHandle AddField(float const goal[2]);
+	void RemoveField(FlowFieldHandle field);
+
+	// Moving a goal to another cell rebuilds its field on the next Update; moving within the cell costs nothing.
+	void SetGoal(FlowFieldHandle field, float const goal[2]);
+
+	// Bring every field up to date with goal and cost changes since the last call.
+	void Update();
+
+	// Unit direction to steer in at position, zero at the goal, where it cannot be reached, or off the grid. O(1).
+	// Until the first Update after AddField the field has nothing built, and gives zero and infinity everywhere.
+	void Sample(FlowFieldHandle field, float const position[2], float direction[2]) const;
+
+	// Path cost from position to the goal in metres of open ground, or infinity if it cannot be reached.
+	float GetDistance(FlowFieldHandle field, float const position[2]) const;
+
+	inline FlowFieldStats const& GetStats(FlowFieldHandle field) const { return m_fields[field]->Stats; }
+	void PrintStats() const;
+
+	NavigationGrid(NavigationGrid const&) = delete;
+	NavigationGrid& operator=(NavigationGrid const&) = delete;
+
+private:
+
+	struct Change
+	{
+		uint32_t Cell;
+		uint8_t OldCost;
+	};
+
+	struct Field
+	{
+		uint32_t Goal; // Cell
+		bool Dirty;	// Needs a rebuild
+		std::vector<uint32_t> Distances;	// Path cost per cell, UINT32_MAX if unreachable
+		std::vector<uint8_t> Directions;	// Neighbour to step to per cell, none at the goal or unreachable
+
+		// Scratch, kept between updates.
+		std::vector<uint64_t> Queue;		// Cells to propagate from, as distance << 32 | cell
+		std::vector<std::vector<uint32_t>> Buckets;
+		std::vector<uint32_t> Touched;		// Cells whose distance changed in this update
+		std::vector<bool> IsTouched;
+		FlowFieldStats Stats;
+	};
+
+	JobSystem* m_jobs;
+	uint32_t m_width, m_height;
+	float m_cell_size;
+	float m_origin[2];
+
+	std::vector<uint8_t> m_costs;
+	std::vector<Change> m_changes; // Since the last Update, one per cell
+	std::vector<bool> m_is_changed;
+
+	std::vector<Field*> m_fields; // Null where removed
+
+	uint32_t GetCell(float const position[2]) const;
+	bool CanStep(int32_t x, int32_t y, uint32_t direction) const;
+	void Rebuild(Field& field) const;
+	void Repair(Field& field) const;
+	void Touch(Field& field, uint32_t cell) const;
+	void Propagate(Field& field) const;
+	void UpdateDirections(Field& field, std::vector<uint32_t> const& cells) const;
+};
+
+// Local avoidance: pushes agents apart from the others within a radius, so a horde following the same flow field
+// spreads out instead of collapsing into a line. Neighbours are found through a hashed grid of radius-sized
+// cells, rebuilt on each call, and agents are processed in parallel batches.
+class SeparationSolver
+{
+public:
+
+	// Batches run on the job system when one is given.
+	SeparationSolver(JobSystem* jobs);
+
+	// For each agent, the sum over neighbours closer than radius of the unit direction away from them, weighted
+	// from one when touching down to zero at the radius. Positions and results are (x, z) pairs.
+	void Compute(float const* positions, uint32_t count, float radius, float* separation);
+
+	SeparationSolver(SeparationSolver const&) = delete;
+	SeparationSolver& operator=(SeparationSolver const&) = delete;
+
+private:
+
+	JobSystem* m_jobs;
+	std::vector<uint32_t> m_bucket_starts;	// Prefix sums of agents per hash bucket
+	std::vector<uint32_t> m_sorted;			// Agent indices ordered by bucket
+	std::vector<uint32_t> m_buckets;		// Bucket of each agent
+};
\ No newline at end of file
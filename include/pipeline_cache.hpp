@@ -0,0 +1,62 @@
+#pragma once
+
+#include "core.hpp"
+#include <mutex>
+#include <shared_mutex>
+
+class GraphicsDevice;
+
+struct PipelineCacheStats
+{
+	uint32_t Hits, Misses;
+	double HitMs, MissMs; // Total creation time as reported by the driver
+};
+
+// Owned by GraphicsDevice. Loaded from disk at startup and written back on destruction, so pipelines compiled
+// in a previous run are served from the cache instead of paying full driver compilation again.
+class PipelineCache
+{
+public:
+
+	PipelineCache(GraphicsDevice const& device, std::string const& filepath);
+
+	// Saves the cache to disk.
+	~PipelineCache();
+
+	inline VkPipelineCache GetHandle() const { return m_cache; }
+
+	// Create pipelines through the cache so creation feedback is collected and merges cannot race with creation.
+	// A worker cache (see below) may be passed in place of the shared one.
+	VkResult CreateGraphicsPipeline(VkGraphicsPipelineCreateInfo const& create_info, VkPipeline* pipeline, VkPipelineCache worker = VK_NULL_HANDLE);
+	VkResult CreateComputePipeline(VkComputePipelineCreateInfo const& create_info, VkPipeline* pipeline, VkPipelineCache worker = VK_NULL_HANDLE);
+
+	// Threads compiling many pipelines fill their own cache, a copy of the shared one, to avoid contention on it,
+	// then merge it back (the worker cache is destroyed by the merge).
+	VkPipelineCache CreateWorkerCache() const;
+	void MergeWorkerCache(VkPipelineCache worker);
+
+	// Write the cache to a temporary file and rename it over the previous one, so a crash never leaves a torn file.
+	void Save() const;
+
+	PipelineCacheStats GetStats() const;
+
+	PipelineCache(PipelineCache const&) = delete;
+	PipelineCache& operator=(PipelineCache const&) = delete;
+
+private:
+
+	VkDevice m_device;
+	VkPhysicalDeviceProperties m_properties;
+	std::string m_filepath;
+	VkPipelineCache m_cache;
+
+	// Shared while creating pipelines with the cache, exclusive while merging into it.
+	mutable std::shared_mutex m_cache_mutex;
+
+	mutable std::mutex m_stats_mutex;
+	PipelineCacheStats m_stats;
+
+	std::vector<char> LoadValidated() const;
+	std::vector<char> GetData() const;
+	void RecordFeedback(VkPipelineCreationFeedback const& feedback);
+};
\ No newline at end of file
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "core.hpp"
+#include <mutex>
+#include <atomic>
+#include <fstream>
+
+class GraphicsDevice;
+
+// One CPU or GPU zone. Times are steady_clock nanoseconds, GPU zones are mapped onto the same clock.
+struct ProfileEvent
+{
+	char const* Name; // Must outlive the profiler, in practice a string literal
+	uint64_t BeginNs;
+	uint64_t EndNs;
+	uint32_t ThreadId; // Small sequential id, GPU zones use the id of the recording thread
+	bool Gpu;
+};
+
+struct ProfilerStats
+{
+	uint64_t Hitches;			// Frames over the hitch threshold whose history was dumped
+	uint64_t LastHitchFrame;	// UINT64_MAX if none
+	std::string LastHitchPath;
+};
+
+struct ProfileFrame
+{
+	uint64_t FrameIndex;
+	uint64_t BeginNs, EndNs; // CPU frame, from one BeginFrame to the next
+	std::vector<ProfileEvent> Events;
+	bool GpuResolved; // GPU zones arrive once the frame retires, frames in flight later
+};
+
+// Collects named CPU and GPU zones per frame, keeps the most recent frames in a ring and writes them out in the
+// Chrome trace format (chrome://tracing, Perfetto). Instrument code with PROFILE_CPU and PROFILE_GPU, which compile
+// to nothing unless ENGINE_PROFILER is defined; when compiled in but disabled a zone costs one relaxed load.
+class Profiler
+{
+public:
+
+	// There is at most one profiler, reachable through GetProfiler. max_gpu_zones is per frame, zones beyond it are dropped.
+	Profiler(GraphicsDevice const& device, uint32_t frames_in_flight, uint32_t max_gpu_zones = 512, uint32_t history_frames = 300);
+	~Profiler();
+
+	inline void SetEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+	inline bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+	// Call right after FrameScheduler::BeginFrame. Closes the previous CPU frame, resolves the GPU zones of the frame
+	// that last used the slot (its fence has signaled by then) and resets the slot's queries in command_buffer.
+	void BeginFrame(VkCommandBuffer command_buffer, uint32_t slot_index, uint64_t frame_index);
+
+	// Record a finished zone into the current frame, from any thread. Dropped between frames or when disabled.
+	void AddCpuZone(char const* name, uint64_t begin_ns, uint64_t end_ns);
+
+	// Returns the zone to end, or UINT32_MAX when disabled or out of queries. Safe from any recording thread,
+	// also in secondary command buffers, as long as they execute in the frame they were recorded for.
+	uint32_t BeginGpuZone(VkCommandBuffer command_buffer, char const* name);
+	void EndGpuZone(VkCommandBuffer command_buffer, uint32_t zone);
+
+	// Stream every frame into a trace file as soon as its GPU zones resolve, until StopTrace.
+	bool StartTrace(std::string const& path);
+	void StopTrace();
+
+	// Write the frames still in the ring to a trace file.
+	bool DumpHistory(std::string const& path) const;
+
+	// Dump the ring to <prefix><frame index>.json whenever a CPU frame takes longer than threshold_ms. Zero disables.
+	inline void SetHitchThreshold(double threshold_ms, std::string const& prefix = "hitch_") { m_hitch_threshold_ms = threshold_ms, m_hitch_prefix = prefix; }
+
+	ProfilerStats GetStats() const;
+	void PrintStats() const;
+
+	Profiler(Profiler const&) = delete;
+	Profiler& operator=(Profiler const&) = delete;
+
+private:
+
+	struct GpuZone
+	{
+		char const* Name;
+		uint32_t ThreadId;
+	};
+
+	// Zone i uses queries 2i and 2i+1 of the slot's pool.
+	struct SlotQueries
+	{
+		VkQueryPool Pool;
+		std::vector<GpuZone> Zones;
+		std::atomic<uint32_t> Used;
+		uint64_t FrameIndex;
+		bool Recorded;
+	};
+
+	GraphicsDevice const* m_device;
+	std::atomic<bool> m_enabled;
+
+	uint32_t m_max_gpu_zones;
+	std::vector<SlotQueries> m_slots;
+	uint32_t m_slot_index;
+
+	float m_timestamp_period; // Nanoseconds per tick
+	uint64_t m_timestamp_mask;
+
+	// GPU tick to CPU nanosecond mapping, refreshed periodically when calibrated timestamps are available.
+	PFN_vkGetCalibratedTimestampsEXT m_get_calibrated_timestamps;
+	VkTimeDomainEXT m_host_domain;
+	double m_host_ns_per_tick;
+	uint64_t m_calibration_gpu, m_calibration_ns, m_calibration_frame;
+
+	PFN_vkCmdBeginDebugUtilsLabelEXT m_begin_label;
+	PFN_vkCmdEndDebugUtilsLabelEXT m_end_label;
+
+	mutable std::mutex m_mutex; // Guards the ring and the trace file
+	std::vector<ProfileFrame> m_frames; // Ring indexed by frame index
+	uint64_t m_frame_index;
+	bool m_frame_open;
+
+	std::ofstream m_trace;
+
+	double m_hitch_threshold_ms;
+	std::string m_hitch_prefix;
+	uint64_t m_pending_hitch; // Frame to dump once its GPU zones are in, UINT64_MAX if none
+	ProfilerStats m_stats;
+
+	void Calibrate();
+	void ResolveSlot(SlotQueries& slot);
+
+	// Require m_mutex.
+	void FrameCompleted(ProfileFrame const& frame);
+	bool WriteHistory(std::string const& path) const;
+};
+
+// Null when no profiler exists.
+Profiler* GetProfiler();
+
+// Steady clock nanoseconds, the time base of every zone.
+uint64_t ProfilerNow();
+
+class CpuProfileZone
+{
+public:
+
+	inline CpuProfileZone(char const* name) : m_name(name), m_begin(0)
+	{
+		if (Profiler* profiler = GetProfiler(); profiler && profiler->IsEnabled())
+			m_begin = ProfilerNow();
+	}
+
+	inline ~CpuProfileZone()
+	{
+		if (m_begin)
+			GetProfiler()->AddCpuZone(m_name, m_begin, ProfilerNow());
+	}
+
+	CpuProfileZone(CpuProfileZone const&) = delete;
+	CpuProfileZone& operator=(CpuProfileZone const&) = delete;
+
+private:
+
+	char const* m_name;
+	uint64_t m_begin; // Zero when not recording
+};
+
+class GpuProfileZone
+{
+public:
+
+	inline GpuProfileZone(VkCommandBuffer command_buffer, char const* name) : m_command_buffer(command_buffer), m_zone(UINT32_MAX)
+	{
+		if (Profiler* profiler = GetProfiler(); profiler && profiler->IsEnabled())
+			m_zone = profiler->BeginGpuZone(command_buffer, name);
+	}
+
+	inline ~GpuProfileZone()
+	{
+		if (m_zone != UINT32_MAX)
+			GetProfiler()->EndGpuZone(m_command_buffer, m_zone);
+	}
+
+	GpuProfileZone(GpuProfileZone const&) = delete;
+	GpuProfileZone& operator=(GpuProfileZone const&) = delete;
+
+private:
+
+	VkCommandBuffer m_command_buffer;
+	uint32_t m_zone;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef ENGINE_PROFILER
+// Zone from here to the end of the enclosing block. The name must be a string literal.
+#define PROFILE_CPU(name) CpuProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_GPU(command_buffer, name) GpuProfileZone PROFILE_CONCAT(profile_gpu_zone_, __LINE__)(command_buffer, name)
+#else
+#define PROFILE_CPU(name)
+#define PROFILE_GPU(command_buffer, name)
+#endif
\ No newline at end of file
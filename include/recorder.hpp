@@ -0,0 +1,55 @@
+#pragma once
+
+#include "core.hpp"
+#include <functional>
+
+class GraphicsDevice;
+class CommandPool;
+class JobSystem;
+
+// Records [begin, end) of a draw list into a secondary command buffer that has already begun.
+// Secondaries inherit nothing but the render pass or rendering formats, so pipeline, viewport and buffers must be bound again.
+using SliceRecorder = std::function<void(VkCommandBuffer command_buffer, uint32_t begin, uint32_t end)>;
+
+// Splits draw recording into jobs. Every job system thread owns one command pool per frame slot, so recording never
+// locks; each contiguous slice of the draw list goes into its own secondary command buffer, and the primary
+// executes them in slice order, so the result does not depend on which thread recorded what.
+class ParallelRecorder
+{
+public:
+
+	ParallelRecorder(GraphicsDevice const& device, JobSystem& jobs, uint32_t frames_in_flight);
+	~ParallelRecorder();
+
+	// Recycle the slot's secondaries. Call after FrameScheduler::BeginFrame, which guarantees the slot has retired.
+	void BeginFrame(uint32_t slot_index);
+
+	// Record count items in parallel and execute the slices into primary. Call from one of the job system's threads. The primary must be inside a render pass
+	// begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS (or rendering begun with the secondary flag), which
+	// inheritance describes. Blocks until every slice is recorded; exceptions from the recorder are rethrown here.
+	void Record(VkCommandBuffer primary, VkCommandBufferInheritanceInfo const& inheritance, uint32_t count, SliceRecorder const& recorder);
+
+	inline uint32_t GetThreadCount() const { return m_thread_count; }
+
+	ParallelRecorder(ParallelRecorder const&) = delete;
+	ParallelRecorder& operator=(ParallelRecorder const&) = delete;
+
+private:
+
+	// One per thread and frame slot. Only ever touched by its thread while recording.
+	struct ThreadPool
+	{
+		CommandPool* Pool;
+		std::vector<VkCommandBuffer> Secondaries;
+		uint32_t Used;
+	};
+
+	GraphicsDevice const* m_device;
+	JobSystem* m_jobs;
+	uint32_t m_thread_count;
+	uint32_t m_slot_index;
+	std::vector<ThreadPool> m_pools; // [slot * thread_count + thread]
+	std::vector<VkCommandBuffer> m_slices;
+
+	VkCommandBuffer RecordSlice(VkCommandBufferInheritanceInfo const& inheritance, uint32_t begin, uint32_t end, SliceRecorder const& recorder);
+};
\ No newline at end of file
@@ -1,9 +1,18 @@
 #pragma once
 
 #include "core.hpp"
+#include <future>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 
 class GraphicsDevice;
+class FrameScheduler;
 class Swapchain;
+class AssetPack;
 
 enum ShaderType
 {
@@ -13,6 +22,26 @@ enum ShaderType
 	SHADER_TYPE_COUNT
 };
 
+// Read a SPIR-V file and create a shader module from it.
+VkShaderModule LoadShaderModule(GraphicsDevice const& device, char const* filepath);
+
+// Create a shader module straight from the SPIR-V mapped in an asset pack, without reading or copying it.
+VkShaderModule LoadShaderModule(GraphicsDevice const& device, AssetPack const& pack, char const* name);
+
+// Fixed-function state of a graphics pipeline, shared by GraphicsPipelineCreator and GraphicsPipelineDesc.
+struct GraphicsPipelineState
+{
+	VkFormat RenderFormat; // VK_FORMAT_UNDEFINED for depth-only pipelines
+	VkImageLayout FinalLayout; // Render pass mode only
+	bool DynamicRendering;
+	VkFormat DepthFormat; // VK_FORMAT_UNDEFINED disables depth testing
+	VkCompareOp DepthCompare;
+	bool DepthWrite;
+	VkCullModeFlags CullMode;
+	std::vector<VkVertexInputBindingDescription> VertexBindings;
+	std::vector<VkVertexInputAttributeDescription> VertexAttributes;
+};
+
 class GraphicsPipelineCreator
 {
 public:
@@ -21,7 +50,25 @@ public:
 	~GraphicsPipelineCreator();
 
 	void AddShaderModule(ShaderType type, char const* filepath);
-	inline void SetRenderFormat(VkFormat format) { m_render_format = format; }
+	void AddShaderModule(ShaderType type, AssetPack const& pack, char const* name);
+	inline void SetRenderFormat(VkFormat format) { m_state.RenderFormat = format; }
+	inline void SetFinalLayout(VkImageLayout layout) { m_state.FinalLayout = layout; }
+
+	// Depth test against an attachment of this format. A prepass writes depth with LESS, and the passes after it
+	// test with EQUAL without writing, so each pixel is shaded once.
+	inline void SetDepthFormat(VkFormat format) { m_state.DepthFormat = format; }
+	inline void SetDepthTest(VkCompareOp compare, bool write) { m_state.DepthCompare = compare, m_state.DepthWrite = write; }
+
+	// Counter-clockwise triangles face front.
+	inline void SetCullMode(VkCullModeFlags mode) { m_state.CullMode = mode; }
+
+	// Build against attachment formats only (VkPipelineRenderingCreateInfo) instead of a baked VkRenderPass,
+	// and render with BeginRendering, no Framebuffers needed.
+	inline void SetDynamicRendering(bool enable) { m_state.DynamicRendering = enable; }
+
+	// Per-vertex input, pipelines without bindings generate their vertices in the shader.
+	inline void AddVertexBinding(uint32_t binding, uint32_t stride) { m_state.VertexBindings.push_back({ binding, stride, VK_VERTEX_INPUT_RATE_VERTEX }); }
+	inline void AddVertexAttribute(uint32_t location, uint32_t binding, VkFormat format, uint32_t offset) { m_state.VertexAttributes.push_back({ location, binding, format, offset }); }
 
 	GraphicsPipelineCreator(GraphicsPipelineCreator const&) = delete;
 	GraphicsPipelineCreator& operator=(GraphicsPipelineCreator const&) = delete;
@@ -30,7 +77,7 @@ private:
 
 	GraphicsDevice const* m_device;
 	std::array<VkShaderModule, SHADER_TYPE_COUNT> m_shader_modules;
-	VkFormat m_render_format;
+	GraphicsPipelineState m_state;
 	friend class GraphicsPipeline;
 };
 
@@ -42,6 +89,11 @@ public:
 
 	~GraphicsPipeline();
 
+	inline VkPipeline GetHandle() const { return m_pipeline; }
+
+	inline VkPipelineLayout GetLayout() const { return m_layout; }
+
+	// VK_NULL_HANDLE in dynamic rendering mode.
 	inline VkRenderPass GetRenderPass() const { return m_render_pass; }
 
 	GraphicsPipeline(GraphicsPipeline const&) = delete;
@@ -54,17 +106,121 @@ private:
 	VkPipelineLayout m_layout;
 	VkRenderPass m_render_pass;
 
+	// Used by GraphicsPipelineBatch, which owns the shader modules and compiles into a worker cache.
+	GraphicsPipeline(GraphicsDevice const& device, std::array<VkShaderModule, SHADER_TYPE_COUNT> const& modules,
+		GraphicsPipelineState const& state, VkPipelineCache worker_cache);
+
 	void CreatePipelineLayout();
-	void CreateRenderPass(VkFormat format);
+	void CreateRenderPass(GraphicsPipelineState const& state);
+
+	friend class GraphicsPipelineBatch;
+};
+
+// Compute pipelines share the graphics pipelines' layout, so the bindless set and push constants carry over
+// between compute and graphics work.
+class ComputePipeline
+{
+public:
+
+	ComputePipeline(GraphicsDevice const& device, char const* filepath);
+	ComputePipeline(GraphicsDevice const& device, AssetPack const& pack, char const* name);
+
+	~ComputePipeline();
+
+	inline VkPipeline GetHandle() const { return m_pipeline; }
+
+	inline VkPipelineLayout GetLayout() const { return m_layout; }
+
+	ComputePipeline(ComputePipeline const&) = delete;
+	ComputePipeline& operator=(ComputePipeline const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	VkPipeline m_pipeline;
+	VkPipelineLayout m_layout;
+
+	void Create(VkShaderModule module);
+};
+
+// Description of one pipeline for batch compilation. Empty paths mean the stage is absent.
+// Paths are asset names when the batch was given a pack.
+struct GraphicsPipelineDesc
+{
+	std::array<std::string, SHADER_TYPE_COUNT> ShaderPaths;
+	GraphicsPipelineState State;
 };
 
+// Compiles many pipelines across a pool of worker threads. Shader modules are read and created concurrently
+// (each distinct file once), then pipelines are compiled, each worker using its own copy of the device pipeline
+// cache which is merged back into it when the worker runs out of work.
+class GraphicsPipelineBatch
+{
+public:
+
+	// A worker count of zero uses every hardware thread. Shaders come from the pack if one is given, which must outlive the batch.
+	GraphicsPipelineBatch(GraphicsDevice const& device, uint32_t worker_count = 0, AssetPack const* pack = nullptr);
+
+	// Waits for outstanding work, then destroys the shader modules.
+	~GraphicsPipelineBatch();
+
+	// Queue a pipeline. The future resolves once it is compiled (or rethrows the failure), the caller owns the result.
+	std::future<GraphicsPipeline*> Add(GraphicsPipelineDesc const& desc);
+
+	// Start compiling everything queued so far and return immediately, so loading can carry on meanwhile.
+	void Compile();
+
+	// Block until every queued pipeline is done.
+	void Wait();
+
+	GraphicsPipelineBatch(GraphicsPipelineBatch const&) = delete;
+	GraphicsPipelineBatch& operator=(GraphicsPipelineBatch const&) = delete;
+
+private:
+
+	struct PendingPipeline
+	{
+		GraphicsPipelineDesc Desc;
+		std::promise<GraphicsPipeline*> Result;
+	};
+
+	GraphicsDevice const* m_device;
+	uint32_t m_worker_count;
+	AssetPack const* m_pack;
+
+	std::vector<std::shared_ptr<PendingPipeline>> m_pending;
+	std::unordered_map<std::string, std::shared_future<VkShaderModule>> m_modules;
+
+	std::mutex m_task_mutex;
+	std::deque<std::function<void(VkPipelineCache)>> m_tasks;
+	std::vector<std::thread> m_workers;
+
+	void WorkerLoop();
+};
+
+// Begin dynamic rendering into a single colour attachment, cleared to clear. The image must already be in
+// COLOR_ATTACHMENT_OPTIMAL; pass VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT to draw with secondaries.
+void BeginRendering(VkCommandBuffer command_buffer, VkImageView view, VkExtent2D extent, VkClearValue const& clear, VkRenderingFlags flags = 0);
+
+// Same with a depth attachment in ATTACHMENT_OPTIMAL, which is stored for later passes. Without a colour view only
+// depth is rendered, as in a prepass. Depth is cleared to 1 unless load_depth keeps what a previous pass wrote.
+void BeginRendering(VkCommandBuffer command_buffer, VkImageView color_view, VkImageView depth_view, VkExtent2D extent,
+	VkClearValue const& clear, bool load_depth, VkRenderingFlags flags = 0);
+
+// Only needed in render pass mode, dynamic rendering draws straight into image views.
 class Framebuffers
 {
 public:
 
-	Framebuffers(GraphicsDevice const& device, GraphicsPipeline const& pipeline, Swapchain const& swapchain);
+	// The depth view is required if the pipeline tests depth.
+	Framebuffers(GraphicsDevice const& device, GraphicsPipeline const& pipeline, Swapchain const& swapchain, VkImageView depth_view = VK_NULL_HANDLE);
 	~Framebuffers();
 
+	// Rebuild after Swapchain::Recreate. The old framebuffers are destroyed through the scheduler once their frames retire.
+	void Recreate(GraphicsPipeline const& pipeline, Swapchain const& swapchain, FrameScheduler& scheduler, VkImageView depth_view = VK_NULL_HANDLE);
+
+	inline VkFramebuffer GetFramebuffer(uint32_t image_index) const { return m_framebuffers[image_index]; }
+
 	Framebuffers(Framebuffers const&) = delete;
 	Framebuffers& operator=(Framebuffers const&) = delete;
 
@@ -72,11 +228,30 @@ private:
 
 	GraphicsDevice const* m_device;
 	std::vector<VkFramebuffer> m_framebuffers;
+
+	void Create(GraphicsPipeline const& pipeline, Swapchain const& swapchain, VkImageView depth_view);
 };
 
 class CommandPool
 {
 public:
 
-	CommandPool();
+	CommandPool(GraphicsDevice const& device, uint32_t queue_family, VkCommandPoolCreateFlags flags = 0);
+	~CommandPool();
+
+	inline VkCommandPool GetHandle() const { return m_pool; }
+
+	// Allocated command buffers are owned by the pool and released along with it.
+	VkCommandBuffer Allocate(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+	// Recycle every command buffer allocated from this pool at once (cheaper than resetting them one by one).
+	void Reset();
+
+	CommandPool(CommandPool const&) = delete;
+	CommandPool& operator=(CommandPool const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	VkCommandPool m_pool;
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "core.hpp"
+#include <functional>
+
+class GraphicsDevice;
+class FrameScheduler;
+struct Allocation;
+
+// Index of an image or buffer in a RenderGraph, valid until the next Reset.
+using RenderResource = uint32_t;
+
+// How a pass uses a resource: the stages and accesses to synchronize with and, for images, the layout it needs.
+struct RenderAccess
+{
+	VkPipelineStageFlags2 Stage;
+	VkAccessFlags2 Access;
+	VkImageLayout Layout; // Ignored for buffers
+};
+
+inline constexpr RenderAccess RENDER_COLOR_ATTACHMENT = { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+	VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+inline constexpr RenderAccess RENDER_DEPTH_ATTACHMENT = { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+	VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL };
+
+// Depth tested but not written, as by the passes after a prepass. Stays in the attachment layout.
+inline constexpr RenderAccess RENDER_DEPTH_TEST = { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+	VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL };
+
+inline constexpr RenderAccess RENDER_SAMPLED_COMPUTE = { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL };
+inline constexpr RenderAccess RENDER_SAMPLED_FRAGMENT = { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL };
+inline constexpr RenderAccess RENDER_COMPUTE_READ = { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+inline constexpr RenderAccess RENDER_COMPUTE_WRITE = { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+inline constexpr RenderAccess RENDER_VERTEX_INPUT = { VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+inline constexpr RenderAccess RENDER_INDIRECT = { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+
+// Image the graph creates for the frame. Usage follows from how passes access it.
+struct RenderImageDesc
+{
+	VkFormat Format;
+	VkExtent2D Extent;
+};
+
+struct RenderGraphStats
+{
+	uint32_t PassCount;
+	uint32_t CulledPasses;
+	uint32_t BarrierBatches;		// vkCmdPipelineBarrier2 calls
+	uint32_t ImageBarriers;
+	uint32_t MemoryBarriers;		// Buffer dependencies, merged into one global barrier per batch
+	uint32_t TransientImages;
+	uint32_t LazyImages;			// Of the transient images, those only ever used as attachments
+	VkDeviceSize TransientBytes;	// Memory the transient images occupy, aliased
+	VkDeviceSize UnaliasedBytes;	// What they would take each in its own memory
+};
+
+// The frame as a list of passes that declare which resources they read and write. Each frame the graph is declared
+// anew and executed:
+//
+// - Passes nothing depends on are culled. A pass survives if it writes an imported resource, is marked as having
+//   side effects, or writes what a surviving pass after it reads.
+// - Barriers are derived from the declared accesses, and everything needed before a pass goes into one
+//   vkCmdPipelineBarrier2, with image barriers for images and one global barrier covering all buffers.
+// - Images created by the graph live only within the frame. Those whose lifetimes, from first to last pass using
+//   them, do not overlap share memory. Images used as attachments only never leave tile memory on tiled GPUs, so
+//   they get lazily allocated memory where the device has it, which may then never be backed at all.
+//
+// Created images stay alive across frames while the images declared and the way they share memory stay the same,
+// so a graph that is the same every frame creates them once. Passes run in the order they were added.
+class RenderGraph
+{
+public:
+
+	RenderGraph(GraphicsDevice const& device);
+	~RenderGraph();
+
+	// Forget the last frame's passes and resources, to declare the next.
+	void Reset();
+
+	// An image owned elsewhere, in state initial before the first pass (UNDEFINED discards its contents), and moved
+	// to state final after the last. A final layout of UNDEFINED leaves it as the last pass did.
+	RenderResource ImportImage(char const* name, VkImage image, VkImageView view, VkImageAspectFlags aspect, RenderAccess const& initial,
+		RenderAccess const& final);
+
+	// A buffer owned elsewhere, last accessed as initial, e.g. by the previous frame.
+	RenderResource ImportBuffer(char const* name, VkBuffer buffer, RenderAccess const& initial);
+
+	// An image created by the graph, undefined before the first pass writing it and discarded after the last one.
+	RenderResource CreateImage(char const* name, RenderImageDesc const& desc);
+
+	// Record runs during Execute, after the barriers for it. Returns the pass to declare accesses on.
+	uint32_t AddPass(char const* name, std::function<void(VkCommandBuffer)> record);
+
+	// Declare that pass reads or writes resource as access. A write whose access also reads (an attachment that is
+	// loaded, or tested) keeps what earlier passes wrote alive.
+	void Read(uint32_t pass, RenderResource resource, RenderAccess const& access);
+	void Write(uint32_t pass, RenderResource resource, RenderAccess const& access);
+
+	// Never cull pass, for effects the graph does not see, such as readbacks or state kept for later frames.
+	void SetSideEffects(uint32_t pass);
+
+	// Cull, place the transient images, then record every surviving pass with its barriers. Images replaced since
+	// the last frame are destroyed through the scheduler once the frames using them retire.
+	void Execute(VkCommandBuffer command_buffer, FrameScheduler& scheduler);
+
+	// For use while recording passes.
+	VkImage GetImage(RenderResource image) const;
+	VkImageView GetView(RenderResource image) const;
+
+	// Bindless slot of a transient image some pass samples, valid in READ_ONLY_OPTIMAL.
+	uint32_t GetTextureIndex(RenderResource image) const;
+
+	inline RenderGraphStats const& GetStats() const { return m_stats; }
+	void PrintStats() const;
+
+	RenderGraph(RenderGraph const&) = delete;
+	RenderGraph& operator=(RenderGraph const&) = delete;
+
+private:
+
+	struct Use
+	{
+		RenderResource Resource;
+		RenderAccess Access;
+		bool Write;
+	};
+
+	struct Pass
+	{
+		char const* Name;
+		std::function<void(VkCommandBuffer)> Record;
+		std::vector<Use> Uses;
+		bool SideEffects;
+	};
+
+	struct Resource
+	{
+		char const* Name;
+		bool IsImage;
+		bool IsImported;
+		VkImage Image;
+		VkImageView View;
+		VkBuffer Buffer;
+		VkImageAspectFlags Aspect;
+		RenderAccess Initial;
+		RenderAccess Final;
+		RenderImageDesc Desc;
+		uint32_t Transient; // Index into m_transients, UINT32_MAX if imported or used by no surviving pass
+	};
+
+	// A created image and where it lives. Images of the same slot share its memory.
+	struct TransientImage
+	{
+		RenderResource Resource;
+		RenderImageDesc Desc;
+		VkImageUsageFlags Usage;
+		VkDeviceSize Size;
+		uint32_t Slot;
+		uint32_t FirstPass, LastPass;
+		VkImage Image;
+		VkImageView View;
+		uint32_t TextureIndex; // UINT32_MAX unless sampled
+	};
+
+	struct MemorySlot
+	{
+		VkMemoryRequirements Requirements;
+		bool Lazy;
+		Allocation* Memory;
+		RenderAccess LastUse; // By the image last using the slot in the previous frame
+	};
+
+	GraphicsDevice const* m_device;
+
+	std::vector<Pass> m_passes;
+	std::vector<Resource> m_resources;
+
+	std::vector<TransientImage> m_transients; // Alive, matching the last executed graph
+	std::vector<MemorySlot> m_slots;
+
+	RenderGraphStats m_stats;
+
+	std::vector<bool> Cull() const;
+	std::vector<TransientImage> PlaceTransients(std::vector<bool> const& alive, std::vector<MemorySlot>& slots) const;
+	void CreateTransients(std::vector<TransientImage>& transients, std::vector<MemorySlot>& slots);
+	void DestroyTransients(FrameScheduler& scheduler);
+};
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "core.hpp"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENGINE_SSE
+#endif
+
+// Four floats processed together, e.g. one bone or one BVH child per lane. SSE2 is part of every x86-64 target,
+// so that is the width used; elsewhere the plain loops below stand in, which compilers still vectorize well.
+struct Float4
+{
+#ifdef ENGINE_SSE
+	__m128 V;
+#else
+	float V[4];
+#endif
+};
+
+#ifdef ENGINE_SSE
+
+inline Float4 Load4(float const* p) { return { _mm_loadu_ps(p) }; }
+inline void Store4(float* p, Float4 a) { _mm_storeu_ps(p, a.V); }
+inline Float4 Splat4(float x) { return { _mm_set1_ps(x) }; }
+inline Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.V, b.V) }; }
+inline Float4 operator-(Float4 a, Float4 b) { return { _mm_sub_ps(a.V, b.V) }; }
+inline Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.V, b.V) }; }
+inline Float4 Min4(Float4 a, Float4 b) { return { _mm_min_ps(a.V, b.V) }; }
+inline Float4 Max4(Float4 a, Float4 b) { return { _mm_max_ps(a.V, b.V) }; }
+inline Float4 InverseSqrt4(Float4 a) { return { _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a.V)) }; }
+
+// Negates the lanes of a where sign is negative.
+inline Float4 FlipSign4(Float4 a, Float4 sign)
+{
+	__m128 negative = _mm_and_ps(_mm_cmplt_ps(sign.V, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+	return { _mm_xor_ps(a.V, negative) };
+}
+
+// Bit i is set where lane i of a <= b.
+inline uint32_t LessEqualMask4(Float4 a, Float4 b) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(a.V, b.V))); }
+
+#else
+
+#define FLOAT4_LANES(expression) Float4 r; for (int i = 0; i < 4; i++) r.V[i] = expression; return r
+inline Float4 Load4(float const* p) { FLOAT4_LANES(p[i]); }
+inline void Store4(float* p, Float4 a) { std::copy_n(a.V, 4, p); }
+inline Float4 Splat4(float x) { FLOAT4_LANES(x); }
+inline Float4 operator+(Float4 a, Float4 b) { FLOAT4_LANES(a.V[i] + b.V[i]); }
+inline Float4 operator-(Float4 a, Float4 b) { FLOAT4_LANES(a.V[i] - b.V[i]); }
+inline Float4 operator*(Float4 a, Float4 b) { FLOAT4_LANES(a.V[i] * b.V[i]); }
+inline Float4 Min4(Float4 a, Float4 b) { FLOAT4_LANES(b.V[i] < a.V[i] ? b.V[i] : a.V[i]); }
+inline Float4 Max4(Float4 a, Float4 b) { FLOAT4_LANES(b.V[i] > a.V[i] ? b.V[i] : a.V[i]); }
+inline Float4 InverseSqrt4(Float4 a) { FLOAT4_LANES(1.0f / std::sqrt(a.V[i])); }
+inline Float4 FlipSign4(Float4 a, Float4 sign) { FLOAT4_LANES(sign.V[i] < 0.0f ? -a.V[i] : a.V[i]); }
+#undef FLOAT4_LANES
+
+inline uint32_t LessEqualMask4(Float4 a, Float4 b)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < 4; i++)
+		mask |= uint32_t(a.V[i] <= b.V[i]) << i;
+	return mask;
+}
+
+#endif
\ No newline at end of file
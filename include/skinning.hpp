@@ -0,0 +1,125 @@
+#pragma once
+
+#include "core.hpp"
+#include "animation.hpp"
+#include "upload.hpp"
+
+class GraphicsDevice;
+class AssetPack;
+class ComputePipeline;
+class GraphicsPipelineCreator;
+class FrameRing;
+class JobSystem;
+class Mesh;
+struct Allocation;
+struct CullMesh;
+
+// Bone influences of one mesh vertex, in the mesh's vertex order. Weights are unorm8 and should add up to 255.
+struct SkinVertex
+{
+	uint8_t Joints[4];
+	uint8_t Weights[4];
+};
+
+// Written by skin.comp: the position in the same unit bounding sphere as PackedVertex, so instance transforms and
+// instance.vert work unchanged, but as floats since limbs may leave the sphere. Normal and UVs as in PackedVertex.
+struct SkinnedVertex
+{
+	float Position[3];
+	int16_t Normal[2];
+	uint16_t Uv[2];
+};
+
+static_assert(sizeof(SkinVertex) == 8 && sizeof(SkinnedVertex) == 20, "Layouts must match skin.comp");
+
+// Animation detail for characters up to MaxDistance from the camera: poses are sampled and skinned every
+// UpdateInterval frames, from the first BoneCount bones of the skeleton (see Skeleton).
+struct AnimationLod
+{
+	float MaxDistance;
+	uint32_t UpdateInterval;
+	uint32_t BoneCount;
+};
+
+// What a character is playing: a cross-fade from the first clip (Blend 0) to the second (Blend 1), each at its own time.
+struct CrowdCharacter
+{
+	uint32_t Clips[2];
+	float Times[2];
+	float Blend;
+	float Distance; // From the camera, picks the LOD
+};
+
+struct CrowdSkinStats
+{
+	uint32_t Skinned;			// Characters skinned in the last update
+	uint32_t Characters[4];		// Characters in each of the first four LODs
+	double SampleMs;			// CPU time of sampling, blending and palettes
+};
+
+// Animates a crowd of characters sharing one skinned mesh. Each update samples and blends the characters' poses
+// on the job system, four bones per SIMD instruction, then a compute pass skins every vertex of them into one
+// buffer, character after character. The depth prepass, shadow passes and main pass all draw from that buffer,
+// so vertices are skinned once per frame however many passes see them.
+//
+// Animation LOD trades detail for time with distance: far characters update less often (staggered across
+// frames so the cost stays flat) and with fewer bones. A character not due in a frame keeps its last vertices.
+class CrowdSkinner
+{
+public:
+
+	// skin has one entry per vertex of the mesh, whose vertex buffer must stay alive. LODs go from the nearest.
+	CrowdSkinner(GraphicsDevice const& device, AssetPack const& pack, Uploader& uploader, JobSystem* jobs, Mesh const& mesh,
+		Skeleton skeleton, std::vector<SkinVertex> const& skin, std::vector<AnimationLod> lods, uint32_t max_characters);
+	~CrowdSkinner();
+
+	// Clips must animate the skeleton's bones. Returns the index CrowdCharacter::Clips refers to it by.
+	uint32_t AddClip(AnimationClip clip);
+
+	// Once the skin weights have been uploaded, and so the mesh, whose upload was queued earlier.
+	inline bool IsReady(Uploader const& uploader) const { return uploader.IsReady(m_ticket); }
+
+	// Pose and skin the characters due this frame. Record outside of rendering, before the passes drawing them. The
+	// caller orders the dispatch after earlier draws reading the vertices and before the draws reading them next.
+	void Update(VkCommandBuffer command_buffer, uint64_t frame_index, FrameRing& ring, CrowdCharacter const* characters, uint32_t count);
+
+	// Skinned vertices of character i start at vertex i * GetVertexCount().
+	inline VkBuffer GetVertexBuffer() const { return m_output; }
+
+	inline uint32_t GetVertexCount() const { return m_vertex_count; }
+
+	// The mesh's levels for GpuCuller, drawing character i's vertices.
+	CullMesh GetCullMesh(uint32_t character, float distance_per_error = 1000.0f) const;
+
+	inline CrowdSkinStats const& GetStats() const { return m_stats; }
+	void PrintStats() const;
+
+	// Vertex binding 0 and attributes 0 (position), 1 (normal) and 2 (UV) of SkinnedVertex, as Mesh::AddVertexInput.
+	static void AddVertexInput(GraphicsPipelineCreator& creator);
+
+	CrowdSkinner(CrowdSkinner const&) = delete;
+	CrowdSkinner& operator=(CrowdSkinner const&) = delete;
+
+private:
+
+	GraphicsDevice const* m_device;
+	JobSystem* m_jobs;
+	Mesh const* m_mesh;
+	ComputePipeline* m_pipeline;
+
+	Skeleton m_skeleton;
+	std::vector<AnimationLod> m_lods;
+	std::vector<AnimationClip> m_clips;
+	uint32_t m_vertex_count;
+	uint32_t m_max_characters;
+
+	VkBuffer m_skin, m_output;
+	Allocation* m_skin_memory, * m_output_memory;
+	VkDeviceAddress m_skin_address, m_output_address;
+	UploadTicket m_ticket;
+
+	std::vector<uint64_t> m_last_updates; // Frame each character was last skinned in, UINT64_MAX if never
+	std::vector<uint32_t> m_due;
+	std::vector<Pose> m_scratch; // Two per thread
+	CrowdSkinStats m_stats;
+};
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "core.hpp"
+
+class JobSystem;
+
+// Index of an object in its SpatialIndex, stable until removed.
+using SpatialHandle = uint32_t;
+
+inline constexpr SpatialHandle SPATIAL_INVALID_HANDLE = UINT32_MAX;
+
+struct SpatialBounds
+{
+	float Min[3];
+	float Max[3];
+};
+
+// Distances are in units of the direction's length, so a normalized direction gives them in world units.
+struct SpatialRay
+{
+	float Origin[3];
+	float MaxDistance;
+	float Direction[3];
+};
+
+// Nearest object whose bounds the ray enters, SPATIAL_INVALID_HANDLE if none. Bounds are all the index knows
+// about; exact shapes (capsules, hitboxes) are up to the caller to test the candidates against.
+struct SpatialHit
+{
+	SpatialHandle Object;
+	float Distance;
+};
+
+struct SpatialSphere
+{
+	float Center[3];
+	float Radius;
+};
+
+struct SpatialStats
+{
+	uint32_t ObjectCount;
+	uint32_t NodeCount;
+	uint32_t PendingCount;	// Inserted since the last rebuild, tested one by one
+	float AreaRatio;		// Surface area of the nodes against just after the last rebuild
+	uint64_t Rebuilds;
+	uint64_t FullRefits;
+	uint64_t PartialRefits;
+};
+
+// Bounding volume hierarchy over moving axis-aligned boxes, for hitscan raycasts and proximity queries.
+//
+// Nodes have four children stored as structure of arrays, so one SIMD instruction tests a ray or sphere against
+// all of them. Moving objects only refits the tree: boxes grow and shrink along the paths above what moved, and
+// the topology stays as built. When refitting has loosened the tree too much, or enough objects have been
+// inserted since the last build (they wait in a list tested one by one until then), Update rebuilds it.
+//
+// Queries are const and safe to run from any number of threads at once, but not alongside changes.
+class SpatialIndex
+{
+public:
+
+	// Batched queries run on the job system when one is given.
+	SpatialIndex(JobSystem* jobs = nullptr);
+
+	// Like Move, takes effect for queries after the next Update.
+	SpatialHandle Insert(SpatialBounds const& bounds);
+
+	void Remove(SpatialHandle object);
+
+	// Takes effect for queries after the next Update.
+	void Move(SpatialHandle object, SpatialBounds const& bounds);
+
+	// Apply the changes since the last call. Refits the paths above moved objects, the whole tree in one pass when
+	// many have moved, and rebuilds when needed.
+	void Update();
+
+	// Drop the current tree and build one from scratch, e.g. after spawning a level's worth of objects.
+	void Rebuild();
+
+	SpatialHit Raycast(SpatialRay const& ray) const;
+
+	// Objects whose bounds touch the sphere, appended to results.
+	void OverlapSphere(SpatialSphere const& sphere, std::vector<SpatialHandle>& results) const;
+
+	// The same for many queries at once, split across the job system.
+	void RaycastBatch(SpatialRay const* rays, uint32_t count, SpatialHit* hits) const;
+	void OverlapSphereBatch(SpatialSphere const* spheres, uint32_t count, std::vector<SpatialHandle>* results) const;
+
+	inline SpatialBounds const& GetBounds(SpatialHandle object) const { return m_bounds[object]; }
+
+	SpatialStats GetStats() const;
+	void PrintStats() const;
+
+	SpatialIndex(SpatialIndex const&) = delete;
+	SpatialIndex& operator=(SpatialIndex const&) = delete;
+
+private:
+
+	// Child slots hold a node index, an object index with the leaf bit set, or nothing. Empty slots and removed
+	// objects have inverted bounds, which no query can hit.
+	struct alignas(64) Node
+	{
+		float MinX[4], MinY[4], MinZ[4];
+		float MaxX[4], MaxY[4], MaxZ[4];
+		uint32_t Children[4];
+		uint32_t Parent;
+		uint32_t ParentSlot;
+	};
+
+	// Where an object sits in the tree, Node is UINT32_MAX while pending.
+	struct Location
+	{
+		uint32_t Node;
+		uint32_t Slot;
+	};
+
+	JobSystem* m_jobs;
+
+	std::vector<SpatialBounds> m_bounds; // By handle
+	std::vector<Location> m_locations;
+	std::vector<SpatialHandle> m_free;
+	std::vector<SpatialHandle> m_pending;
+	std::vector<SpatialHandle> m_moved;
+	std::vector<bool> m_is_moved;
+	uint32_t m_object_count;
+
+	std::vector<Node> m_nodes; // Parents before children, the root first
+	float m_built_area;
+	float m_area; // Kept current by partial refits too, which is what decides the rebuild
+	float m_area_ratio;
+
+	uint64_t m_rebuilds, m_full_refits, m_partial_refits;
+
+	uint32_t BuildNode(std::vector<SpatialHandle>& objects, std::vector<float>& centroids, uint32_t begin, uint32_t end, uint32_t parent, uint32_t parent_slot);
+	void SetSlot(Node& node, uint32_t slot, SpatialBounds const& bounds) const;
+	SpatialBounds GetNodeBounds(Node const& node) const;
+	float RefitAll();
+};
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "core.hpp"
+#include <atomic>
+
+class GraphicsDevice;
+
+// Monotonic counter shared by the CPU and every queue. A submission signals a value and other queues (or the CPU)
+// wait for it, which replaces a fence plus a binary semaphore per cross-queue dependency.
+class TimelineSemaphore
+{
+public:
+
+	TimelineSemaphore(GraphicsDevice const& device, uint64_t initial_value = 0);
+	~TimelineSemaphore();
+
+	inline VkSemaphore GetHandle() const { return m_semaphore; }
+
+	// Reserve the next value to signal, safe to call from any thread.
+	inline uint64_t Advance() { return ++m_last_value; }
+
+	// Last value reserved with Advance, which is what a consumer should wait for.
+	inline uint64_t GetLastValue() const { return m_last_value; }
+
+	// Value the GPU (or a host Signal) has reached so far.
+	uint64_t GetCompletedValue() const;
+
+	// Block until the value is reached. Returns false on timeout.
+	bool Wait(uint64_t value, uint64_t timeout = std::numeric_limits<uint64_t>::max()) const;
+
+	void Signal(uint64_t value);
+
+	// Entries for VkSubmitInfo2 waiting on or signaling the given value.
+	VkSemaphoreSubmitInfo WaitInfo(uint64_t value, VkPipelineStageFlags2 stage) const;
+	VkSemaphoreSubmitInfo SignalInfo(uint64_t value, VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT) const;
+
+	TimelineSemaphore(TimelineSemaphore const&) = delete;
+	TimelineSemaphore& operator=(TimelineSemaphore const&) = delete;
+
+private:
+
+	VkDevice m_device;
+	VkSemaphore m_semaphore;
+	std::atomic<uint64_t> m_last_value;
+};
+
+// Single image layout transition within one queue, e.g. around dynamic rendering where no render pass does it.
+void TransitionImage(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout,
+	VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+// Execution and memory dependency covering every resource, e.g. between a compute pass and the draws consuming its
+// output. Cheaper to record than per-buffer barriers and no less precise on current hardware.
+void GlobalBarrier(VkCommandBuffer command_buffer, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access,
+	VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+// Hands buffers and images over from one queue family to another (e.g. transfer to graphics). The release half is
+// recorded on the source queue, the acquire half on the destination queue in a submission that waits for the
+// release, typically on a TimelineSemaphore. If both families are the same, the release records nothing and the
+// acquire is an ordinary barrier, so callers need not care whether the device has dedicated queues.
+class QueueOwnershipTransfer
+{
+public:
+
+	QueueOwnershipTransfer(uint32_t src_family, uint32_t dst_family);
+
+	// src_* describe the last use on the source queue, dst_* the first use on the destination queue.
+	void AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+		VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+	// The layout transition is part of the transfer and happens once, between release and acquire.
+	void AddImage(VkImage image, VkImageSubresourceRange const& range, VkImageLayout old_layout, VkImageLayout new_layout,
+		VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+	void RecordRelease(VkCommandBuffer command_buffer) const;
+	void RecordAcquire(VkCommandBuffer command_buffer) const;
+
+	inline bool IsEmpty() const { return m_buffers.empty() && m_images.empty(); }
+
+	inline bool IsCrossFamily() const { return m_src_family != m_dst_family; }
+
+	void Clear();
+
+private:
+
+	uint32_t m_src_family, m_dst_family;
+	std::vector<VkBufferMemoryBarrier2> m_buffers;
+	std::vector<VkImageMemoryBarrier2> m_images;
+
+	void Record(VkCommandBuffer command_buffer, bool release) const;
+};
\ No newline at end of file
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "core.hpp"
+#include "upload.hpp"
+#include <atomic>
+#include <functional>
+
+class GraphicsDevice;
+class AssetPack;
+class FrameScheduler;
+class FrameRing;
+class JobSystem;
+class JobCounter;
+struct Allocation;
+
+// Index of a texture in its streamer, stable for the streamer's lifetime. Materials store this rather than a
+// bindless slot, which changes whenever the texture's resident mips do.
+using TextureHandle = uint32_t;
+
+// KTX2 supercompression schemes.
+enum TextureSupercompression : uint32_t
+{
+	TEXTURE_SUPERCOMPRESSION_NONE,
+	TEXTURE_SUPERCOMPRESSION_BASIS_LZ,
+	TEXTURE_SUPERCOMPRESSION_ZSTD,
+	TEXTURE_SUPERCOMPRESSION_ZLIB,
+};
+
+// One mip level as stored in the file, handed to a transcoder.
+struct TextureSource
+{
+	void const* File;	// The whole KTX2 file, for schemes with global data (BasisLZ)
+	size_t FileSize;
+	uint32_t Level;
+	void const* Data;
+	size_t Size;
+	size_t UncompressedSize; // As declared by the file
+	uint32_t Width, Height;
+	VkFormat Format;		// As declared by the file, VK_FORMAT_UNDEFINED for BasisLZ
+};
+
+// Turns one level into tightly packed blocks of the format it was registered with. Runs on the job system.
+using TextureTranscoder = std::function<std::vector<char>(TextureSource const& source)>;
+
+struct TextureStreamStats
+{
+	VkDeviceSize BudgetBytes;
+	VkDeviceSize ResidentBytes;		// Mips resident or being streamed in
+	VkDeviceSize RequestedBytes;	// What every texture would take with the mips last requested for it, budget aside
+	VkDeviceSize StreamedBytes;		// Total uploaded so far
+	uint64_t EvictedLevels;			// Mips dropped to stay within the budget
+	uint64_t FailedChanges;			// Residency changes dropped because a mip failed to decode or upload
+	uint32_t TextureCount;
+	uint32_t PendingCount;			// Textures waiting for mips to arrive
+};
+
+// Streams block-compressed (BCn, ETC2/EAC, ASTC) KTX2 textures from an asset pack under a fixed memory budget.
+//
+// Every texture keeps its mip tail (levels no larger than tail_size) resident at all times; larger mips are
+// streamed in when draws ask for them through Request, and dropped again, least recently requested texture
+// first, when the budget runs out. Residency changes by replacing the image with one holding the new range of
+// mips: new levels are uploaded, the levels both images share are copied on the GPU, and the bindless slot is
+// switched once everything has arrived, so a texture is never sampled half loaded and never stalls a frame.
+//
+// Supercompressed levels are decoded on the job system before upload. Zlib is built in; other schemes (zstd,
+// BasisLZ) need a transcoder registered with SetTranscoder. A level that fails to decode or upload drops the change
+// that needed it, and the texture streams nothing that fine again.
+class TextureStreamer
+{
+public:
+
+	// A null job system decodes on the calling thread.
+	TextureStreamer(GraphicsDevice const& device, AssetPack const& pack, Uploader& uploader, JobSystem* jobs,
+		VkDeviceSize budget = 256ull << 20, uint32_t tail_size = 128);
+
+	// The device must be idle and the uploader done with every texture, e.g. deleted first.
+	~TextureStreamer();
+
+	// Decode levels in scheme with transcoder, producing format (VK_FORMAT_UNDEFINED keeps the file's format).
+	// Register before loading textures that use it.
+	void SetTranscoder(TextureSupercompression scheme, VkFormat format, TextureTranscoder transcoder);
+
+	// Throws if the asset is missing, not a 2D KTX2 texture, or in a format or scheme that cannot be loaded.
+	// The mip tail starts streaming in right away.
+	TextureHandle Load(std::string_view name);
+
+	// The texture covers up to screen_size pixels across this frame (its whole UV range, along its longer side),
+	// so mips finer than that are not needed. Safe from any thread, but not alongside Load or Update.
+	void Request(TextureHandle texture, float screen_size);
+
+	// Call once per frame, after Uploader::BeginFrame and before the draws. Applies the frame's requests within
+	// the budget, starts and finishes residency changes, and returns the address of this frame's slot table:
+	// a uint32_t bindless texture slot per handle, BINDLESS_INVALID_INDEX until the mip tail has arrived.
+	VkDeviceAddress Update(VkCommandBuffer command_buffer, FrameScheduler& scheduler, FrameRing& ring);
+
+	// Bindless slot of the anisotropic, repeating sampler textures are meant to be read with.
+	inline uint32_t GetSamplerIndex() const { return m_sampler_index; }
+
+	TextureStreamStats GetStats() const;
+	void PrintStats() const;
+
+	TextureStreamer(TextureStreamer const&) = delete;
+	TextureStreamer& operator=(TextureStreamer const&) = delete;
+
+private:
+
+	struct Level
+	{
+		void const* Data;
+		size_t Size;
+		size_t UncompressedSize;
+		VkDeviceSize ResidentSize; // Once decoded
+	};
+
+	struct Transcoder
+	{
+		VkFormat Format;
+		TextureTranscoder Function;
+	};
+
+	// A new image, waiting for its uploads before it replaces the texture's current one.
+	struct Change
+	{
+		uint32_t First; // Most detailed level
+		VkImage Image;
+		Allocation* Memory;
+		VkImageView View;
+		JobCounter* Decoded;
+		std::atomic<UploadTicket> LastTicket;
+		std::atomic<uint32_t> FailedEnd; // One past the coarsest level that failed, 0 if none did
+	};
+
+	struct Texture
+	{
+		void const* File;
+		size_t FileSize;
+		TextureSupercompression Scheme;
+		VkFormat SourceFormat;
+		VkFormat Format;
+		uint32_t Width, Height;
+		uint32_t LevelCount;
+		uint32_t TailFirst; // Levels from here on are always resident
+		uint32_t Finest; // Finest level that may be streamed, past any that failed
+		std::vector<Level> Levels;
+
+		uint32_t First; // LevelCount while nothing is resident
+		VkImage Image;
+		Allocation* Memory;
+		VkImageView View;
+		uint32_t Slot;
+
+		std::atomic<uint32_t> Requested; // Finest level asked for since the last Update, LevelCount if none
+		uint64_t LastRequested; // Frame index
+		Change* Pending;
+	};
+
+	GraphicsDevice const* m_device;
+	AssetPack const* m_pack;
+	Uploader* m_uploader;
+	JobSystem* m_jobs;
+	VkDeviceSize m_budget;
+	uint32_t m_tail_size;
+
+	VkSampler m_sampler;
+	uint32_t m_sampler_index;
+
+	std::vector<Texture*> m_textures;
+	std::vector<Transcoder> m_transcoders; // By scheme
+
+	VkDeviceSize m_requested_bytes; // As of the last Update
+	std::atomic<VkDeviceSize> m_streamed_bytes; // Added to by decode jobs
+	uint64_t m_evicted_levels;
+	uint64_t m_failed_changes;
+
+	VkDeviceSize GetResidentSize(Texture const& texture, uint32_t first) const;
+	void StartChange(Texture& texture, uint32_t first);
+	void UploadLevel(Texture& texture, Change& change, uint32_t level);
+	void FinishChanges(VkCommandBuffer command_buffer, FrameScheduler& scheduler);
+};
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "core.hpp"
+#include "sync.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+
+class GraphicsDevice;
+class FrameScheduler;
+class CommandPool;
+class LinearPool;
+
+// Identifies one queued upload. Tickets increase in submission order.
+using UploadTicket = uint64_t;
+
+struct UploadStats
+{
+	VkDeviceSize PendingBytes;	// Queued but not yet copied into staging.
+	VkDeviceSize UploadedBytes;	// Total copied so far.
+	uint64_t Batches;			// Transfer submissions so far.
+};
+
+// Moves vertex, index and texture data to the GPU on a background thread. Requests from any thread are copied
+// into a persistently mapped staging ring and turned into a few batched copy submissions on the transfer queue,
+// each signaling a timeline value that retires its staging range. The graphics thread acquires finished uploads
+// once per frame; how many bytes may be started per frame is capped so streaming never causes a hitch.
+class Uploader
+{
+public:
+
+	// A frame budget of zero means unlimited.
+	Uploader(GraphicsDevice const& device, VkDeviceSize staging_size = 64ull << 20, VkDeviceSize frame_budget = 8ull << 20);
+
+	// Finishes the copies already submitted, requests still queued are dropped.
+	~Uploader();
+
+	// Copy data into a buffer range. dst_stage and dst_access describe its first use on the graphics queue.
+	UploadTicket UploadBuffer(VkBuffer buffer, VkDeviceSize offset, std::vector<char> data,
+		VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+	// As above without taking a copy: data must stay valid until the upload is ready, as assets mapped from a pack do.
+	// Saves a heap copy of every mesh streamed straight from the pack into staging.
+	UploadTicket UploadBuffer(VkBuffer buffer, VkDeviceSize offset, void const* data, VkDeviceSize size,
+		VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+	// Copy tightly packed texels into one subresource. The image is expected in UNDEFINED layout and left in final_layout.
+	UploadTicket UploadImage(VkImage image, VkImageSubresourceLayers const& subresource, VkExtent3D extent, std::vector<char> data,
+		VkImageLayout final_layout, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+	// As above without taking a copy, under the same rule as the borrowing UploadBuffer.
+	UploadTicket UploadImage(VkImage image, VkImageSubresourceLayers const& subresource, VkExtent3D extent, void const* data, VkDeviceSize size,
+		VkImageLayout final_layout, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+	// Call once per frame on the graphics thread, after FrameScheduler::BeginFrame. Records the acquire half of every
+	// upload the transfer queue finished since last frame, makes the frame wait for them and refills the budget.
+	void BeginFrame(VkCommandBuffer command_buffer, FrameScheduler& scheduler);
+
+	// Whether GPU work recorded after the last BeginFrame may use the upload.
+	inline bool IsReady(UploadTicket ticket) const { return ticket <= m_acquired_ticket; }
+
+	// Block until everything queued so far has been submitted and executed, ignoring the budget (e.g. loading screens).
+	// The uploads still need a BeginFrame before they can be used.
+	void Flush();
+
+	UploadStats GetStats() const;
+
+	Uploader(Uploader const&) = delete;
+	Uploader& operator=(Uploader const&) = delete;
+
+private:
+
+	struct UploadRequest
+	{
+		UploadTicket Ticket;
+		VkBuffer Buffer; // Either Buffer or Image is set
+		VkDeviceSize Offset;
+		VkImage Image;
+		VkImageSubresourceLayers Subresource;
+		VkExtent3D Extent;
+		VkImageLayout FinalLayout;
+		VkPipelineStageFlags2 DstStage;
+		VkAccessFlags2 DstAccess;
+		std::vector<char> Data;
+		char const* External; // Borrowed bytes used instead of Data when set
+		VkDeviceSize ExternalSize;
+
+		inline char const* GetBytes() const { return External ? External : Data.data(); }
+		inline VkDeviceSize GetSize() const { return External ? ExternalSize : Data.size(); }
+	};
+
+	// Command buffer on the transfer queue, recycled once its batch retires.
+	struct UploadContext
+	{
+		CommandPool* Pool;
+		VkCommandBuffer CommandBuffer;
+	};
+
+	struct UploadBatch
+	{
+		UploadContext Context;
+		uint64_t TimelineValue;
+		VkDeviceSize StagingMarker;
+		UploadTicket LastTicket;
+		QueueOwnershipTransfer Transfer;
+	};
+
+	GraphicsDevice const* m_device;
+	LinearPool* m_staging;
+	TimelineSemaphore m_timeline;
+	VkDeviceSize m_frame_budget;
+	VkDeviceSize m_copy_alignment;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_work_cv, m_idle_cv;
+	std::deque<UploadRequest> m_requests;
+	std::deque<UploadBatch> m_in_flight;	// Submitted, staging still in use
+	std::vector<UploadBatch> m_retired;		// Executed, waiting for the graphics thread to acquire
+	std::vector<UploadContext> m_free_contexts;
+	UploadTicket m_next_ticket;
+	std::atomic<UploadTicket> m_acquired_ticket;
+	int64_t m_budget_remaining;
+	uint32_t m_flushing;
+	bool m_busy;
+	bool m_stop;
+	UploadStats m_stats;
+
+	std::thread m_worker;
+
+	UploadTicket Enqueue(UploadRequest request);
+	void WorkerLoop();
+	void Record(std::vector<UploadRequest>& requests);
+	UploadBatch BeginBatch();
+	void SubmitBatch(UploadBatch& batch);
+	bool AllocateStaging(VkDeviceSize size, VkDeviceSize* offset);
+
+	// Requires m_mutex.
+	void RetireCompleted();
+};
\ No newline at end of file
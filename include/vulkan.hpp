@@ -1,10 +1,13 @@
 #pragma once
 
 #include "core.hpp"
+#include <mutex>
+#include <unordered_map>
 
 // Create vulkan instance
 // Create debug messenger (ifndef NDEBUG)
-void LaunchVulkan();
+// Headless mode skips GLFW and window-system extensions entirely.
+void LaunchVulkan(bool headless = false);
 
 // Destroy vulkan instance
 // Destroy debug messenger (ifndef NDEBUG)
@@ -15,6 +18,15 @@ VkInstance GetVulkanInstance();
 // Forward declaration of Window in window.hpp
 class Window;
 
+// Forward declaration of PipelineCache in pipeline_cache.hpp
+class PipelineCache;
+
+// Forward declaration of MemoryAllocator in memory.hpp
+class MemoryAllocator;
+
+// Forward declaration of BindlessHeap in bindless.hpp
+class BindlessHeap;
+
 struct CommandQueue
 {
 	VkQueue Queue;
@@ -36,6 +48,43 @@ public:
 
 	inline CommandQueue GetPresentQueue() const { return m_present_queue; }
 
+	// Transfer-only family when the device has one (DMA engine), otherwise a compute or the graphics family.
+	inline CommandQueue GetTransferQueue() const { return m_transfer_queue; }
+
+	// Compute family without graphics when the device has one (async compute), otherwise the graphics family.
+	inline CommandQueue GetComputeQueue() const { return m_compute_queue; }
+
+	// When false the queue is shared with graphics, and ownership transfers between the two are skipped.
+	inline bool HasDedicatedTransferQueue() const { return m_transfer_queue.FamilyIndex != m_graphics_queue.FamilyIndex; }
+
+	inline bool HasDedicatedComputeQueue() const { return m_compute_queue.FamilyIndex != m_graphics_queue.FamilyIndex; }
+
+	// Queue access must be externally synchronized, and fallback queues may alias each other.
+	// Every submission and present goes through these so that any thread may use any queue.
+	VkResult Submit(CommandQueue const& queue, uint32_t count, VkSubmitInfo2 const* submits, VkFence fence = VK_NULL_HANDLE) const;
+	VkResult Present(VkPresentInfoKHR const& present_info) const;
+
+	// Whether VK_KHR_present_id and VK_KHR_present_wait are enabled, i.e. presents may carry an id to wait for.
+	inline bool SupportsPresentWait() const { return m_wait_for_present != nullptr; }
+
+	// Block until the present with the given id (or a later one) is visible. Returns VK_TIMEOUT on timeout.
+	VkResult WaitForPresent(VkSwapchainKHR swapchain, uint64_t present_id, uint64_t timeout) const;
+
+	// Whether VK_EXT_calibrated_timestamps is enabled, which lets GPU timestamps be mapped onto the CPU clock.
+	inline bool SupportsCalibratedTimestamps() const { return m_calibrated_timestamps; }
+
+	// Index of the first memory type allowed by type_bits that has all the requested properties.
+	uint32_t FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags properties) const;
+
+	// Persistent pipeline cache shared by every pipeline created on this device.
+	inline PipelineCache* GetPipelineCache() const { return m_pipeline_cache; }
+
+	// Sub-allocator all buffer and image memory on this device should come from.
+	inline MemoryAllocator* GetAllocator() const { return m_allocator; }
+
+	// Global descriptor set every pipeline layout on this device starts with.
+	inline BindlessHeap* GetBindlessHeap() const { return m_bindless_heap; }
+
 	GraphicsDevice(GraphicsDevice const&) = delete;
 	GraphicsDevice& operator=(GraphicsDevice const&) = delete;
 
@@ -46,6 +95,18 @@ private:
 
 	CommandQueue m_graphics_queue;
 	CommandQueue m_present_queue;
+	CommandQueue m_transfer_queue;
+	CommandQueue m_compute_queue;
+
+	// One lock per distinct VkQueue, filled once in the constructor.
+	mutable std::unordered_map<VkQueue, std::mutex> m_queue_mutexes;
+
+	PipelineCache* m_pipeline_cache;
+	MemoryAllocator* m_allocator;
+	BindlessHeap* m_bindless_heap;
+
+	PFN_vkWaitForPresentKHR m_wait_for_present; // Null unless present wait is enabled
+	bool m_calibrated_timestamps;
 };
 
 void CreateSwapchain();
@@ -3,12 +3,15 @@
 #include "core.hpp"
 
 class GraphicsDevice;
+class FrameScheduler;
+struct Allocation;
 
 class Window
 {
 public:
 
-	Window(int width, int height, bool fullscreen);
+	// A headless window has no GLFW window and no surface, the swapchain then renders into device-owned images.
+	Window(int width, int height, bool fullscreen, bool headless = false);
 
 	~Window();
 
@@ -16,6 +19,18 @@ public:
 
 	inline VkSurfaceKHR GetSurface() const { return m_surface; }
 
+	inline bool IsHeadless() const { return m_headless; }
+
+	inline int GetWidth() const { return m_width; }
+
+	inline int GetHeight() const { return m_height; }
+
+	// True once after the framebuffer changed size (including minimize), then cleared.
+	bool ConsumeResize();
+
+	// Block on window events, without spinning, while the framebuffer has zero area.
+	void WaitWhileMinimized();
+
 	Window(Window const&) = delete;
 	Window& operator=(Window const&) = delete;
 
@@ -26,19 +41,70 @@ private:
 
 	int m_width, m_height;
 	bool m_fullscreen;
+	bool m_headless;
+	bool m_resized;
+
+	static void s_FramebufferSizeCallback(GLFWwindow* window, int width, int height);
+};
+
+// How frames reach the display, i.e. the trade-off between input latency, tearing and throughput.
+struct PresentPolicy
+{
+	// IMMEDIATE presents right away and tears. MAILBOX replaces the queued image, no tearing at the cost of frames
+	// never shown. FIFO is vsync and queues up to the image count. FIFO_RELAXED tears rather than wait for the next
+	// vblank when a frame is late. Unsupported modes fall back to FIFO, which every device supports.
+	VkPresentModeKHR PresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+
+	// Clamped to the surface limits. Zero asks for one more than the minimum. Fewer images queue fewer frames (lower
+	// latency with FIFO), more images leave the GPU more slack.
+	uint32_t ImageCount = 0;
+
+	// Frame limiter on the CPU, zero means unlimited. Frames start at this rate, so input is sampled evenly.
+	double TargetFps = 0.0;
+
+	// Hold the next frame until the previous one is on screen (needs VK_KHR_present_wait). Keeps at most one frame
+	// queued for presentation, so input-to-photon latency stays at about one frame even when GPU-bound.
+	bool WaitForPresent = false;
 };
 
 class Swapchain
 {
 public:
 
-	Swapchain(Window const& window, GraphicsDevice const& device);
+	Swapchain(Window const& window, GraphicsDevice const& device, PresentPolicy const& policy = {});
 	~Swapchain();
 
+	// Present mode and image count take effect on the next Recreate, the rest on the next frame.
+	inline void SetPresentPolicy(PresentPolicy const& policy) { m_policy = policy; }
+
+	inline PresentPolicy const& GetPresentPolicy() const { return m_policy; }
+
+	// Mode actually in use after fallback.
+	inline VkPresentModeKHR GetPresentMode() const { return m_present_mode; }
+
+	// Rebuild for the window's current size, handing the old swapchain over to the new one. The old swapchain and
+	// its views are destroyed through the scheduler once the frames using them have retired, so nothing waits
+	// for the device to go idle. The window must not be minimized.
+	void Recreate(Window const& window, FrameScheduler& scheduler);
+
+	// VK_NULL_HANDLE when headless.
+	inline VkSwapchainKHR GetHandle() const { return m_swapchain; }
+
+	inline bool IsHeadless() const { return m_headless; }
+
+	// Layout images must be left in at the end of a frame (PRESENT_SRC, or TRANSFER_SRC for readback when headless).
+	inline VkImageLayout GetFinalLayout() const { return m_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; }
+
 	inline VkFormat GetImageFormat() const { return m_image_format; }
 
 	inline std::vector<VkImageView> GetImageViews() const { return m_image_views; }
 
+	inline VkImage GetImage(uint32_t index) const { return m_images[index]; }
+
+	inline VkImageView GetImageView(uint32_t index) const { return m_image_views[index]; }
+
+	inline uint32_t GetImageCount() const { return static_cast<uint32_t>(m_image_views.size()); }
+
 	inline VkExtent2D GetExtent() const { return m_extent; }
 
 	Swapchain(Swapchain const&) = delete;
@@ -50,5 +116,16 @@ private:
 	VkSwapchainKHR m_swapchain;
 	VkFormat m_image_format;
 	VkExtent2D m_extent;
+	PresentPolicy m_policy;
+	VkPresentModeKHR m_present_mode;
+	std::vector<VkImage> m_images;
 	std::vector<VkImageView> m_image_views;
+
+	bool m_headless;
+	std::vector<VkImage> m_headless_images;
+	std::vector<Allocation*> m_headless_memory;
+
+	void Create(Window const& window, VkSwapchainKHR old_swapchain);
+	void CreateHeadlessImages(Window const& window);
+	void CreateImageViews(std::vector<VkImage> const& images);
 };
\ No newline at end of file
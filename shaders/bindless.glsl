@@ -0,0 +1,22 @@
+// Declarations of the bindless heap, see bindless.hpp. Resources are reached through indices passed in push constants.
+
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_EXT_buffer_reference : require
+
+layout(set = 0, binding = 0) uniform texture2D u_Textures[];
+layout(set = 0, binding = 3) uniform sampler u_Samplers[];
+
+// Storage images and buffers need a format or a block type, declare them with these, e.g.
+// BINDLESS_BUFFER(readonly, Material, { vec4 Color; }) gives u_Material[index].Color.
+#define BINDLESS_STORAGE_IMAGE(format, name) layout(set = 0, binding = 1, format) uniform image2D name[]
+#define BINDLESS_BUFFER(qualifier, name, body) layout(set = 0, binding = 2, std430) qualifier buffer name##Block body u_##name[]
+
+// Data allocated from the frame ring (frame_ring.hpp) is read through its address instead of a descriptor, e.g.
+// FRAME_DATA(FrameConstants, { vec4 Tint; }) declares a reference type to put in the push constants.
+#define FRAME_DATA(name, body) layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer name body
+
+// Index arguments that may differ across a draw (e.g. per instance) must be wrapped in nonuniformEXT.
+vec4 SampleTexture(uint texture_index, uint sampler_index, vec2 uv)
+{
+    return texture(sampler2D(u_Textures[nonuniformEXT(texture_index)], u_Samplers[nonuniformEXT(sampler_index)]), uv);
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "bindless.glsl"
+#include "scene.glsl"
+
+// PackedVertex, see mesh_format.hpp. The position is unit-sphere snorm16, which the instance transform scales
+// and moves to the mesh's bounding sphere in the world. Skinned meshes feed SkinnedVertex (skinning.hpp) instead,
+// with the position in the same unit sphere as floats.
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNormal;
+layout(location = 2) in vec2 inUv;
+
+layout(location = 0) out vec3 outNormal;
+layout(location = 1) out vec2 outUv;
+
+// The depth prepass and the shaded pass run this shader in different pipelines, and the shaded pass tests depth
+// for EQUAL. Without this the two may compute positions that differ in the last bit.
+invariant gl_Position;
+
+vec3 DecodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void main() {
+    vec4 transform = u_Draw.Transforms.Transforms[gl_InstanceIndex];
+    gl_Position = u_Draw.Frame.ViewProjection * vec4(inPosition.xyz * transform.w + transform.xyz, 1.0);
+    outNormal = DecodeOctahedral(inNormal);
+    outUv = inUv;
+}
\ No newline at end of file
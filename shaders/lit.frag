@@ -0,0 +1,28 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "bindless.glsl"
+#include "scene.glsl"
+
+// Texture is a TextureHandle, turned into a slot through the frame's table.
+BINDLESS_BUFFER(readonly, Material, { vec4 Color; uint Texture; uint Sampler; });
+
+layout(location = 0) in vec3 inNormal;
+layout(location = 1) in vec2 inUv;
+
+layout(location = 0) out vec4 outColor;
+
+// Fixed light from above, with some ambient so the shadowed sides stay readable.
+const vec3 LIGHT_DIRECTION = normalize(vec3(0.4, 1.0, 0.3));
+
+void main() {
+    uint material = u_Draw.MaterialIndex;
+    uint slot = u_Draw.Frame.Textures.Slots[u_Material[material].Texture];
+
+    // Untextured until the mip tail has streamed in.
+    vec4 albedo = slot != 0xFFFFFFFFu ? SampleTexture(slot, u_Material[material].Sampler, inUv) : vec4(1.0);
+
+    float diffuse = max(dot(normalize(inNormal), LIGHT_DIRECTION), 0.0);
+    outColor = albedo * u_Material[material].Color * u_Draw.Frame.Tint;
+    outColor.rgb *= 0.25 + 0.75 * diffuse;
+}
\ No newline at end of file
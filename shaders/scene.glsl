@@ -0,0 +1,18 @@
+// Per-frame and per-draw inputs shared by the scene shaders. Must match DrawConstants and FrameConstants
+// in main.cpp and frame_bench.cpp.
+
+// Bindless slot of every streamed texture this frame, indexed by TextureHandle (see texture.hpp).
+FRAME_DATA(TextureSlots, { uint Slots[]; });
+
+FRAME_DATA(FrameConstants, { mat4 ViewProjection; vec4 Tint; TextureSlots Textures; });
+
+// World position and uniform scale of every instance, indexed by gl_InstanceIndex. For packed meshes these
+// place the mesh's bounding sphere: the centre, and the scale times the radius.
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer TransformArray { vec4 Transforms[]; };
+
+layout(push_constant) uniform DrawConstants {
+    uint MaterialIndex;
+    uint Padding;
+    FrameConstants Frame;
+    TransformArray Transforms; // Unused by unbatched draws
+} u_Draw;
\ No newline at end of file
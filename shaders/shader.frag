@@ -1,7 +1,13 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "bindless.glsl"
+#include "scene.glsl"
+
+BINDLESS_BUFFER(readonly, Material, { vec4 Color; });
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(1.0, 0.0, 0.0, 1.0);
+    outColor = u_Material[u_Draw.MaterialIndex].Color * u_Draw.Frame.Tint;
 }
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include "animation.hpp"
+#include "simd.hpp"
+
+#define THISFILE "animation.cpp"
+
+static uint32_t s_PaddedBoneCount(uint32_t bone_count)
+{
+	return (bone_count + 3) & ~3u;
+}
+
+// Interpolate a to b by t, four bones at a time up to bone_count (rounded up, the padding is harmless).
+static void s_Interpolate(Pose const& a, Pose const& b, Float4 t, uint32_t bone_count, Pose& out)
+{
+	static constexpr PoseChannel s_LINEAR_CHANNELS[] = { POSE_TRANSLATION_X, POSE_TRANSLATION_Y, POSE_TRANSLATION_Z, POSE_SCALE };
+
+	uint32_t padded = s_PaddedBoneCount(bone_count);
+
+	for (PoseChannel channel : s_LINEAR_CHANNELS)
+	{
+		float const* pa = a.GetChannel(channel);
+		float const* pb = b.GetChannel(channel);
+		float* po = out.GetChannel(channel);
+		for (uint32_t i = 0; i < padded; i += 4)
+		{
+			Float4 va = Load4(pa + i);
+			Store4(po + i, va + (Load4(pb + i) - va) * t);
+		}
+	}
+
+	float const* ax = a.GetChannel(POSE_ROTATION_X), * ay = a.GetChannel(POSE_ROTATION_Y);
+	float const* az = a.GetChannel(POSE_ROTATION_Z), * aw = a.GetChannel(POSE_ROTATION_W);
+	float const* bx = b.GetChannel(POSE_ROTATION_X), * by = b.GetChannel(POSE_ROTATION_Y);
+	float const* bz = b.GetChannel(POSE_ROTATION_Z), * bw = b.GetChannel(POSE_ROTATION_W);
+	float* ox = out.GetChannel(POSE_ROTATION_X), * oy = out.GetChannel(POSE_ROTATION_Y);
+	float* oz = out.GetChannel(POSE_ROTATION_Z), * ow = out.GetChannel(POSE_ROTATION_W);
+
+	for (uint32_t i = 0; i < padded; i += 4)
+	{
+		Float4 qax = Load4(ax + i), qay = Load4(ay + i), qaz = Load4(az + i), qaw = Load4(aw + i);
+		Float4 qbx = Load4(bx + i), qby = Load4(by + i), qbz = Load4(bz + i), qbw = Load4(bw + i);
+
+		// q and -q are the same rotation, take the one on a's side of the sphere to go the short way round.
+		Float4 dot = qax * qbx + qay * qby + qaz * qbz + qaw * qbw;
+		qbx = FlipSign4(qbx, dot);
+		qby = FlipSign4(qby, dot);
+		qbz = FlipSign4(qbz, dot);
+		qbw = FlipSign4(qbw, dot);
+
+		Float4 x = qax + (qbx - qax) * t, y = qay + (qby - qay) * t;
+		Float4 z = qaz + (qbz - qaz) * t, w = qaw + (qbw - qaw) * t;
+		Float4 scale = InverseSqrt4(x * x + y * y + z * z + w * w);
+
+		Store4(ox + i, x * scale);
+		Store4(oy + i, y * scale);
+		Store4(oz + i, z * scale);
+		Store4(ow + i, w * scale);
+	}
+}
+
+// out = a * b for affine row-major 3x4 matrices (an implied last row of 0 0 0 1). out may be a or b.
+static inline void s_MultiplyAffine(float const* a, float const* b, float* out)
+{
+	Float4 b0 = Load4(b), b1 = Load4(b + 4), b2 = Load4(b + 8);
+	Float4 rows[3];
+	float translation[3];
+	for (int i = 0; i < 3; i++)
+	{
+		float const* row = a + i * 4;
+		rows[i] = Splat4(row[0]) * b0 + Splat4(row[1]) * b1 + Splat4(row[2]) * b2;
+		translation[i] = row[3];
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		Store4(out + i * 4, rows[i]);
+		out[i * 4 + 3] += translation[i];
+	}
+}
+
+// General inverse of an affine row-major 3x4 matrix, out must not be m.
+static void s_InvertAffine(float const* m, float* out)
+{
+	float a = m[0], b = m[1], c = m[2];
+	float d = m[4], e = m[5], f = m[6];
+	float g = m[8], h = m[9], i = m[10];
+
+	float c00 = e * i - f * h, c01 = c * h - b * i, c02 = b * f - c * e;
+	float c10 = f * g - d * i, c11 = a * i - c * g, c12 = c * d - a * f;
+	float c20 = d * h - e * g, c21 = b * g - a * h, c22 = a * e - b * d;
+
+	float determinant = a * c00 + b * c10 + c * c20;
+	VALIDATE(std::abs(determinant) > 1e-12f); // Degenerate bind pose.
+	float s = 1.0f / determinant;
+
+	float r[9] = { c00 * s, c01 * s, c02 * s, c10 * s, c11 * s, c12 * s, c20 * s, c21 * s, c22 * s };
+	for (int row = 0; row < 3; row++)
+	{
+		out[row * 4 + 0] = r[row * 3 + 0];
+		out[row * 4 + 1] = r[row * 3 + 1];
+		out[row * 4 + 2] = r[row * 3 + 2];
+		out[row * 4 + 3] = -(r[row * 3 + 0] * m[3] + r[row * 3 + 1] * m[7] + r[row * 3 + 2] * m[11]);
+	}
+}
+
+// Model-space matrices of the first bone_count bones into matrices, 12 floats each.
+static void s_ComputeModelMatrices(Skeleton const& skeleton, Pose const& pose, uint32_t bone_count, float* matrices)
+{
+	float const* tx = pose.GetChannel(POSE_TRANSLATION_X), * ty = pose.GetChannel(POSE_TRANSLATION_Y);
+	float const* tz = pose.GetChannel(POSE_TRANSLATION_Z), * sc = pose.GetChannel(POSE_SCALE);
+	float const* qx = pose.GetChannel(POSE_ROTATION_X), * qy = pose.GetChannel(POSE_ROTATION_Y);
+	float const* qz = pose.GetChannel(POSE_ROTATION_Z), * qw = pose.GetChannel(POSE_ROTATION_W);
+
+	Float4 one = Splat4(1.0f), two = Splat4(2.0f);
+
+	// Local matrices, four bones at a time, then scattered to each bone's 12 floats.
+	for (uint32_t i = 0; i < bone_count; i += 4)
+	{
+		Float4 x = Load4(qx + i), y = Load4(qy + i), z = Load4(qz + i), w = Load4(qw + i);
+		Float4 s = Load4(sc + i);
+
+		Float4 xx = x * x, yy = y * y, zz = z * z;
+		Float4 xy = x * y, xz = x * z, yz = y * z;
+		Float4 wx = w * x, wy = w * y, wz = w * z;
+		Float4 s2 = s * two;
+
+		alignas(16) float lanes[12][4];
+		Store4(lanes[0], s * (one - two * (yy + zz)));
+		Store4(lanes[1], s2 * (xy - wz));
+		Store4(lanes[2], s2 * (xz + wy));
+		Store4(lanes[3], Load4(tx + i));
+		Store4(lanes[4], s2 * (xy + wz));
+		Store4(lanes[5], s * (one - two * (xx + zz)));
+		Store4(lanes[6], s2 * (yz - wx));
+		Store4(lanes[7], Load4(ty + i));
+		Store4(lanes[8], s2 * (xz - wy));
+		Store4(lanes[9], s2 * (yz + wx));
+		Store4(lanes[10], s * (one - two * (xx + yy)));
+		Store4(lanes[11], Load4(tz + i));
+
+		uint32_t count = std::min(4u, bone_count - i);
+		for (uint32_t lane = 0; lane < count; lane++)
+			for (int j = 0; j < 12; j++)
+				matrices[(i + lane) * 12 + j] = lanes[j][lane];
+	}
+
+	// Parents come first, so theirs are already in model space.
+	for (uint32_t i = 0; i < bone_count; i++)
+	{
+		int32_t parent = skeleton.Parents[i];
+		if (parent >= 0)
+			s_MultiplyAffine(matrices + parent * 12, matrices + i * 12, matrices + i * 12);
+	}
+}
+
+Pose::Pose(uint32_t bone_count)
+	: m_bone_count(0), m_stride(0)
+{
+	Resize(bone_count);
+}
+
+void Pose::Resize(uint32_t bone_count)
+{
+	m_bone_count = bone_count;
+	m_stride = s_PaddedBoneCount(bone_count);
+	m_data.assign(size_t(POSE_CHANNEL_COUNT) * m_stride, 0.0f);
+	std::fill_n(GetChannel(POSE_ROTATION_W), m_stride, 1.0f);
+	std::fill_n(GetChannel(POSE_SCALE), m_stride, 1.0f);
+}
+
+void Pose::SetBone(uint32_t bone, float const translation[3], float const rotation[4], float scale)
+{
+	ASSERT(bone < m_bone_count);
+	for (int i = 0; i < 3; i++)
+		GetChannel(static_cast<PoseChannel>(POSE_TRANSLATION_X + i))[bone] = translation[i];
+	for (int i = 0; i < 4; i++)
+		GetChannel(static_cast<PoseChannel>(POSE_ROTATION_X + i))[bone] = rotation[i];
+	GetChannel(POSE_SCALE)[bone] = scale;
+}
+
+AnimationClip::AnimationClip(uint32_t bone_count, uint32_t key_count, float sample_rate)
+	: m_sample_rate(sample_rate), m_key_poses(key_count, Pose(bone_count))
+{
+	VALIDATE(key_count >= 2 && sample_rate > 0.0f);
+}
+
+void AnimationClip::Sample(float time, uint32_t bone_count, Pose& out) const
+{
+	ASSERT(bone_count <= GetBoneCount() && bone_count <= out.GetBoneCount());
+
+	float duration = GetDuration();
+	time = std::fmod(time, duration);
+	if (time < 0.0f)
+		time += duration;
+
+	float frame = time * m_sample_rate;
+	uint32_t key = std::min(static_cast<uint32_t>(frame), GetKeyCount() - 2);
+	s_Interpolate(m_key_poses[key], m_key_poses[key + 1], Splat4(frame - key), bone_count, out);
+}
+
+void BlendPoses(Pose const& a, Pose const& b, float weight, uint32_t bone_count, Pose& out)
+{
+	ASSERT(bone_count <= a.GetBoneCount() && bone_count <= b.GetBoneCount() && bone_count <= out.GetBoneCount());
+	s_Interpolate(a, b, Splat4(weight), bone_count, out);
+}
+
+void SetBindPose(Skeleton& skeleton, Pose const& bind_pose)
+{
+	uint32_t bone_count = skeleton.GetBoneCount();
+	VALIDATE(bind_pose.GetBoneCount() == bone_count);
+
+	std::vector<float> model(size_t(bone_count) * 12);
+	s_ComputeModelMatrices(skeleton, bind_pose, bone_count, model.data());
+
+	skeleton.InverseBind.resize(model.size());
+	for (uint32_t i = 0; i < bone_count; i++)
+		s_InvertAffine(model.data() + i * 12, skeleton.InverseBind.data() + i * 12);
+}
+
+void ComputeSkinningPalette(Skeleton const& skeleton, Pose const& pose, uint32_t bone_count, float* palette)
+{
+	uint32_t total = skeleton.GetBoneCount();
+	ASSERT(bone_count && bone_count <= total && bone_count <= pose.GetBoneCount());
+	ASSERT(skeleton.InverseBind.size() == size_t(total) * 12);
+
+	// The palette holds model matrices first, so children can build on their parents in place.
+	s_ComputeModelMatrices(skeleton, pose, bone_count, palette);
+	for (uint32_t i = 0; i < bone_count; i++)
+		s_MultiplyAffine(palette + i * 12, skeleton.InverseBind.data() + i * 12, palette + i * 12);
+
+	// Bones past the LOD keep their bind pose relative to their parents, which makes their skinning matrix the
+	// same as their parent's (the identity for roots).
+	static constexpr float s_IDENTITY[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+	for (uint32_t i = bone_count; i < total; i++)
+	{
+		int32_t parent = skeleton.Parents[i];
+		std::copy_n(parent >= 0 ? palette + parent * 12 : s_IDENTITY, 12, palette + i * 12);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "asset_pack.hpp"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define THISFILE "asset_pack.cpp"
+
+AssetPack::AssetPack(std::string const& filepath)
+	: m_data(nullptr), m_size(0), m_header(nullptr), m_table(nullptr)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr)
+#endif
+{
+	// The destructor does not run for a constructor that throws, so whatever is open by then is released here.
+	try
+	{
+		Open(filepath);
+		Validate();
+	}
+	catch (...)
+	{
+		Release();
+		throw;
+	}
+}
+
+AssetPack::~AssetPack()
+{
+	Release();
+}
+
+void AssetPack::Open(std::string const& filepath)
+{
+#ifdef _WIN32
+
+	m_file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	VALIDATE(m_file != INVALID_HANDLE_VALUE);
+
+	LARGE_INTEGER size;
+	VALIDATE(GetFileSizeEx(m_file, &size));
+	m_size = static_cast<size_t>(size.QuadPart);
+	VALIDATE(m_size >= sizeof(AssetPackHeader));
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	VALIDATE(m_mapping);
+	m_data = static_cast<char const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	VALIDATE(m_data);
+
+#else
+
+	int file = open(filepath.c_str(), O_RDONLY);
+	VALIDATE(file >= 0);
+
+	// The mapping keeps the file alive on its own, so the descriptor is closed before anything can throw.
+	struct stat info;
+	void* data = MAP_FAILED;
+	if (fstat(file, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(AssetPackHeader))
+		data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	VALIDATE(data != MAP_FAILED);
+	m_data = static_cast<char const*>(data);
+	m_size = static_cast<size_t>(info.st_size);
+
+#endif
+}
+
+void AssetPack::Validate()
+{
+	// Mappings are page aligned, so entry alignment within the file carries over to memory.
+	m_header = reinterpret_cast<AssetPackHeader const*>(m_data);
+	m_table = reinterpret_cast<AssetPackEntry const*>(m_data + sizeof(AssetPackHeader));
+
+	// A stale or truncated pack would hand garbage to the driver, check the layout once here instead.
+	VALIDATE(m_header->Magic == ASSET_PACK_MAGIC && m_header->Version == ASSET_PACK_VERSION);
+	VALIDATE(m_header->FileSize == m_size);
+	VALIDATE(m_header->TableSize && (m_header->TableSize & (m_header->TableSize - 1)) == 0);
+	VALIDATE(sizeof(AssetPackHeader) + uint64_t(m_header->TableSize) * sizeof(AssetPackEntry) <= m_header->NamesOffset && m_header->NamesOffset <= m_size);
+
+	uint32_t used = 0;
+	for (uint32_t i = 0; i < m_header->TableSize; i++)
+	{
+		AssetPackEntry const& entry = m_table[i];
+		if (!entry.Hash)
+			continue;
+		used++;
+
+		VALIDATE(entry.Offset % AssetAlignment(entry.Type) == 0 && entry.Offset <= m_size && entry.Size <= m_size - entry.Offset);
+
+		// Find compares names in place, so each must end inside the file.
+		VALIDATE(entry.NameOffset < m_size - m_header->NamesOffset);
+		char const* name = m_data + m_header->NamesOffset + entry.NameOffset;
+		VALIDATE(std::memchr(name, '\0', m_data + m_size - name));
+	}
+
+	// Find stops at the first empty slot, and would never stop in a full table.
+	VALIDATE(used == m_header->EntryCount && used < m_header->TableSize);
+}
+
+void AssetPack::Release()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+#else
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
+
+AssetView AssetPack::Find(std::string_view name) const
+{
+	uint64_t hash = AssetNameHash(name);
+	uint32_t mask = m_header->TableSize - 1;
+
+	// Linear probing, the constructor checked that an empty slot always ends the search.
+	for (uint32_t slot = static_cast<uint32_t>(hash) & mask;; slot = (slot + 1) & mask)
+	{
+		AssetPackEntry const& entry = m_table[slot];
+		if (!entry.Hash)
+			return { nullptr, 0, ASSET_RAW };
+
+		if (entry.Hash == hash && name == std::string_view(m_data + m_header->NamesOffset + entry.NameOffset))
+			return { m_data + entry.Offset, static_cast<size_t>(entry.Size), entry.Type };
+	}
+}
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "bindless.hpp"
+#include "vulkan.hpp"
+#include "frame.hpp"
+
+#define THISFILE "bindless.cpp"
+
+static constexpr VkDescriptorType s_DESCRIPTOR_TYPES[BINDLESS_TYPE_COUNT] = {
+	VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+	VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+	VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+	VK_DESCRIPTOR_TYPE_SAMPLER,
+};
+
+BindlessHeap::BindlessHeap(GraphicsDevice const& device, uint32_t max_textures, uint32_t max_storage_images, uint32_t max_buffers, uint32_t max_samplers)
+	: m_device(device.GetLogical()), m_next{}
+{
+	VkPhysicalDeviceVulkan12Properties props_12{};
+	props_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 props{};
+	props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	props.pNext = &props_12;
+	vkGetPhysicalDeviceProperties2(device.GetPhysical(), &props);
+
+	// Leave some room below the per-set limits for the odd regular descriptor set.
+	m_capacity[BINDLESS_TEXTURE] = std::min(max_textures, props_12.maxDescriptorSetUpdateAfterBindSampledImages / 2);
+	m_capacity[BINDLESS_STORAGE_IMAGE] = std::min(max_storage_images, props_12.maxDescriptorSetUpdateAfterBindStorageImages / 2);
+	m_capacity[BINDLESS_BUFFER] = std::min(max_buffers, props_12.maxDescriptorSetUpdateAfterBindStorageBuffers / 2);
+	m_capacity[BINDLESS_SAMPLER] = std::min(max_samplers, props_12.maxDescriptorSetUpdateAfterBindSamplers / 2);
+
+	std::array<VkDescriptorSetLayoutBinding, BINDLESS_TYPE_COUNT> bindings{};
+	std::array<VkDescriptorBindingFlags, BINDLESS_TYPE_COUNT> binding_flags{};
+	std::array<VkDescriptorPoolSize, BINDLESS_TYPE_COUNT> pool_sizes{};
+
+	for (uint32_t i = 0; i < BINDLESS_TYPE_COUNT; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = s_DESCRIPTOR_TYPES[i];
+		bindings[i].descriptorCount = m_capacity[i];
+		bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+
+		// Slots may be written while the set is bound and in use, as long as no pending draw reads them,
+		// and slots never written are fine as long as no shader reads them.
+		binding_flags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+			| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+		pool_sizes[i] = { s_DESCRIPTOR_TYPES[i], m_capacity[i] };
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+	flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flags_info.bindingCount = BINDLESS_TYPE_COUNT;
+	flags_info.pBindingFlags = binding_flags.data();
+
+	VkDescriptorSetLayoutCreateInfo layout_info{};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.pNext = &flags_info;
+	layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layout_info.bindingCount = BINDLESS_TYPE_COUNT;
+	layout_info.pBindings = bindings.data();
+	VALIDATE(vkCreateDescriptorSetLayout(m_device, &layout_info, nullptr, &m_layout) == VK_SUCCESS);
+
+	VkDescriptorPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	pool_info.maxSets = 1;
+	pool_info.poolSizeCount = BINDLESS_TYPE_COUNT;
+	pool_info.pPoolSizes = pool_sizes.data();
+	VALIDATE(vkCreateDescriptorPool(m_device, &pool_info, nullptr, &m_pool) == VK_SUCCESS);
+
+	VkDescriptorSetAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = m_pool;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = &m_layout;
+	VALIDATE(vkAllocateDescriptorSets(m_device, &alloc_info, &m_set) == VK_SUCCESS);
+}
+
+BindlessHeap::~BindlessHeap()
+{
+	// Destroying the pool frees the set.
+	vkDestroyDescriptorPool(m_device, m_pool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_layout, nullptr);
+}
+
+uint32_t BindlessHeap::AddTexture(VkImageView view, VkImageLayout layout)
+{
+	VkDescriptorImageInfo info{ VK_NULL_HANDLE, view, layout };
+	uint32_t index = AllocateSlot(BINDLESS_TEXTURE);
+	Write(BINDLESS_TEXTURE, index, &info, nullptr);
+	return index;
+}
+
+uint32_t BindlessHeap::AddStorageImage(VkImageView view)
+{
+	VkDescriptorImageInfo info{ VK_NULL_HANDLE, view, VK_IMAGE_LAYOUT_GENERAL };
+	uint32_t index = AllocateSlot(BINDLESS_STORAGE_IMAGE);
+	Write(BINDLESS_STORAGE_IMAGE, index, &info, nullptr);
+	return index;
+}
+
+uint32_t BindlessHeap::AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	VkDescriptorBufferInfo info{ buffer, offset, range };
+	uint32_t index = AllocateSlot(BINDLESS_BUFFER);
+	Write(BINDLESS_BUFFER, index, nullptr, &info);
+	return index;
+}
+
+uint32_t BindlessHeap::AddSampler(VkSampler sampler)
+{
+	VkDescriptorImageInfo info{ sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+	uint32_t index = AllocateSlot(BINDLESS_SAMPLER);
+	Write(BINDLESS_SAMPLER, index, &info, nullptr);
+	return index;
+}
+
+void BindlessHeap::Free(BindlessType type, uint32_t index, FrameScheduler& scheduler)
+{
+	{
+		// AllocateSlot grows m_next under the lock from other threads.
+		std::lock_guard lock(m_mutex);
+		ASSERT(index < m_next[type]);
+	}
+
+	// The descriptor stays as it is until the slot is reused, which partially bound arrays allow.
+	scheduler.Defer([this, type, index]() {
+		std::lock_guard lock(m_mutex);
+		m_free[type].push_back(index);
+	});
+}
+
+void BindlessHeap::Free(BindlessType type, uint32_t index)
+{
+	std::lock_guard lock(m_mutex);
+	ASSERT(index < m_next[type]);
+	m_free[type].push_back(index);
+}
+
+void BindlessHeap::Bind(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout layout) const
+{
+	vkCmdBindDescriptorSets(command_buffer, bind_point, layout, 0, 1, &m_set, 0, nullptr);
+}
+
+uint32_t BindlessHeap::AllocateSlot(BindlessType type)
+{
+	std::lock_guard lock(m_mutex);
+
+	// Recently freed slots first, so indices stay dense and the driver touches fewer descriptor pages.
+	if (!m_free[type].empty())
+	{
+		uint32_t index = m_free[type].back();
+		m_free[type].pop_back();
+		return index;
+	}
+
+	VALIDATE(m_next[type] < m_capacity[type]); // Heap exhausted, raise its capacity.
+	return m_next[type]++;
+}
+
+void BindlessHeap::Write(BindlessType type, uint32_t index, VkDescriptorImageInfo const* image, VkDescriptorBufferInfo const* buffer)
+{
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_set;
+	write.dstBinding = type;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = s_DESCRIPTOR_TYPES[type];
+	write.pImageInfo = image;
+	write.pBufferInfo = buffer;
+
+	std::lock_guard lock(m_mutex);
+	vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
\ No newline at end of file
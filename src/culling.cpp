@@ -0,0 +1,149 @@
+#include "culling.hpp"
+#include "vulkan.hpp"
+#include "render.hpp"
+#include "memory.hpp"
+#include "frame_ring.hpp"
+#include "bindless.hpp"
+#include "hiz.hpp"
+#include "sync.hpp"
+#include "profiler.hpp"
+#include <cmath>
+
+#define THISFILE "culling.cpp"
+
+// Must match local_size_x in cull.comp.
+static constexpr uint32_t s_GROUP_SIZE = 64;
+
+// Counters at the start of each slot, in the order of cull.comp's DrawCount block.
+static constexpr VkDeviceSize s_COUNTERS_SIZE = 4 * sizeof(uint32_t);
+
+// Push constants of cull.comp.
+struct CullConstants
+{
+	VkDeviceAddress View;
+	VkDeviceAddress Instances;
+	VkDeviceAddress Meshes;
+	VkDeviceAddress Commands;
+	VkDeviceAddress Count;
+	uint32_t InstanceCount;
+	uint32_t Padding;
+};
+
+void ExtractFrustumPlanes(float const view_projection[16], float planes[6][4])
+{
+	// Row i of the matrix, clip = M * v.
+	auto row = [view_projection](int i, int j) { return view_projection[j * 4 + i]; };
+
+	// Gribb-Hartmann: left, right, bottom, top, near (z >= 0), far (z <= w).
+	for (int j = 0; j < 4; j++)
+	{
+		planes[0][j] = row(3, j) + row(0, j);
+		planes[1][j] = row(3, j) - row(0, j);
+		planes[2][j] = row(3, j) + row(1, j);
+		planes[3][j] = row(3, j) - row(1, j);
+		planes[4][j] = row(2, j);
+		planes[5][j] = row(3, j) - row(2, j);
+	}
+
+	// Normalized so the plane distance compares directly against sphere radii.
+	for (int i = 0; i < 6; i++)
+	{
+		float length = std::sqrt(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		for (int j = 0; j < 4; j++)
+			planes[i][j] /= length;
+	}
+}
+
+GpuCuller::GpuCuller(GraphicsDevice const& device, AssetPack const& pack, uint32_t frames_in_flight, uint32_t max_instances)
+	: m_device(&device), m_max_instances(max_instances), m_slot_frames(frames_in_flight, UINT64_MAX), m_stats{}
+{
+	m_pipeline = new ComputePipeline(device, pack, "shaders/cull.comp.spv");
+
+	m_slot_size = s_COUNTERS_SIZE + sizeof(VkDrawIndexedIndirectCommand) * static_cast<VkDeviceSize>(max_instances);
+
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = m_slot_size * frames_in_flight;
+	create_info.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	m_buffer = device.GetAllocator()->CreateBuffer(create_info, GPU_ONLY_MEMORY, &m_allocation);
+	m_address = device.GetAllocator()->GetDeviceAddress(m_buffer);
+
+	create_info.size = s_COUNTERS_SIZE * frames_in_flight;
+	create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	m_readback = device.GetAllocator()->CreateBuffer(create_info, READBACK_MEMORY, &m_readback_allocation);
+	VALIDATE(m_readback_allocation->Mapped);
+}
+
+GpuCuller::~GpuCuller()
+{
+	m_device->GetAllocator()->DestroyBuffer(m_readback, m_readback_allocation);
+	m_device->GetAllocator()->DestroyBuffer(m_buffer, m_allocation);
+	delete m_pipeline;
+}
+
+void GpuCuller::Cull(VkCommandBuffer command_buffer, uint32_t slot, uint64_t frame_index, FrameRing& ring, CullView const& view,
+	VkDeviceAddress instances, VkDeviceAddress meshes, uint32_t instance_count, HiZPyramid const* pyramid, float const* previous_view_projection)
+{
+	ASSERT(instance_count <= m_max_instances);
+	ASSERT(!pyramid || previous_view_projection);
+	PROFILE_GPU(command_buffer, "Cull instances");
+
+	VkDeviceSize slot_offset = m_slot_size * slot;
+
+	// The slot has retired, so the counters it copied out last time are final.
+	if (m_slot_frames[slot] != UINT64_MAX)
+	{
+		m_device->GetAllocator()->Invalidate(m_readback_allocation);
+		uint32_t const* counters = reinterpret_cast<uint32_t const*>(static_cast<char const*>(m_readback_allocation->Mapped) + s_COUNTERS_SIZE * slot);
+		m_stats = { m_slot_frames[slot], counters[0], counters[1], counters[2], counters[3] };
+	}
+	m_slot_frames[slot] = frame_index;
+
+	FrameSpan<CullView> view_data = ring.Allocate<CullView>();
+	*view_data.Data = view;
+	view_data.Data->PyramidTexture = BINDLESS_INVALID_INDEX;
+
+	if (pyramid && pyramid->IsValid())
+	{
+		std::copy_n(previous_view_projection, 16, view_data.Data->OcclusionViewProjection);
+		view_data.Data->PyramidSize[0] = static_cast<float>(pyramid->GetExtent().width);
+		view_data.Data->PyramidSize[1] = static_cast<float>(pyramid->GetExtent().height);
+		view_data.Data->PyramidTexture = pyramid->GetTextureIndex();
+		view_data.Data->PyramidSampler = pyramid->GetSamplerIndex();
+	}
+
+	// The slot's previous draws retired with its fence, only the reset has to land before the shader counts.
+	vkCmdFillBuffer(command_buffer, m_buffer, slot_offset, s_COUNTERS_SIZE, 0);
+	GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+	CullConstants constants{};
+	constants.View = view_data.Address;
+	constants.Instances = instances;
+	constants.Meshes = meshes;
+	constants.Count = m_address + slot_offset;
+	constants.Commands = m_address + slot_offset + s_COUNTERS_SIZE;
+	constants.InstanceCount = instance_count;
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetHandle());
+	m_device->GetBindlessHeap()->Bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetLayout());
+	PushConstants(command_buffer, m_pipeline->GetLayout(), constants);
+	vkCmdDispatch(command_buffer, (instance_count + s_GROUP_SIZE - 1) / s_GROUP_SIZE, 1, 1);
+
+	GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT);
+
+	VkBufferCopy copy{ slot_offset, s_COUNTERS_SIZE * slot, s_COUNTERS_SIZE };
+	vkCmdCopyBuffer(command_buffer, m_buffer, m_readback, 1, &copy);
+	GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+}
+
+void GpuCuller::Draw(VkCommandBuffer command_buffer, uint32_t slot) const
+{
+	VkDeviceSize slot_offset = m_slot_size * slot;
+	vkCmdDrawIndexedIndirectCount(command_buffer, m_buffer, slot_offset + s_COUNTERS_SIZE, m_buffer, slot_offset, m_max_instances,
+		sizeof(VkDrawIndexedIndirectCommand));
+}
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "ecs.hpp"
+#include "jobs.hpp"
+#include <mutex>
+#include <new>
+
+#define THISFILE "ecs.cpp"
+
+// Arrays start on 16 bytes at least, for aligned vector loads.
+static constexpr uint32_t s_MIN_ARRAY_ALIGNMENT = 16;
+
+static constexpr std::align_val_t s_CHUNK_ALIGNMENT{ 64 };
+
+struct ComponentInfo
+{
+	uint32_t Size;
+	uint32_t Alignment;
+};
+
+static std::mutex s_registry_mutex;
+static std::vector<ComponentInfo> s_registry;
+
+static uint32_t s_AlignUp(uint32_t value, uint32_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t RegisterComponent(uint32_t size, uint32_t alignment)
+{
+	std::lock_guard lock(s_registry_mutex);
+	VALIDATE(s_registry.size() < ECS_MAX_COMPONENTS); // Out of signature bits, widen ComponentMask.
+	s_registry.push_back({ size, alignment });
+	return static_cast<uint32_t>(s_registry.size() - 1);
+}
+
+World::World(JobSystem* jobs)
+	: m_jobs(jobs), m_entity_count(0), m_query_depth(0), m_version(0)
+{
+}
+
+World::~World()
+{
+	for (Archetype* archetype : m_archetypes)
+	{
+		for (Chunk& chunk : archetype->Chunks)
+			::operator delete(chunk.Data, s_CHUNK_ALIGNMENT);
+		delete archetype;
+	}
+}
+
+void World::Destroy(Entity entity)
+{
+	ASSERT(!m_query_depth && IsAlive(entity));
+
+	EntityRecord& record = m_records[entity.Index];
+	RemoveRow(*record.Owner, record.Chunk, record.Row);
+
+	record.Owner = nullptr;
+	record.Generation++;
+	m_free_indices.push_back(entity.Index);
+	m_entity_count--;
+}
+
+bool World::IsAlive(Entity entity) const
+{
+	return entity.Index < m_records.size() && m_records[entity.Index].Owner && m_records[entity.Index].Generation == entity.Generation;
+}
+
+Entity World::CreateEntity(ComponentMask mask, uint32_t component_count)
+{
+	ASSERT(!m_query_depth);
+	VALIDATE(static_cast<uint32_t>(std::popcount(mask)) == component_count); // A component type given twice
+
+	uint32_t index;
+	if (!m_free_indices.empty())
+	{
+		index = m_free_indices.back();
+		m_free_indices.pop_back();
+	}
+	else
+	{
+		index = static_cast<uint32_t>(m_records.size());
+		m_records.push_back({ nullptr, 0, 0, 0 });
+	}
+
+	Entity entity{ index, m_records[index].Generation };
+	PlaceEntity(entity, *GetArchetype(mask));
+	m_entity_count++;
+	return entity;
+}
+
+void* World::GetComponent(Entity entity, uint32_t id, bool write)
+{
+	ASSERT(IsAlive(entity));
+
+	EntityRecord const& record = m_records[entity.Index];
+	uint8_t column = record.Owner->Columns[id];
+	if (column == Archetype::ABSENT)
+		return nullptr;
+
+	Chunk& chunk = record.Owner->Chunks[record.Chunk];
+	if (write)
+		chunk.MarkWritten(column, m_version + 1);
+
+	return chunk.Data + record.Owner->Offsets[column] + record.Row * record.Owner->Sizes[column];
+}
+
+void World::MoveEntity(Entity entity, ComponentMask mask)
+{
+	ASSERT(!m_query_depth && IsAlive(entity));
+
+	EntityRecord& record = m_records[entity.Index];
+	Archetype& source = *record.Owner;
+	uint32_t source_chunk = record.Chunk, source_row = record.Row;
+
+	// May add an archetype, but never touches the source's chunks.
+	Archetype& target = *GetArchetype(mask);
+	PlaceEntity(entity, target);
+
+	// Components in both archetypes carry over, new ones are left for the caller to write.
+	char const* source_data = source.Chunks[source_chunk].Data;
+	char* target_data = target.Chunks[record.Chunk].Data;
+
+	for (uint32_t column = 0; column < source.Ids.size(); column++)
+	{
+		uint8_t target_column = target.Columns[source.Ids[column]];
+		if (target_column != Archetype::ABSENT)
+			std::memcpy(target_data + target.Offsets[target_column] + record.Row * target.Sizes[target_column],
+				source_data + source.Offsets[column] + source_row * source.Sizes[column], source.Sizes[column]);
+	}
+
+	RemoveRow(source, source_chunk, source_row);
+}
+
+Archetype* World::GetArchetype(ComponentMask mask)
+{
+	auto it = m_archetype_map.find(mask);
+	if (it != m_archetype_map.end())
+		return it->second;
+
+	Archetype* archetype = new Archetype{};
+	archetype->Mask = mask;
+	archetype->Columns.fill(Archetype::ABSENT);
+
+	uint32_t row_size = sizeof(Entity);
+	std::vector<uint32_t> alignments;
+
+	{
+		std::lock_guard lock(s_registry_mutex);
+		for (ComponentMask bits = mask; bits; bits &= bits - 1)
+		{
+			uint32_t id = std::countr_zero(bits);
+			archetype->Columns[id] = static_cast<uint8_t>(archetype->Ids.size());
+			archetype->Ids.push_back(id);
+			archetype->Sizes.push_back(s_registry[id].Size);
+			alignments.push_back(std::max(s_registry[id].Alignment, s_MIN_ARRAY_ALIGNMENT));
+			row_size += s_registry[id].Size;
+		}
+	}
+
+	// As many rows as fit once every array is aligned, which padding may cost a row or two.
+	archetype->Offsets.resize(archetype->Ids.size());
+	for (uint32_t capacity = ECS_CHUNK_SIZE / row_size;; capacity--)
+	{
+		VALIDATE(capacity > 0); // Components of the archetype do not fit a chunk together.
+
+		uint32_t offset = capacity * sizeof(Entity);
+		for (uint32_t column = 0; column < archetype->Ids.size(); column++)
+		{
+			offset = s_AlignUp(offset, alignments[column]);
+			archetype->Offsets[column] = offset;
+			offset += capacity * archetype->Sizes[column];
+		}
+
+		if (offset <= ECS_CHUNK_SIZE)
+		{
+			archetype->Capacity = capacity;
+			break;
+		}
+	}
+
+	m_archetypes.push_back(archetype);
+	m_archetype_map.emplace(mask, archetype);
+	return archetype;
+}
+
+void World::PlaceEntity(Entity entity, Archetype& archetype)
+{
+	if (archetype.Chunks.empty() || archetype.Chunks.back().Count == archetype.Capacity)
+	{
+		Chunk chunk;
+		chunk.Data = static_cast<char*>(::operator new(ECS_CHUNK_SIZE, s_CHUNK_ALIGNMENT));
+		chunk.Count = 0;
+		chunk.Versions.assign(archetype.Ids.size(), 0);
+		archetype.Chunks.push_back(std::move(chunk));
+	}
+
+	uint32_t chunk_index = static_cast<uint32_t>(archetype.Chunks.size() - 1);
+	Chunk& chunk = archetype.Chunks[chunk_index];
+	uint32_t row = chunk.Count++;
+
+	reinterpret_cast<Entity*>(chunk.Data)[row] = entity;
+	for (uint64_t& version : chunk.Versions)
+		version = m_version + 1;
+
+	EntityRecord& record = m_records[entity.Index];
+	record.Owner = &archetype;
+	record.Chunk = chunk_index;
+	record.Row = row;
+}
+
+void World::RemoveRow(Archetype& archetype, uint32_t chunk_index, uint32_t row)
+{
+	Chunk& last = archetype.Chunks.back();
+	uint32_t last_row = last.Count - 1;
+
+	// Fill the hole with the very last entity of the archetype, keeping every chunk but the last full.
+	if (&last != &archetype.Chunks[chunk_index] || row != last_row)
+	{
+		Chunk& chunk = archetype.Chunks[chunk_index];
+		Entity moved = reinterpret_cast<Entity*>(last.Data)[last_row];
+		reinterpret_cast<Entity*>(chunk.Data)[row] = moved;
+
+		for (uint32_t column = 0; column < archetype.Ids.size(); column++)
+		{
+			uint32_t size = archetype.Sizes[column];
+			std::memcpy(chunk.Data + archetype.Offsets[column] + row * size, last.Data + archetype.Offsets[column] + last_row * size, size);
+			chunk.Versions[column] = m_version + 1;
+		}
+
+		m_records[moved.Index].Chunk = chunk_index;
+		m_records[moved.Index].Row = row;
+	}
+
+	if (--last.Count == 0)
+	{
+		::operator delete(last.Data, s_CHUNK_ALIGNMENT);
+		archetype.Chunks.pop_back();
+	}
+}
+
+void World::ParallelFor(uint32_t count, std::function<void(uint32_t)> const& body)
+{
+	if (!m_jobs)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			body(i);
+		return;
+	}
+
+	m_jobs->ParallelFor(count, 0, [&body](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+			body(i);
+	});
+}
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include "frame.hpp"
+#include "vulkan.hpp"
+#include "window.hpp"
+#include "render.hpp"
+#include "profiler.hpp"
+#include <thread>
+
+#define THISFILE "frame.cpp"
+
+using FrameClock = std::chrono::steady_clock;
+
+static double s_MillisecondsSince(FrameClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(FrameClock::now() - start).count();
+}
+
+FrameScheduler::FrameScheduler(GraphicsDevice const& device, Swapchain const& swapchain, uint32_t frames_in_flight)
+	: m_device(&device), m_swapchain(&swapchain), m_slot_index(0), m_image_index(0), m_frame_index(0), m_out_of_date(false), m_last_gpu_end(0), m_stats{}, m_paced(false)
+{
+	ASSERT(frames_in_flight > 0);
+	ASSERT(!swapchain.IsHeadless() || frames_in_flight <= swapchain.GetImageCount()); // Headless images are reused round-robin.
+
+	auto ld = device.GetLogical();
+	auto gq = device.GetGraphicsQueue();
+
+	// Timestamps are only meaningful if the graphics family writes them.
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(device.GetPhysical(), &props);
+	m_timestamp_period = props.limits.timestampPeriod;
+
+	uint32_t qf_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device.GetPhysical(), &qf_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(qf_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(device.GetPhysical(), &qf_count, families.data());
+
+	uint32_t valid_bits = families[gq.FamilyIndex].timestampValidBits;
+	m_timestamp_mask = valid_bits >= 64 ? ~0ull : valid_bits ? (1ull << valid_bits) - 1 : 0;
+
+	m_slots.resize(frames_in_flight);
+
+	for (FrameSlot& slot : m_slots)
+	{
+		slot.Pool = new CommandPool(device, gq.FamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		slot.CommandBuffer = slot.Pool->Allocate();
+		slot.Submitted = false;
+
+		VkSemaphoreCreateInfo sci{};
+		sci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		VALIDATE(vkCreateSemaphore(ld, &sci, nullptr, &slot.ImageAcquired) == VK_SUCCESS);
+		VALIDATE(vkCreateSemaphore(ld, &sci, nullptr, &slot.RenderFinished) == VK_SUCCESS);
+
+		// Created signaled so the first wait on every slot returns immediately.
+		VkFenceCreateInfo fci{};
+		fci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fci.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		VALIDATE(vkCreateFence(ld, &fci, nullptr, &slot.InFlight) == VK_SUCCESS);
+
+		slot.Timestamps = VK_NULL_HANDLE;
+		if (m_timestamp_mask)
+		{
+			VkQueryPoolCreateInfo qci{};
+			qci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			qci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			qci.queryCount = 2;
+			VALIDATE(vkCreateQueryPool(ld, &qci, nullptr, &slot.Timestamps) == VK_SUCCESS);
+		}
+	}
+}
+
+FrameScheduler::~FrameScheduler()
+{
+	auto ld = m_device->GetLogical();
+
+	// Nothing may be destroyed while the GPU still references it.
+	vkDeviceWaitIdle(ld);
+	RunDeferred(true);
+
+	for (FrameSlot& slot : m_slots)
+	{
+		if (slot.Timestamps)
+			vkDestroyQueryPool(ld, slot.Timestamps, nullptr);
+		vkDestroyFence(ld, slot.InFlight, nullptr);
+		vkDestroySemaphore(ld, slot.RenderFinished, nullptr);
+		vkDestroySemaphore(ld, slot.ImageAcquired, nullptr);
+		delete slot.Pool;
+	}
+}
+
+// Sleeping is only accurate to a millisecond or so, the rest of the wait yields instead.
+static constexpr std::chrono::microseconds s_SPIN_THRESHOLD(1500);
+
+// Upper bound on waiting for a present, so a hidden or occluded window cannot hang the frame loop.
+static constexpr uint64_t s_PRESENT_WAIT_TIMEOUT = 100'000'000;
+
+void FrameScheduler::Pace()
+{
+	if (m_paced)
+		return;
+	m_paced = true;
+
+	PROFILE_CPU("Pace");
+
+	PresentPolicy const& policy = m_swapchain->GetPresentPolicy();
+
+	// Wait for the previous frame to be shown before starting the next; the limiter then only kicks in
+	// if the target rate is below the refresh rate.
+	bool wait_present = policy.WaitForPresent && m_device->SupportsPresentWait() && !m_swapchain->IsHeadless();
+	PollPresents(wait_present ? m_frame_index : 0);
+
+	if (policy.TargetFps > 0.0)
+	{
+		auto period = std::chrono::duration_cast<FrameClock::duration>(std::chrono::duration<double>(1.0 / policy.TargetFps));
+		auto now = FrameClock::now();
+
+		// After a long stall, start over rather than rushing through frames to catch up.
+		if (now > m_next_deadline + period)
+			m_next_deadline = now;
+
+		if (m_next_deadline - now > s_SPIN_THRESHOLD)
+			std::this_thread::sleep_until(m_next_deadline - s_SPIN_THRESHOLD);
+		while (FrameClock::now() < m_next_deadline)
+			std::this_thread::yield();
+
+		m_next_deadline += period;
+	}
+
+	m_frame_start = FrameClock::now();
+}
+
+VkCommandBuffer FrameScheduler::BeginFrame()
+{
+	auto ld = m_device->GetLogical();
+	FrameSlot& slot = m_slots[m_slot_index];
+
+	Pace();
+
+	PROFILE_CPU("Begin frame");
+
+	auto wait_start = FrameClock::now();
+
+	// Block until the GPU is done with the frame that used this slot last time.
+	VALIDATE(vkWaitForFences(ld, 1, &slot.InFlight, VK_TRUE, UINT64_MAX) == VK_SUCCESS);
+
+	if (slot.Submitted)
+		ReadTimestamps(slot);
+
+	RunDeferred(false);
+
+	// Headless images are handed out round-robin, there is nothing to wait on.
+	if (m_swapchain->IsHeadless())
+		m_image_index = static_cast<uint32_t>(m_frame_index % m_swapchain->GetImageCount());
+	else
+	{
+		VkResult acquired = vkAcquireNextImageKHR(ld, m_swapchain->GetHandle(), UINT64_MAX, slot.ImageAcquired, VK_NULL_HANDLE, &m_image_index);
+
+		// Nothing was signaled, so the slot stays as it is (fence included) until the caller recreates the swapchain.
+		// The next attempt is paced again.
+		if (acquired == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			m_out_of_date = true;
+			m_paced = false;
+			return VK_NULL_HANDLE;
+		}
+
+		VALIDATE(acquired == VK_SUCCESS || acquired == VK_SUBOPTIMAL_KHR);
+		m_out_of_date |= acquired == VK_SUBOPTIMAL_KHR;
+	}
+
+	m_stats.FrameIndex = m_frame_index;
+	m_stats.CpuWaitMs = s_MillisecondsSince(wait_start);
+
+	// Only reset once the frame is certain to be submitted, an unsignaled fence would block the next BeginFrame forever.
+	VALIDATE(vkResetFences(ld, 1, &slot.InFlight) == VK_SUCCESS);
+	slot.Pool->Reset();
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VALIDATE(vkBeginCommandBuffer(slot.CommandBuffer, &begin_info) == VK_SUCCESS);
+
+	if (slot.Timestamps)
+	{
+		vkCmdResetQueryPool(slot.CommandBuffer, slot.Timestamps, 0, 2);
+		vkCmdWriteTimestamp(slot.CommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.Timestamps, 0);
+	}
+
+	return slot.CommandBuffer;
+}
+
+void FrameScheduler::EndFrame()
+{
+	FrameSlot& slot = m_slots[m_slot_index];
+
+	if (slot.Timestamps)
+		vkCmdWriteTimestamp(slot.CommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, slot.Timestamps, 1);
+
+	VALIDATE(vkEndCommandBuffer(slot.CommandBuffer) == VK_SUCCESS);
+
+	bool headless = m_swapchain->IsHeadless();
+
+	// Headless images are never acquired nor presented, the fence alone orders their reuse.
+	if (!headless)
+	{
+		VkSemaphoreSubmitInfo wait_info{};
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		wait_info.semaphore = slot.ImageAcquired;
+		wait_info.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+		m_extra_waits.push_back(wait_info);
+	}
+
+	VkSemaphoreSubmitInfo signal_info{};
+	signal_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+	signal_info.semaphore = slot.RenderFinished;
+	signal_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+	VkCommandBufferSubmitInfo command_info{};
+	command_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+	command_info.commandBuffer = slot.CommandBuffer;
+
+	VkSubmitInfo2 submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+	submit_info.waitSemaphoreInfoCount = static_cast<uint32_t>(m_extra_waits.size());
+	submit_info.pWaitSemaphoreInfos = m_extra_waits.data();
+	submit_info.commandBufferInfoCount = 1;
+	submit_info.pCommandBufferInfos = &command_info;
+	submit_info.signalSemaphoreInfoCount = headless ? 0 : 1;
+	submit_info.pSignalSemaphoreInfos = &signal_info;
+
+	VALIDATE(m_device->Submit(m_device->GetGraphicsQueue(), 1, &submit_info, slot.InFlight) == VK_SUCCESS);
+	m_extra_waits.clear();
+	slot.Submitted = true;
+
+	if (!headless)
+	{
+		VkSwapchainKHR swapchain = m_swapchain->GetHandle();
+
+		VkPresentInfoKHR present_info{};
+		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present_info.waitSemaphoreCount = 1;
+		present_info.pWaitSemaphores = &slot.RenderFinished;
+		present_info.swapchainCount = 1;
+		present_info.pSwapchains = &swapchain;
+		present_info.pImageIndices = &m_image_index;
+
+		uint64_t present_id = m_frame_index + 1;
+
+		VkPresentIdKHR present_id_info{};
+		present_id_info.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+		present_id_info.swapchainCount = 1;
+		present_id_info.pPresentIds = &present_id;
+
+		if (m_device->SupportsPresentWait())
+		{
+			present_info.pNext = &present_id_info;
+			m_pending_presents.push_back({ present_id, swapchain, m_frame_start });
+		}
+
+		VkResult presented = m_device->Present(present_info);
+		VALIDATE(presented == VK_SUCCESS || presented == VK_SUBOPTIMAL_KHR || presented == VK_ERROR_OUT_OF_DATE_KHR);
+		m_out_of_date |= presented != VK_SUCCESS;
+	}
+
+	m_slot_index = (m_slot_index + 1) % static_cast<uint32_t>(m_slots.size());
+	m_frame_index++;
+	m_paced = false;
+}
+
+void FrameScheduler::Defer(std::function<void()> destroy)
+{
+	m_deferred.emplace_back(m_frame_index, std::move(destroy));
+}
+
+bool FrameScheduler::ConsumeOutOfDate()
+{
+	bool out_of_date = m_out_of_date;
+	m_out_of_date = false;
+	return out_of_date;
+}
+
+void FrameScheduler::RunDeferred(bool all)
+{
+	// Called right after the current slot's fence, so the frame that used this slot last (m_frame_index minus the
+	// frames in flight) and everything before it have retired. An entry waits for the frames before its index.
+	uint64_t retired = m_frame_index + 1 >= m_slots.size() ? m_frame_index + 1 - m_slots.size() : 0;
+
+	size_t count = 0;
+	while (count < m_deferred.size() && (all || m_deferred[count].first <= retired))
+		m_deferred[count++].second();
+
+	m_deferred.erase(m_deferred.begin(), m_deferred.begin() + count);
+}
+
+void FrameScheduler::PollPresents(uint64_t wait_id)
+{
+	VkSwapchainKHR swapchain = m_swapchain->GetHandle();
+
+	while (!m_pending_presents.empty())
+	{
+		PendingPresent const& pending = m_pending_presents.front();
+
+		// Ids of a replaced swapchain may never complete, and it may already be destroyed.
+		if (pending.Swapchain != swapchain)
+		{
+			m_pending_presents.pop_front();
+			continue;
+		}
+
+		// Block only up to the requested id, everything after is merely polled.
+		uint64_t timeout = pending.Id <= wait_id ? s_PRESENT_WAIT_TIMEOUT : 0;
+		VkResult result = m_device->WaitForPresent(swapchain, pending.Id, timeout);
+
+		if (result == VK_TIMEOUT)
+			break;
+
+		// Out of date or surface lost, the swapchain is recreated soon and its ids dropped then.
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+			break;
+
+		m_stats.PresentLatencyMs = s_MillisecondsSince(pending.Start);
+		m_pending_presents.pop_front();
+	}
+}
+
+void FrameScheduler::ReadTimestamps(FrameSlot const& slot)
+{
+	if (!slot.Timestamps)
+		return;
+
+	uint64_t ticks[2];
+	VkResult result = vkGetQueryPoolResults(m_device->GetLogical(), slot.Timestamps, 0, 2, sizeof(ticks), ticks,
+		sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS)
+		return;
+
+	uint64_t begin = ticks[0] & m_timestamp_mask;
+	uint64_t end = ticks[1] & m_timestamp_mask;
+	double ms_per_tick = m_timestamp_period / 1e6;
+
+	// Frames retire in submission order on a single queue, so the gap to the previous end is GPU idle time.
+	m_stats.GpuWaitMs = m_last_gpu_end && begin > m_last_gpu_end ? (begin - m_last_gpu_end) * ms_per_tick : 0.0;
+	m_stats.GpuBusyMs = end > begin ? (end - begin) * ms_per_tick : 0.0;
+	m_last_gpu_end = end;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "frame_ring.hpp"
+#include "vulkan.hpp"
+#include "memory.hpp"
+
+#define THISFILE "frame_ring.cpp"
+
+FrameRing::FrameRing(GraphicsDevice const& device, uint32_t frames_in_flight, VkDeviceSize slot_size)
+	: m_allocator(device.GetAllocator()), m_slot_count(frames_in_flight), m_slot_begin(0), m_head(0)
+{
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(device.GetPhysical(), &props);
+
+	// Both limits are powers of two, so the larger one satisfies either use of an allocation.
+	m_alignment = std::max<VkDeviceSize>({ 16, props.limits.minUniformBufferOffsetAlignment, props.limits.minStorageBufferOffsetAlignment });
+	m_slot_size = (slot_size + m_alignment - 1) & ~(m_alignment - 1);
+
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = m_slot_size * m_slot_count;
+	create_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	// Device local where the platform has host visible VRAM, so shaders read it without crossing the bus.
+	m_buffer = m_allocator->CreateBuffer(create_info, DYNAMIC_MEMORY, &m_allocation);
+	VALIDATE(m_allocation->Mapped);
+	m_mapped = static_cast<char*>(m_allocation->Mapped);
+	m_address = m_allocator->GetDeviceAddress(m_buffer);
+}
+
+FrameRing::~FrameRing()
+{
+	m_allocator->DestroyBuffer(m_buffer, m_allocation);
+}
+
+void FrameRing::BeginFrame(uint32_t slot)
+{
+	ASSERT(slot < m_slot_count);
+	m_slot_begin = m_slot_size * slot;
+	m_head.store(m_slot_begin, std::memory_order_relaxed);
+}
+
+void FrameRing::Overflow(VkDeviceSize size) const
+{
+	throw std::runtime_error("Runtime Error: Frame ring slot of " + std::to_string(m_slot_size) + " bytes exhausted allocating "
+		+ std::to_string(size) + " bytes at " THISFILE ", raise its slot size.");
+}
\ No newline at end of file
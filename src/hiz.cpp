@@ -0,0 +1,173 @@
+#include "hiz.hpp"
+#include "vulkan.hpp"
+#include "render.hpp"
+#include "memory.hpp"
+#include "frame.hpp"
+#include "bindless.hpp"
+#include "sync.hpp"
+#include "profiler.hpp"
+#include <bit>
+
+#define THISFILE "hiz.cpp"
+
+// Must match local_size_x and local_size_y in hiz.comp.
+static constexpr uint32_t s_GROUP_SIZE = 8;
+
+// Push constants of hiz.comp.
+struct ReduceConstants
+{
+	uint32_t SourceTexture;
+	uint32_t Sampler;
+	float SourceLod;
+	uint32_t TargetImage;
+	uint32_t TargetSize[2];
+};
+
+HiZPyramid::HiZPyramid(GraphicsDevice const& device, AssetPack const& pack, VkExtent2D depth_extent)
+	: m_device(&device)
+{
+	m_pipeline = new ComputePipeline(device, pack, "shaders/hiz.comp.spv");
+
+	// Max reduction turns one bilinear tap into a conservative 2x2 downsample, and a conservative test later on.
+	VkSamplerReductionModeCreateInfo reduction{};
+	reduction.sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO;
+	reduction.reductionMode = VK_SAMPLER_REDUCTION_MODE_MAX;
+
+	VkSamplerCreateInfo sampler_info{};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.pNext = &reduction;
+	sampler_info.magFilter = VK_FILTER_LINEAR;
+	sampler_info.minFilter = VK_FILTER_LINEAR;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+	VALIDATE(vkCreateSampler(device.GetLogical(), &sampler_info, nullptr, &m_sampler) == VK_SUCCESS);
+	m_sampler_index = device.GetBindlessHeap()->AddSampler(m_sampler);
+
+	Create(depth_extent);
+}
+
+HiZPyramid::~HiZPyramid()
+{
+	VkDevice ld = m_device->GetLogical();
+	BindlessHeap* heap = m_device->GetBindlessHeap();
+
+	heap->Free(BINDLESS_TEXTURE, m_texture_index);
+	for (uint32_t index : m_mip_indices)
+		heap->Free(BINDLESS_STORAGE_IMAGE, index);
+	heap->Free(BINDLESS_SAMPLER, m_sampler_index);
+
+	for (VkImageView view : m_mip_views)
+		vkDestroyImageView(ld, view, nullptr);
+	vkDestroyImageView(ld, m_view, nullptr);
+	m_device->GetAllocator()->DestroyImage(m_image, m_allocation);
+	vkDestroySampler(ld, m_sampler, nullptr);
+	delete m_pipeline;
+}
+
+void HiZPyramid::Recreate(VkExtent2D depth_extent, FrameScheduler& scheduler)
+{
+	BindlessHeap* heap = m_device->GetBindlessHeap();
+	heap->Free(BINDLESS_TEXTURE, m_texture_index, scheduler);
+	for (uint32_t index : m_mip_indices)
+		heap->Free(BINDLESS_STORAGE_IMAGE, index, scheduler);
+
+	GraphicsDevice const* device = m_device;
+	scheduler.Defer([device, image = m_image, allocation = m_allocation, view = m_view, mip_views = m_mip_views]() {
+		for (VkImageView mip_view : mip_views)
+			vkDestroyImageView(device->GetLogical(), mip_view, nullptr);
+		vkDestroyImageView(device->GetLogical(), view, nullptr);
+		device->GetAllocator()->DestroyImage(image, allocation);
+	});
+
+	Create(depth_extent);
+}
+
+VkExtent2D HiZPyramid::GetPyramidExtent(VkExtent2D depth_extent)
+{
+	// Rounding down would leave depth texels between the taps of level 0, never reaching the pyramid.
+	return { std::bit_ceil(std::max(depth_extent.width, 1u)), std::bit_ceil(std::max(depth_extent.height, 1u)) };
+}
+
+void HiZPyramid::Create(VkExtent2D depth_extent)
+{
+	m_extent = GetPyramidExtent(depth_extent);
+	m_mip_count = std::bit_width(std::max(m_extent.width, m_extent.height));
+	m_valid = false;
+	m_initialized = false;
+
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = VK_FORMAT_R32_SFLOAT;
+	image_info.extent = { m_extent.width, m_extent.height, 1 };
+	image_info.mipLevels = m_mip_count;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	m_image = m_device->GetAllocator()->CreateImage(image_info, GPU_ONLY_MEMORY, &m_allocation);
+
+	VkImageViewCreateInfo view_info{};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = m_image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = VK_FORMAT_R32_SFLOAT;
+	view_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_mip_count, 0, 1 };
+	VALIDATE(vkCreateImageView(m_device->GetLogical(), &view_info, nullptr, &m_view) == VK_SUCCESS);
+
+	// The pyramid stays in GENERAL: each level is written as a storage image and read back while building the next.
+	BindlessHeap* heap = m_device->GetBindlessHeap();
+	m_texture_index = heap->AddTexture(m_view, VK_IMAGE_LAYOUT_GENERAL);
+
+	m_mip_views.resize(m_mip_count);
+	m_mip_indices.resize(m_mip_count);
+
+	for (uint32_t i = 0; i < m_mip_count; i++)
+	{
+		view_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+		VALIDATE(vkCreateImageView(m_device->GetLogical(), &view_info, nullptr, &m_mip_views[i]) == VK_SUCCESS);
+		m_mip_indices[i] = heap->AddStorageImage(m_mip_views[i]);
+	}
+}
+
+void HiZPyramid::Build(VkCommandBuffer command_buffer, uint32_t depth_texture)
+{
+	PROFILE_GPU(command_buffer, "Build Hi-Z");
+
+	// Culling read the previous contents earlier on, which only has to finish before they are overwritten.
+	if (!m_initialized)
+		TransitionImage(command_buffer, m_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	else
+		GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE);
+	m_initialized = true;
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetHandle());
+	m_device->GetBindlessHeap()->Bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetLayout());
+
+	for (uint32_t i = 0; i < m_mip_count; i++)
+	{
+		ReduceConstants constants{};
+		constants.SourceTexture = i ? m_texture_index : depth_texture;
+		constants.Sampler = m_sampler_index;
+		constants.SourceLod = i ? static_cast<float>(i - 1) : 0.0f;
+		constants.TargetImage = m_mip_indices[i];
+		constants.TargetSize[0] = std::max(m_extent.width >> i, 1u);
+		constants.TargetSize[1] = std::max(m_extent.height >> i, 1u);
+
+		PushConstants(command_buffer, m_pipeline->GetLayout(), constants);
+		vkCmdDispatch(command_buffer, (constants.TargetSize[0] + s_GROUP_SIZE - 1) / s_GROUP_SIZE, (constants.TargetSize[1] + s_GROUP_SIZE - 1) / s_GROUP_SIZE, 1);
+
+		// Each level is read by the next one, and the last barrier makes the whole pyramid visible to culling.
+		GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+	}
+
+	m_valid = true;
+}
\ No newline at end of file
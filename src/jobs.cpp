@@ -0,0 +1,457 @@
+#include "jobs.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define THISFILE "jobs.cpp"
+
+// Jobs a thread can have queued in its own deque; beyond that they go to the shared queue.
+static constexpr uint32_t s_DEQUE_CAPACITY = 4096;
+
+// Failed searches before a thread goes to sleep. Spinning a little catches jobs submitted right after a thread runs dry.
+static constexpr uint32_t s_SPIN_COUNT = 64;
+
+struct Job
+{
+	JobFunction Function;
+	JobCounter* Counter;
+	JobAffinity Affinity;
+};
+
+// Chase-Lev work-stealing deque with a fixed capacity, as in "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Lê et al.). Only the owner pushes and pops, at the bottom; any thread may steal from the top.
+class JobDeque
+{
+public:
+
+	JobDeque() : m_top(0), m_bottom(0), m_jobs(s_DEQUE_CAPACITY) {}
+
+	// False when full.
+	bool Push(Job* job)
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		int64_t top = m_top.load(std::memory_order_acquire);
+		if (bottom - top >= static_cast<int64_t>(s_DEQUE_CAPACITY))
+			return false;
+
+		m_jobs[bottom & (s_DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	Job* Pop()
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = m_top.load(std::memory_order_relaxed);
+
+		if (top > bottom)
+		{
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Job* job = m_jobs[bottom & (s_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+
+		// The last job may be stolen at the same time, whoever moves top first gets it.
+		if (top == bottom)
+		{
+			if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = nullptr;
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+
+		return job;
+	}
+
+	// Null when empty or when another thread won the race, which sets conflict.
+	Job* Steal(bool& conflict)
+	{
+		int64_t top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom)
+			return nullptr;
+
+		Job* job = m_jobs[top & (s_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			conflict = true;
+			return nullptr;
+		}
+
+		return job;
+	}
+
+private:
+
+	alignas(64) std::atomic<int64_t> m_top;
+	alignas(64) std::atomic<int64_t> m_bottom;
+	std::vector<std::atomic<Job*>> m_jobs;
+};
+
+// Cache line aligned so threads updating their own statistics do not invalidate each other's.
+struct alignas(64) JobSystem::Worker
+{
+	JobDeque Deque;
+	uint32_t Random; // Xorshift state picking the first steal victim
+
+	std::atomic<uint64_t> JobsRun, Steals, StealAttempts, StealConflicts;
+	std::atomic<uint64_t> BusyNs, IdleNs;
+};
+
+static thread_local JobSystem const* s_system = nullptr;
+static thread_local uint32_t s_thread_index = UINT32_MAX;
+
+static void s_PinCurrentThread(uint32_t core)
+{
+#ifdef _WIN32
+	if (core < 64)
+		SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+static uint64_t s_ElapsedNs(std::chrono::steady_clock::time_point begin)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+}
+
+JobSystem::JobSystem(uint32_t thread_count, bool pin_threads)
+	: m_queued(0), m_sleeping(0), m_stop(false)
+{
+	uint32_t core_count = std::max(1u, std::thread::hardware_concurrency());
+	m_thread_count = thread_count ? thread_count : core_count;
+
+	// Pinning more threads than cores would stack them on the same ones.
+	bool pin = pin_threads && m_thread_count <= core_count;
+
+	for (uint32_t i = 0; i < m_thread_count; i++)
+	{
+		Worker* worker = new Worker();
+		worker->Random = 0x9E3779B9u * (i + 1);
+		m_workers.push_back(worker);
+	}
+
+	VALIDATE(!s_system); // One job system per thread.
+	s_system = this;
+	s_thread_index = 0;
+	if (pin)
+		s_PinCurrentThread(0);
+
+	for (uint32_t i = 1; i < m_thread_count; i++)
+		m_threads.emplace_back(&JobSystem::WorkerLoop, this, i, pin);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard lock(m_sleep_mutex);
+		m_stop = true;
+	}
+
+	m_sleep_cv.notify_all();
+	for (std::thread& thread : m_threads)
+		thread.join();
+
+	s_system = nullptr;
+	s_thread_index = UINT32_MAX;
+
+	for (Worker* worker : m_workers)
+		delete worker;
+}
+
+void JobSystem::Submit(JobFunction function, JobCounter* counter, JobCounter* dependency, JobAffinity affinity)
+{
+	Job* job = new Job{ std::move(function), counter, affinity };
+	if (counter)
+		counter->m_value.fetch_add(1, std::memory_order_relaxed);
+
+	// Checked under the dependency's lock, so the job is either queued now or released by the last job of the group.
+	if (dependency)
+	{
+		std::lock_guard lock(dependency->m_mutex);
+		if (dependency->m_value.load(std::memory_order_acquire))
+		{
+			dependency->m_dependents.push_back(job);
+			return;
+		}
+	}
+
+	Push(job);
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	uint32_t index = GetThreadIndex();
+
+	while (!counter.IsDone())
+	{
+		Job* job = index != UINT32_MAX ? FindJob(index) : nullptr;
+		if (job)
+		{
+			Run(job, index);
+			continue;
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		std::this_thread::yield();
+		if (index != UINT32_MAX)
+			m_workers[index]->IdleNs.fetch_add(s_ElapsedNs(begin), std::memory_order_relaxed);
+	}
+
+	// The last job of the group may still hold the lock, and the counter must outlive it.
+	{
+		std::lock_guard lock(counter.m_mutex);
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard lock(m_error_mutex);
+		std::swap(error, m_error);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t grain, std::function<void(uint32_t begin, uint32_t end)> const& body)
+{
+	if (!count)
+		return;
+
+	// A few ranges per thread, so threads finishing early have something left to steal.
+	if (!grain)
+		grain = std::max(1u, count / (m_thread_count * 4));
+
+	if (count <= grain)
+	{
+		body(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (uint32_t begin = 0; begin < count; begin += grain)
+	{
+		uint32_t end = std::min(count, begin + grain);
+		Submit([&body, begin, end]() { body(begin, end); }, &counter);
+	}
+
+	Wait(counter);
+}
+
+uint32_t JobSystem::GetThreadIndex() const
+{
+	return s_system == this ? s_thread_index : UINT32_MAX;
+}
+
+std::vector<JobThreadStats> JobSystem::GetStats() const
+{
+	std::vector<JobThreadStats> stats;
+	for (Worker const* worker : m_workers)
+	{
+		stats.push_back({ worker->JobsRun.load(std::memory_order_relaxed), worker->Steals.load(std::memory_order_relaxed),
+			worker->StealAttempts.load(std::memory_order_relaxed), worker->StealConflicts.load(std::memory_order_relaxed),
+			worker->BusyNs.load(std::memory_order_relaxed) * 1e-6, worker->IdleNs.load(std::memory_order_relaxed) * 1e-6 });
+	}
+
+	return stats;
+}
+
+void JobSystem::ResetStats()
+{
+	for (Worker* worker : m_workers)
+	{
+		worker->JobsRun = worker->Steals = worker->StealAttempts = worker->StealConflicts = 0;
+		worker->BusyNs = worker->IdleNs = 0;
+	}
+}
+
+void JobSystem::PrintStats() const
+{
+	auto stats = GetStats();
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		JobThreadStats const& thread = stats[i];
+		double total = thread.BusyMs + thread.IdleMs;
+		std::cout << "[Jobs] thread " << i << (i ? "" : " (main)") << ": " << thread.JobsRun << " jobs, busy " << thread.BusyMs
+			<< " ms, idle " << thread.IdleMs << " ms (" << (total > 0.0 ? 100.0 * thread.IdleMs / total : 0.0) << "%), "
+			<< thread.Steals << "/" << thread.StealAttempts << " steals, " << thread.StealConflicts << " conflicts\n";
+	}
+}
+
+void JobSystem::WorkerLoop(uint32_t index, bool pin)
+{
+	s_system = this;
+	s_thread_index = index;
+	if (pin)
+		s_PinCurrentThread(index);
+
+	Worker& worker = *m_workers[index];
+	uint32_t failures = 0;
+	auto idle_begin = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		if (Job* job = FindJob(index))
+		{
+			worker.IdleNs.fetch_add(s_ElapsedNs(idle_begin), std::memory_order_relaxed);
+			Run(job, index);
+			idle_begin = std::chrono::steady_clock::now();
+			failures = 0;
+			continue;
+		}
+
+		if (++failures < s_SPIN_COUNT)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// Submitters bump m_queued before checking for sleepers, and sleepers register before checking m_queued,
+		// so a wake-up cannot be missed.
+		std::unique_lock lock(m_sleep_mutex);
+		m_sleeping++;
+		m_sleep_cv.wait(lock, [this]() { return m_stop || m_queued.load() > 0; });
+		m_sleeping--;
+		failures = 0;
+
+		if (m_stop)
+			return;
+	}
+}
+
+void JobSystem::Push(Job* job)
+{
+	if (job->Affinity == JOB_MAIN_THREAD)
+	{
+		// Only the main thread runs these, so they neither count as queued nor wake anyone.
+		std::lock_guard lock(m_queue_mutex);
+		m_main_jobs.push_back(job);
+		return;
+	}
+
+	uint32_t index = GetThreadIndex();
+	if (index == UINT32_MAX || !m_workers[index]->Deque.Push(job))
+	{
+		std::lock_guard lock(m_queue_mutex);
+		m_injected.push_back(job);
+	}
+
+	m_queued.fetch_add(1);
+	if (m_sleeping.load())
+	{
+		std::lock_guard lock(m_sleep_mutex);
+		m_sleep_cv.notify_one();
+	}
+}
+
+Job* JobSystem::FindJob(uint32_t index)
+{
+	Worker& worker = *m_workers[index];
+
+	if (Job* job = worker.Deque.Pop())
+	{
+		m_queued.fetch_sub(1);
+		return job;
+	}
+
+	if (index == 0)
+	{
+		std::lock_guard lock(m_queue_mutex);
+		if (!m_main_jobs.empty())
+		{
+			Job* job = m_main_jobs.back();
+			m_main_jobs.pop_back();
+			return job;
+		}
+	}
+
+	// Nothing is queued anywhere, don't touch the other threads' cache lines.
+	if (!m_queued.load(std::memory_order_relaxed))
+		return nullptr;
+
+	// Victims in a random rotation, so thieves spread out instead of all hitting thread 0.
+	worker.Random ^= worker.Random << 13, worker.Random ^= worker.Random >> 17, worker.Random ^= worker.Random << 5;
+	for (uint32_t i = 0; i < m_thread_count; i++)
+	{
+		uint32_t victim = (worker.Random + i) % m_thread_count;
+		if (victim == index)
+			continue;
+
+		bool conflict = false;
+		Job* job = m_workers[victim]->Deque.Steal(conflict);
+		worker.StealAttempts.fetch_add(1, std::memory_order_relaxed);
+		if (conflict)
+			worker.StealConflicts.fetch_add(1, std::memory_order_relaxed);
+
+		if (job)
+		{
+			worker.Steals.fetch_add(1, std::memory_order_relaxed);
+			m_queued.fetch_sub(1);
+			return job;
+		}
+	}
+
+	std::lock_guard lock(m_queue_mutex);
+	if (!m_injected.empty())
+	{
+		Job* job = m_injected.back();
+		m_injected.pop_back();
+		m_queued.fetch_sub(1);
+		return job;
+	}
+
+	return nullptr;
+}
+
+void JobSystem::Run(Job* job, uint32_t index)
+{
+	auto begin = std::chrono::steady_clock::now();
+
+	try
+	{
+		job->Function();
+	}
+	catch (...)
+	{
+		std::lock_guard lock(m_error_mutex);
+		if (!m_error)
+			m_error = std::current_exception();
+	}
+
+	if (job->Counter)
+		Release(*job->Counter);
+	delete job;
+
+	Worker& worker = *m_workers[index];
+	worker.JobsRun.fetch_add(1, std::memory_order_relaxed);
+	worker.BusyNs.fetch_add(s_ElapsedNs(begin), std::memory_order_relaxed);
+}
+
+void JobSystem::Release(JobCounter& counter)
+{
+	// Everything touching the counter happens under its lock, which Wait takes once more before returning.
+	std::vector<Job*> ready;
+	{
+		std::lock_guard lock(counter.m_mutex);
+		if (counter.m_value.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			ready.swap(counter.m_dependents);
+	}
+
+	for (Job* job : ready)
+		Push(job);
+}
\ No newline at end of file
@@ -1,31 +1,570 @@
 #include "vulkan.hpp"
 #include "window.hpp"
 #include "render.hpp"
+#include "frame.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "asset_pack.hpp"
+#include "profiler.hpp"
+#include "bindless.hpp"
+#include "frame_ring.hpp"
+#include "culling.hpp"
+#include "hiz.hpp"
+#include "jobs.hpp"
+#include "mesh.hpp"
+#include "texture.hpp"
+#include "skinning.hpp"
+#include "render_graph.hpp"
+#include <cmath>
+#include <cfloat>
+
+// Number of frames the CPU may record ahead of the GPU.
+static constexpr uint32_t s_FRAMES_IN_FLIGHT = 2;
+
+// The horde: a grid of capsules with rows of giant ones across it as walls, so there is plenty hidden to cull.
+static constexpr uint32_t s_GRID_SIZE = 128;
+static constexpr float s_GRID_SPACING = 3.0f;
+static constexpr uint32_t s_WALL_EVERY = 16; // Grid rows between walls
+
+// The shambling part of the horde: animated capsules in a band around the middle, between the static ones.
+static constexpr uint32_t s_CROWD_SIZE = 1500;
+static constexpr float s_CROWD_INNER_RADIUS = 110.0f;
+static constexpr float s_CROWD_OUTER_RADIUS = 145.0f;
+static constexpr uint32_t s_SPINE_BONES = 4;
+
+static constexpr float s_FOV_Y = 1.0f;
+static constexpr VkFormat s_DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+
+// Push constants of the scene shaders, see scene.glsl.
+struct DrawConstants
+{
+	uint32_t MaterialIndex;
+	uint32_t Padding;
+	VkDeviceAddress Frame; // FrameConstants in the frame ring
+	VkDeviceAddress Transforms;
+};
+
+struct FrameConstants
+{
+	float ViewProjection[16];
+	float Tint[4];
+	VkDeviceAddress Textures; // Slot table from TextureStreamer::Update
+};
+
+// Material of lit.frag.
+struct Material
+{
+	float Color[4];
+	TextureHandle Texture;
+	uint32_t Sampler;
+	uint32_t Padding[2];
+};
+
+// Column-major, right-handed, looking down -z, with Vulkan's [0, 1] depth and y pointing down in clip space.
+static void s_Perspective(float fov_y, float aspect, float near_z, float far_z, float out[16])
+{
+	float f = 1.0f / std::tan(fov_y * 0.5f);
+	std::fill_n(out, 16, 0.0f);
+	out[0] = f / aspect;
+	out[5] = -f;
+	out[10] = far_z / (near_z - far_z);
+	out[11] = -1.0f;
+	out[14] = near_z * far_z / (near_z - far_z);
+}
+
+static void s_LookAt(float const eye[3], float const target[3], float out[16])
+{
+	float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	float f_length = std::sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	for (float& c : f)
+		c /= f_length;
+
+	// Side is forward cross world up (+y), then up is side cross forward.
+	float s[3] = { -f[2], 0.0f, f[0] };
+	float s_length = std::sqrt(s[0] * s[0] + s[2] * s[2]);
+	s[0] /= s_length, s[2] /= s_length;
+	float u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+
+	float const m[16] = {
+		s[0], u[0], -f[0], 0.0f,
+		s[1], u[1], -f[1], 0.0f,
+		s[2], u[2], -f[2], 0.0f,
+		-(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]), -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]), f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2], 1.0f,
+	};
+	std::copy_n(m, 16, out);
+}
+
+static void s_Multiply(float const a[16], float const b[16], float out[16])
+{
+	for (int col = 0; col < 4; col++)
+		for (int row = 0; row < 4; row++)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < 4; k++)
+				sum += a[k * 4 + row] * b[col * 4 + k];
+			out[col * 4 + row] = sum;
+		}
+}
 
 int main()
 {
 	LaunchVulkan();
 
+	// Engine-wide job system. This thread, which owns the window and submits, is its main thread, pinned to core 0.
+	JobSystem* jobs = new JobSystem();
+
 	Window* window = new Window(1600, 900, false);
 	GraphicsDevice* device = new GraphicsDevice(*window);
-	Swapchain* swapchain = new Swapchain(*window, *device);
-	GraphicsPipeline* pipeline;
+	MemoryAllocator* allocator = device->GetAllocator();
+
+	// Latency over throughput: no vsync queue, and never more than one frame waiting to be shown.
+	PresentPolicy present_policy;
+	present_policy.PresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	present_policy.WaitForPresent = true;
+
+	Swapchain* swapchain = new Swapchain(*window, *device, present_policy);
+	AssetPack* assets = new AssetPack("assets.pack");
+	GraphicsPipeline* depth_pipeline, * skinned_depth_pipeline;
+	GraphicsPipeline* pipeline, * skinned_pipeline;
+
+	// Depth prepass first, then shading only the nearest surface of each pixel. Static and skinned meshes only
+	// differ in their vertex input.
+	auto create_pipelines = [&](void (*add_vertex_input)(GraphicsPipelineCreator&), GraphicsPipeline*& depth_only, GraphicsPipeline*& shaded) {
+		{
+			GraphicsPipelineCreator creator(*device);
+			creator.SetDynamicRendering(true);
+			creator.SetDepthFormat(s_DEPTH_FORMAT);
+			creator.SetDepthTest(VK_COMPARE_OP_LESS, true);
+			creator.SetCullMode(VK_CULL_MODE_BACK_BIT);
+			creator.AddShaderModule(VERTEX_SHADER, *assets, "shaders/instance.vert.spv");
+			add_vertex_input(creator);
+			depth_only = new GraphicsPipeline(creator);
+		}
+
+		{
+			GraphicsPipelineCreator creator(*device);
+			creator.SetRenderFormat(swapchain->GetImageFormat());
+			creator.SetDynamicRendering(true);
+			creator.SetDepthFormat(s_DEPTH_FORMAT);
+			creator.SetDepthTest(VK_COMPARE_OP_EQUAL, false);
+			creator.SetCullMode(VK_CULL_MODE_BACK_BIT);
+			creator.AddShaderModule(VERTEX_SHADER, *assets, "shaders/instance.vert.spv");
+			creator.AddShaderModule(FRAGMENT_SHADER, *assets, "shaders/lit.frag.spv");
+			add_vertex_input(creator);
+			shaded = new GraphicsPipeline(creator);
+		}
+	};
+
+	create_pipelines(Mesh::AddVertexInput, depth_pipeline, pipeline);
+	create_pipelines(CrowdSkinner::AddVertexInput, skinned_depth_pipeline, skinned_pipeline);
+
+	FrameScheduler* scheduler = new FrameScheduler(*device, *swapchain, s_FRAMES_IN_FLIGHT);
+
+	// Frames slower than 50 ms are dumped along with the frames before them.
+	Profiler* profiler = new Profiler(*device, s_FRAMES_IN_FLIGHT);
+	profiler->SetHitchThreshold(50.0);
+	Uploader* uploader = new Uploader(*device);
+
+	// Static scene data, streamed in through the uploader. Everything read by shaders is reached by address.
+	std::vector<UploadTicket> tickets;
+	auto create_buffer = [&](void const* data, size_t size, VkBufferUsageFlags usage, VkPipelineStageFlags2 stage, VkAccessFlags2 access, Allocation** memory) {
+		VkBufferCreateInfo bci{};
+		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bci.size = size;
+		bci.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		VkBuffer buffer = allocator->CreateBuffer(bci, GPU_ONLY_MEMORY, memory);
+		tickets.push_back(uploader->UploadBuffer(buffer, 0, std::vector<char>(static_cast<char const*>(data), static_cast<char const*>(data) + size), stage, access));
+		return buffer;
+	};
+
+	// Cooked by MeshCooker with its levels of detail, streamed from the pack.
+	Mesh* mesh = new Mesh(*device, *assets, "meshes/capsule.mesh", *uploader);
+	CullMesh cull_mesh = mesh->GetCullMesh();
+	float const* mesh_center = mesh->GetCenter();
+
+	std::vector<CullInstance> instances;
+	std::vector<float> transforms;
+
+	// Both the culler and the vertex shader work on the mesh's bounding sphere, placed by the instance.
+	auto add_instance = [&](float x, float y, float z, float scale) {
+		float const center[3] = { x + scale * mesh_center[0], y + scale * mesh_center[1], z + scale * mesh_center[2] };
+		float radius = scale * mesh->GetRadius();
+		instances.push_back({ { center[0], center[1], center[2] }, radius, 0 });
+		transforms.insert(transforms.end(), { center[0], center[1], center[2], radius });
+	};
+
+	float const half_grid = s_GRID_SIZE * s_GRID_SPACING * 0.5f;
+	for (uint32_t z = 0; z < s_GRID_SIZE; z++)
+	{
+		for (uint32_t x = 0; x < s_GRID_SIZE; x++)
+			add_instance(x * s_GRID_SPACING - half_grid, 0.0f, z * s_GRID_SPACING - half_grid, 1.0f);
+
+		if (z && z % s_WALL_EVERY == 0)
+			for (float x = -half_grid; x < half_grid; x += 3.0f)
+				add_instance(x, 0.0f, z * s_GRID_SPACING - half_grid - s_GRID_SPACING * 0.5f, 5.0f);
+	}
+
+	uint32_t const instance_count = static_cast<uint32_t>(instances.size());
+
+	Allocation* mesh_memory, * instance_memory, * transform_memory, * material_memory;
+	VkBuffer mesh_buffer = create_buffer(&cull_mesh, sizeof(cull_mesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &mesh_memory);
+	VkBuffer instance_buffer = create_buffer(instances.data(), instances.size() * sizeof(CullInstance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &instance_memory);
+	VkBuffer transform_buffer = create_buffer(transforms.data(), transforms.size() * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &transform_memory);
+
+	// Streamed textures within a fixed budget; decoding runs on the job system.
+	TextureStreamer* textures = new TextureStreamer(*device, *assets, *uploader, jobs);
+	TextureHandle checker = textures->Load("textures/checker.ktx2");
+
+	// Material, which the fragment shader finds through the buffer's bindless index.
+	Material const material{ { 0.4f, 0.7f, 0.3f, 1.0f }, checker, textures->GetSamplerIndex() };
+	VkBuffer material_buffer = create_buffer(&material, sizeof(material), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &material_memory);
+
+	DrawConstants draw_constants{ device->GetBindlessHeap()->AddBuffer(material_buffer) };
+	draw_constants.Transforms = allocator->GetDeviceAddress(transform_buffer);
+
+	// The capsule as a zombie: a spine of bones from its bottom to its top, each vertex weighted between the two
+	// bones nearest its height. The cooker imports no skins or clips yet, so both are built here.
+	uint32_t const vertex_count = mesh->GetVertexCount();
+	std::vector<float> heights(vertex_count);
+	for (uint32_t i = 0; i < vertex_count; i++)
+		heights[i] = mesh_center[1] + mesh->GetRadius() * mesh->GetVertices()[i].Position[1] / 32767.0f;
+
+	float const spine_bottom = *std::min_element(heights.begin(), heights.end());
+	float const segment = (*std::max_element(heights.begin(), heights.end()) - spine_bottom) / s_SPINE_BONES;
+
+	Skeleton skeleton;
+	Pose bind_pose(s_SPINE_BONES);
+	for (uint32_t bone = 0; bone < s_SPINE_BONES; bone++)
+	{
+		skeleton.Parents.push_back(static_cast<int32_t>(bone) - 1);
+		float const translation[3] = { bone ? 0.0f : mesh_center[0], bone ? segment : spine_bottom, bone ? 0.0f : mesh_center[2] };
+		float const rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		bind_pose.SetBone(bone, translation, rotation);
+	}
+	SetBindPose(skeleton, bind_pose);
 
+	std::vector<SkinVertex> skin(vertex_count);
+	for (uint32_t i = 0; i < vertex_count; i++)
 	{
-		GraphicsPipelineCreator creator(*device);
-		creator.SetRenderFormat(swapchain->GetImageFormat());
-		creator.AddShaderModule(VERTEX_SHADER, "shaders/shader.vert.spv");
-		creator.AddShaderModule(FRAGMENT_SHADER, "shaders/shader.frag.spv");
-		pipeline = new GraphicsPipeline(creator);
+		// Fully on a bone at the middle of its segment, shared with the next one in between.
+		float along = std::clamp((heights[i] - spine_bottom) / segment - 0.5f, 0.0f, s_SPINE_BONES - 1.0f);
+		uint32_t bone = std::min(static_cast<uint32_t>(along), s_SPINE_BONES - 1);
+		uint8_t weight = static_cast<uint8_t>(std::lround((along - bone) * 255.0f));
+		skin[i] = { { static_cast<uint8_t>(bone), static_cast<uint8_t>(std::min(bone + 1, s_SPINE_BONES - 1)), 0, 0 },
+			{ static_cast<uint8_t>(255 - weight), weight, 0, 0 } };
 	}
 
-	Framebuffers* framebuffers = new Framebuffers(*device, *pipeline, *swapchain);
+	// Full detail close up, half the rate and the lower spine further out, a rigid sway a quarter as often far away.
+	std::vector<AnimationLod> const animation_lods = { { 25.0f, 1, s_SPINE_BONES }, { 60.0f, 2, 2 }, { FLT_MAX, 4, 1 } };
+	CrowdSkinner* skinner = new CrowdSkinner(*device, *assets, *uploader, jobs, *mesh, skeleton, skin, animation_lods, s_CROWD_SIZE);
+
+	// Two one-second loops to blend between: a sideways shamble, each bone a little behind the one below, and a
+	// forward lurch.
+	auto make_clip = [&](float sway, float lean, float lag) {
+		static constexpr uint32_t s_KEYS = 31;
+		AnimationClip clip(s_SPINE_BONES, s_KEYS, s_KEYS - 1.0f);
+		for (uint32_t key = 0; key < s_KEYS; key++)
+			for (uint32_t bone = 0; bone < s_SPINE_BONES; bone++)
+			{
+				float phase = 2.0f * 3.14159265f * key / (s_KEYS - 1) - bone * lag;
+				// Half angles of a roll about z after a pitch about x.
+				float roll = sway * std::sin(phase) * 0.5f, pitch = lean * (0.5f + 0.5f * std::sin(phase * 2.0f)) * 0.5f;
+				float const rotation[4] = { std::cos(roll) * std::sin(pitch), std::sin(roll) * std::sin(pitch),
+					std::sin(roll) * std::cos(pitch), std::cos(roll) * std::cos(pitch) };
+				float const translation[3] = { bone ? 0.0f : mesh_center[0], bone ? segment : spine_bottom, bone ? 0.0f : mesh_center[2] };
+				clip.GetKey(key).SetBone(bone, translation, rotation);
+			}
+		return clip;
+	};
+
+	uint32_t const shamble = skinner->AddClip(make_clip(0.25f, 0.1f, 0.6f));
+	uint32_t const lurch = skinner->AddClip(make_clip(0.1f, 0.5f, 0.3f));
+
+	// Zombies stand in every other grid cell of the band, between the static capsules and clear of the walls, each
+	// drawing its own skinned copy of the mesh. Swaying takes them out of the rest pose's bounding sphere, so they
+	// are culled with a larger one.
+	std::vector<CullInstance> crowd_instances;
+	std::vector<CullMesh> crowd_meshes;
+	std::vector<float> crowd_transforms;
+	std::vector<CrowdCharacter> crowd;
+
+	for (uint32_t z = 0; z < s_GRID_SIZE && crowd.size() < s_CROWD_SIZE; z++)
+		for (uint32_t x = (z & 1); x < s_GRID_SIZE && crowd.size() < s_CROWD_SIZE; x += 2)
+		{
+			float const position[2] = { x * s_GRID_SPACING - half_grid + s_GRID_SPACING * 0.5f, z * s_GRID_SPACING - half_grid + s_GRID_SPACING * 0.5f };
+			float distance = std::sqrt(position[0] * position[0] + position[1] * position[1]);
+			bool in_wall = (z + 1) % s_WALL_EVERY == 0;
+			if (distance < s_CROWD_INNER_RADIUS || distance > s_CROWD_OUTER_RADIUS || in_wall)
+				continue;
+
+			uint32_t index = static_cast<uint32_t>(crowd.size());
+			float const center[3] = { position[0] + mesh_center[0], mesh_center[1], position[1] + mesh_center[2] };
+			crowd_instances.push_back({ { center[0], center[1], center[2] }, mesh->GetRadius() * 1.25f, index });
+			crowd_meshes.push_back(skinner->GetCullMesh(index));
+			crowd_transforms.insert(crowd_transforms.end(), { center[0], center[1], center[2], mesh->GetRadius() });
+			crowd.push_back({ { shamble, lurch } });
+		}
+
+	uint32_t const crowd_count = static_cast<uint32_t>(crowd.size());
+
+	Allocation* crowd_mesh_memory, * crowd_instance_memory, * crowd_transform_memory;
+	VkBuffer crowd_mesh_buffer = create_buffer(crowd_meshes.data(), crowd_meshes.size() * sizeof(CullMesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &crowd_mesh_memory);
+	VkBuffer crowd_instance_buffer = create_buffer(crowd_instances.data(), crowd_instances.size() * sizeof(CullInstance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &crowd_instance_memory);
+	VkBuffer crowd_transform_buffer = create_buffer(crowd_transforms.data(), crowd_transforms.size() * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, &crowd_transform_memory);
+
+	DrawConstants crowd_draw_constants = draw_constants;
+	crowd_draw_constants.Transforms = allocator->GetDeviceAddress(crowd_transform_buffer);
+
+	FrameRing* frame_ring = new FrameRing(*device, s_FRAMES_IN_FLIGHT);
+	GpuCuller* culler = new GpuCuller(*device, *assets, s_FRAMES_IN_FLIGHT, instance_count);
+	GpuCuller* crowd_culler = new GpuCuller(*device, *assets, s_FRAMES_IN_FLIGHT, crowd_count);
+	HiZPyramid* pyramid = new HiZPyramid(*device, *assets, swapchain->GetExtent());
+
+	// Declared anew every frame. Its depth buffer is created once and kept while the extent stays the same.
+	RenderGraph* graph = new RenderGraph(*device);
+
+	// The pyramid holds the depth of the frame rendered with this view-projection.
+	float pyramid_view_projection[16];
+
+	double cpu_wait = 0.0, gpu_wait = 0.0;
+	uint32_t stat_frames = 0;
+
+	while (!glfwWindowShouldClose(window->GetNativePointer()))
+	{
+		// Pace first so the events polled below are as fresh as possible when the frame is recorded.
+		scheduler->Pace();
+		glfwPollEvents();
+
+		// Both flags are consumed, hence no short-circuit.
+		if (window->ConsumeResize() | scheduler->ConsumeOutOfDate())
+		{
+			window->WaitWhileMinimized();
+			if (glfwWindowShouldClose(window->GetNativePointer()))
+				break;
+			swapchain->Recreate(*window, *scheduler);
+			pyramid->Recreate(swapchain->GetExtent(), *scheduler);
+		}
+
+		VkCommandBuffer cmd = scheduler->BeginFrame();
+		if (!cmd)
+			continue;
+
+		profiler->BeginFrame(cmd, scheduler->GetSlotIndex(), scheduler->GetFrameIndex());
+		uploader->BeginFrame(cmd, *scheduler);
+		frame_ring->BeginFrame(scheduler->GetSlotIndex());
+		VkExtent2D extent = swapchain->GetExtent();
+
+		// Circle the horde at head height, where the walls hide most of it.
+		float time = static_cast<float>(glfwGetTime()) * 0.1f;
+		float const eye[3] = { std::cos(time) * 150.0f, 12.0f, std::sin(time) * 150.0f };
+		float const target[3] = { 0.0f, 0.0f, 0.0f };
+
+		float projection[16], view_matrix[16];
+		s_Perspective(s_FOV_Y, static_cast<float>(extent.width) / extent.height, 0.5f, 1000.0f, projection);
+		s_LookAt(eye, target, view_matrix);
+
+		FrameSpan<FrameConstants> frame_constants = frame_ring->Allocate<FrameConstants>();
+		s_Multiply(projection, view_matrix, frame_constants.Data->ViewProjection);
+		std::fill_n(frame_constants.Data->Tint, 4, 1.0f);
+		draw_constants.Frame = frame_constants.Address;
+		crowd_draw_constants.Frame = frame_constants.Address;
+
+		// The closest capsule is the one whose grid cell the camera is over. Its texture runs once from bottom to top,
+		// so on screen it spans about the bounding sphere's diameter.
+		{
+			float cell[2];
+			for (int i = 0; i < 2; i++)
+				cell[i] = std::round((eye[i * 2] + half_grid) / s_GRID_SPACING) * s_GRID_SPACING - half_grid;
+
+			float const* center = mesh->GetCenter();
+			float offset[3] = { eye[0] - cell[0] - center[0], eye[1] - center[1], eye[2] - cell[1] - center[2] };
+			float distance = std::max(std::sqrt(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]), 0.5f);
+			float pixels_per_unit = extent.height * 0.5f / std::tan(s_FOV_Y * 0.5f) / distance;
+			textures->Request(checker, 2.0f * mesh->GetRadius() * pixels_per_unit);
+		}
+		frame_constants.Data->Textures = textures->Update(cmd, *scheduler, *frame_ring);
+
+		bool ready = mesh->IsReady(*uploader) && std::all_of(tickets.begin(), tickets.end(), [uploader](UploadTicket ticket) { return uploader->IsReady(ticket); });
+		bool crowd_ready = ready && skinner->IsReady(*uploader);
+
+		VkImage image = swapchain->GetImage(scheduler->GetImageIndex());
+		VkImageView view = swapchain->GetImageView(scheduler->GetImageIndex());
+
+		// The acquire semaphore is waited on at colour output, so the backbuffer's first barrier chains after it.
+		// The skinned vertices were last read by the previous frame's draws, and depth was last sampled by its Hi-Z
+		// build, which the graph remembers.
+		graph->Reset();
+		RenderResource backbuffer = graph->ImportImage("Backbuffer", image, view, VK_IMAGE_ASPECT_COLOR_BIT,
+			{ VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED },
+			{ VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, swapchain->GetFinalLayout() });
+		RenderResource skinned = graph->ImportBuffer("Skinned vertices", skinner->GetVertexBuffer(), { VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_NONE });
+		RenderResource depth = graph->CreateImage("Depth", { s_DEPTH_FORMAT, extent });
+
+		// Skinned once here, then drawn by both passes. The golden ratio spreads the zombies' phases evenly, so
+		// they shamble out of step.
+		if (crowd_ready)
+		{
+			float now = static_cast<float>(glfwGetTime());
+			for (uint32_t i = 0; i < crowd_count; i++)
+			{
+				CrowdCharacter& character = crowd[i];
+				float const* center = crowd_instances[i].Center;
+				float phase = std::fmod(i * 0.618034f, 1.0f);
+
+				character.Times[0] = character.Times[1] = now * (0.8f + 0.4f * phase) + phase;
+				character.Blend = 0.5f + 0.5f * std::sin(now * 0.5f + phase * 6.2831853f);
+
+				float offset[3] = { eye[0] - center[0], eye[1] - center[1], eye[2] - center[2] };
+				character.Distance = std::sqrt(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+			}
+
+			uint32_t skinning = graph->AddPass("Skinning", [&](VkCommandBuffer cmd) {
+				skinner->Update(cmd, scheduler->GetFrameIndex(), *frame_ring, crowd.data(), crowd_count);
+			});
+			graph->Write(skinning, skinned, RENDER_COMPUTE_WRITE);
+		}
+
+		// Culling keeps its own barriers around its compute and indirect buffers, so the graph only has to keep it.
+		if (ready)
+		{
+			uint32_t cull = graph->AddPass("Cull", [&](VkCommandBuffer cmd) {
+				CullView cull_view{};
+				ExtractFrustumPlanes(frame_constants.Data->ViewProjection, cull_view.Planes);
+				std::copy_n(eye, 3, cull_view.Camera);
+				cull_view.LodScale = 1.0f;
+
+				culler->Cull(cmd, scheduler->GetSlotIndex(), scheduler->GetFrameIndex(), *frame_ring, cull_view, allocator->GetDeviceAddress(instance_buffer),
+					allocator->GetDeviceAddress(mesh_buffer), instance_count, pyramid, pyramid_view_projection);
+
+				if (crowd_ready)
+					crowd_culler->Cull(cmd, scheduler->GetSlotIndex(), scheduler->GetFrameIndex(), *frame_ring, cull_view, allocator->GetDeviceAddress(crowd_instance_buffer),
+						allocator->GetDeviceAddress(crowd_mesh_buffer), crowd_count, pyramid, pyramid_view_projection);
+			});
+			graph->SetSideEffects(cull);
+		}
+
+		VkClearValue clear{};
+		clear.color = { { 0.05f, 0.05f, 0.08f, 1.0f } };
+
+		VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+		VkRect2D scissor{ { 0, 0 }, extent };
+
+		// Both passes draw the same culled lists, the crowd from its skinned vertices.
+		auto draw_horde = [&](GraphicsPipeline const* pass_pipeline, GraphicsPipeline const* skinned_pass_pipeline) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pass_pipeline->GetHandle());
+			device->GetBindlessHeap()->Bind(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pass_pipeline->GetLayout());
+			vkCmdSetViewport(cmd, 0, 1, &viewport);
+			vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+			VkBuffer vertex_buffer = mesh->GetVertexBuffer();
+			VkDeviceSize vertex_offset = 0;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer, &vertex_offset);
+			vkCmdBindIndexBuffer(cmd, mesh->GetIndexBuffer(), 0, mesh->GetIndexType());
+			PushConstants(cmd, pass_pipeline->GetLayout(), draw_constants);
+			if (ready)
+				culler->Draw(cmd, scheduler->GetSlotIndex());
+
+			if (crowd_ready)
+			{
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, skinned_pass_pipeline->GetHandle());
+				vertex_buffer = skinner->GetVertexBuffer();
+				vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer, &vertex_offset);
+				PushConstants(cmd, skinned_pass_pipeline->GetLayout(), crowd_draw_constants);
+				crowd_culler->Draw(cmd, scheduler->GetSlotIndex());
+			}
+		};
+
+		uint32_t prepass = graph->AddPass("Depth prepass", [&](VkCommandBuffer cmd) {
+			PROFILE_GPU(cmd, "Depth prepass");
+			BeginRendering(cmd, VK_NULL_HANDLE, graph->GetView(depth), extent, clear, false);
+			draw_horde(depth_pipeline, skinned_depth_pipeline);
+			vkCmdEndRendering(cmd);
+		});
+		graph->Write(prepass, depth, RENDER_DEPTH_ATTACHMENT);
+		graph->Read(prepass, skinned, RENDER_VERTEX_INPUT);
+
+		uint32_t horde = graph->AddPass("Horde pass", [&](VkCommandBuffer cmd) {
+			PROFILE_GPU(cmd, "Horde pass");
+			BeginRendering(cmd, view, graph->GetView(depth), extent, clear, true);
+			draw_horde(pipeline, skinned_pipeline);
+			vkCmdEndRendering(cmd);
+		});
+		graph->Write(horde, backbuffer, RENDER_COLOR_ATTACHMENT);
+		graph->Read(horde, depth, RENDER_DEPTH_TEST);
+		graph->Read(horde, skinned, RENDER_VERTEX_INPUT);
+
+		// Next frame culls against this frame's depth.
+		uint32_t hiz = graph->AddPass("Build Hi-Z", [&](VkCommandBuffer cmd) {
+			pyramid->Build(cmd, graph->GetTextureIndex(depth));
+		});
+		graph->Read(hiz, depth, RENDER_SAMPLED_COMPUTE);
+		graph->SetSideEffects(hiz);
+
+		graph->Execute(cmd, *scheduler);
+		std::copy_n(frame_constants.Data->ViewProjection, 16, pyramid_view_projection);
+
+		scheduler->EndFrame();
+
+		// Print averaged waits every few hundred frames to tell CPU-bound from GPU-bound, and what culling saved.
+		FrameStats const& stats = scheduler->GetStats();
+		cpu_wait += stats.CpuWaitMs, gpu_wait += stats.GpuWaitMs;
+		if (++stat_frames == 300)
+		{
+			CullStats const& cull = culler->GetStats();
+			CullStats const& crowd_cull = crowd_culler->GetStats();
+			std::cout << "[Frame " << stats.FrameIndex << "] cpu wait " << cpu_wait / stat_frames
+				<< " ms, gpu wait " << gpu_wait / stat_frames << " ms, gpu busy " << stats.GpuBusyMs
+				<< " ms, present latency " << stats.PresentLatencyMs << " ms\n";
+			std::cout << "[Frame " << cull.FrameIndex << "] " << cull.Drawn << " drawn, culled " << cull.FrustumCulled << " by frustum, "
+				<< cull.DistanceCulled << " by distance, " << cull.OcclusionCulled << " by occlusion\n";
+			std::cout << "[Frame " << crowd_cull.FrameIndex << "] crowd " << crowd_cull.Drawn << " drawn, culled " << crowd_cull.FrustumCulled << " by frustum, "
+				<< crowd_cull.DistanceCulled << " by distance, " << crowd_cull.OcclusionCulled << " by occlusion\n";
+			skinner->PrintStats();
+			textures->PrintStats();
+			graph->PrintStats();
+			jobs->PrintStats();
+			jobs->ResetStats();
+			profiler->PrintStats();
+			cpu_wait = gpu_wait = 0.0, stat_frames = 0;
+		}
+	}
 
-	delete framebuffers;
+	delete scheduler;
+	delete graph;
+	delete profiler;
+	delete uploader;
+	delete textures;
+	delete pyramid;
+	delete crowd_culler;
+	delete culler;
+	delete frame_ring;
+	allocator->DestroyBuffer(crowd_transform_buffer, crowd_transform_memory);
+	allocator->DestroyBuffer(crowd_instance_buffer, crowd_instance_memory);
+	allocator->DestroyBuffer(crowd_mesh_buffer, crowd_mesh_memory);
+	delete skinner;
+	allocator->DestroyBuffer(material_buffer, material_memory);
+	allocator->DestroyBuffer(transform_buffer, transform_memory);
+	allocator->DestroyBuffer(instance_buffer, instance_memory);
+	allocator->DestroyBuffer(mesh_buffer, mesh_memory);
+	delete mesh;
+	delete skinned_pipeline;
 	delete pipeline;
+	delete skinned_depth_pipeline;
+	delete depth_pipeline;
+	delete assets;
 	delete swapchain;
 	delete device;
 	delete window;
+	delete jobs;
 
 	EndVulkan();
 	return 0;
@@ -0,0 +1,794 @@
+#include "memory.hpp"
+#include "vulkan.hpp"
+#include <bit>
+
+#define THISFILE "memory.cpp"
+
+static constexpr uint32_t s_SL_BITS = 4;
+static constexpr uint32_t s_SL_COUNT = 1u << s_SL_BITS;
+static constexpr uint32_t s_FL_COUNT = 64;
+static constexpr uint32_t s_NULL_NODE = ~0u;
+
+// Blocks on large heaps, smaller heaps (e.g. the 256 MiB BAR window) are split into eighths instead.
+static constexpr VkDeviceSize s_LARGE_HEAP_BLOCK_SIZE = 256ull << 20;
+static constexpr VkDeviceSize s_SMALL_HEAP_THRESHOLD = 1ull << 30;
+
+// Render targets at least this large get their own memory, they are long lived and would fragment blocks.
+static constexpr VkDeviceSize s_DEDICATED_ATTACHMENT_SIZE = 8ull << 20;
+
+static VkDeviceSize s_AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t s_Log2(VkDeviceSize value)
+{
+	return 63 - std::countl_zero(value);
+}
+
+// First level is the power of two, second level splits it linearly into s_SL_COUNT lists.
+static void s_Mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl)
+{
+	fl = s_Log2(size);
+	sl = fl < s_SL_BITS ? 0 : static_cast<uint32_t>((size >> (fl - s_SL_BITS)) & (s_SL_COUNT - 1));
+}
+
+// Round a request up so that every block in the list it maps to is large enough.
+static VkDeviceSize s_RoundUpForSearch(VkDeviceSize size)
+{
+	uint32_t fl = s_Log2(size);
+	if (fl < s_SL_BITS)
+		return std::bit_ceil(size);
+	return s_AlignUp(size, VkDeviceSize(1) << (fl - s_SL_BITS));
+}
+
+// Two-level segregated fit allocator over the offsets of one VkDeviceMemory.
+// Allocation and free are O(1), free physical neighbours are merged immediately.
+class TlsfAllocator
+{
+public:
+
+	TlsfAllocator(VkDeviceSize size)
+		: m_size(size), m_free_bytes(size), m_first(0), m_fl_bitmap(0)
+	{
+		m_sl_bitmap.fill(0);
+		for (auto& heads : m_heads)
+			heads.fill(s_NULL_NODE);
+
+		m_nodes.push_back({ 0, size, s_NULL_NODE, s_NULL_NODE, s_NULL_NODE, s_NULL_NODE, nullptr, true });
+		InsertFree(0);
+	}
+
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, Allocation* owner, uint32_t* node, VkDeviceSize* offset)
+	{
+		// Searching for size + alignment - 1 guarantees the aligned range fits in whatever block is found.
+		uint32_t fl, sl;
+		if (!FindFree(size + alignment - 1, fl, sl))
+			return false;
+
+		uint32_t index = m_heads[fl][sl];
+		RemoveFree(index);
+
+		VkDeviceSize aligned = s_AlignUp(m_nodes[index].Offset, alignment);
+		VkDeviceSize padding = aligned - m_nodes[index].Offset;
+
+		// The alignment gap goes back to the free lists. The previous neighbour is never free, as it would have been merged.
+		if (padding)
+		{
+			uint32_t front = NewNode();
+			Node& n = m_nodes[index];
+			m_nodes[front] = { n.Offset, padding, n.PrevPhys, index, s_NULL_NODE, s_NULL_NODE, nullptr, true };
+			if (n.PrevPhys != s_NULL_NODE)
+				m_nodes[n.PrevPhys].NextPhys = front;
+			else
+				m_first = front;
+			n.PrevPhys = front;
+			n.Offset = aligned;
+			n.Size -= padding;
+			InsertFree(front);
+		}
+
+		if (m_nodes[index].Size > size)
+		{
+			uint32_t back = NewNode();
+			Node& n = m_nodes[index];
+			m_nodes[back] = { n.Offset + size, n.Size - size, index, n.NextPhys, s_NULL_NODE, s_NULL_NODE, nullptr, true };
+			if (n.NextPhys != s_NULL_NODE)
+				m_nodes[n.NextPhys].PrevPhys = back;
+			n.NextPhys = back;
+			n.Size = size;
+			InsertFree(back);
+		}
+
+		Node& n = m_nodes[index];
+		n.Free = false;
+		n.Owner = owner;
+		m_free_bytes -= size;
+
+		*node = index;
+		*offset = n.Offset;
+		return true;
+	}
+
+	void Free(uint32_t index)
+	{
+		m_free_bytes += m_nodes[index].Size;
+		m_nodes[index].Free = true;
+		m_nodes[index].Owner = nullptr;
+
+		uint32_t prev = m_nodes[index].PrevPhys;
+		if (prev != s_NULL_NODE && m_nodes[prev].Free)
+		{
+			RemoveFree(prev);
+			Absorb(prev, index);
+			index = prev;
+		}
+
+		uint32_t next = m_nodes[index].NextPhys;
+		if (next != s_NULL_NODE && m_nodes[next].Free)
+		{
+			RemoveFree(next);
+			Absorb(index, next);
+		}
+
+		InsertFree(index);
+	}
+
+	inline VkDeviceSize GetFreeBytes() const { return m_free_bytes; }
+
+	inline VkDeviceSize GetUsedBytes() const { return m_size - m_free_bytes; }
+
+	inline bool IsEmpty() const { return m_free_bytes == m_size; }
+
+	// Visit (owner, node) of every live range in address order.
+	template<typename Fn>
+	void ForEachAllocation(Fn&& fn) const
+	{
+		for (uint32_t i = m_first; i != s_NULL_NODE; i = m_nodes[i].NextPhys) {
+			if (!m_nodes[i].Free)
+				fn(m_nodes[i].Owner, i);
+		}
+	}
+
+private:
+
+	struct Node
+	{
+		VkDeviceSize Offset, Size;
+		uint32_t PrevPhys, NextPhys;
+		uint32_t PrevFree, NextFree;
+		Allocation* Owner;
+		bool Free;
+	};
+
+	VkDeviceSize m_size;
+	VkDeviceSize m_free_bytes;
+	uint32_t m_first;
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_spare_nodes;
+
+	uint64_t m_fl_bitmap;
+	std::array<uint32_t, s_FL_COUNT> m_sl_bitmap;
+	std::array<std::array<uint32_t, s_SL_COUNT>, s_FL_COUNT> m_heads;
+
+	uint32_t NewNode()
+	{
+		if (!m_spare_nodes.empty())
+		{
+			uint32_t index = m_spare_nodes.back();
+			m_spare_nodes.pop_back();
+			return index;
+		}
+
+		m_nodes.emplace_back();
+		return static_cast<uint32_t>(m_nodes.size() - 1);
+	}
+
+	// Merge the physically following node into node.
+	void Absorb(uint32_t node, uint32_t following)
+	{
+		m_nodes[node].Size += m_nodes[following].Size;
+		m_nodes[node].NextPhys = m_nodes[following].NextPhys;
+		if (m_nodes[following].NextPhys != s_NULL_NODE)
+			m_nodes[m_nodes[following].NextPhys].PrevPhys = node;
+		m_spare_nodes.push_back(following);
+	}
+
+	bool FindFree(VkDeviceSize size, uint32_t& fl, uint32_t& sl) const
+	{
+		s_Mapping(s_RoundUpForSearch(size), fl, sl);
+		if (fl >= s_FL_COUNT)
+			return false;
+
+		uint32_t sl_map = m_sl_bitmap[fl] & (~0u << sl);
+		if (!sl_map)
+		{
+			uint64_t fl_map = fl + 1 < s_FL_COUNT ? m_fl_bitmap & (~0ull << (fl + 1)) : 0;
+			if (!fl_map)
+				return false;
+
+			fl = std::countr_zero(fl_map);
+			sl_map = m_sl_bitmap[fl];
+		}
+
+		sl = std::countr_zero(sl_map);
+		return true;
+	}
+
+	void InsertFree(uint32_t index)
+	{
+		uint32_t fl, sl;
+		s_Mapping(m_nodes[index].Size, fl, sl);
+
+		uint32_t head = m_heads[fl][sl];
+		m_nodes[index].PrevFree = s_NULL_NODE;
+		m_nodes[index].NextFree = head;
+		if (head != s_NULL_NODE)
+			m_nodes[head].PrevFree = index;
+		m_heads[fl][sl] = index;
+
+		m_fl_bitmap |= 1ull << fl;
+		m_sl_bitmap[fl] |= 1u << sl;
+	}
+
+	void RemoveFree(uint32_t index)
+	{
+		uint32_t fl, sl;
+		s_Mapping(m_nodes[index].Size, fl, sl);
+
+		Node& n = m_nodes[index];
+		if (n.PrevFree != s_NULL_NODE)
+			m_nodes[n.PrevFree].NextFree = n.NextFree;
+		else
+			m_heads[fl][sl] = n.NextFree;
+		if (n.NextFree != s_NULL_NODE)
+			m_nodes[n.NextFree].PrevFree = n.PrevFree;
+
+		if (m_heads[fl][sl] == s_NULL_NODE)
+		{
+			m_sl_bitmap[fl] &= ~(1u << sl);
+			if (!m_sl_bitmap[fl])
+				m_fl_bitmap &= ~(1ull << fl);
+		}
+	}
+};
+
+struct MemoryBlock
+{
+	VkDeviceMemory Memory;
+	VkDeviceSize Size;
+	void* Mapped;
+	uint32_t MemoryType;
+	uint32_t PoolIndex;
+	TlsfAllocator Tlsf;
+};
+
+MemoryAllocator::MemoryAllocator(GraphicsDevice const& device)
+	: m_device(&device), m_allocation_count(0)
+{
+	vkGetPhysicalDeviceMemoryProperties(device.GetPhysical(), &m_memory_props);
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(device.GetPhysical(), &props);
+	m_max_allocation_count = props.limits.maxMemoryAllocationCount;
+	m_non_coherent_atom_size = props.limits.nonCoherentAtomSize;
+
+	m_block_sizes.resize(m_memory_props.memoryHeapCount);
+	m_heap_stats.resize(m_memory_props.memoryHeapCount);
+
+	for (uint32_t i = 0; i < m_memory_props.memoryHeapCount; i++)
+	{
+		VkDeviceSize heap_size = m_memory_props.memoryHeaps[i].size;
+		m_block_sizes[i] = heap_size >= s_SMALL_HEAP_THRESHOLD ? s_LARGE_HEAP_BLOCK_SIZE : s_AlignUp(heap_size / 8, 1 << 20);
+		m_heap_stats[i] = {};
+		m_heap_stats[i].HeapSize = heap_size;
+	}
+
+	// Linear and optimal-tiling resources never share a block.
+	m_pools.resize(m_memory_props.memoryTypeCount * 2);
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+	for (auto& pool : m_pools) {
+		for (MemoryBlock* block : pool)
+			DestroyBlock(block);
+	}
+
+	for (Allocation* allocation : m_dedicated)
+	{
+		vkFreeMemory(m_device->GetLogical(), allocation->Memory, nullptr);
+		delete allocation;
+	}
+}
+
+VkDeviceAddress MemoryAllocator::GetDeviceAddress(VkBuffer buffer) const
+{
+	VkBufferDeviceAddressInfo info{};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	info.buffer = buffer;
+	return vkGetBufferDeviceAddress(m_device->GetLogical(), &info);
+}
+
+void MemoryAllocator::Invalidate(Allocation const* allocation) const
+{
+	if (m_memory_props.memoryTypes[allocation->MemoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+		return;
+
+	// The range must be aligned to the atom size, or reach the end of the memory.
+	VkDeviceSize memory_size = allocation->Block ? allocation->Block->Size : allocation->Offset + allocation->Size;
+	VkDeviceSize begin = allocation->Offset / m_non_coherent_atom_size * m_non_coherent_atom_size;
+	VkDeviceSize end = s_AlignUp(allocation->Offset + allocation->Size, m_non_coherent_atom_size);
+
+	VkMappedMemoryRange range{};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = allocation->Memory;
+	range.offset = begin;
+	range.size = end >= memory_size ? VK_WHOLE_SIZE : end - begin;
+	VALIDATE(vkInvalidateMappedMemoryRanges(m_device->GetLogical(), 1, &range) == VK_SUCCESS);
+}
+
+uint32_t MemoryAllocator::ChooseMemoryType(uint32_t type_bits, MemoryUsage usage) const
+{
+	VkMemoryPropertyFlags required = 0, preferred = 0, unwanted = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+	switch (usage)
+	{
+	case GPU_ONLY_MEMORY:
+		required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		unwanted |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		break;
+	case UPLOAD_MEMORY:
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		unwanted |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		break;
+	case DYNAMIC_MEMORY:
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		break;
+	case READBACK_MEMORY:
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		break;
+	case TRANSIENT_MEMORY:
+		required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		preferred = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		unwanted = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		break;
+	default:
+		ASSERT(false);
+	}
+
+	uint32_t best = ~0u;
+	int best_score = std::numeric_limits<int>::min();
+
+	for (uint32_t i = 0; i < m_memory_props.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = m_memory_props.memoryTypes[i].propertyFlags;
+		if (!(type_bits & (1u << i)) || (flags & required) != required)
+			continue;
+
+		int score = std::popcount(flags & preferred) - std::popcount(flags & unwanted);
+		if (score > best_score)
+			best = i, best_score = score;
+	}
+
+	VALIDATE(best != ~0u); // Ensure a suitable memory type exists.
+	return best;
+}
+
+Allocation* MemoryAllocator::Allocate(VkMemoryRequirements const& requirements, MemoryUsage usage, bool optimal_image)
+{
+	uint32_t memory_type = ChooseMemoryType(requirements.memoryTypeBits, usage);
+	uint32_t heap = m_memory_props.memoryTypes[memory_type].heapIndex;
+
+	std::lock_guard lock(m_mutex);
+
+	// Anything larger than half a block would mostly waste the rest of it.
+	if (requirements.size > m_block_sizes[heap] / 2)
+		return AllocateDedicated(requirements, memory_type, VK_NULL_HANDLE, VK_NULL_HANDLE);
+
+	return AllocateFromPool(requirements, memory_type, optimal_image);
+}
+
+void MemoryAllocator::Free(Allocation* allocation)
+{
+	if (!allocation)
+		return;
+
+	std::lock_guard lock(m_mutex);
+
+	HeapStats& stats = m_heap_stats[m_memory_props.memoryTypes[allocation->MemoryType].heapIndex];
+	stats.UsedBytes -= allocation->Size;
+	stats.AllocationCount--;
+
+	if (!allocation->Block)
+	{
+		vkFreeMemory(m_device->GetLogical(), allocation->Memory, nullptr);
+		m_allocation_count--;
+		stats.ReservedBytes -= allocation->Size;
+		stats.DedicatedCount--;
+		m_dedicated.erase(allocation);
+	}
+	else
+	{
+		// The destination of a move still in flight is never used now, EndDefragmentation skips the move.
+		if (m_moving.erase(allocation))
+		{
+			stats.UsedBytes -= allocation->Size;
+			FreeNode(allocation->MoveBlock, allocation->MoveNode);
+		}
+		FreeNode(allocation->Block, allocation->Node);
+	}
+
+	delete allocation;
+}
+
+void MemoryAllocator::FreeNode(MemoryBlock* block, uint32_t node)
+{
+	block->Tlsf.Free(node);
+
+	// Keep one empty block around so a free/allocate pattern does not thrash vkAllocateMemory.
+	auto& pool = m_pools[block->PoolIndex];
+	if (block->Tlsf.IsEmpty() && pool.size() > 1)
+	{
+		pool.erase(std::find(pool.begin(), pool.end(), block));
+		DestroyBlock(block);
+	}
+}
+
+VkBuffer MemoryAllocator::CreateBuffer(VkBufferCreateInfo const& create_info, MemoryUsage usage, Allocation** allocation)
+{
+	VkDevice ld = m_device->GetLogical();
+
+	VkBuffer buffer;
+	VALIDATE(vkCreateBuffer(ld, &create_info, nullptr, &buffer) == VK_SUCCESS);
+
+	VkMemoryDedicatedRequirements dedicated{};
+	dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+	VkMemoryRequirements2 reqs{};
+	reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	reqs.pNext = &dedicated;
+
+	VkBufferMemoryRequirementsInfo2 info{};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+	info.buffer = buffer;
+	vkGetBufferMemoryRequirements2(ld, &info, &reqs);
+
+	if (dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation)
+	{
+		uint32_t memory_type = ChooseMemoryType(reqs.memoryRequirements.memoryTypeBits, usage);
+		std::lock_guard lock(m_mutex);
+		*allocation = AllocateDedicated(reqs.memoryRequirements, memory_type, buffer, VK_NULL_HANDLE);
+	}
+	else
+		*allocation = Allocate(reqs.memoryRequirements, usage, false);
+
+	VALIDATE(vkBindBufferMemory(ld, buffer, (*allocation)->Memory, (*allocation)->Offset) == VK_SUCCESS);
+	return buffer;
+}
+
+VkImage MemoryAllocator::CreateImage(VkImageCreateInfo const& create_info, MemoryUsage usage, Allocation** allocation)
+{
+	VkDevice ld = m_device->GetLogical();
+
+	VkImage image;
+	VALIDATE(vkCreateImage(ld, &create_info, nullptr, &image) == VK_SUCCESS);
+
+	VkMemoryDedicatedRequirements dedicated{};
+	dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+	VkMemoryRequirements2 reqs{};
+	reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	reqs.pNext = &dedicated;
+
+	VkImageMemoryRequirementsInfo2 info{};
+	info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+	info.image = image;
+	vkGetImageMemoryRequirements2(ld, &info, &reqs);
+
+	bool attachment = create_info.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	bool large_target = attachment && reqs.memoryRequirements.size >= s_DEDICATED_ATTACHMENT_SIZE;
+
+	if (dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation || large_target)
+	{
+		uint32_t memory_type = ChooseMemoryType(reqs.memoryRequirements.memoryTypeBits, usage);
+		std::lock_guard lock(m_mutex);
+		*allocation = AllocateDedicated(reqs.memoryRequirements, memory_type, VK_NULL_HANDLE, image);
+	}
+	else
+		*allocation = Allocate(reqs.memoryRequirements, usage, create_info.tiling == VK_IMAGE_TILING_OPTIMAL);
+
+	VALIDATE(vkBindImageMemory(ld, image, (*allocation)->Memory, (*allocation)->Offset) == VK_SUCCESS);
+	return image;
+}
+
+void MemoryAllocator::DestroyBuffer(VkBuffer buffer, Allocation* allocation)
+{
+	vkDestroyBuffer(m_device->GetLogical(), buffer, nullptr);
+	Free(allocation);
+}
+
+void MemoryAllocator::DestroyImage(VkImage image, Allocation* allocation)
+{
+	vkDestroyImage(m_device->GetLogical(), image, nullptr);
+	Free(allocation);
+}
+
+DefragmentationPlan MemoryAllocator::BeginDefragmentation(VkDeviceSize max_bytes)
+{
+	std::lock_guard lock(m_mutex);
+
+	DefragmentationPlan plan;
+	VkDeviceSize moved = 0;
+
+	for (auto const& pool : m_pools)
+	{
+		if (pool.size() < 2)
+			continue;
+
+		// Empty the least used blocks into the fullest ones. Moves only ever go towards fuller blocks, never back.
+		std::vector<MemoryBlock*> blocks = pool;
+		std::sort(blocks.begin(), blocks.end(), [](MemoryBlock* a, MemoryBlock* b) {
+			return a->Tlsf.GetUsedBytes() < b->Tlsf.GetUsedBytes(); });
+
+		for (size_t src = 0; src + 1 < blocks.size() && moved < max_bytes; src++)
+		{
+			std::vector<Allocation*> candidates;
+			blocks[src]->Tlsf.ForEachAllocation([&](Allocation* owner, uint32_t) {
+				// Ranges reserved for an earlier move still belong to their source block, and nothing moves twice.
+				if (owner->Block == blocks[src] && !m_moving.contains(owner))
+					candidates.push_back(owner);
+			});
+
+			for (Allocation* allocation : candidates)
+			{
+				if (moved + allocation->Size > max_bytes)
+					break;
+
+				for (size_t dst = blocks.size() - 1; dst > src; dst--)
+				{
+					DefragmentationMove move{};
+					if (!blocks[dst]->Tlsf.Allocate(allocation->Size, allocation->Alignment, allocation, &move.DstNode, &move.DstOffset))
+						continue;
+
+					move.Target = allocation;
+					move.SrcMemory = allocation->Memory;
+					move.SrcOffset = allocation->Offset;
+					move.DstMemory = blocks[dst]->Memory;
+					move.DstBlock = blocks[dst];
+					move.Size = allocation->Size;
+					plan.Moves.push_back(move);
+
+					allocation->MoveBlock = blocks[dst];
+					allocation->MoveNode = move.DstNode;
+					m_moving.insert(allocation);
+
+					m_heap_stats[m_memory_props.memoryTypes[allocation->MemoryType].heapIndex].UsedBytes += allocation->Size;
+					moved += allocation->Size;
+					break;
+				}
+			}
+		}
+	}
+
+	return plan;
+}
+
+void MemoryAllocator::EndDefragmentation(DefragmentationPlan const& plan)
+{
+	std::lock_guard lock(m_mutex);
+
+	for (DefragmentationMove const& move : plan.Moves)
+	{
+		// Freed since, and its destination with it. A new allocation at the same address carries a different move.
+		Allocation* allocation = move.Target;
+		if (!m_moving.contains(allocation) || allocation->MoveBlock != move.DstBlock || allocation->MoveNode != move.DstNode)
+			continue;
+		m_moving.erase(allocation);
+
+		allocation->Block->Tlsf.Free(allocation->Node);
+		m_heap_stats[m_memory_props.memoryTypes[allocation->MemoryType].heapIndex].UsedBytes -= allocation->Size;
+
+		allocation->Memory = move.DstMemory;
+		allocation->Offset = move.DstOffset;
+		allocation->Block = move.DstBlock;
+		allocation->Node = move.DstNode;
+		allocation->Mapped = move.DstBlock->Mapped ? static_cast<char*>(move.DstBlock->Mapped) + move.DstOffset : nullptr;
+		allocation->MoveBlock = nullptr;
+	}
+
+	for (auto& pool : m_pools)
+	{
+		for (size_t i = 0; i < pool.size() && pool.size() > 1;)
+		{
+			if (pool[i]->Tlsf.IsEmpty())
+			{
+				DestroyBlock(pool[i]);
+				pool.erase(pool.begin() + i);
+			}
+			else
+				i++;
+		}
+	}
+}
+
+std::vector<HeapStats> MemoryAllocator::GetHeapStats() const
+{
+	std::lock_guard lock(m_mutex);
+
+	std::vector<HeapStats> stats = m_heap_stats;
+	for (HeapStats& heap : stats)
+		heap.WastedBytes = heap.ReservedBytes - heap.UsedBytes;
+	return stats;
+}
+
+void MemoryAllocator::PrintStats() const
+{
+	auto stats = GetHeapStats();
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		HeapStats const& heap = stats[i];
+		std::cout << "[Memory] heap " << i << ": " << (heap.ReservedBytes >> 20) << "/" << (heap.HeapSize >> 20) << " MiB reserved, "
+			<< (heap.UsedBytes >> 10) << " KiB used, " << (heap.WastedBytes >> 10) << " KiB wasted, "
+			<< heap.BlockCount << " blocks, " << heap.AllocationCount << " allocations (" << heap.DedicatedCount << " dedicated)\n";
+	}
+}
+
+Allocation* MemoryAllocator::AllocateDedicated(VkMemoryRequirements const& requirements, uint32_t memory_type, VkBuffer buffer, VkImage image)
+{
+	Allocation* allocation = new Allocation{};
+	allocation->Memory = AllocateMemory(requirements.size, memory_type, buffer, image, &allocation->Mapped);
+	allocation->Offset = 0;
+	allocation->Size = requirements.size;
+	allocation->Alignment = requirements.alignment;
+	allocation->MemoryType = memory_type;
+	allocation->Block = nullptr;
+
+	HeapStats& stats = m_heap_stats[m_memory_props.memoryTypes[memory_type].heapIndex];
+	stats.ReservedBytes += requirements.size;
+	stats.UsedBytes += requirements.size;
+	stats.AllocationCount++;
+	stats.DedicatedCount++;
+
+	m_dedicated.insert(allocation);
+	return allocation;
+}
+
+Allocation* MemoryAllocator::AllocateFromPool(VkMemoryRequirements const& requirements, uint32_t memory_type, bool optimal_image)
+{
+	uint32_t pool_index = memory_type * 2 + (optimal_image ? 1 : 0);
+	auto& pool = m_pools[pool_index];
+
+	Allocation* allocation = new Allocation{};
+	allocation->Size = requirements.size;
+	allocation->Alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+	allocation->MemoryType = memory_type;
+
+	MemoryBlock* block = nullptr;
+	for (MemoryBlock* candidate : pool)
+	{
+		if (candidate->Tlsf.Allocate(allocation->Size, allocation->Alignment, allocation, &allocation->Node, &allocation->Offset))
+		{
+			block = candidate;
+			break;
+		}
+	}
+
+	if (!block)
+	{
+		block = CreateBlock(memory_type, pool_index);
+		pool.push_back(block);
+		VALIDATE(block->Tlsf.Allocate(allocation->Size, allocation->Alignment, allocation, &allocation->Node, &allocation->Offset));
+	}
+
+	allocation->Block = block;
+	allocation->Memory = block->Memory;
+	allocation->Mapped = block->Mapped ? static_cast<char*>(block->Mapped) + allocation->Offset : nullptr;
+
+	HeapStats& stats = m_heap_stats[m_memory_props.memoryTypes[memory_type].heapIndex];
+	stats.UsedBytes += allocation->Size;
+	stats.AllocationCount++;
+
+	return allocation;
+}
+
+MemoryBlock* MemoryAllocator::CreateBlock(uint32_t memory_type, uint32_t pool_index)
+{
+	uint32_t heap = m_memory_props.memoryTypes[memory_type].heapIndex;
+	VkDeviceSize size = m_block_sizes[heap];
+
+	void* mapped = nullptr;
+	VkDeviceMemory memory = AllocateMemory(size, memory_type, VK_NULL_HANDLE, VK_NULL_HANDLE, &mapped);
+
+	m_heap_stats[heap].ReservedBytes += size;
+	m_heap_stats[heap].BlockCount++;
+
+	return new MemoryBlock{ memory, size, mapped, memory_type, pool_index, TlsfAllocator(size) };
+}
+
+void MemoryAllocator::DestroyBlock(MemoryBlock* block)
+{
+	HeapStats& stats = m_heap_stats[m_memory_props.memoryTypes[block->MemoryType].heapIndex];
+	stats.ReservedBytes -= block->Size;
+	stats.BlockCount--;
+
+	vkFreeMemory(m_device->GetLogical(), block->Memory, nullptr);
+	m_allocation_count--;
+	delete block;
+}
+
+VkDeviceMemory MemoryAllocator::AllocateMemory(VkDeviceSize size, uint32_t memory_type, VkBuffer buffer, VkImage image, void** mapped)
+{
+	// Running into maxMemoryAllocationCount is exactly what sub-allocation exists to avoid.
+	VALIDATE(m_allocation_count < m_max_allocation_count);
+
+	VkMemoryDedicatedAllocateInfo dedicated{};
+	dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicated.buffer = buffer;
+	dedicated.image = image;
+
+	// Any buffer placed in the memory may ask for its device address, so every allocation that can hold buffers allows it.
+	VkMemoryAllocateFlagsInfo flags{};
+	flags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+	flags.pNext = buffer || image ? &dedicated : nullptr;
+	flags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+
+	VkMemoryAllocateInfo info{};
+	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	info.pNext = image ? flags.pNext : &flags;
+	info.allocationSize = size;
+	info.memoryTypeIndex = memory_type;
+
+	VkDevice ld = m_device->GetLogical();
+	VkDeviceMemory memory;
+	VALIDATE(vkAllocateMemory(ld, &info, nullptr, &memory) == VK_SUCCESS);
+	m_allocation_count++;
+
+	*mapped = nullptr;
+	if (m_memory_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		VALIDATE(vkMapMemory(ld, memory, 0, VK_WHOLE_SIZE, 0, mapped) == VK_SUCCESS);
+
+	return memory;
+}
+
+LinearPool::LinearPool(MemoryAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memory_usage)
+	: m_allocator(&allocator), m_size(size), m_head(0), m_tail(0)
+{
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = size;
+	create_info.usage = usage;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	m_buffer = allocator.CreateBuffer(create_info, memory_usage, &m_allocation);
+	VALIDATE(m_allocation->Mapped); // Linear pools are written by the CPU.
+}
+
+LinearPool::~LinearPool()
+{
+	m_allocator->DestroyBuffer(m_buffer, m_allocation);
+}
+
+bool LinearPool::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+	if (size > m_size)
+		return false;
+
+	// Aligned within the buffer rather than in absolute terms, as the size need not be a multiple of anything.
+	VkDeviceSize lap = m_head - m_head % m_size;
+	VkDeviceSize start = lap + s_AlignUp(m_head - lap, alignment);
+
+	// Ranges never wrap around the end of the buffer, skip ahead to the start instead.
+	if (start - lap + size > m_size)
+		start = lap + m_size;
+
+	if (start + size - m_tail > m_size)
+		return false;
+
+	*offset = start % m_size;
+	m_head = start + size;
+	return true;
+}
\ No newline at end of file
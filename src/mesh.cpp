@@ -0,0 +1,92 @@
+#include "mesh.hpp"
+#include "vulkan.hpp"
+#include "render.hpp"
+#include "memory.hpp"
+#include "asset_pack.hpp"
+#include "culling.hpp"
+#include <cfloat>
+
+#define THISFILE "mesh.cpp"
+
+static VkBuffer s_CreateBuffer(MemoryAllocator* allocator, VkDeviceSize size, VkBufferUsageFlags usage, Allocation** allocation)
+{
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = size;
+	create_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	return allocator->CreateBuffer(create_info, GPU_ONLY_MEMORY, allocation);
+}
+
+Mesh::Mesh(GraphicsDevice const& device, AssetPack const& pack, std::string_view name, Uploader& uploader)
+	: m_device(&device)
+{
+	AssetView asset = pack.Find(name);
+	VALIDATE(asset.Data && asset.Type == ASSET_MESH && asset.Size >= sizeof(MeshHeader));
+
+	char const* data = static_cast<char const*>(asset.Data);
+	m_header = reinterpret_cast<MeshHeader const*>(data);
+	m_lods = reinterpret_cast<MeshLodRange const*>(m_header + 1);
+
+	// Everything below reads straight from the mapping, so every range is checked once here.
+	MeshHeader const& header = *m_header;
+	VALIDATE(header.Magic == MESH_MAGIC && header.Version == MESH_VERSION);
+	VALIDATE(header.LodCount && header.LodCount <= MESH_MAX_LODS && header.LodCount <= MAX_MESH_LODS);
+	VALIDATE(header.VertexCount && header.IndexCount && (header.IndexSize == 2 || header.IndexSize == 4));
+	VALIDATE(sizeof(MeshHeader) + header.LodCount * sizeof(MeshLodRange) <= header.VertexOffset && header.VertexOffset % 16 == 0);
+	VALIDATE(header.VertexOffset + uint64_t(header.VertexCount) * sizeof(PackedVertex) <= header.IndexOffset);
+	VALIDATE(header.IndexOffset % header.IndexSize == 0 && header.IndexOffset + uint64_t(header.IndexCount) * header.IndexSize <= asset.Size);
+	for (uint32_t i = 0; i < header.LodCount; i++)
+		VALIDATE(uint64_t(m_lods[i].FirstIndex) + m_lods[i].IndexCount <= header.IndexCount && m_lods[i].IndexCount % 3 == 0);
+
+	m_vertices = reinterpret_cast<PackedVertex const*>(data + header.VertexOffset);
+	m_index_type = header.IndexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	VkDeviceSize vertex_size = VkDeviceSize(header.VertexCount) * sizeof(PackedVertex);
+	VkDeviceSize index_size = VkDeviceSize(header.IndexCount) * header.IndexSize;
+
+	MemoryAllocator* allocator = device.GetAllocator();
+	// Vertices are also read by address, as the rest pose of compute skinning.
+	m_vertex_buffer = s_CreateBuffer(allocator, vertex_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, &m_vertex_allocation);
+	m_vertex_address = allocator->GetDeviceAddress(m_vertex_buffer);
+	m_index_buffer = s_CreateBuffer(allocator, index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &m_index_allocation);
+
+	// The pack outlives the uploads, so they copy from the mapping into staging directly. Tickets are handed out
+	// in order, so the index upload's also covers the vertices.
+	uploader.UploadBuffer(m_vertex_buffer, 0, data + header.VertexOffset, vertex_size,
+		VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+	m_ticket = uploader.UploadBuffer(m_index_buffer, 0, data + header.IndexOffset, index_size,
+		VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT);
+}
+
+Mesh::~Mesh()
+{
+	MemoryAllocator* allocator = m_device->GetAllocator();
+	allocator->DestroyBuffer(m_index_buffer, m_index_allocation);
+	allocator->DestroyBuffer(m_vertex_buffer, m_vertex_allocation);
+}
+
+CullMesh Mesh::GetCullMesh(float distance_per_error) const
+{
+	CullMesh mesh{};
+	mesh.LodCount = m_header->LodCount;
+	for (uint32_t i = 0; i < mesh.LodCount; i++)
+	{
+		bool last = i + 1 == mesh.LodCount;
+		mesh.Lods[i].IndexCount = m_lods[i].IndexCount;
+		mesh.Lods[i].FirstIndex = m_lods[i].FirstIndex;
+		mesh.Lods[i].VertexOffset = 0;
+		mesh.Lods[i].MaxDistance = last ? FLT_MAX : m_lods[i + 1].Error * distance_per_error;
+	}
+	return mesh;
+}
+
+void Mesh::AddVertexInput(GraphicsPipelineCreator& creator)
+{
+	creator.AddVertexBinding(0, sizeof(PackedVertex));
+	creator.AddVertexAttribute(0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(PackedVertex, Position));
+	creator.AddVertexAttribute(1, 0, VK_FORMAT_R16G16_SNORM, offsetof(PackedVertex, Normal));
+	creator.AddVertexAttribute(2, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, Uv));
+}
\ No newline at end of file
@@ -0,0 +1,516 @@
+#include "navigation.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+#include <cmath>
+#include <numeric>
+
+#define THISFILE "navigation.cpp"
+
+static constexpr uint32_t s_UNREACHABLE = UINT32_MAX;
+static constexpr uint8_t s_NO_DIRECTION = 8;
+
+// Path costs are whole numbers: a straight step across a cell costs ten times its cost, a diagonal one fourteen,
+// close enough to the square root of two.
+static constexpr uint32_t s_STRAIGHT_STEP = 10;
+static constexpr uint32_t s_DIAGONAL_STEP = 14;
+
+// Keeps path costs, at most 254 * 14 per cell, within 32 bits.
+static constexpr uint64_t s_MAX_CELLS = 1u << 20;
+
+// Ring of buckets in Propagate, which must span more than the costliest step.
+static constexpr uint32_t s_BUCKET_COUNT = 4096;
+static constexpr uint32_t s_BUCKET_MASK = s_BUCKET_COUNT - 1;
+static_assert(s_BUCKET_COUNT > (NAV_BLOCKED - 1) * s_DIAGONAL_STEP);
+
+// Straight neighbours first, so that ties between equally short paths go straight rather than diagonally.
+static constexpr int32_t s_OFFSETS[8][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }, { 1, 1 }, { -1, 1 }, { 1, -1 }, { -1, -1 } };
+static constexpr uint32_t s_STEPS[8] = { s_STRAIGHT_STEP, s_STRAIGHT_STEP, s_STRAIGHT_STEP, s_STRAIGHT_STEP,
+	s_DIAGONAL_STEP, s_DIAGONAL_STEP, s_DIAGONAL_STEP, s_DIAGONAL_STEP };
+
+// Unit vectors of the directions, plus zero for none.
+static constexpr float s_DIAGONAL = 0.70710678f;
+static constexpr float s_VECTORS[9][2] = { { 1.0f, 0.0f }, { -1.0f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, -1.0f },
+	{ s_DIAGONAL, s_DIAGONAL }, { -s_DIAGONAL, s_DIAGONAL }, { s_DIAGONAL, -s_DIAGONAL }, { -s_DIAGONAL, -s_DIAGONAL }, { 0.0f, 0.0f } };
+
+// Agents separated per job.
+static constexpr uint32_t s_SEPARATION_GRAIN = 256;
+
+static uint32_t s_HashCell(int32_t x, int32_t z, uint32_t mask)
+{
+	return (static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(z) * 19349663u) & mask;
+}
+
+NavigationGrid::NavigationGrid(JobSystem* jobs, uint32_t width, uint32_t height, float cell_size, float const origin[2])
+	: m_jobs(jobs), m_width(width), m_height(height), m_cell_size(cell_size), m_origin{ origin[0], origin[1] },
+	m_costs(size_t(width) * height, NAV_OPEN), m_is_changed(size_t(width) * height, false)
+{
+	VALIDATE(width && height && uint64_t(width) * height <= s_MAX_CELLS);
+	VALIDATE(cell_size > 0.0f);
+}
+
+NavigationGrid::~NavigationGrid()
+{
+	for (Field* field : m_fields)
+		delete field;
+}
+
+void NavigationGrid::SetCost(uint32_t x, uint32_t y, uint8_t cost)
+{
+	ASSERT(x < m_width && y < m_height && cost);
+	uint32_t cell = y * m_width + x;
+	if (!m_is_changed[cell])
+	{
+		m_is_changed[cell] = true;
+		m_changes.push_back({ cell, m_costs[cell] });
+	}
+	m_costs[cell] = cost;
+}
+
+FlowFieldHandle NavigationGrid::AddField(float const goal[2])
+{
+	Field* field = new Field{};
+	field->Goal = GetCell(goal);
+	field->Dirty = true;
+	VALIDATE(field->Goal != s_UNREACHABLE);
+
+	auto free = std::find(m_fields.begin(), m_fields.end(), nullptr);
+	if (free != m_fields.end())
+	{
+		*free = field;
+		return static_cast<FlowFieldHandle>(free - m_fields.begin());
+	}
+	m_fields.push_back(field);
+	return static_cast<FlowFieldHandle>(m_fields.size() - 1);
+}
+
+void NavigationGrid::RemoveField(FlowFieldHandle field)
+{
+	ASSERT(field < m_fields.size() && m_fields[field]);
+	delete m_fields[field];
+	m_fields[field] = nullptr;
+}
+
+void NavigationGrid::SetGoal(FlowFieldHandle field, float const goal[2])
+{
+	ASSERT(field < m_fields.size() && m_fields[field]);
+	uint32_t cell = GetCell(goal);
+	VALIDATE(cell != s_UNREACHABLE);
+	if (cell != m_fields[field]->Goal)
+	{
+		m_fields[field]->Goal = cell;
+		m_fields[field]->Dirty = true;
+	}
+}
+
+void NavigationGrid::Update()
+{
+	PROFILE_CPU("Flow fields");
+
+	std::vector<Field*> fields;
+	for (Field* field : m_fields)
+		if (field && (field->Dirty || !m_changes.empty()))
+			fields.push_back(field);
+
+	// One field per job: each is a serial search, and a handful of goals is the usual case.
+	auto update = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			Field& field = *fields[i];
+			auto start = std::chrono::steady_clock::now();
+			field.Stats.Rebuilt = field.Dirty;
+			if (field.Dirty)
+				Rebuild(field);
+			else
+				Repair(field);
+			field.Dirty = false;
+			field.Stats.UpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			field.Stats.TouchedCells = static_cast<uint32_t>(field.Touched.size());
+			for (uint32_t cell : field.Touched)
+				field.IsTouched[cell] = false;
+			field.Touched.clear();
+		}
+	};
+
+	uint32_t count = static_cast<uint32_t>(fields.size());
+	if (m_jobs && count > 1)
+		m_jobs->ParallelFor(count, 1, update);
+	else
+		update(0, count);
+
+	for (Change const& change : m_changes)
+		m_is_changed[change.Cell] = false;
+	m_changes.clear();
+}
+
+void NavigationGrid::Sample(FlowFieldHandle field, float const position[2], float direction[2]) const
+{
+	ASSERT(field < m_fields.size() && m_fields[field]);
+	Field const& flow = *m_fields[field];
+
+	// A field added since the last Update has nothing built yet.
+	uint32_t cell = flow.Directions.empty() ? s_UNREACHABLE : GetCell(position);
+	float const* vector = s_VECTORS[cell == s_UNREACHABLE ? s_NO_DIRECTION : flow.Directions[cell]];
+	direction[0] = vector[0];
+	direction[1] = vector[1];
+}
+
+float NavigationGrid::GetDistance(FlowFieldHandle field, float const position[2]) const
+{
+	ASSERT(field < m_fields.size() && m_fields[field]);
+	Field const& flow = *m_fields[field];
+	uint32_t cell = flow.Distances.empty() ? s_UNREACHABLE : GetCell(position);
+	uint32_t distance = cell == s_UNREACHABLE ? s_UNREACHABLE : flow.Distances[cell];
+	if (distance == s_UNREACHABLE)
+		return std::numeric_limits<float>::infinity();
+	return distance * (m_cell_size / s_STRAIGHT_STEP);
+}
+
+void NavigationGrid::PrintStats() const
+{
+	for (size_t i = 0; i < m_fields.size(); i++)
+	{
+		if (!m_fields[i])
+			continue;
+		FlowFieldStats const& stats = m_fields[i]->Stats;
+		std::cout << "[Navigation] Field " << i << (stats.Rebuilt ? " rebuilt" : " repaired") << " in " << stats.UpdateMs << " ms, "
+			<< stats.TouchedCells << " of " << m_costs.size() << " cells changed\n";
+	}
+}
+
+// The cell containing position, or s_UNREACHABLE off the grid.
+uint32_t NavigationGrid::GetCell(float const position[2]) const
+{
+	float x = std::floor((position[0] - m_origin[0]) / m_cell_size);
+	float y = std::floor((position[1] - m_origin[1]) / m_cell_size);
+	if (!(x >= 0.0f && y >= 0.0f && x < m_width && y < m_height))
+		return s_UNREACHABLE;
+	return static_cast<uint32_t>(y) * m_width + static_cast<uint32_t>(x);
+}
+
+// Whether an agent in cell (x, y) may step to its neighbour in direction. Diagonal steps may not cut the corner of
+// a blocked cell, or agents would clip walls.
+bool NavigationGrid::CanStep(int32_t x, int32_t y, uint32_t direction) const
+{
+	int32_t dx = s_OFFSETS[direction][0], dy = s_OFFSETS[direction][1];
+	if (x + dx < 0 || y + dy < 0 || x + dx >= int32_t(m_width) || y + dy >= int32_t(m_height))
+		return false;
+	if (m_costs[(y + dy) * m_width + x + dx] == NAV_BLOCKED)
+		return false;
+	if (dx && dy)
+		return m_costs[y * m_width + x + dx] != NAV_BLOCKED && m_costs[(y + dy) * m_width + x] != NAV_BLOCKED;
+	return true;
+}
+
+void NavigationGrid::Rebuild(Field& field) const
+{
+	field.Distances.assign(m_costs.size(), s_UNREACHABLE);
+	field.Directions.assign(m_costs.size(), s_NO_DIRECTION);
+	field.IsTouched.assign(m_costs.size(), false);
+	field.Queue.clear();
+
+	field.Distances[field.Goal] = 0;
+	Touch(field, field.Goal);
+	if (m_costs[field.Goal] != NAV_BLOCKED)
+		field.Queue.push_back(field.Goal);
+	Propagate(field);
+
+	std::vector<uint32_t> cells(m_costs.size());
+	std::iota(cells.begin(), cells.end(), 0u);
+	UpdateDirections(field, cells);
+}
+
+// Cost changes since the last update, applied to a field that was up to date before them.
+void NavigationGrid::Repair(Field& field) const
+{
+	std::vector<uint32_t>& touched = field.Touched;
+	field.Queue.clear();
+
+	// The neighbour of cell in direction, or s_UNREACHABLE off the grid.
+	auto neighbour = [this](uint32_t cell, uint32_t direction) {
+		int32_t x = static_cast<int32_t>(cell % m_width) + s_OFFSETS[direction][0];
+		int32_t y = static_cast<int32_t>(cell / m_width) + s_OFFSETS[direction][1];
+		if (x < 0 || y < 0 || x >= int32_t(m_width) || y >= int32_t(m_height))
+			return s_UNREACHABLE;
+		return static_cast<uint32_t>(y) * m_width + static_cast<uint32_t>(x);
+	};
+	auto invalidate = [&](uint32_t cell) {
+		if (cell != field.Goal && field.Distances[cell] != s_UNREACHABLE)
+		{
+			field.Distances[cell] = s_UNREACHABLE;
+			Touch(field, cell);
+		}
+	};
+
+	// Raised cells cost more to leave, and blocked ones can no longer be stepped to or past. Clear them and the
+	// neighbours whose step is now forbidden, then everything whose path runs through a cleared cell, found by
+	// following the directions backwards.
+	for (Change const& change : m_changes)
+	{
+		if (m_costs[change.Cell] <= change.OldCost)
+			continue;
+		invalidate(change.Cell);
+		for (uint32_t d = 0; d < 8; d++)
+		{
+			uint32_t next = neighbour(change.Cell, d);
+			if (next != s_UNREACHABLE && field.Directions[next] != s_NO_DIRECTION && !CanStep(next % m_width, next / m_width, field.Directions[next]))
+				invalidate(next);
+		}
+	}
+
+	for (size_t i = 0; i < touched.size(); i++)
+	{
+		for (uint32_t d = 0; d < 8; d++)
+		{
+			uint32_t next = neighbour(touched[i], d);
+			if (next != s_UNREACHABLE && field.Directions[next] != s_NO_DIRECTION && neighbour(next, field.Directions[next]) == touched[i])
+				invalidate(next);
+		}
+	}
+
+	// Cheapest path from a cell through its neighbours as they stand, queued if it improves on the cell's own.
+	auto seed = [&](uint32_t cell) {
+		if (cell == s_UNREACHABLE || cell == field.Goal || m_costs[cell] == NAV_BLOCKED)
+			return;
+		uint32_t best = field.Distances[cell];
+		int32_t x = static_cast<int32_t>(cell % m_width), y = static_cast<int32_t>(cell / m_width);
+		for (uint32_t d = 0; d < 8; d++)
+		{
+			if (!CanStep(x, y, d))
+				continue;
+			uint32_t distance = field.Distances[neighbour(cell, d)];
+			if (distance != s_UNREACHABLE)
+				best = std::min(best, distance + m_costs[cell] * s_STEPS[d]);
+		}
+		if (best < field.Distances[cell])
+		{
+			field.Distances[cell] = best;
+			field.Queue.push_back(uint64_t(best) << 32 | cell);
+			Touch(field, cell);
+		}
+	};
+
+	// Cleared cells refill from the uncleared cells around them. Lowered cells may now be cheaper to leave, and
+	// an unblocked one opens steps into and past it for its neighbours.
+	size_t const cleared = touched.size();
+	for (size_t i = 0; i < cleared; i++)
+		seed(touched[i]);
+	for (Change const& change : m_changes)
+	{
+		if (m_costs[change.Cell] >= change.OldCost)
+			continue;
+		seed(change.Cell);
+		for (uint32_t d = 0; d < 8; d++)
+			seed(neighbour(change.Cell, d));
+	}
+
+	Propagate(field);
+
+	// Directions change where distances did, next to them, and next to cells whose cost changed. The touched flags
+	// keep the list free of repeats, and are cleared again for the cells that are only neighbours.
+	std::vector<uint32_t> cells(touched);
+	auto add_neighbours = [&](uint32_t cell) {
+		for (uint32_t d = 0; d < 8; d++)
+		{
+			uint32_t next = neighbour(cell, d);
+			if (next != s_UNREACHABLE && !field.IsTouched[next])
+			{
+				field.IsTouched[next] = true;
+				cells.push_back(next);
+			}
+		}
+	};
+	for (uint32_t cell : touched)
+		add_neighbours(cell);
+	for (Change const& change : m_changes)
+	{
+		if (!field.IsTouched[change.Cell])
+		{
+			field.IsTouched[change.Cell] = true;
+			cells.push_back(change.Cell);
+		}
+		add_neighbours(change.Cell);
+	}
+	UpdateDirections(field, cells);
+
+	for (size_t i = touched.size(); i < cells.size(); i++)
+		field.IsTouched[cells[i]] = false;
+}
+
+// Record that the distance of cell changed in this update.
+void NavigationGrid::Touch(Field& field, uint32_t cell) const
+{
+	if (!field.IsTouched[cell])
+	{
+		field.IsTouched[cell] = true;
+		field.Touched.push_back(cell);
+	}
+}
+
+// Dijkstra from the queued cells, lowering the distances of their neighbours. Steps cost small whole numbers, so
+// rather than a heap, cells wait in a ring of buckets by distance (Dial's algorithm): everything waiting is within
+// one step of the cell being expanded, and finding the next is a short scan instead of a logarithmic sift. The
+// queued cells themselves can be any distance apart, so they are sorted and merged in as the scan reaches them.
+void NavigationGrid::Propagate(Field& field) const
+{
+	std::vector<uint64_t>& seeds = field.Queue;
+	std::sort(seeds.begin(), seeds.end());
+	field.Buckets.resize(s_BUCKET_COUNT);
+
+	size_t next_seed = 0;
+	uint32_t waiting = 0;
+	uint32_t distance = 0;
+	while (waiting || next_seed < seeds.size())
+	{
+		uint32_t cell;
+		if (!waiting)
+			distance = static_cast<uint32_t>(seeds[next_seed] >> 32);
+		while (field.Buckets[distance & s_BUCKET_MASK].empty() && (next_seed == seeds.size() || seeds[next_seed] >> 32 > distance))
+			distance++;
+
+		std::vector<uint32_t>& bucket = field.Buckets[distance & s_BUCKET_MASK];
+		if (next_seed < seeds.size() && seeds[next_seed] >> 32 == distance)
+		{
+			cell = static_cast<uint32_t>(seeds[next_seed++]);
+		}
+		else
+		{
+			cell = bucket.back();
+			bucket.pop_back();
+			waiting--;
+		}
+		if (distance != field.Distances[cell])
+			continue; // Superseded by a shorter path
+
+		int32_t x = static_cast<int32_t>(cell % m_width), y = static_cast<int32_t>(cell / m_width);
+		for (uint32_t d = 0; d < 8; d++)
+		{
+			// The neighbour steps here in the opposite direction, which the blocked checks treat the same.
+			if (!CanStep(x, y, d))
+				continue;
+			uint32_t next = static_cast<uint32_t>((y + s_OFFSETS[d][1]) * int32_t(m_width) + x + s_OFFSETS[d][0]);
+			uint32_t next_distance = distance + m_costs[next] * s_STEPS[d];
+			if (next_distance < field.Distances[next])
+			{
+				field.Distances[next] = next_distance;
+				Touch(field, next);
+				field.Buckets[next_distance & s_BUCKET_MASK].push_back(next);
+				waiting++;
+			}
+		}
+	}
+	seeds.clear();
+}
+
+// Point each of cells at the neighbour its cheapest path steps to, which is also the one its distance came from.
+void NavigationGrid::UpdateDirections(Field& field, std::vector<uint32_t> const& cells) const
+{
+	for (uint32_t cell : cells)
+	{
+		uint8_t best = s_NO_DIRECTION;
+		if (cell != field.Goal && field.Distances[cell] != s_UNREACHABLE)
+		{
+			uint32_t best_distance = s_UNREACHABLE;
+			int32_t x = static_cast<int32_t>(cell % m_width), y = static_cast<int32_t>(cell / m_width);
+			for (uint32_t d = 0; d < 8; d++)
+			{
+				if (!CanStep(x, y, d))
+					continue;
+				uint32_t distance = field.Distances[(y + s_OFFSETS[d][1]) * m_width + x + s_OFFSETS[d][0]];
+				if (distance == s_UNREACHABLE)
+					continue;
+				distance += m_costs[cell] * s_STEPS[d];
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best = static_cast<uint8_t>(d);
+				}
+			}
+		}
+		field.Directions[cell] = best;
+	}
+}
+
+SeparationSolver::SeparationSolver(JobSystem* jobs)
+	: m_jobs(jobs)
+{
+}
+
+void SeparationSolver::Compute(float const* positions, uint32_t count, float radius, float* separation)
+{
+	PROFILE_CPU("Separation");
+	ASSERT(radius > 0.0f);
+
+	// Bucket agents by the radius-sized cell they stand in, counting sort style. Around two buckets per agent
+	// keeps collisions between unrelated cells rare; they only cost distance checks.
+	uint32_t bucket_count = 64;
+	while (bucket_count < count * 2)
+		bucket_count *= 2;
+	uint32_t const mask = bucket_count - 1;
+	float const inverse_radius = 1.0f / radius;
+
+	m_bucket_starts.assign(bucket_count + 1, 0);
+	m_buckets.resize(count);
+	m_sorted.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		int32_t x = static_cast<int32_t>(std::floor(positions[i * 2] * inverse_radius));
+		int32_t z = static_cast<int32_t>(std::floor(positions[i * 2 + 1] * inverse_radius));
+		m_buckets[i] = s_HashCell(x, z, mask);
+		m_bucket_starts[m_buckets[i] + 1]++;
+	}
+	for (uint32_t i = 0; i < bucket_count; i++)
+		m_bucket_starts[i + 1] += m_bucket_starts[i];
+	{
+		std::vector<uint32_t> offsets(m_bucket_starts.begin(), m_bucket_starts.end() - 1);
+		for (uint32_t i = 0; i < count; i++)
+			m_sorted[offsets[m_buckets[i]]++] = i;
+	}
+
+	float const radius_squared = radius * radius;
+
+	auto body = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			float px = positions[i * 2], pz = positions[i * 2 + 1];
+			int32_t x = static_cast<int32_t>(std::floor(px * inverse_radius));
+			int32_t z = static_cast<int32_t>(std::floor(pz * inverse_radius));
+
+			// Anyone within the radius is in the 3x3 cells around. Cells sharing a bucket are visited once.
+			uint32_t visited[9];
+			uint32_t visited_count = 0;
+			float sx = 0.0f, sz = 0.0f;
+			for (int32_t dz = -1; dz <= 1; dz++)
+			{
+				for (int32_t dx = -1; dx <= 1; dx++)
+				{
+					uint32_t bucket = s_HashCell(x + dx, z + dz, mask);
+					if (std::find(visited, visited + visited_count, bucket) != visited + visited_count)
+						continue;
+					visited[visited_count++] = bucket;
+
+					for (uint32_t k = m_bucket_starts[bucket]; k < m_bucket_starts[bucket + 1]; k++)
+					{
+						uint32_t j = m_sorted[k];
+						float ox = px - positions[j * 2], oz = pz - positions[j * 2 + 1];
+						float distance_squared = ox * ox + oz * oz;
+
+						// Agents on the same spot, including this one, give no direction to part in.
+						if (distance_squared >= radius_squared || distance_squared == 0.0f)
+							continue;
+						float distance = std::sqrt(distance_squared);
+						float weight = (1.0f - distance * inverse_radius) / distance;
+						sx += ox * weight;
+						sz += oz * weight;
+					}
+				}
+			}
+			separation[i * 2] = sx;
+			separation[i * 2 + 1] = sz;
+		}
+	};
+
+	if (m_jobs)
+		m_jobs->ParallelFor(count, s_SEPARATION_GRAIN, body);
+	else
+		body(0, count);
+}
\ No newline at end of file
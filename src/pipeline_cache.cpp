@@ -0,0 +1,231 @@
+#include "pipeline_cache.hpp"
+#include "vulkan.hpp"
+#include <fstream>
+#include <filesystem>
+
+#define THISFILE "pipeline_cache.cpp"
+
+// Prefixed to the driver blob on disk. Drivers are not required to survive truncated or corrupted
+// cache data, so the blob is only handed over after its size and hash have been checked.
+struct PipelineCacheFileHeader
+{
+	uint32_t Magic;
+	uint32_t DriverVersion;
+	uint64_t DataSize;
+	uint64_t DataHash;
+};
+
+static constexpr uint32_t s_CACHE_MAGIC = 0x3143504D; // "MPC1"
+
+static uint64_t s_HashBytes(char const* data, size_t size)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ull;
+	return hash;
+}
+
+static double s_NanosecondsToMs(uint64_t ns)
+{
+	return static_cast<double>(ns) / 1e6;
+}
+
+PipelineCache::PipelineCache(GraphicsDevice const& device, std::string const& filepath)
+	: m_device(device.GetLogical()), m_filepath(filepath), m_stats{}
+{
+	vkGetPhysicalDeviceProperties(device.GetPhysical(), &m_properties);
+
+	std::vector<char> initial_data = LoadValidated();
+
+	VkPipelineCacheCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	create_info.initialDataSize = initial_data.size();
+	create_info.pInitialData = initial_data.empty() ? nullptr : initial_data.data();
+
+	VALIDATE(vkCreatePipelineCache(m_device, &create_info, nullptr, &m_cache) == VK_SUCCESS);
+}
+
+PipelineCache::~PipelineCache()
+{
+	Save();
+
+	PipelineCacheStats stats = GetStats();
+	std::cout << "[PipelineCache] " << stats.Hits << " hits (" << stats.HitMs << " ms), "
+		<< stats.Misses << " misses (" << stats.MissMs << " ms)\n";
+
+	vkDestroyPipelineCache(m_device, m_cache, nullptr);
+}
+
+std::vector<char> PipelineCache::LoadValidated() const
+{
+	std::ifstream ifs(m_filepath, std::ios::ate | std::ios::binary);
+	if (!ifs.is_open())
+		return {};
+
+	size_t fsize = ifs.tellg();
+	if (fsize < sizeof(PipelineCacheFileHeader) + sizeof(VkPipelineCacheHeaderVersionOne))
+		return {};
+
+	PipelineCacheFileHeader file_header;
+	ifs.seekg(0);
+	ifs.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
+
+	if (file_header.Magic != s_CACHE_MAGIC || file_header.DriverVersion != m_properties.driverVersion
+		|| file_header.DataSize != fsize - sizeof(file_header))
+		return {};
+
+	std::vector<char> data(file_header.DataSize);
+	ifs.read(data.data(), data.size());
+	if (!ifs || s_HashBytes(data.data(), data.size()) != file_header.DataHash)
+		return {};
+
+	// The blob must have been produced by this exact device and driver.
+	VkPipelineCacheHeaderVersionOne header;
+	std::memcpy(&header, data.data(), sizeof(header));
+
+	if (header.headerSize < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		|| header.vendorID != m_properties.vendorID || header.deviceID != m_properties.deviceID
+		|| std::memcmp(header.pipelineCacheUUID, m_properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		return {};
+
+	return data;
+}
+
+void PipelineCache::Save() const
+{
+	std::vector<char> data = GetData();
+
+	PipelineCacheFileHeader file_header{};
+	file_header.Magic = s_CACHE_MAGIC;
+	file_header.DriverVersion = m_properties.driverVersion;
+	file_header.DataSize = data.size();
+	file_header.DataHash = s_HashBytes(data.data(), data.size());
+
+	std::string temp_path = m_filepath + ".tmp";
+
+	{
+		std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+		if (!ofs.is_open())
+			return; // Read-only location, the cache simply won't persist.
+
+		ofs.write(reinterpret_cast<char const*>(&file_header), sizeof(file_header));
+		ofs.write(data.data(), data.size());
+		ofs.flush();
+		if (!ofs)
+			return;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temp_path, m_filepath, error);
+	if (error)
+		std::filesystem::remove(temp_path, error);
+}
+
+VkResult PipelineCache::CreateGraphicsPipeline(VkGraphicsPipelineCreateInfo const& create_info, VkPipeline* pipeline, VkPipelineCache worker)
+{
+	VkPipelineCreationFeedback feedback{};
+
+	VkPipelineCreationFeedbackCreateInfo feedback_info{};
+	feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+	feedback_info.pNext = create_info.pNext;
+	feedback_info.pPipelineCreationFeedback = &feedback;
+
+	VkGraphicsPipelineCreateInfo info = create_info;
+	info.pNext = &feedback_info;
+
+	VkResult result;
+	if (worker)
+		result = vkCreateGraphicsPipelines(m_device, worker, 1, &info, nullptr, pipeline);
+	else
+	{
+		std::shared_lock lock(m_cache_mutex);
+		result = vkCreateGraphicsPipelines(m_device, m_cache, 1, &info, nullptr, pipeline);
+	}
+
+	if (result == VK_SUCCESS)
+		RecordFeedback(feedback);
+	return result;
+}
+
+VkResult PipelineCache::CreateComputePipeline(VkComputePipelineCreateInfo const& create_info, VkPipeline* pipeline, VkPipelineCache worker)
+{
+	VkPipelineCreationFeedback feedback{};
+
+	VkPipelineCreationFeedbackCreateInfo feedback_info{};
+	feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+	feedback_info.pNext = create_info.pNext;
+	feedback_info.pPipelineCreationFeedback = &feedback;
+
+	VkComputePipelineCreateInfo info = create_info;
+	info.pNext = &feedback_info;
+
+	VkResult result;
+	if (worker)
+		result = vkCreateComputePipelines(m_device, worker, 1, &info, nullptr, pipeline);
+	else
+	{
+		std::shared_lock lock(m_cache_mutex);
+		result = vkCreateComputePipelines(m_device, m_cache, 1, &info, nullptr, pipeline);
+	}
+
+	if (result == VK_SUCCESS)
+		RecordFeedback(feedback);
+	return result;
+}
+
+VkPipelineCache PipelineCache::CreateWorkerCache() const
+{
+	// Seeded with everything the shared cache holds, the disk cache included, so workers hit it too.
+	std::vector<char> data = GetData();
+
+	VkPipelineCacheCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	create_info.initialDataSize = data.size();
+	create_info.pInitialData = data.data();
+
+	VkPipelineCache worker;
+	VALIDATE(vkCreatePipelineCache(m_device, &create_info, nullptr, &worker) == VK_SUCCESS);
+	return worker;
+}
+
+void PipelineCache::MergeWorkerCache(VkPipelineCache worker)
+{
+	{
+		std::unique_lock lock(m_cache_mutex);
+		VALIDATE(vkMergePipelineCaches(m_device, m_cache, 1, &worker) == VK_SUCCESS);
+	}
+
+	vkDestroyPipelineCache(m_device, worker, nullptr);
+}
+
+std::vector<char> PipelineCache::GetData() const
+{
+	std::unique_lock lock(m_cache_mutex);
+	size_t size = 0;
+	VALIDATE(vkGetPipelineCacheData(m_device, m_cache, &size, nullptr) == VK_SUCCESS);
+	std::vector<char> data(size);
+	VALIDATE(vkGetPipelineCacheData(m_device, m_cache, &size, data.data()) == VK_SUCCESS);
+	data.resize(size);
+	return data;
+}
+
+PipelineCacheStats PipelineCache::GetStats() const
+{
+	std::lock_guard lock(m_stats_mutex);
+	return m_stats;
+}
+
+void PipelineCache::RecordFeedback(VkPipelineCreationFeedback const& feedback)
+{
+	// Drivers are allowed to leave the feedback empty.
+	if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT))
+		return;
+
+	std::lock_guard lock(m_stats_mutex);
+
+	if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT)
+		m_stats.Hits++, m_stats.HitMs += s_NanosecondsToMs(feedback.duration);
+	else
+		m_stats.Misses++, m_stats.MissMs += s_NanosecondsToMs(feedback.duration);
+}
\ No newline at end of file
@@ -0,0 +1,433 @@
+#include "profiler.hpp"
+#include "vulkan.hpp"
+#include <bit>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#define THISFILE "profiler.cpp"
+
+static Profiler* s_profiler = nullptr;
+
+// Drift between the GPU and CPU clocks is small, recalibrating every couple of seconds is plenty.
+static constexpr uint64_t s_CALIBRATION_INTERVAL = 120;
+
+static std::atomic<uint32_t> s_next_thread_id = 0;
+
+static uint32_t s_ThreadId()
+{
+	thread_local uint32_t id = s_next_thread_id++;
+	return id;
+}
+
+Profiler* GetProfiler()
+{
+	return s_profiler;
+}
+
+uint64_t ProfilerNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Profiler::Profiler(GraphicsDevice const& device, uint32_t frames_in_flight, uint32_t max_gpu_zones, uint32_t history_frames)
+	: m_device(&device), m_enabled(true), m_max_gpu_zones(max_gpu_zones), m_slots(frames_in_flight), m_slot_index(0),
+	m_get_calibrated_timestamps(nullptr), m_host_domain(VK_TIME_DOMAIN_DEVICE_EXT), m_host_ns_per_tick(1.0),
+	m_calibration_gpu(0), m_calibration_ns(0), m_calibration_frame(0), m_begin_label(nullptr), m_end_label(nullptr),
+	m_frames(history_frames), m_frame_index(0), m_frame_open(false),
+	m_hitch_threshold_ms(0.0), m_pending_hitch(UINT64_MAX), m_stats{ 0, UINT64_MAX, {} }
+{
+	ASSERT(!s_profiler);
+	ASSERT(history_frames > frames_in_flight); // Frames must still be in the ring when their GPU zones resolve.
+	s_profiler = this;
+
+	auto ld = device.GetLogical();
+	auto pd = device.GetPhysical();
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(pd, &props);
+	m_timestamp_period = props.limits.timestampPeriod;
+
+	uint32_t qf_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(pd, &qf_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(qf_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(pd, &qf_count, families.data());
+
+	uint32_t valid_bits = families[device.GetGraphicsQueue().FamilyIndex].timestampValidBits;
+	m_timestamp_mask = valid_bits >= 64 ? ~0ull : valid_bits ? (1ull << valid_bits) - 1 : 0;
+
+	// Without timestamp support the pools stay null and only CPU zones are recorded.
+	for (SlotQueries& slot : m_slots)
+	{
+		slot.Pool = VK_NULL_HANDLE;
+		slot.Zones.resize(max_gpu_zones);
+		slot.Used = 0;
+		slot.FrameIndex = 0;
+		slot.Recorded = false;
+
+		if (!m_timestamp_mask)
+			continue;
+
+		VkQueryPoolCreateInfo qci{};
+		qci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		qci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		qci.queryCount = 2 * max_gpu_zones;
+		VALIDATE(vkCreateQueryPool(ld, &qci, nullptr, &slot.Pool) == VK_SUCCESS);
+	}
+
+	// The host domain has to be the clock steady_clock reads: QueryPerformanceCounter on Windows, CLOCK_MONOTONIC elsewhere.
+	if (device.SupportsCalibratedTimestamps())
+	{
+#ifdef _WIN32
+		VkTimeDomainEXT host_domain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		m_host_ns_per_tick = 1e9 / static_cast<double>(frequency.QuadPart);
+#else
+		VkTimeDomainEXT host_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+
+		auto get_domains = reinterpret_cast<PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT>(
+			vkGetInstanceProcAddr(GetVulkanInstance(), "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT"));
+
+		std::vector<VkTimeDomainEXT> domains;
+		if (get_domains)
+		{
+			uint32_t count = 0;
+			get_domains(pd, &count, nullptr);
+			domains.resize(count);
+			get_domains(pd, &count, domains.data());
+		}
+
+		bool has_device = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end();
+		bool has_host = std::find(domains.begin(), domains.end(), host_domain) != domains.end();
+
+		if (has_device && has_host)
+		{
+			m_host_domain = host_domain;
+			m_get_calibrated_timestamps = reinterpret_cast<PFN_vkGetCalibratedTimestampsEXT>(vkGetDeviceProcAddr(ld, "vkGetCalibratedTimestampsEXT"));
+		}
+	}
+
+#ifndef NDEBUG
+
+	// Debug utils is only enabled on the instance in debug builds, GPU zones then double as debug labels.
+	m_begin_label = reinterpret_cast<PFN_vkCmdBeginDebugUtilsLabelEXT>(vkGetInstanceProcAddr(GetVulkanInstance(), "vkCmdBeginDebugUtilsLabelEXT"));
+	m_end_label = reinterpret_cast<PFN_vkCmdEndDebugUtilsLabelEXT>(vkGetInstanceProcAddr(GetVulkanInstance(), "vkCmdEndDebugUtilsLabelEXT"));
+
+#endif
+}
+
+Profiler::~Profiler()
+{
+	StopTrace();
+
+	for (SlotQueries& slot : m_slots)
+	{
+		if (slot.Pool)
+			vkDestroyQueryPool(m_device->GetLogical(), slot.Pool, nullptr);
+	}
+
+	s_profiler = nullptr;
+}
+
+void Profiler::BeginFrame(VkCommandBuffer command_buffer, uint32_t slot_index, uint64_t frame_index)
+{
+	uint64_t now = ProfilerNow();
+
+	{
+		std::lock_guard lock(m_mutex);
+
+		if (m_frame_open)
+		{
+			ProfileFrame& frame = m_frames[m_frame_index % m_frames.size()];
+			frame.EndNs = now;
+			frame.Events.push_back({ "Frame", frame.BeginNs, frame.EndNs, s_ThreadId(), false });
+
+			double frame_ms = (frame.EndNs - frame.BeginNs) / 1e6;
+			if (m_hitch_threshold_ms > 0.0 && frame_ms > m_hitch_threshold_ms && m_pending_hitch == UINT64_MAX)
+				m_pending_hitch = frame.FrameIndex;
+
+			m_frame_open = false;
+		}
+	}
+
+	// The slot's fence has signaled, so the frame that used it last has retired.
+	SlotQueries& slot = m_slots[slot_index];
+	ResolveSlot(slot);
+
+	m_slot_index = slot_index;
+	slot.Used = 0;
+
+	if (!IsEnabled())
+		return;
+
+	{
+		std::lock_guard lock(m_mutex);
+
+		ProfileFrame& frame = m_frames[frame_index % m_frames.size()];
+		frame.FrameIndex = frame_index;
+		frame.BeginNs = now;
+		frame.EndNs = now;
+		frame.Events.clear();
+		frame.GpuResolved = false;
+
+		m_frame_index = frame_index;
+		m_frame_open = true;
+	}
+
+	if (m_get_calibrated_timestamps && (!m_calibration_ns || frame_index - m_calibration_frame >= s_CALIBRATION_INTERVAL))
+	{
+		Calibrate();
+		m_calibration_frame = frame_index;
+	}
+
+	// Without a pool the slot still carries the frame, which completes with no GPU zones when the slot retires.
+	slot.FrameIndex = frame_index;
+	slot.Recorded = true;
+	if (slot.Pool)
+		vkCmdResetQueryPool(command_buffer, slot.Pool, 0, 2 * m_max_gpu_zones);
+}
+
+void Profiler::AddCpuZone(char const* name, uint64_t begin_ns, uint64_t end_ns)
+{
+	std::lock_guard lock(m_mutex);
+
+	// Zones are attributed to the frame they end in.
+	if (m_frame_open)
+		m_frames[m_frame_index % m_frames.size()].Events.push_back({ name, begin_ns, end_ns, s_ThreadId(), false });
+}
+
+uint32_t Profiler::BeginGpuZone(VkCommandBuffer command_buffer, char const* name)
+{
+	SlotQueries& slot = m_slots[m_slot_index];
+	if (!slot.Recorded || !slot.Pool)
+		return UINT32_MAX;
+
+	uint32_t zone = slot.Used.fetch_add(1, std::memory_order_relaxed);
+	if (zone >= m_max_gpu_zones)
+		return UINT32_MAX;
+
+	slot.Zones[zone] = { name, s_ThreadId() };
+
+	if (m_begin_label)
+	{
+		VkDebugUtilsLabelEXT label{};
+		label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+		label.pLabelName = name;
+		m_begin_label(command_buffer, &label);
+	}
+
+	// Top of pipe marks when the zone's commands may start, all commands when the last of them has finished.
+	vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, slot.Pool, 2 * zone);
+	return zone;
+}
+
+void Profiler::EndGpuZone(VkCommandBuffer command_buffer, uint32_t zone)
+{
+	vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_slots[m_slot_index].Pool, 2 * zone + 1);
+
+	if (m_end_label)
+		m_end_label(command_buffer);
+}
+
+bool Profiler::StartTrace(std::string const& path)
+{
+	std::lock_guard lock(m_mutex);
+
+	if (m_trace.is_open())
+		m_trace.close();
+
+	// The JSON array format may be left unterminated, so a crash still leaves a loadable trace behind.
+	m_trace.open(path, std::ios::trunc);
+	if (!m_trace)
+		return false;
+
+	m_trace << "[\n"
+		<< "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}},\n"
+		<< "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+	return true;
+}
+
+void Profiler::StopTrace()
+{
+	std::lock_guard lock(m_mutex);
+
+	if (!m_trace.is_open())
+		return;
+
+	m_trace << "\n]\n";
+	m_trace.close();
+}
+
+bool Profiler::DumpHistory(std::string const& path) const
+{
+	std::lock_guard lock(m_mutex);
+	return WriteHistory(path);
+}
+
+ProfilerStats Profiler::GetStats() const
+{
+	std::lock_guard lock(m_mutex);
+	return m_stats;
+}
+
+void Profiler::PrintStats() const
+{
+	ProfilerStats stats = GetStats();
+	std::cout << "[Profiler] " << stats.Hitches << " hitches";
+	if (stats.Hitches)
+		std::cout << ", last at frame " << stats.LastHitchFrame << " in " << stats.LastHitchPath;
+	std::cout << '\n';
+}
+
+void Profiler::Calibrate()
+{
+	VkCalibratedTimestampInfoEXT infos[2]{};
+	infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+	infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+	infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+	infos[1].timeDomain = m_host_domain;
+
+	uint64_t timestamps[2], max_deviation;
+	if (m_get_calibrated_timestamps(m_device->GetLogical(), 2, infos, timestamps, &max_deviation) != VK_SUCCESS)
+		return;
+
+	m_calibration_gpu = timestamps[0] & m_timestamp_mask;
+	m_calibration_ns = static_cast<uint64_t>(timestamps[1] * m_host_ns_per_tick);
+}
+
+void Profiler::ResolveSlot(SlotQueries& slot)
+{
+	if (!slot.Recorded)
+		return;
+	slot.Recorded = false;
+
+	uint32_t used = std::min(slot.Used.load(), m_max_gpu_zones);
+
+	// Value and availability per query, zones whose commands never executed are skipped.
+	std::vector<uint64_t> results(4 * used);
+	bool read = used && vkGetQueryPoolResults(m_device->GetLogical(), slot.Pool, 0, 2 * used, results.size() * sizeof(uint64_t),
+		results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) == VK_SUCCESS;
+
+	std::lock_guard lock(m_mutex);
+
+	ProfileFrame& frame = m_frames[slot.FrameIndex % m_frames.size()];
+	if (frame.FrameIndex != slot.FrameIndex || frame.GpuResolved)
+		return;
+
+	if (read)
+	{
+		// Only timestampValidBits of a tick count, and the counter wraps at them: ticks are compared as a difference
+		// modulo the valid bits, sign-extended since zones may come before the calibration point.
+		auto ticks_since = [shift = std::countl_zero(m_timestamp_mask)](uint64_t ticks, uint64_t base) {
+			return static_cast<int64_t>((ticks - base) << shift) >> shift;
+		};
+
+		// Uncalibrated, the GPU timeline is pinned to the end of the frame on the CPU, i.e. roughly its submission.
+		uint64_t base_gpu = m_calibration_gpu, base_ns = m_calibration_ns;
+		if (!m_get_calibrated_timestamps)
+		{
+			int64_t earliest = 0;
+			bool found = false;
+			for (uint32_t i = 0; i < used; i++)
+			{
+				if (!results[4 * i + 1])
+					continue;
+				if (!found)
+					base_gpu = results[4 * i], found = true;
+				earliest = std::min(earliest, ticks_since(results[4 * i], base_gpu));
+			}
+			base_gpu += earliest, base_ns = frame.EndNs;
+		}
+
+		auto to_ns = [&](uint64_t ticks) {
+			double delta = static_cast<double>(ticks_since(ticks, base_gpu)) * m_timestamp_period;
+			return static_cast<uint64_t>(static_cast<double>(base_ns) + delta);
+		};
+
+		for (uint32_t i = 0; i < used; i++)
+		{
+			uint64_t const* query = &results[4 * i];
+			if (!query[1] || !query[3])
+				continue;
+
+			frame.Events.push_back({ slot.Zones[i].Name, to_ns(query[0]), to_ns(query[2]), slot.Zones[i].ThreadId, true });
+		}
+	}
+
+	frame.GpuResolved = true;
+	FrameCompleted(frame);
+}
+
+static void s_WriteEvent(std::ostream& out, ProfileEvent const& event)
+{
+	out << "{\"name\":\"";
+	for (char const* c = event.Name; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			out << '\\';
+		out << *c;
+	}
+
+	// Chrome traces are in microseconds.
+	out << "\",\"ph\":\"X\",\"ts\":" << event.BeginNs / 1e3 << ",\"dur\":" << (event.EndNs > event.BeginNs ? event.EndNs - event.BeginNs : 0) / 1e3
+		<< ",\"pid\":" << (event.Gpu ? 1 : 0) << ",\"tid\":" << event.ThreadId << "}";
+}
+
+void Profiler::FrameCompleted(ProfileFrame const& frame)
+{
+	if (m_trace.is_open())
+	{
+		m_trace << std::fixed;
+		for (ProfileEvent const& event : frame.Events) {
+			m_trace << ",\n";
+			s_WriteEvent(m_trace, event);
+		}
+		m_trace.flush();
+	}
+
+	// Dumped only now so the hitch frame's GPU zones make it into the file.
+	if (m_pending_hitch != UINT64_MAX && frame.FrameIndex >= m_pending_hitch)
+	{
+		std::string path = m_hitch_prefix + std::to_string(m_pending_hitch) + ".json";
+		if (WriteHistory(path))
+		{
+			m_stats.Hitches++;
+			m_stats.LastHitchFrame = m_pending_hitch;
+			m_stats.LastHitchPath = std::move(path);
+		}
+		m_pending_hitch = UINT64_MAX;
+	}
+}
+
+bool Profiler::WriteHistory(std::string const& path) const
+{
+	std::ofstream out(path, std::ios::trunc);
+	if (!out)
+		return false;
+
+	out << std::fixed << "{\"traceEvents\":[\n"
+		<< "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}},\n"
+		<< "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+
+	// Oldest first, frames that never completed (still recording or in flight) are left out.
+	uint64_t newest = m_frame_index;
+	uint64_t count = std::min<uint64_t>(m_frames.size(), newest + 1);
+	for (uint64_t index = newest + 1 - count; index <= newest; index++)
+	{
+		ProfileFrame const& frame = m_frames[index % m_frames.size()];
+		if (frame.FrameIndex != index || frame.EndNs == frame.BeginNs)
+			continue;
+
+		for (ProfileEvent const& event : frame.Events) {
+			out << ",\n";
+			s_WriteEvent(out, event);
+		}
+	}
+
+	out << "\n]}\n";
+	return static_cast<bool>(out);
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "recorder.hpp"
+#include "vulkan.hpp"
+#include "render.hpp"
+#include "profiler.hpp"
+#include "jobs.hpp"
+
+#define THISFILE "recorder.cpp"
+
+// Slices smaller than this cost more in vkBeginCommandBuffer and vkCmdExecuteCommands than they save.
+static constexpr uint32_t s_MIN_SLICE_SIZE = 64;
+
+// More slices than threads lets fast threads pick up the slack of slow ones.
+static constexpr uint32_t s_SLICES_PER_THREAD = 4;
+
+ParallelRecorder::ParallelRecorder(GraphicsDevice const& device, JobSystem& jobs, uint32_t frames_in_flight)
+	: m_device(&device), m_jobs(&jobs), m_thread_count(jobs.GetThreadCount()), m_slot_index(0)
+{
+	m_pools.resize(frames_in_flight * m_thread_count);
+	for (ThreadPool& pool : m_pools)
+	{
+		pool.Pool = new CommandPool(device, device.GetGraphicsQueue().FamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		pool.Used = 0;
+	}
+}
+
+ParallelRecorder::~ParallelRecorder()
+{
+	for (ThreadPool& pool : m_pools)
+		delete pool.Pool;
+}
+
+void ParallelRecorder::BeginFrame(uint32_t slot_index)
+{
+	m_slot_index = slot_index;
+
+	// No job is recording between calls to Record, so the pools can be reset from here.
+	for (uint32_t i = 0; i < m_thread_count; i++)
+	{
+		ThreadPool& pool = m_pools[slot_index * m_thread_count + i];
+		if (pool.Used)
+			pool.Pool->Reset();
+		pool.Used = 0;
+	}
+}
+
+void ParallelRecorder::Record(VkCommandBuffer primary, VkCommandBufferInheritanceInfo const& inheritance, uint32_t count, SliceRecorder const& recorder)
+{
+	if (!count)
+		return;
+
+	uint32_t slice_size = std::max(s_MIN_SLICE_SIZE, (count + m_thread_count * s_SLICES_PER_THREAD - 1) / (m_thread_count * s_SLICES_PER_THREAD));
+	uint32_t slice_count = (count + slice_size - 1) / slice_size;
+	m_slices.assign(slice_count, VK_NULL_HANDLE);
+
+	// One job per slice; a single slice runs right here.
+	m_jobs->ParallelFor(slice_count, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t slice = begin; slice < end; slice++)
+			m_slices[slice] = RecordSlice(inheritance, slice * slice_size, std::min(count, (slice + 1) * slice_size), recorder);
+	});
+
+	vkCmdExecuteCommands(primary, slice_count, m_slices.data());
+}
+
+VkCommandBuffer ParallelRecorder::RecordSlice(VkCommandBufferInheritanceInfo const& inheritance, uint32_t begin, uint32_t end, SliceRecorder const& recorder)
+{
+	// A thread runs one job at a time, so its pool is never touched concurrently.
+	uint32_t thread_index = m_jobs->GetThreadIndex();
+	VALIDATE(thread_index < m_thread_count);
+	ThreadPool& pool = m_pools[m_slot_index * m_thread_count + thread_index];
+
+	if (pool.Used == pool.Secondaries.size())
+		pool.Secondaries.push_back(pool.Pool->Allocate(VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+	VkCommandBuffer cmd = pool.Secondaries[pool.Used++];
+
+	PROFILE_CPU("Record slice");
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	begin_info.pInheritanceInfo = &inheritance;
+
+	VALIDATE(vkBeginCommandBuffer(cmd, &begin_info) == VK_SUCCESS);
+	recorder(cmd, begin, end);
+	VALIDATE(vkEndCommandBuffer(cmd) == VK_SUCCESS);
+	return cmd;
+}
\ No newline at end of file
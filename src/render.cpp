@@ -1,23 +1,15 @@
 #include "render.hpp"
 #include "vulkan.hpp"
 #include "window.hpp"
+#include "pipeline_cache.hpp"
+#include "frame.hpp"
+#include "asset_pack.hpp"
+#include "bindless.hpp"
 #include <fstream>
 
 #define THISFILE "render.cpp"
 
-GraphicsPipelineCreator::GraphicsPipelineCreator(GraphicsDevice const& device)
-	: m_device(&device), m_render_format(VK_FORMAT_UNDEFINED)
-{
-	std::fill(m_shader_modules.begin(), m_shader_modules.end(), nullptr);
-}
-
-GraphicsPipelineCreator::~GraphicsPipelineCreator()
-{
-	for (VkShaderModule shader : m_shader_modules)
-		vkDestroyShaderModule(m_device->GetLogical(), shader, nullptr);
-}
-
-void GraphicsPipelineCreator::AddShaderModule(ShaderType type, char const* filepath)
+VkShaderModule LoadShaderModule(GraphicsDevice const& device, char const* filepath)
 {
 	std::ifstream ifs(filepath, std::ios::ate | std::ios::binary);
 	VALIDATE(ifs.is_open());
@@ -33,37 +25,91 @@ void GraphicsPipelineCreator::AddShaderModule(ShaderType type, char const* filep
 	create_info.codeSize = buffer.size();
 	create_info.pCode = reinterpret_cast<const uint32_t*>(buffer.data());
 
-	VALIDATE(vkCreateShaderModule(m_device->GetLogical(), &create_info, nullptr, &m_shader_modules[type]) == VK_SUCCESS);
+	VkShaderModule module;
+	VALIDATE(vkCreateShaderModule(device.GetLogical(), &create_info, nullptr, &module) == VK_SUCCESS);
+	return module;
+}
+
+VkShaderModule LoadShaderModule(GraphicsDevice const& device, AssetPack const& pack, char const* name)
+{
+	AssetView asset = pack.Find(name);
+	VALIDATE(asset.Data && asset.Type == ASSET_SPIRV); // Packed SPIR-V is 4-byte aligned as pCode requires.
+
+	VkShaderModuleCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	create_info.codeSize = asset.Size;
+	create_info.pCode = static_cast<uint32_t const*>(asset.Data);
+
+	VkShaderModule module;
+	VALIDATE(vkCreateShaderModule(device.GetLogical(), &create_info, nullptr, &module) == VK_SUCCESS);
+	return module;
+}
+
+GraphicsPipelineCreator::GraphicsPipelineCreator(GraphicsDevice const& device)
+	: m_device(&device)
+{
+	std::fill(m_shader_modules.begin(), m_shader_modules.end(), nullptr);
+	m_state.RenderFormat = VK_FORMAT_UNDEFINED;
+	m_state.FinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	m_state.DynamicRendering = false;
+	m_state.DepthFormat = VK_FORMAT_UNDEFINED;
+	m_state.DepthCompare = VK_COMPARE_OP_LESS;
+	m_state.DepthWrite = true;
+	m_state.CullMode = VK_CULL_MODE_NONE;
+}
+
+GraphicsPipelineCreator::~GraphicsPipelineCreator()
+{
+	for (VkShaderModule shader : m_shader_modules)
+		vkDestroyShaderModule(m_device->GetLogical(), shader, nullptr);
+}
+
+void GraphicsPipelineCreator::AddShaderModule(ShaderType type, char const* filepath)
+{
+	m_shader_modules[type] = LoadShaderModule(*m_device, filepath);
+}
+
+void GraphicsPipelineCreator::AddShaderModule(ShaderType type, AssetPack const& pack, char const* name)
+{
+	m_shader_modules[type] = LoadShaderModule(*m_device, pack, name);
 }
 
 GraphicsPipeline::GraphicsPipeline(GraphicsPipelineCreator const& creator)
-	: m_device(creator.m_device)
+	: GraphicsPipeline(*creator.m_device, creator.m_shader_modules, creator.m_state, VK_NULL_HANDLE)
 {
-	// Check if vertex shader and fragment shader present.
-	ASSERT(creator.m_shader_modules[VERTEX_SHADER] && creator.m_shader_modules[FRAGMENT_SHADER]);
+}
+
+GraphicsPipeline::GraphicsPipeline(GraphicsDevice const& device, std::array<VkShaderModule, SHADER_TYPE_COUNT> const& modules,
+	GraphicsPipelineState const& state, VkPipelineCache worker_cache)
+	: m_device(&device)
+{
+	// Check if vertex shader present. Depth-only pipelines may go without a fragment shader.
+	ASSERT(modules[VERTEX_SHADER]);
+	ASSERT(modules[FRAGMENT_SHADER] || !state.RenderFormat);
 
 	VkPipelineShaderStageCreateInfo vert_stage{};
 	vert_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vert_stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vert_stage.module = creator.m_shader_modules[VERTEX_SHADER];
+	vert_stage.module = modules[VERTEX_SHADER];
 	vert_stage.pName = "main";
 
 	VkPipelineShaderStageCreateInfo frag_stage{};
 	frag_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	frag_stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	frag_stage.module = creator.m_shader_modules[FRAGMENT_SHADER];
+	frag_stage.module = modules[FRAGMENT_SHADER];
 	frag_stage.pName = "main";
 
 	// Shader stages
 	VkPipelineShaderStageCreateInfo shader_stages[] = { vert_stage, frag_stage };
+	uint32_t stage_count = modules[FRAGMENT_SHADER] ? 2 : 1;
 
 	// Vertex input
 	VkPipelineVertexInputStateCreateInfo vertex_input{};
 	vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertex_input.vertexBindingDescriptionCount = 0;
-	vertex_input.pVertexBindingDescriptions = nullptr; // Optional
-	vertex_input.vertexAttributeDescriptionCount = 0;
-	vertex_input.pVertexAttributeDescriptions = nullptr; // Optional
+	vertex_input.vertexBindingDescriptionCount = static_cast<uint32_t>(state.VertexBindings.size());
+	vertex_input.pVertexBindingDescriptions = state.VertexBindings.data();
+	vertex_input.vertexAttributeDescriptionCount = static_cast<uint32_t>(state.VertexAttributes.size());
+	vertex_input.pVertexAttributeDescriptions = state.VertexAttributes.data();
 
 	// Input assembly
 	VkPipelineInputAssemblyStateCreateInfo input_assembly{};
@@ -91,7 +137,7 @@ GraphicsPipeline::GraphicsPipeline(GraphicsPipelineCreator const& creator)
 	rasterizer.rasterizerDiscardEnable = VK_FALSE;
 	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
 	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_NONE;
+	rasterizer.cullMode = state.CullMode;
 	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	rasterizer.depthBiasEnable = VK_FALSE;
 	rasterizer.depthBiasConstantFactor = 0.0f; // Optional
@@ -108,6 +154,13 @@ GraphicsPipeline::GraphicsPipeline(GraphicsPipelineCreator const& creator)
 	multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
 	multisampling.alphaToOneEnable = VK_FALSE; // Optional
 
+	// Depth testing
+	VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = state.DepthFormat != VK_FORMAT_UNDEFINED;
+	depth_stencil.depthWriteEnable = depth_stencil.depthTestEnable && state.DepthWrite;
+	depth_stencil.depthCompareOp = state.DepthCompare;
+
 	// Color blending
 	VkPipelineColorBlendAttachmentState blend_func{};
 	blend_func.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
@@ -123,35 +176,58 @@ GraphicsPipeline::GraphicsPipeline(GraphicsPipelineCreator const& creator)
 	blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	blending.logicOpEnable = VK_FALSE;
 	blending.logicOp = VK_LOGIC_OP_COPY; // Optional
-	blending.attachmentCount = 1;
+	blending.attachmentCount = state.RenderFormat ? 1 : 0;
 	blending.pAttachments = &blend_func;
 	blending.blendConstants[0] = 0.0f; // Optional
 	blending.blendConstants[1] = 0.0f; // Optional
 	blending.blendConstants[2] = 0.0f; // Optional
 	blending.blendConstants[3] = 0.0f; // Optional
 
+	ASSERT(state.RenderFormat || state.DepthFormat); // Check if defined.
+
 	CreatePipelineLayout();
 
-	ASSERT(creator.m_render_format); // Check if defined.
-	CreateRenderPass(creator.m_render_format);
-
-	VkGraphicsPipelineCreateInfo create_info{};
-	create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	create_info.stageCount = 2;
-	create_info.pStages = shader_stages;
-	create_info.pVertexInputState = &vertex_input;
-	create_info.pInputAssemblyState = &input_assembly;
-	create_info.pViewportState = &viewport_state;
-	create_info.pRasterizationState = &rasterizer;
-	create_info.pMultisampleState = &multisampling;
-	create_info.pColorBlendState = &blending;
-	create_info.pDynamicState = &dstate;
-	create_info.layout = m_layout;
-	create_info.renderPass = m_render_pass;
-	create_info.subpass = 0;
-	create_info.basePipelineHandle = VK_NULL_HANDLE;
+	VkPipelineRenderingCreateInfo rendering_info{};
+	rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	rendering_info.colorAttachmentCount = state.RenderFormat ? 1 : 0;
+	rendering_info.pColorAttachmentFormats = &state.RenderFormat;
+	rendering_info.depthAttachmentFormat = state.DepthFormat;
 
-	VALIDATE(vkCreateGraphicsPipelines(m_device->GetLogical(), VK_NULL_HANDLE, 1, &create_info, nullptr, &m_pipeline) == VK_SUCCESS);
+	// The destructor does not run if construction throws (batch workers report such failures and carry on), so
+	// whatever was created by then is destroyed here.
+	m_render_pass = VK_NULL_HANDLE;
+	try
+	{
+		if (!state.DynamicRendering)
+			CreateRenderPass(state);
+
+		VkGraphicsPipelineCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		create_info.pNext = state.DynamicRendering ? &rendering_info : nullptr;
+		create_info.stageCount = stage_count;
+		create_info.pStages = shader_stages;
+		create_info.pVertexInputState = &vertex_input;
+		create_info.pInputAssemblyState = &input_assembly;
+		create_info.pViewportState = &viewport_state;
+		create_info.pRasterizationState = &rasterizer;
+		create_info.pMultisampleState = &multisampling;
+		create_info.pDepthStencilState = &depth_stencil;
+		create_info.pColorBlendState = &blending;
+		create_info.pDynamicState = &dstate;
+		create_info.layout = m_layout;
+		create_info.renderPass = m_render_pass;
+		create_info.subpass = 0;
+		create_info.basePipelineHandle = VK_NULL_HANDLE;
+
+		VALIDATE(m_device->GetPipelineCache()->CreateGraphicsPipeline(create_info, &m_pipeline, worker_cache) == VK_SUCCESS);
+	}
+	catch (...)
+	{
+		if (m_render_pass)
+			vkDestroyRenderPass(m_device->GetLogical(), m_render_pass, nullptr);
+		vkDestroyPipelineLayout(m_device->GetLogical(), m_layout, nullptr);
+		throw;
+	}
 }
 
 GraphicsPipeline::~GraphicsPipeline()
@@ -159,55 +235,309 @@ GraphicsPipeline::~GraphicsPipeline()
 	VkDevice ld = m_device->GetLogical();
 
 	vkDestroyPipeline(ld, m_pipeline, nullptr);
-	vkDestroyRenderPass(ld, m_render_pass, nullptr);
+	if (m_render_pass)
+		vkDestroyRenderPass(ld, m_render_pass, nullptr);
 	vkDestroyPipelineLayout(ld, m_layout, nullptr);
 }
 
-void GraphicsPipeline::CreatePipelineLayout()
+static VkPipelineLayout s_CreatePipelineLayout(GraphicsDevice const& device)
 {
+	// Every layout is the bindless set plus the shared push constant range, so all layouts are compatible
+	// and the set stays bound when switching pipelines.
+	VkDescriptorSetLayout set_layout = device.GetBindlessHeap()->GetLayout();
+	VkPushConstantRange push_range{ VK_SHADER_STAGE_ALL, 0, BINDLESS_PUSH_CONSTANT_SIZE };
+
 	VkPipelineLayoutCreateInfo create_info{};
 	create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	create_info.setLayoutCount = 0; // Optional
-	create_info.pSetLayouts = nullptr; // Optional
-	create_info.pushConstantRangeCount = 0; // Optional
-	create_info.pPushConstantRanges = nullptr; // Optional
+	create_info.setLayoutCount = 1;
+	create_info.pSetLayouts = &set_layout;
+	create_info.pushConstantRangeCount = 1;
+	create_info.pPushConstantRanges = &push_range;
+
+	VkPipelineLayout layout;
+	VALIDATE(vkCreatePipelineLayout(device.GetLogical(), &create_info, nullptr, &layout) == VK_SUCCESS);
+	return layout;
+}
 
-	VALIDATE(vkCreatePipelineLayout(m_device->GetLogical(), &create_info, nullptr, &m_layout) == VK_SUCCESS);
+void GraphicsPipeline::CreatePipelineLayout()
+{
+	m_layout = s_CreatePipelineLayout(*m_device);
 }
 
-void GraphicsPipeline::CreateRenderPass(VkFormat format)
+void GraphicsPipeline::CreateRenderPass(GraphicsPipelineState const& state)
 {
+	// Colour first (if any), then depth; Framebuffers attaches views in the same order.
+	std::vector<VkAttachmentDescription> attachments;
+
 	VkAttachmentDescription attach{};
-	attach.format = format;
+	attach.format = state.RenderFormat;
 	attach.samples = VK_SAMPLE_COUNT_1_BIT;
 	attach.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	attach.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	attach.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attach.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attach.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attach.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	attach.finalLayout = state.FinalLayout;
 
 	VkAttachmentReference attach_ref{};
 	attach_ref.attachment = 0;
 	attach_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	if (state.RenderFormat)
+		attachments.push_back(attach);
+
+	// Depth is stored, later passes and the Hi-Z build read it.
+	VkAttachmentDescription depth_attach = attach;
+	depth_attach.format = state.DepthFormat;
+	depth_attach.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depth_ref{};
+	depth_ref.attachment = static_cast<uint32_t>(attachments.size());
+	depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	if (state.DepthFormat)
+		attachments.push_back(depth_attach);
+
 	VkSubpassDescription subpass{};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
+	subpass.colorAttachmentCount = state.RenderFormat ? 1 : 0;
 	subpass.pColorAttachments = &attach_ref;
+	subpass.pDepthStencilAttachment = state.DepthFormat ? &depth_ref : nullptr;
 
 	VkRenderPassCreateInfo create_info{};
 	create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	create_info.attachmentCount = 1;
-	create_info.pAttachments = &attach;
+	create_info.attachmentCount = static_cast<uint32_t>(attachments.size());
+	create_info.pAttachments = attachments.data();
 	create_info.subpassCount = 1;
 	create_info.pSubpasses = &subpass;
 
-	VALIDATE(vkCreateRenderPass(m_device->GetLogical(), &create_info, nullptr, &m_render_pass) == VK_SUCCESS);
+	VkRenderPass render_pass;
+	VALIDATE(vkCreateRenderPass(m_device->GetLogical(), &create_info, nullptr, &render_pass) == VK_SUCCESS);
+	m_render_pass = render_pass;
+}
+
+void BeginRendering(VkCommandBuffer command_buffer, VkImageView view, VkExtent2D extent, VkClearValue const& clear, VkRenderingFlags flags)
+{
+	BeginRendering(command_buffer, view, VK_NULL_HANDLE, extent, clear, false, flags);
+}
+
+void BeginRendering(VkCommandBuffer command_buffer, VkImageView color_view, VkImageView depth_view, VkExtent2D extent,
+	VkClearValue const& clear, bool load_depth, VkRenderingFlags flags)
+{
+	VkRenderingAttachmentInfo color{};
+	color.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	color.imageView = color_view;
+	color.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	color.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color.clearValue = clear;
+
+	VkRenderingAttachmentInfo depth{};
+	depth.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	depth.imageView = depth_view;
+	depth.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+	depth.loadOp = load_depth ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depth.clearValue.depthStencil = { 1.0f, 0 };
+
+	VkRenderingInfo rendering_info{};
+	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	rendering_info.flags = flags;
+	rendering_info.renderArea.extent = extent;
+	rendering_info.layerCount = 1;
+	rendering_info.colorAttachmentCount = color_view ? 1 : 0;
+	rendering_info.pColorAttachments = &color;
+	rendering_info.pDepthAttachment = depth_view ? &depth : nullptr;
+
+	vkCmdBeginRendering(command_buffer, &rendering_info);
 }
 
-Framebuffers::Framebuffers(GraphicsDevice const& device, GraphicsPipeline const& pipeline, Swapchain const& swapchain)
+ComputePipeline::ComputePipeline(GraphicsDevice const& device, char const* filepath)
 	: m_device(&device)
+{
+	Create(LoadShaderModule(device, filepath));
+}
+
+ComputePipeline::ComputePipeline(GraphicsDevice const& device, AssetPack const& pack, char const* name)
+	: m_device(&device)
+{
+	Create(LoadShaderModule(device, pack, name));
+}
+
+ComputePipeline::~ComputePipeline()
+{
+	vkDestroyPipeline(m_device->GetLogical(), m_pipeline, nullptr);
+	vkDestroyPipelineLayout(m_device->GetLogical(), m_layout, nullptr);
+}
+
+void ComputePipeline::Create(VkShaderModule module)
+{
+	m_layout = s_CreatePipelineLayout(*m_device);
+
+	VkComputePipelineCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	create_info.stage.module = module;
+	create_info.stage.pName = "main";
+	create_info.layout = m_layout;
+
+	VkResult result = m_device->GetPipelineCache()->CreateComputePipeline(create_info, &m_pipeline);
+
+	// The module is only needed while compiling.
+	vkDestroyShaderModule(m_device->GetLogical(), module, nullptr);
+	VALIDATE(result == VK_SUCCESS);
+}
+
+GraphicsPipelineBatch::GraphicsPipelineBatch(GraphicsDevice const& device, uint32_t worker_count, AssetPack const* pack)
+	: m_device(&device), m_worker_count(worker_count ? worker_count : std::max(1u, std::thread::hardware_concurrency())), m_pack(pack)
+{
+}
+
+GraphicsPipelineBatch::~GraphicsPipelineBatch()
+{
+	Wait();
+
+	for (auto& [path, module] : m_modules)
+	{
+		// Modules that failed to load rethrow here and have nothing to destroy.
+		try { vkDestroyShaderModule(m_device->GetLogical(), module.get(), nullptr); }
+		catch (...) {}
+	}
+}
+
+std::future<GraphicsPipeline*> GraphicsPipelineBatch::Add(GraphicsPipelineDesc const& desc)
+{
+	auto pending = std::make_shared<PendingPipeline>();
+	pending->Desc = desc;
+	m_pending.push_back(pending);
+	return pending->Result.get_future();
+}
+
+void GraphicsPipelineBatch::Compile()
+{
+	std::deque<std::function<void(VkPipelineCache)>> tasks;
+
+	// Every distinct shader file is read and created once, by whichever worker picks it up first.
+	for (auto const& pending : m_pending)
+	{
+		for (auto const& path : pending->Desc.ShaderPaths)
+		{
+			if (path.empty() || m_modules.count(path))
+				continue;
+
+			auto promise = std::make_shared<std::promise<VkShaderModule>>();
+			m_modules[path] = promise->get_future().share();
+
+			tasks.push_back([this, path, promise](VkPipelineCache) {
+				try { promise->set_value(m_pack ? LoadShaderModule(*m_device, *m_pack, path.c_str()) : LoadShaderModule(*m_device, path.c_str())); }
+				catch (...) { promise->set_exception(std::current_exception()); }
+			});
+		}
+	}
+
+	// Pipelines are queued behind every shader task, so a worker blocking on a module only ever waits for one in flight.
+	for (auto const& pending : m_pending)
+	{
+		std::array<std::shared_future<VkShaderModule>, SHADER_TYPE_COUNT> modules;
+		for (int i = 0; i < SHADER_TYPE_COUNT; i++) {
+			if (!pending->Desc.ShaderPaths[i].empty())
+				modules[i] = m_modules[pending->Desc.ShaderPaths[i]];
+		}
+
+		tasks.push_back([this, pending, modules](VkPipelineCache cache) {
+			try
+			{
+				std::array<VkShaderModule, SHADER_TYPE_COUNT> handles{};
+				for (int i = 0; i < SHADER_TYPE_COUNT; i++) {
+					if (modules[i].valid())
+						handles[i] = modules[i].get();
+				}
+				pending->Result.set_value(new GraphicsPipeline(*m_device, handles, pending->Desc.State, cache));
+			}
+			catch (...) { pending->Result.set_exception(std::current_exception()); }
+		});
+	}
+
+	m_pending.clear();
+
+	uint32_t worker_count = std::min(m_worker_count, static_cast<uint32_t>(tasks.size()));
+
+	{
+		std::lock_guard lock(m_task_mutex);
+		for (auto& task : tasks)
+			m_tasks.push_back(std::move(task));
+	}
+
+	for (uint32_t i = 0; i < worker_count; i++)
+		m_workers.emplace_back(&GraphicsPipelineBatch::WorkerLoop, this);
+}
+
+void GraphicsPipelineBatch::Wait()
+{
+	for (auto& worker : m_workers)
+		worker.join();
+	m_workers.clear();
+}
+
+void GraphicsPipelineBatch::WorkerLoop()
+{
+	PipelineCache* shared_cache = m_device->GetPipelineCache();
+	VkPipelineCache cache = shared_cache->CreateWorkerCache();
+
+	// Tasks hand their failures to their futures. Should anything else escape, the cache is still merged back.
+	try
+	{
+		for (;;)
+		{
+			std::function<void(VkPipelineCache)> task;
+
+			{
+				std::lock_guard lock(m_task_mutex);
+				if (m_tasks.empty())
+					break;
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+
+			task(cache);
+		}
+	}
+	catch (...)
+	{
+		shared_cache->MergeWorkerCache(cache);
+		throw;
+	}
+
+	shared_cache->MergeWorkerCache(cache);
+}
+
+Framebuffers::Framebuffers(GraphicsDevice const& device, GraphicsPipeline const& pipeline, Swapchain const& swapchain, VkImageView depth_view)
+	: m_device(&device)
+{
+	Create(pipeline, swapchain, depth_view);
+}
+
+Framebuffers::~Framebuffers()
+{
+	for (auto framebuffer : m_framebuffers)
+		vkDestroyFramebuffer(m_device->GetLogical(), framebuffer, nullptr);
+}
+
+void Framebuffers::Recreate(GraphicsPipeline const& pipeline, Swapchain const& swapchain, FrameScheduler& scheduler, VkImageView depth_view)
+{
+	VkDevice ld = m_device->GetLogical();
+	std::vector<VkFramebuffer> old_framebuffers = std::move(m_framebuffers);
+
+	scheduler.Defer([ld, old_framebuffers]() {
+		for (auto framebuffer : old_framebuffers)
+			vkDestroyFramebuffer(ld, framebuffer, nullptr);
+	});
+
+	Create(pipeline, swapchain, depth_view);
+}
+
+void Framebuffers::Create(GraphicsPipeline const& pipeline, Swapchain const& swapchain, VkImageView depth_view)
 {
 	auto const& image_views = swapchain.GetImageViews();
 	auto extent = swapchain.GetExtent();
@@ -216,21 +546,51 @@ Framebuffers::Framebuffers(GraphicsDevice const& device, GraphicsPipeline const&
 
 	for (int i = 0; i < m_framebuffers.size(); i++)
 	{
+		VkImageView attachments[] = { image_views[i], depth_view };
+
 		VkFramebufferCreateInfo framebufferInfo{};
 		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		framebufferInfo.renderPass = pipeline.GetRenderPass();
-		framebufferInfo.attachmentCount = 1;
-		framebufferInfo.pAttachments = &image_views[i];
+		framebufferInfo.attachmentCount = depth_view ? 2 : 1;
+		framebufferInfo.pAttachments = attachments;
 		framebufferInfo.width = extent.width;
 		framebufferInfo.height = extent.height;
 		framebufferInfo.layers = 1;
 
-		VALIDATE(vkCreateFramebuffer(device.GetLogical(), &framebufferInfo, nullptr, &m_framebuffers[i]) == VK_SUCCESS);
+		VALIDATE(vkCreateFramebuffer(m_device->GetLogical(), &framebufferInfo, nullptr, &m_framebuffers[i]) == VK_SUCCESS);
 	}
 }
 
-Framebuffers::~Framebuffers()
+CommandPool::CommandPool(GraphicsDevice const& device, uint32_t queue_family, VkCommandPoolCreateFlags flags)
+	: m_device(&device)
 {
-	for (auto framebuffer : m_framebuffers)
-		vkDestroyFramebuffer(m_device->GetLogical(), framebuffer, nullptr);
+	VkCommandPoolCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	create_info.flags = flags;
+	create_info.queueFamilyIndex = queue_family;
+
+	VALIDATE(vkCreateCommandPool(device.GetLogical(), &create_info, nullptr, &m_pool) == VK_SUCCESS);
+}
+
+CommandPool::~CommandPool()
+{
+	vkDestroyCommandPool(m_device->GetLogical(), m_pool, nullptr);
+}
+
+VkCommandBuffer CommandPool::Allocate(VkCommandBufferLevel level)
+{
+	VkCommandBufferAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandPool = m_pool;
+	alloc_info.level = level;
+	alloc_info.commandBufferCount = 1;
+
+	VkCommandBuffer buffer;
+	VALIDATE(vkAllocateCommandBuffers(m_device->GetLogical(), &alloc_info, &buffer) == VK_SUCCESS);
+	return buffer;
+}
+
+void CommandPool::Reset()
+{
+	VALIDATE(vkResetCommandPool(m_device->GetLogical(), m_pool, 0) == VK_SUCCESS);
 }
\ No newline at end of file
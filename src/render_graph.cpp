@@ -0,0 +1,595 @@
+#include "render_graph.hpp"
+#include "vulkan.hpp"
+#include "memory.hpp"
+#include "frame.hpp"
+#include "bindless.hpp"
+#include "profiler.hpp"
+#include <numeric>
+
+#define THISFILE "render_graph.cpp"
+
+static constexpr VkAccessFlags2 s_WRITE_ACCESS = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+	| VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT
+	| VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+static constexpr VkImageUsageFlags s_ATTACHMENT_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+	| VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+static constexpr uint32_t s_NONE = UINT32_MAX;
+
+static bool s_IsDepthFormat(VkFormat format)
+{
+	return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D24_UNORM_S8_UINT
+		|| format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_X8_D24_UNORM_PACK32;
+}
+
+// Image usage needed for an access.
+static VkImageUsageFlags s_GetUsage(VkAccessFlags2 access)
+{
+	VkImageUsageFlags usage = 0;
+	if (access & (VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT))
+		usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if (access & (VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT))
+		usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (access & VK_ACCESS_2_INPUT_ATTACHMENT_READ_BIT)
+		usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	if (access & (VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT))
+		usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (access & (VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT))
+		usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+	if (access & VK_ACCESS_2_TRANSFER_READ_BIT)
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	if (access & VK_ACCESS_2_TRANSFER_WRITE_BIT)
+		usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	return usage;
+}
+
+static VkImageCreateInfo s_ImageInfo(RenderImageDesc const& desc, VkImageUsageFlags usage)
+{
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = desc.Format;
+	image_info.extent = { desc.Extent.width, desc.Extent.height, 1 };
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = usage;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	return image_info;
+}
+
+RenderGraph::RenderGraph(GraphicsDevice const& device)
+	: m_device(&device), m_stats{}
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+	VkDevice ld = m_device->GetLogical();
+	for (TransientImage const& transient : m_transients)
+	{
+		if (transient.TextureIndex != s_NONE)
+			m_device->GetBindlessHeap()->Free(BINDLESS_TEXTURE, transient.TextureIndex);
+		vkDestroyImageView(ld, transient.View, nullptr);
+		vkDestroyImage(ld, transient.Image, nullptr);
+	}
+	for (MemorySlot const& slot : m_slots)
+		m_device->GetAllocator()->Free(slot.Memory);
+}
+
+void RenderGraph::Reset()
+{
+	m_passes.clear();
+	m_resources.clear();
+}
+
+RenderResource RenderGraph::ImportImage(char const* name, VkImage image, VkImageView view, VkImageAspectFlags aspect, RenderAccess const& initial,
+	RenderAccess const& final)
+{
+	Resource resource{};
+	resource.Name = name;
+	resource.IsImage = true;
+	resource.IsImported = true;
+	resource.Image = image;
+	resource.View = view;
+	resource.Aspect = aspect;
+	resource.Initial = initial;
+	resource.Final = final;
+	resource.Transient = s_NONE;
+	m_resources.push_back(resource);
+	return static_cast<RenderResource>(m_resources.size() - 1);
+}
+
+RenderResource RenderGraph::ImportBuffer(char const* name, VkBuffer buffer, RenderAccess const& initial)
+{
+	Resource resource{};
+	resource.Name = name;
+	resource.IsImported = true;
+	resource.Buffer = buffer;
+	resource.Initial = initial;
+	resource.Transient = s_NONE;
+	m_resources.push_back(resource);
+	return static_cast<RenderResource>(m_resources.size() - 1);
+}
+
+RenderResource RenderGraph::CreateImage(char const* name, RenderImageDesc const& desc)
+{
+	VALIDATE(desc.Extent.width && desc.Extent.height);
+
+	Resource resource{};
+	resource.Name = name;
+	resource.IsImage = true;
+	resource.Aspect = s_IsDepthFormat(desc.Format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	resource.Initial = { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED };
+	resource.Final = resource.Initial;
+	resource.Desc = desc;
+	resource.Transient = s_NONE;
+	m_resources.push_back(resource);
+	return static_cast<RenderResource>(m_resources.size() - 1);
+}
+
+uint32_t RenderGraph::AddPass(char const* name, std::function<void(VkCommandBuffer)> record)
+{
+	m_passes.push_back({ name, std::move(record), {}, false });
+	return static_cast<uint32_t>(m_passes.size() - 1);
+}
+
+void RenderGraph::Read(uint32_t pass, RenderResource resource, RenderAccess const& access)
+{
+	ASSERT(pass < m_passes.size() && resource < m_resources.size());
+	VALIDATE(!m_resources[resource].IsImage || access.Layout != VK_IMAGE_LAYOUT_UNDEFINED);
+
+	// One barrier covers a resource per pass, so several uses by the same pass become one.
+	for (Use& use : m_passes[pass].Uses)
+	{
+		if (use.Resource == resource)
+		{
+			VALIDATE(use.Access.Layout == access.Layout);
+			use.Access.Stage |= access.Stage;
+			use.Access.Access |= access.Access;
+			return;
+		}
+	}
+	m_passes[pass].Uses.push_back({ resource, access, false });
+}
+
+void RenderGraph::Write(uint32_t pass, RenderResource resource, RenderAccess const& access)
+{
+	Read(pass, resource, access);
+	for (Use& use : m_passes[pass].Uses)
+		if (use.Resource == resource)
+			use.Write = true;
+}
+
+void RenderGraph::SetSideEffects(uint32_t pass)
+{
+	ASSERT(pass < m_passes.size());
+	m_passes[pass].SideEffects = true;
+}
+
+VkImage RenderGraph::GetImage(RenderResource image) const
+{
+	Resource const& resource = m_resources[image];
+	ASSERT(resource.IsImage && (resource.IsImported || resource.Transient != s_NONE));
+	return resource.IsImported ? resource.Image : m_transients[resource.Transient].Image;
+}
+
+VkImageView RenderGraph::GetView(RenderResource image) const
+{
+	Resource const& resource = m_resources[image];
+	ASSERT(resource.IsImage && (resource.IsImported || resource.Transient != s_NONE));
+	return resource.IsImported ? resource.View : m_transients[resource.Transient].View;
+}
+
+uint32_t RenderGraph::GetTextureIndex(RenderResource image) const
+{
+	Resource const& resource = m_resources[image];
+	ASSERT(!resource.IsImported && resource.Transient != s_NONE);
+	uint32_t index = m_transients[resource.Transient].TextureIndex;
+	ASSERT(index != s_NONE);
+	return index;
+}
+
+void RenderGraph::Execute(VkCommandBuffer command_buffer, FrameScheduler& scheduler)
+{
+	std::vector<bool> alive;
+	{
+		PROFILE_CPU("Compile render graph");
+
+		m_stats = {};
+		m_stats.PassCount = static_cast<uint32_t>(m_passes.size());
+
+		alive = Cull();
+		m_stats.CulledPasses = static_cast<uint32_t>(std::count(alive.begin(), alive.end(), false));
+
+		std::vector<MemorySlot> slots;
+		std::vector<TransientImage> transients = PlaceTransients(alive, slots);
+
+		// Keep the images of the last frame if this one places the same images the same way.
+		bool same = transients.size() == m_transients.size() && slots.size() == m_slots.size();
+		for (size_t i = 0; same && i < transients.size(); i++)
+		{
+			TransientImage const& a = transients[i], & b = m_transients[i];
+			same = a.Desc.Format == b.Desc.Format && a.Desc.Extent.width == b.Desc.Extent.width && a.Desc.Extent.height == b.Desc.Extent.height
+				&& a.Usage == b.Usage && a.Slot == b.Slot;
+		}
+		for (size_t i = 0; same && i < slots.size(); i++)
+		{
+			VkMemoryRequirements const& a = slots[i].Requirements, & b = m_slots[i].Requirements;
+			same = a.size == b.size && a.alignment == b.alignment && a.memoryTypeBits == b.memoryTypeBits && slots[i].Lazy == m_slots[i].Lazy;
+		}
+
+		if (same)
+		{
+			for (size_t i = 0; i < transients.size(); i++)
+			{
+				m_transients[i].Resource = transients[i].Resource;
+				m_transients[i].FirstPass = transients[i].FirstPass;
+				m_transients[i].LastPass = transients[i].LastPass;
+			}
+		}
+		else
+		{
+			DestroyTransients(scheduler);
+			CreateTransients(transients, slots);
+			m_transients = std::move(transients);
+			m_slots = std::move(slots);
+		}
+
+		for (uint32_t i = 0; i < m_transients.size(); i++)
+		{
+			m_resources[m_transients[i].Resource].Transient = i;
+			m_stats.UnaliasedBytes += m_transients[i].Size;
+			m_stats.LazyImages += m_slots[m_transients[i].Slot].Lazy;
+		}
+		m_stats.TransientImages = static_cast<uint32_t>(m_transients.size());
+		for (MemorySlot const& slot : m_slots)
+			m_stats.TransientBytes += slot.Requirements.size;
+	}
+
+	// What each resource went through since its last barrier: the last write (or layout transition) still to be
+	// made visible, the stages that read it since, and where it has been made visible already.
+	struct State
+	{
+		VkPipelineStageFlags2 WriteStage;
+		VkAccessFlags2 WriteAccess;
+		VkPipelineStageFlags2 ReadStages;
+		VkPipelineStageFlags2 VisibleStages;
+		VkAccessFlags2 VisibleAccess;
+		VkImageLayout Layout;
+	};
+
+	std::vector<State> states(m_resources.size());
+	for (size_t i = 0; i < m_resources.size(); i++)
+	{
+		RenderAccess const& initial = m_resources[i].Initial;
+		State& state = states[i];
+		state.Layout = initial.Layout;
+		if (initial.Access & s_WRITE_ACCESS)
+			state.WriteStage = initial.Stage, state.WriteAccess = initial.Access & s_WRITE_ACCESS;
+		else
+			state.ReadStages = initial.Stage;
+	}
+
+	// Transient images take over their slot's memory from whichever image used it last, earlier in this frame or
+	// in the previous one, and must wait for it.
+	std::vector<RenderAccess> slot_uses(m_slots.size());
+	for (size_t i = 0; i < m_slots.size(); i++)
+		slot_uses[i] = m_slots[i].LastUse;
+
+	std::vector<VkImageMemoryBarrier2> image_barriers;
+	VkMemoryBarrier2 memory_barrier{};
+	memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+
+	auto require = [&](RenderResource index, RenderAccess const& access) {
+		Resource const& resource = m_resources[index];
+		State& state = states[index];
+
+		bool writes = (access.Access & s_WRITE_ACCESS) != 0;
+		bool transition = resource.IsImage && access.Layout != state.Layout;
+
+		VkPipelineStageFlags2 src_stage = 0;
+		VkAccessFlags2 src_access = 0;
+		if (writes || transition)
+		{
+			// Everything before has to finish, reads included, and writes have to be made available.
+			src_stage = state.WriteStage | state.ReadStages;
+			src_access = state.WriteAccess;
+			state.WriteStage = access.Stage;
+			state.WriteAccess = access.Access & s_WRITE_ACCESS;
+			state.ReadStages = writes ? 0 : access.Stage;
+			state.VisibleStages = writes ? 0 : access.Stage;
+			state.VisibleAccess = writes ? 0 : access.Access;
+		}
+		else
+		{
+			state.ReadStages |= access.Stage;
+			if (!state.WriteStage || (!(access.Stage & ~state.VisibleStages) && !(access.Access & ~state.VisibleAccess)))
+				return;
+			src_stage = state.WriteStage;
+			src_access = state.WriteAccess;
+			state.VisibleStages |= access.Stage;
+			state.VisibleAccess |= access.Access;
+		}
+
+		if (!src_stage && !transition)
+			return;
+
+		if (resource.IsImage)
+		{
+			VkImageMemoryBarrier2 barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			barrier.srcStageMask = src_stage ? src_stage : VK_PIPELINE_STAGE_2_NONE;
+			barrier.srcAccessMask = src_access;
+			barrier.dstStageMask = access.Stage;
+			barrier.dstAccessMask = access.Access;
+			barrier.oldLayout = transition ? state.Layout : access.Layout;
+			barrier.newLayout = access.Layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = GetImage(index);
+			barrier.subresourceRange = { resource.Aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+			image_barriers.push_back(barrier);
+			state.Layout = access.Layout;
+		}
+		else
+		{
+			memory_barrier.srcStageMask |= src_stage;
+			memory_barrier.srcAccessMask |= src_access;
+			memory_barrier.dstStageMask |= access.Stage;
+			memory_barrier.dstAccessMask |= access.Access;
+		}
+	};
+
+	auto flush = [&]() {
+		bool has_memory_barrier = memory_barrier.srcStageMask || memory_barrier.dstStageMask;
+		if (image_barriers.empty() && !has_memory_barrier)
+			return;
+
+		VkDependencyInfo dependency{};
+		dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+		dependency.memoryBarrierCount = has_memory_barrier ? 1 : 0;
+		dependency.pMemoryBarriers = &memory_barrier;
+		dependency.imageMemoryBarrierCount = static_cast<uint32_t>(image_barriers.size());
+		dependency.pImageMemoryBarriers = image_barriers.data();
+		vkCmdPipelineBarrier2(command_buffer, &dependency);
+
+		m_stats.BarrierBatches++;
+		m_stats.ImageBarriers += static_cast<uint32_t>(image_barriers.size());
+		m_stats.MemoryBarriers += has_memory_barrier;
+		image_barriers.clear();
+		memory_barrier.srcStageMask = memory_barrier.dstStageMask = 0;
+		memory_barrier.srcAccessMask = memory_barrier.dstAccessMask = 0;
+	};
+
+	for (uint32_t i = 0; i < m_passes.size(); i++)
+	{
+		if (!alive[i])
+			continue;
+
+		for (Use const& use : m_passes[i].Uses)
+		{
+			Resource const& resource = m_resources[use.Resource];
+			if (resource.Transient != s_NONE && m_transients[resource.Transient].FirstPass == i)
+			{
+				RenderAccess const& previous = slot_uses[m_transients[resource.Transient].Slot];
+				State& state = states[use.Resource];
+				state.ReadStages = previous.Stage;
+				state.WriteAccess = previous.Access & s_WRITE_ACCESS;
+			}
+			require(use.Resource, use.Access);
+		}
+		flush();
+
+		m_passes[i].Record(command_buffer);
+
+		for (Use const& use : m_passes[i].Uses)
+		{
+			Resource const& resource = m_resources[use.Resource];
+			if (resource.Transient != s_NONE)
+			{
+				State const& state = states[use.Resource];
+				slot_uses[m_transients[resource.Transient].Slot] = { state.WriteStage | state.ReadStages, state.WriteAccess, VK_IMAGE_LAYOUT_UNDEFINED };
+			}
+		}
+	}
+
+	// Hand imported images over in the state their owners expect.
+	for (RenderResource i = 0; i < m_resources.size(); i++)
+		if (m_resources[i].IsImported && m_resources[i].IsImage && m_resources[i].Final.Layout != VK_IMAGE_LAYOUT_UNDEFINED)
+			require(i, m_resources[i].Final);
+	flush();
+
+	for (size_t i = 0; i < m_slots.size(); i++)
+		m_slots[i].LastUse = slot_uses[i];
+}
+
+void RenderGraph::PrintStats() const
+{
+	std::cout << "[RenderGraph] " << m_stats.PassCount - m_stats.CulledPasses << " of " << m_stats.PassCount << " passes run, "
+		<< m_stats.BarrierBatches << " barrier batches of " << m_stats.ImageBarriers << " image and " << m_stats.MemoryBarriers << " memory barriers, "
+		<< m_stats.TransientImages << " transient images (" << m_stats.LazyImages << " lazy) in " << m_stats.TransientBytes / 1024 << " KiB, "
+		<< m_stats.UnaliasedBytes / 1024 << " KiB unaliased\n";
+}
+
+// Liveness, from the last pass backwards: a pass is needed if it has side effects, writes an imported resource, or
+// writes something a needed pass after it reads. Writing without reading ends what earlier writes were needed for.
+std::vector<bool> RenderGraph::Cull() const
+{
+	std::vector<bool> alive(m_passes.size(), false);
+	std::vector<bool> wanted(m_resources.size(), false);
+
+	for (size_t i = m_passes.size(); i-- > 0;)
+	{
+		Pass const& pass = m_passes[i];
+		bool needed = pass.SideEffects;
+		for (Use const& use : pass.Uses)
+			needed |= use.Write && (m_resources[use.Resource].IsImported || wanted[use.Resource]);
+		if (!needed)
+			continue;
+
+		alive[i] = true;
+		for (Use const& use : pass.Uses)
+			wanted[use.Resource] = !use.Write || (use.Access.Access & ~s_WRITE_ACCESS);
+	}
+	return alive;
+}
+
+// Lifetimes, usage and memory requirements of the images created by the graph, and slots of memory to put them in.
+// Largest first, each image goes into the first slot whose images all live at other times, so big images are the
+// ones sharing and small ones fill in around them.
+std::vector<RenderGraph::TransientImage> RenderGraph::PlaceTransients(std::vector<bool> const& alive, std::vector<MemorySlot>& slots) const
+{
+	std::vector<TransientImage> transients;
+	std::vector<uint32_t> transient_of(m_resources.size(), s_NONE);
+
+	for (uint32_t i = 0; i < m_passes.size(); i++)
+	{
+		if (!alive[i])
+			continue;
+		for (Use const& use : m_passes[i].Uses)
+		{
+			if (m_resources[use.Resource].IsImported)
+				continue;
+			uint32_t& index = transient_of[use.Resource];
+			if (index == s_NONE)
+			{
+				index = static_cast<uint32_t>(transients.size());
+				TransientImage transient{};
+				transient.Resource = use.Resource;
+				transient.Desc = m_resources[use.Resource].Desc;
+				transient.FirstPass = i;
+				transient.Slot = s_NONE; // Unplaced images must not hold slot 0 in the overlap test
+				transient.TextureIndex = s_NONE;
+				transients.push_back(transient);
+			}
+			transients[index].Usage |= s_GetUsage(use.Access.Access);
+			transients[index].LastPass = i;
+		}
+	}
+
+	std::vector<VkMemoryRequirements> requirements(transients.size());
+	for (size_t i = 0; i < transients.size(); i++)
+	{
+		TransientImage& transient = transients[i];
+		if (!(transient.Usage & ~s_ATTACHMENT_USAGE))
+			transient.Usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+		VkImageCreateInfo image_info = s_ImageInfo(transient.Desc, transient.Usage);
+		VkDeviceImageMemoryRequirements info{};
+		info.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+		info.pCreateInfo = &image_info;
+		VkMemoryRequirements2 result{};
+		result.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+		vkGetDeviceImageMemoryRequirements(m_device->GetLogical(), &info, &result);
+		requirements[i] = result.memoryRequirements;
+		transient.Size = result.memoryRequirements.size;
+	}
+
+	std::vector<uint32_t> order(transients.size());
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return requirements[a].size > requirements[b].size; });
+
+	slots.clear();
+	for (uint32_t i : order)
+	{
+		TransientImage& transient = transients[i];
+		VkMemoryRequirements const& required = requirements[i];
+		bool lazy = (transient.Usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+
+		for (uint32_t s = 0; s < slots.size() && transient.Slot == s_NONE; s++)
+		{
+			MemorySlot const& slot = slots[s];
+			if (slot.Lazy != lazy || !(slot.Requirements.memoryTypeBits & required.memoryTypeBits))
+				continue;
+
+			bool overlaps = false;
+			for (TransientImage const& other : transients)
+				overlaps |= &other != &transient && other.Slot == s && other.FirstPass <= transient.LastPass && transient.FirstPass <= other.LastPass;
+			if (!overlaps)
+				transient.Slot = s;
+		}
+
+		if (transient.Slot == s_NONE)
+		{
+			transient.Slot = static_cast<uint32_t>(slots.size());
+			MemorySlot slot{};
+			slot.Requirements = required;
+			slot.Lazy = lazy;
+			slots.push_back(slot);
+			continue;
+		}
+
+		VkMemoryRequirements& slot_requirements = slots[transient.Slot].Requirements;
+		slot_requirements.size = std::max(slot_requirements.size, required.size);
+		slot_requirements.alignment = std::max(slot_requirements.alignment, required.alignment);
+		slot_requirements.memoryTypeBits &= required.memoryTypeBits;
+	}
+
+	return transients;
+}
+
+void RenderGraph::CreateTransients(std::vector<TransientImage>& transients, std::vector<MemorySlot>& slots)
+{
+	VkDevice ld = m_device->GetLogical();
+	MemoryAllocator* allocator = m_device->GetAllocator();
+
+	for (MemorySlot& slot : slots)
+	{
+		slot.Memory = allocator->Allocate(slot.Requirements, slot.Lazy ? TRANSIENT_MEMORY : GPU_ONLY_MEMORY, true);
+		slot.LastUse = { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED };
+	}
+
+	for (TransientImage& transient : transients)
+	{
+		VkImageCreateInfo image_info = s_ImageInfo(transient.Desc, transient.Usage);
+		VALIDATE(vkCreateImage(ld, &image_info, nullptr, &transient.Image) == VK_SUCCESS);
+
+		Allocation const* memory = slots[transient.Slot].Memory;
+		VALIDATE(vkBindImageMemory(ld, transient.Image, memory->Memory, memory->Offset) == VK_SUCCESS);
+
+		VkImageViewCreateInfo view_info{};
+		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_info.image = transient.Image;
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.format = transient.Desc.Format;
+		view_info.subresourceRange = { m_resources[transient.Resource].Aspect, 0, 1, 0, 1 };
+		VALIDATE(vkCreateImageView(ld, &view_info, nullptr, &transient.View) == VK_SUCCESS);
+
+		if (transient.Usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+			transient.TextureIndex = m_device->GetBindlessHeap()->AddTexture(transient.View, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+	}
+}
+
+void RenderGraph::DestroyTransients(FrameScheduler& scheduler)
+{
+	BindlessHeap* heap = m_device->GetBindlessHeap();
+	std::vector<std::pair<VkImage, VkImageView>> images;
+	std::vector<Allocation*> memory;
+
+	for (TransientImage const& transient : m_transients)
+	{
+		if (transient.TextureIndex != s_NONE)
+			heap->Free(BINDLESS_TEXTURE, transient.TextureIndex, scheduler);
+		images.emplace_back(transient.Image, transient.View);
+	}
+	for (MemorySlot const& slot : m_slots)
+		memory.push_back(slot.Memory);
+
+	GraphicsDevice const* device = m_device;
+	scheduler.Defer([device, images, memory]() {
+		for (auto [image, view] : images)
+		{
+			vkDestroyImageView(device->GetLogical(), view, nullptr);
+			vkDestroyImage(device->GetLogical(), image, nullptr);
+		}
+		for (Allocation* allocation : memory)
+			device->GetAllocator()->Free(allocation);
+	});
+
+	m_transients.clear();
+	m_slots.clear();
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "skinning.hpp"
+#include "vulkan.hpp"
+#include "render.hpp"
+#include "memory.hpp"
+#include "frame_ring.hpp"
+#include "bindless.hpp"
+#include "jobs.hpp"
+#include "mesh.hpp"
+#include "culling.hpp"
+#include "profiler.hpp"
+
+#define THISFILE "skinning.cpp"
+
+// Must match local_size_x in skin.comp.
+static constexpr uint32_t s_GROUP_SIZE = 64;
+
+// Characters posed per job.
+static constexpr uint32_t s_SAMPLE_GRAIN = 16;
+
+// Push constants of skin.comp.
+struct SkinConstants
+{
+	float Bounds[4]; // Centre and radius of the mesh's bounding sphere
+	VkDeviceAddress Rest;
+	VkDeviceAddress Skin;
+	VkDeviceAddress Palettes;
+	VkDeviceAddress Characters;
+	VkDeviceAddress Output;
+	uint32_t VertexCount;
+	uint32_t BoneCount;
+};
+
+CrowdSkinner::CrowdSkinner(GraphicsDevice const& device, AssetPack const& pack, Uploader& uploader, JobSystem* jobs, Mesh const& mesh,
+	Skeleton skeleton, std::vector<SkinVertex> const& skin, std::vector<AnimationLod> lods, uint32_t max_characters)
+	: m_device(&device), m_jobs(jobs), m_mesh(&mesh), m_skeleton(std::move(skeleton)), m_lods(std::move(lods)),
+	m_vertex_count(mesh.GetVertexCount()), m_max_characters(max_characters), m_last_updates(max_characters, UINT64_MAX), m_stats{}
+{
+	uint32_t bone_count = m_skeleton.GetBoneCount();
+	VALIDATE(bone_count && bone_count <= 256); // Joints are bytes.
+	VALIDATE(m_skeleton.InverseBind.size() == size_t(bone_count) * 12);
+	VALIDATE(skin.size() == m_vertex_count && !m_lods.empty());
+	for (AnimationLod const& lod : m_lods)
+		VALIDATE(lod.UpdateInterval && lod.BoneCount && lod.BoneCount <= bone_count);
+	for (SkinVertex const& vertex : skin)
+		for (uint8_t joint : vertex.Joints)
+			VALIDATE(joint < bone_count);
+
+	m_pipeline = new ComputePipeline(device, pack, "shaders/skin.comp.spv");
+
+	MemoryAllocator* allocator = device.GetAllocator();
+
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = skin.size() * sizeof(SkinVertex);
+	create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	m_skin = allocator->CreateBuffer(create_info, GPU_ONLY_MEMORY, &m_skin_memory);
+	m_skin_address = allocator->GetDeviceAddress(m_skin);
+
+	create_info.size = VkDeviceSize(m_vertex_count) * max_characters * sizeof(SkinnedVertex);
+	create_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	m_output = allocator->CreateBuffer(create_info, GPU_ONLY_MEMORY, &m_output_memory);
+	m_output_address = allocator->GetDeviceAddress(m_output);
+
+	char const* skin_data = reinterpret_cast<char const*>(skin.data());
+	m_ticket = uploader.UploadBuffer(m_skin, 0, std::vector<char>(skin_data, skin_data + skin.size() * sizeof(SkinVertex)),
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+
+	uint32_t thread_count = jobs ? jobs->GetThreadCount() : 1;
+	m_scratch.assign(thread_count * 2, Pose(bone_count));
+}
+
+CrowdSkinner::~CrowdSkinner()
+{
+	MemoryAllocator* allocator = m_device->GetAllocator();
+	allocator->DestroyBuffer(m_output, m_output_memory);
+	allocator->DestroyBuffer(m_skin, m_skin_memory);
+	delete m_pipeline;
+}
+
+uint32_t CrowdSkinner::AddClip(AnimationClip clip)
+{
+	VALIDATE(clip.GetBoneCount() == m_skeleton.GetBoneCount());
+	m_clips.push_back(std::move(clip));
+	return static_cast<uint32_t>(m_clips.size() - 1);
+}
+
+void CrowdSkinner::Update(VkCommandBuffer command_buffer, uint64_t frame_index, FrameRing& ring, CrowdCharacter const* characters, uint32_t count)
+{
+	ASSERT(count <= m_max_characters);
+
+	auto select_lod = [this](float distance) {
+		uint32_t lod = 0;
+		while (lod + 1 < m_lods.size() && distance > m_lods[lod].MaxDistance)
+			lod++;
+		return lod;
+	};
+
+	// Characters of a LOD updating every n frames take turns by index, so each frame does about 1/n of them.
+	m_due.clear();
+	std::fill_n(m_stats.Characters, 4, 0u);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t lod = select_lod(characters[i].Distance);
+		if (lod < 4)
+			m_stats.Characters[lod]++;
+		if (m_last_updates[i] == UINT64_MAX || (frame_index + i) % m_lods[lod].UpdateInterval == 0)
+		{
+			m_due.push_back(i);
+			m_last_updates[i] = frame_index;
+		}
+	}
+
+	m_stats.Skinned = static_cast<uint32_t>(m_due.size());
+	if (m_due.empty())
+		return;
+
+	uint32_t const bone_count = m_skeleton.GetBoneCount();
+	uint32_t const due_count = static_cast<uint32_t>(m_due.size());
+
+	FrameSpan<uint32_t> due = ring.Allocate<uint32_t>(due_count);
+	std::copy(m_due.begin(), m_due.end(), due.Data);
+	FrameSpan<float> palettes = ring.Allocate<float>(due_count * bone_count * 12);
+
+	{
+		PROFILE_CPU("Sample poses");
+		auto start = std::chrono::steady_clock::now();
+
+		auto pose = [&](uint32_t begin, uint32_t end) {
+			uint32_t thread = m_jobs ? m_jobs->GetThreadIndex() : 0;
+			Pose& a = m_scratch[thread * 2];
+			Pose& b = m_scratch[thread * 2 + 1];
+			for (uint32_t i = begin; i < end; i++)
+			{
+				CrowdCharacter const& character = characters[m_due[i]];
+				uint32_t lod_bones = m_lods[select_lod(character.Distance)].BoneCount;
+
+				m_clips[character.Clips[0]].Sample(character.Times[0], lod_bones, a);
+				if (character.Blend > 0.0f)
+				{
+					m_clips[character.Clips[1]].Sample(character.Times[1], lod_bones, b);
+					BlendPoses(a, b, character.Blend, lod_bones, a);
+				}
+				ComputeSkinningPalette(m_skeleton, a, lod_bones, palettes.Data + size_t(i) * bone_count * 12);
+			}
+		};
+
+		if (m_jobs)
+			m_jobs->ParallelFor(due_count, s_SAMPLE_GRAIN, pose);
+		else
+			pose(0, due_count);
+
+		m_stats.SampleMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	PROFILE_GPU(command_buffer, "Skinning");
+
+	float const* center = m_mesh->GetCenter();
+
+	SkinConstants constants{};
+	constants.Bounds[0] = center[0];
+	constants.Bounds[1] = center[1];
+	constants.Bounds[2] = center[2];
+	constants.Bounds[3] = m_mesh->GetRadius();
+	constants.Rest = m_mesh->GetVertexAddress();
+	constants.Skin = m_skin_address;
+	constants.Palettes = palettes.Address;
+	constants.Characters = due.Address;
+	constants.Output = m_output_address;
+	constants.VertexCount = m_vertex_count;
+	constants.BoneCount = bone_count;
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetHandle());
+	m_device->GetBindlessHeap()->Bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetLayout());
+	PushConstants(command_buffer, m_pipeline->GetLayout(), constants);
+	vkCmdDispatch(command_buffer, (m_vertex_count + s_GROUP_SIZE - 1) / s_GROUP_SIZE, due_count, 1);
+}
+
+CullMesh CrowdSkinner::GetCullMesh(uint32_t character, float distance_per_error) const
+{
+	ASSERT(character < m_max_characters);
+	CullMesh mesh = m_mesh->GetCullMesh(distance_per_error);
+	for (uint32_t i = 0; i < mesh.LodCount; i++)
+		mesh.Lods[i].VertexOffset = static_cast<int32_t>(character * m_vertex_count);
+	return mesh;
+}
+
+void CrowdSkinner::PrintStats() const
+{
+	std::cout << "[Skinning] " << m_stats.Skinned << " characters skinned, by LOD";
+	for (uint32_t i = 0; i < std::min<size_t>(m_lods.size(), 4); i++)
+		std::cout << ' ' << m_stats.Characters[i];
+	std::cout << ", posed in " << m_stats.SampleMs << " ms\n";
+}
+
+void CrowdSkinner::AddVertexInput(GraphicsPipelineCreator& creator)
+{
+	creator.AddVertexBinding(0, sizeof(SkinnedVertex));
+	creator.AddVertexAttribute(0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SkinnedVertex, Position));
+	creator.AddVertexAttribute(1, 0, VK_FORMAT_R16G16_SNORM, offsetof(SkinnedVertex, Normal));
+	creator.AddVertexAttribute(2, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(SkinnedVertex, Uv));
+}
\ No newline at end of file
@@ -0,0 +1,508 @@
+#include "spatial.hpp"
+#include "simd.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+#define THISFILE "spatial.cpp"
+
+static constexpr uint32_t s_LEAF_BIT = 0x80000000u;
+static constexpr uint32_t s_EMPTY = UINT32_MAX;
+
+// Refitting the paths above a moved object costs about the depth of the tree, a full refit the number of nodes,
+// about half the objects. Past this fraction of objects moved, one pass over every node is cheaper.
+static constexpr uint32_t s_PARTIAL_REFIT_DIVISOR = 16;
+
+// Rebuild once the nodes' total surface area, which is what queries pay for, has grown this much since the build.
+static constexpr float s_REBUILD_AREA_RATIO = 2.0f;
+
+// Rebuild once more objects than this wait outside the tree, plus one for every s_PENDING_DIVISOR in it.
+static constexpr uint32_t s_MAX_PENDING = 64;
+static constexpr uint32_t s_PENDING_DIVISOR = 64;
+
+// Deep enough for any balanced tree of 32-bit object counts, with three siblings pushed per level.
+static constexpr uint32_t s_STACK_SIZE = 64;
+
+static constexpr uint32_t s_BATCH_GRAIN = 64;
+
+static constexpr float s_HUGE = std::numeric_limits<float>::max();
+
+static constexpr SpatialBounds s_EMPTY_BOUNDS = { { s_HUGE, s_HUGE, s_HUGE }, { -s_HUGE, -s_HUGE, -s_HUGE } };
+
+static bool s_IsEmpty(SpatialBounds const& bounds)
+{
+	return bounds.Min[0] > bounds.Max[0];
+}
+
+static float s_SurfaceArea(SpatialBounds const& bounds)
+{
+	if (s_IsEmpty(bounds))
+		return 0.0f;
+	float x = bounds.Max[0] - bounds.Min[0], y = bounds.Max[1] - bounds.Min[1], z = bounds.Max[2] - bounds.Min[2];
+	return 2.0f * (x * y + y * z + z * x);
+}
+
+// Reciprocal of a direction component that stays finite, so that zero times it never gives NaN.
+static float s_InverseDirection(float d)
+{
+	return std::abs(d) < 1e-30f ? std::copysign(1e30f, d) : 1.0f / d;
+}
+
+// Scalar ray-box test for objects waiting outside the tree. Returns the entry distance, or a negative value on a miss.
+static float s_RayBox(SpatialRay const& ray, float const inverse[3], SpatialBounds const& bounds, float max_distance)
+{
+	float near_t = 0.0f, far_t = max_distance;
+	for (int i = 0; i < 3; i++)
+	{
+		float a = (bounds.Min[i] - ray.Origin[i]) * inverse[i], b = (bounds.Max[i] - ray.Origin[i]) * inverse[i];
+		if (inverse[i] < 0.0f)
+			std::swap(a, b);
+		near_t = std::max(near_t, a);
+		far_t = std::min(far_t, b);
+	}
+	return near_t <= far_t ? near_t : -1.0f;
+}
+
+static bool s_SphereBox(SpatialSphere const& sphere, SpatialBounds const& bounds)
+{
+	float distance_squared = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		float d = std::max(std::max(bounds.Min[i] - sphere.Center[i], sphere.Center[i] - bounds.Max[i]), 0.0f);
+		distance_squared += d * d;
+	}
+	return distance_squared <= sphere.Radius * sphere.Radius;
+}
+
+SpatialIndex::SpatialIndex(JobSystem* jobs)
+	: m_jobs(jobs), m_object_count(0), m_built_area(0.0f), m_area(0.0f), m_area_ratio(1.0f), m_rebuilds(0), m_full_refits(0), m_partial_refits(0)
+{
+}
+
+SpatialHandle SpatialIndex::Insert(SpatialBounds const& bounds)
+{
+	ASSERT(!s_IsEmpty(bounds));
+	m_object_count++;
+
+	// A removed object's slot in the tree is as good as any, taking it over is just a move.
+	if (!m_free.empty())
+	{
+		SpatialHandle object = m_free.back();
+		m_free.pop_back();
+		Move(object, bounds);
+		if (m_locations[object].Node == UINT32_MAX)
+			m_pending.push_back(object);
+		return object;
+	}
+
+	SpatialHandle object = static_cast<SpatialHandle>(m_bounds.size());
+	m_bounds.push_back(bounds);
+	m_locations.push_back({ UINT32_MAX, 0 });
+	m_is_moved.push_back(false);
+	m_pending.push_back(object);
+	return object;
+}
+
+void SpatialIndex::Remove(SpatialHandle object)
+{
+	ASSERT(object < m_bounds.size() && !s_IsEmpty(m_bounds[object]));
+	m_object_count--;
+
+	if (m_locations[object].Node == UINT32_MAX)
+	{
+		m_bounds[object] = s_EMPTY_BOUNDS;
+		auto it = std::find(m_pending.begin(), m_pending.end(), object);
+		*it = m_pending.back();
+		m_pending.pop_back();
+	}
+	else
+		Move(object, s_EMPTY_BOUNDS);
+
+	m_free.push_back(object);
+}
+
+void SpatialIndex::Move(SpatialHandle object, SpatialBounds const& bounds)
+{
+	ASSERT(object < m_bounds.size());
+	m_bounds[object] = bounds;
+	if (m_locations[object].Node != UINT32_MAX && !m_is_moved[object])
+	{
+		m_is_moved[object] = true;
+		m_moved.push_back(object);
+	}
+}
+
+void SpatialIndex::Update()
+{
+	PROFILE_CPU("Update spatial index");
+
+	if (m_nodes.empty() ? !m_pending.empty() : m_pending.size() > s_MAX_PENDING + m_object_count / s_PENDING_DIVISOR)
+	{
+		Rebuild();
+		return;
+	}
+
+	if (m_moved.empty())
+		return;
+
+	if (m_moved.size() * s_PARTIAL_REFIT_DIVISOR < m_object_count)
+	{
+		// Up from each moved object until a node's bounds come out the same as before. Every node's area is counted
+		// in its parent's slot, so what the walk changes there is what the total changes by, the root's aside.
+		double area_change = -s_SurfaceArea(GetNodeBounds(m_nodes[0]));
+		for (SpatialHandle object : m_moved)
+		{
+			Location location = m_locations[object];
+			SetSlot(m_nodes[location.Node], location.Slot, m_bounds[object]);
+
+			for (uint32_t index = location.Node; m_nodes[index].Parent != UINT32_MAX; index = m_nodes[index].Parent)
+			{
+				Node const& node = m_nodes[index];
+				Node& parent = m_nodes[node.Parent];
+				SpatialBounds bounds = GetNodeBounds(node);
+				uint32_t slot = node.ParentSlot;
+
+				if (parent.MinX[slot] == bounds.Min[0] && parent.MinY[slot] == bounds.Min[1] && parent.MinZ[slot] == bounds.Min[2]
+					&& parent.MaxX[slot] == bounds.Max[0] && parent.MaxY[slot] == bounds.Max[1] && parent.MaxZ[slot] == bounds.Max[2])
+					break;
+
+				area_change += s_SurfaceArea(bounds);
+				area_change -= s_SurfaceArea({ { parent.MinX[slot], parent.MinY[slot], parent.MinZ[slot] }, { parent.MaxX[slot], parent.MaxY[slot], parent.MaxZ[slot] } });
+				SetSlot(parent, slot, bounds);
+			}
+		}
+		area_change += s_SurfaceArea(GetNodeBounds(m_nodes[0]));
+		m_area = std::max(static_cast<float>(m_area + area_change), 0.0f);
+		m_partial_refits++;
+	}
+	else
+	{
+		m_area = RefitAll();
+		m_full_refits++;
+	}
+	m_area_ratio = m_built_area > 0.0f ? m_area / m_built_area : 1.0f;
+
+	for (SpatialHandle object : m_moved)
+		m_is_moved[object] = false;
+	m_moved.clear();
+
+	if (m_area_ratio > s_REBUILD_AREA_RATIO)
+		Rebuild();
+}
+
+void SpatialIndex::Rebuild()
+{
+	PROFILE_CPU("Rebuild spatial index");
+
+	std::vector<SpatialHandle> objects;
+	std::vector<float> centroids(m_bounds.size() * 3);
+	objects.reserve(m_object_count);
+
+	for (SpatialHandle object = 0; object < m_bounds.size(); object++)
+	{
+		SpatialBounds const& bounds = m_bounds[object];
+		m_locations[object] = { UINT32_MAX, 0 };
+		m_is_moved[object] = false;
+		if (s_IsEmpty(bounds))
+			continue;
+
+		objects.push_back(object);
+		for (int i = 0; i < 3; i++)
+			centroids[object * 3 + i] = (bounds.Min[i] + bounds.Max[i]) * 0.5f;
+	}
+
+	m_nodes.clear();
+	m_pending.clear();
+	m_moved.clear();
+
+	if (!objects.empty())
+	{
+		m_nodes.reserve(objects.size() / 2 + 1);
+		BuildNode(objects, centroids, 0, static_cast<uint32_t>(objects.size()), UINT32_MAX, 0);
+	}
+
+	m_built_area = RefitAll();
+	m_area = m_built_area;
+	m_area_ratio = 1.0f;
+	m_rebuilds++;
+}
+
+uint32_t SpatialIndex::BuildNode(std::vector<SpatialHandle>& objects, std::vector<float>& centroids, uint32_t begin, uint32_t end,
+	uint32_t parent, uint32_t parent_slot)
+{
+	uint32_t index = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.emplace_back();
+	Node& node = m_nodes.back();
+	for (uint32_t slot = 0; slot < 4; slot++)
+	{
+		node.Children[slot] = s_EMPTY;
+		SetSlot(node, slot, s_EMPTY_BOUNDS);
+	}
+	node.Parent = parent;
+	node.ParentSlot = parent_slot;
+
+	// Halve at the median along the axis the centroids spread widest on. Cheap and balanced, which suits objects
+	// that move around as much as a crowd does better than a tighter but costlier split would.
+	auto split = [&](uint32_t lo, uint32_t hi) {
+		float min[3] = { s_HUGE, s_HUGE, s_HUGE }, max[3] = { -s_HUGE, -s_HUGE, -s_HUGE };
+		for (uint32_t i = lo; i < hi; i++)
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float c = centroids[objects[i] * 3 + axis];
+				min[axis] = std::min(min[axis], c);
+				max[axis] = std::max(max[axis], c);
+			}
+
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+			if (max[i] - min[i] > max[axis] - min[axis])
+				axis = i;
+
+		uint32_t mid = (lo + hi) / 2;
+		std::nth_element(objects.begin() + lo, objects.begin() + mid, objects.begin() + hi,
+			[&](SpatialHandle a, SpatialHandle b) { return centroids[a * 3 + axis] < centroids[b * 3 + axis]; });
+		return mid;
+	};
+
+	// Four children: the halves, halved again.
+	uint32_t count = end - begin;
+	uint32_t groups[5] = { begin, begin + 1, begin + 2, begin + 3, end };
+	if (count <= 4)
+		groups[1] = std::min(groups[1], end), groups[2] = std::min(groups[2], end), groups[3] = std::min(groups[3], end);
+	else
+	{
+		groups[2] = split(begin, end);
+		groups[1] = split(begin, groups[2]);
+		groups[3] = split(groups[2], end);
+	}
+
+	for (uint32_t slot = 0; slot < 4; slot++)
+	{
+		uint32_t lo = groups[slot], hi = groups[slot + 1];
+		if (hi - lo == 1)
+		{
+			m_nodes[index].Children[slot] = objects[lo] | s_LEAF_BIT;
+			m_locations[objects[lo]] = { index, slot };
+		}
+		else if (hi > lo)
+		{
+			uint32_t child = BuildNode(objects, centroids, lo, hi, index, slot);
+			m_nodes[index].Children[slot] = child; // The recursion may have moved the array
+		}
+	}
+
+	return index;
+}
+
+void SpatialIndex::SetSlot(Node& node, uint32_t slot, SpatialBounds const& bounds) const
+{
+	node.MinX[slot] = bounds.Min[0];
+	node.MinY[slot] = bounds.Min[1];
+	node.MinZ[slot] = bounds.Min[2];
+	node.MaxX[slot] = bounds.Max[0];
+	node.MaxY[slot] = bounds.Max[1];
+	node.MaxZ[slot] = bounds.Max[2];
+}
+
+SpatialBounds SpatialIndex::GetNodeBounds(Node const& node) const
+{
+	SpatialBounds bounds;
+	bounds.Min[0] = std::min(std::min(node.MinX[0], node.MinX[1]), std::min(node.MinX[2], node.MinX[3]));
+	bounds.Min[1] = std::min(std::min(node.MinY[0], node.MinY[1]), std::min(node.MinY[2], node.MinY[3]));
+	bounds.Min[2] = std::min(std::min(node.MinZ[0], node.MinZ[1]), std::min(node.MinZ[2], node.MinZ[3]));
+	bounds.Max[0] = std::max(std::max(node.MaxX[0], node.MaxX[1]), std::max(node.MaxX[2], node.MaxX[3]));
+	bounds.Max[1] = std::max(std::max(node.MaxY[0], node.MaxY[1]), std::max(node.MaxY[2], node.MaxY[3]));
+	bounds.Max[2] = std::max(std::max(node.MaxZ[0], node.MaxZ[1]), std::max(node.MaxZ[2], node.MaxZ[3]));
+	return bounds;
+}
+
+float SpatialIndex::RefitAll()
+{
+	// Children come after their parents, so walking backwards finishes every child before its parent.
+	float area = 0.0f;
+	for (uint32_t index = static_cast<uint32_t>(m_nodes.size()); index-- > 0;)
+	{
+		Node& node = m_nodes[index];
+		for (uint32_t slot = 0; slot < 4; slot++)
+		{
+			uint32_t child = node.Children[slot];
+			if (child == s_EMPTY)
+				continue;
+			SetSlot(node, slot, child & s_LEAF_BIT ? m_bounds[child & ~s_LEAF_BIT] : GetNodeBounds(m_nodes[child]));
+		}
+		area += s_SurfaceArea(GetNodeBounds(node));
+	}
+	return area;
+}
+
+SpatialHit SpatialIndex::Raycast(SpatialRay const& ray) const
+{
+	SpatialHit hit{ SPATIAL_INVALID_HANDLE, ray.MaxDistance };
+	float const inverse[3] = { s_InverseDirection(ray.Direction[0]), s_InverseDirection(ray.Direction[1]), s_InverseDirection(ray.Direction[2]) };
+
+	for (SpatialHandle object : m_pending)
+	{
+		float t = s_RayBox(ray, inverse, m_bounds[object], hit.Distance);
+		if (t >= 0.0f)
+			hit = { object, t };
+	}
+
+	if (m_nodes.empty())
+		return hit;
+
+	Float4 const origin_x = Splat4(ray.Origin[0]), origin_y = Splat4(ray.Origin[1]), origin_z = Splat4(ray.Origin[2]);
+	Float4 const inverse_x = Splat4(inverse[0]), inverse_y = Splat4(inverse[1]), inverse_z = Splat4(inverse[2]);
+	Float4 const zero = Splat4(0.0f);
+
+	// Slabs are entered through the min planes along positive directions and the max planes along negative ones.
+	// Picking them up front keeps empty slots, whose min is above their max, from ever being hit.
+	bool const negative[3] = { inverse[0] < 0.0f, inverse[1] < 0.0f, inverse[2] < 0.0f };
+
+	struct Entry { uint32_t Node; float Distance; };
+	Entry stack[s_STACK_SIZE];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = { 0, 0.0f };
+
+	while (stack_size)
+	{
+		Entry entry = stack[--stack_size];
+		if (entry.Distance > hit.Distance)
+			continue;
+
+		Node const& node = m_nodes[entry.Node];
+		Float4 near_x = (Load4(negative[0] ? node.MaxX : node.MinX) - origin_x) * inverse_x;
+		Float4 far_x = (Load4(negative[0] ? node.MinX : node.MaxX) - origin_x) * inverse_x;
+		Float4 near_y = (Load4(negative[1] ? node.MaxY : node.MinY) - origin_y) * inverse_y;
+		Float4 far_y = (Load4(negative[1] ? node.MinY : node.MaxY) - origin_y) * inverse_y;
+		Float4 near_z = (Load4(negative[2] ? node.MaxZ : node.MinZ) - origin_z) * inverse_z;
+		Float4 far_z = (Load4(negative[2] ? node.MinZ : node.MaxZ) - origin_z) * inverse_z;
+
+		Float4 enter = Max4(Max4(near_x, near_y), Max4(near_z, zero));
+		Float4 exit = Min4(Min4(far_x, far_y), Min4(far_z, Splat4(hit.Distance)));
+		uint32_t mask = LessEqualMask4(enter, exit);
+		if (!mask)
+			continue;
+
+		alignas(16) float distances[4];
+		Store4(distances, enter);
+
+		// Nodes go on the stack farthest first, so the nearest is searched first and shortens the ray for the rest.
+		Entry children[4];
+		uint32_t child_count = 0;
+		for (uint32_t slot = 0; slot < 4; slot++)
+		{
+			if (!(mask & (1u << slot)))
+				continue;
+
+			uint32_t child = node.Children[slot];
+			if (child & s_LEAF_BIT)
+			{
+				if (distances[slot] < hit.Distance || hit.Object == SPATIAL_INVALID_HANDLE)
+					hit = { child & ~s_LEAF_BIT, distances[slot] };
+			}
+			else
+			{
+				uint32_t i = child_count++;
+				for (; i > 0 && children[i - 1].Distance < distances[slot]; i--)
+					children[i] = children[i - 1];
+				children[i] = { child, distances[slot] };
+			}
+		}
+
+		ASSERT(stack_size + child_count <= s_STACK_SIZE);
+		for (uint32_t i = 0; i < child_count; i++)
+			stack[stack_size++] = children[i];
+	}
+
+	return hit;
+}
+
+void SpatialIndex::OverlapSphere(SpatialSphere const& sphere, std::vector<SpatialHandle>& results) const
+{
+	for (SpatialHandle object : m_pending)
+		if (s_SphereBox(sphere, m_bounds[object]))
+			results.push_back(object);
+
+	if (m_nodes.empty())
+		return;
+
+	Float4 const center_x = Splat4(sphere.Center[0]), center_y = Splat4(sphere.Center[1]), center_z = Splat4(sphere.Center[2]);
+	Float4 const radius_squared = Splat4(sphere.Radius * sphere.Radius);
+	Float4 const zero = Splat4(0.0f);
+
+	uint32_t stack[s_STACK_SIZE];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size)
+	{
+		Node const& node = m_nodes[stack[--stack_size]];
+
+		// Distance from the centre to each box, zero along axes where the centre is within the box.
+		Float4 dx = Max4(Max4(Load4(node.MinX) - center_x, center_x - Load4(node.MaxX)), zero);
+		Float4 dy = Max4(Max4(Load4(node.MinY) - center_y, center_y - Load4(node.MaxY)), zero);
+		Float4 dz = Max4(Max4(Load4(node.MinZ) - center_z, center_z - Load4(node.MaxZ)), zero);
+		uint32_t mask = LessEqualMask4(dx * dx + dy * dy + dz * dz, radius_squared);
+
+		for (uint32_t slot = 0; slot < 4; slot++)
+		{
+			if (!(mask & (1u << slot)))
+				continue;
+
+			uint32_t child = node.Children[slot];
+			if (child & s_LEAF_BIT)
+				results.push_back(child & ~s_LEAF_BIT);
+			else
+			{
+				ASSERT(stack_size < s_STACK_SIZE);
+				stack[stack_size++] = child;
+			}
+		}
+	}
+}
+
+void SpatialIndex::RaycastBatch(SpatialRay const* rays, uint32_t count, SpatialHit* hits) const
+{
+	auto body = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+			hits[i] = Raycast(rays[i]);
+	};
+
+	if (m_jobs)
+		m_jobs->ParallelFor(count, s_BATCH_GRAIN, body);
+	else
+		body(0, count);
+}
+
+void SpatialIndex::OverlapSphereBatch(SpatialSphere const* spheres, uint32_t count, std::vector<SpatialHandle>* results) const
+{
+	auto body = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+			OverlapSphere(spheres[i], results[i]);
+	};
+
+	if (m_jobs)
+		m_jobs->ParallelFor(count, s_BATCH_GRAIN, body);
+	else
+		body(0, count);
+}
+
+SpatialStats SpatialIndex::GetStats() const
+{
+	SpatialStats stats{};
+	stats.ObjectCount = m_object_count;
+	stats.NodeCount = static_cast<uint32_t>(m_nodes.size());
+	stats.PendingCount = static_cast<uint32_t>(m_pending.size());
+	stats.AreaRatio = m_area_ratio;
+	stats.Rebuilds = m_rebuilds;
+	stats.FullRefits = m_full_refits;
+	stats.PartialRefits = m_partial_refits;
+	return stats;
+}
+
+void SpatialIndex::PrintStats() const
+{
+	SpatialStats stats = GetStats();
+	std::cout << "[Spatial] " << stats.ObjectCount << " objects in " << stats.NodeCount << " nodes, " << stats.PendingCount << " pending, area "
+		<< stats.AreaRatio << "x of last build, " << stats.Rebuilds << " rebuilds, " << stats.FullRefits << " full and "
+		<< stats.PartialRefits << " partial refits\n";
+}
\ No newline at end of file
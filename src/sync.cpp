@@ -0,0 +1,204 @@
+#include "sync.hpp"
+#include "vulkan.hpp"
+
+#define THISFILE "sync.cpp"
+
+TimelineSemaphore::TimelineSemaphore(GraphicsDevice const& device, uint64_t initial_value)
+	: m_device(device.GetLogical()), m_last_value(initial_value)
+{
+	VkSemaphoreTypeCreateInfo type_info{};
+	type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = initial_value;
+
+	VkSemaphoreCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	create_info.pNext = &type_info;
+
+	VALIDATE(vkCreateSemaphore(m_device, &create_info, nullptr, &m_semaphore) == VK_SUCCESS);
+}
+
+TimelineSemaphore::~TimelineSemaphore()
+{
+	vkDestroySemaphore(m_device, m_semaphore, nullptr);
+}
+
+uint64_t TimelineSemaphore::GetCompletedValue() const
+{
+	uint64_t value;
+	VALIDATE(vkGetSemaphoreCounterValue(m_device, m_semaphore, &value) == VK_SUCCESS);
+	return value;
+}
+
+bool TimelineSemaphore::Wait(uint64_t value, uint64_t timeout) const
+{
+	VkSemaphoreWaitInfo wait_info{};
+	wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	wait_info.semaphoreCount = 1;
+	wait_info.pSemaphores = &m_semaphore;
+	wait_info.pValues = &value;
+
+	VkResult result = vkWaitSemaphores(m_device, &wait_info, timeout);
+	VALIDATE(result == VK_SUCCESS || result == VK_TIMEOUT);
+	return result == VK_SUCCESS;
+}
+
+void TimelineSemaphore::Signal(uint64_t value)
+{
+	VkSemaphoreSignalInfo signal_info{};
+	signal_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO;
+	signal_info.semaphore = m_semaphore;
+	signal_info.value = value;
+
+	VALIDATE(vkSignalSemaphore(m_device, &signal_info) == VK_SUCCESS);
+}
+
+VkSemaphoreSubmitInfo TimelineSemaphore::WaitInfo(uint64_t value, VkPipelineStageFlags2 stage) const
+{
+	VkSemaphoreSubmitInfo info{};
+	info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+	info.semaphore = m_semaphore;
+	info.value = value;
+	info.stageMask = stage;
+	return info;
+}
+
+VkSemaphoreSubmitInfo TimelineSemaphore::SignalInfo(uint64_t value, VkPipelineStageFlags2 stage) const
+{
+	return WaitInfo(value, stage);
+}
+
+void TransitionImage(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout,
+	VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	VkImageMemoryBarrier2 barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	barrier.srcStageMask = src_stage;
+	barrier.srcAccessMask = src_access;
+	barrier.dstStageMask = dst_stage;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+
+	VkDependencyInfo dependency{};
+	dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependency.imageMemoryBarrierCount = 1;
+	dependency.pImageMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2(command_buffer, &dependency);
+}
+
+void GlobalBarrier(VkCommandBuffer command_buffer, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access,
+	VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	VkMemoryBarrier2 barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+	barrier.srcStageMask = src_stage;
+	barrier.srcAccessMask = src_access;
+	barrier.dstStageMask = dst_stage;
+	barrier.dstAccessMask = dst_access;
+
+	VkDependencyInfo dependency{};
+	dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependency.memoryBarrierCount = 1;
+	dependency.pMemoryBarriers = &barrier;
+
+	vkCmdPipelineBarrier2(command_buffer, &dependency);
+}
+
+QueueOwnershipTransfer::QueueOwnershipTransfer(uint32_t src_family, uint32_t dst_family)
+	: m_src_family(src_family), m_dst_family(dst_family)
+{
+}
+
+void QueueOwnershipTransfer::AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+	VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	VkBufferMemoryBarrier2 barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+	barrier.srcStageMask = src_stage;
+	barrier.srcAccessMask = src_access;
+	barrier.dstStageMask = dst_stage;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = IsCrossFamily() ? m_src_family : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = IsCrossFamily() ? m_dst_family : VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+	m_buffers.push_back(barrier);
+}
+
+void QueueOwnershipTransfer::AddImage(VkImage image, VkImageSubresourceRange const& range, VkImageLayout old_layout, VkImageLayout new_layout,
+	VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	VkImageMemoryBarrier2 barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	barrier.srcStageMask = src_stage;
+	barrier.srcAccessMask = src_access;
+	barrier.dstStageMask = dst_stage;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = IsCrossFamily() ? m_src_family : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = IsCrossFamily() ? m_dst_family : VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	m_images.push_back(barrier);
+}
+
+void QueueOwnershipTransfer::RecordRelease(VkCommandBuffer command_buffer) const
+{
+	if (IsCrossFamily())
+		Record(command_buffer, true);
+}
+
+void QueueOwnershipTransfer::RecordAcquire(VkCommandBuffer command_buffer) const
+{
+	Record(command_buffer, false);
+}
+
+void QueueOwnershipTransfer::Clear()
+{
+	m_buffers.clear();
+	m_images.clear();
+}
+
+void QueueOwnershipTransfer::Record(VkCommandBuffer command_buffer, bool release) const
+{
+	if (IsEmpty())
+		return;
+
+	// Across families, the release only has a source scope and the acquire only a destination scope;
+	// the semaphore between the two submissions covers the rest. Within a family the acquire is the full barrier.
+	std::vector<VkBufferMemoryBarrier2> buffers = m_buffers;
+	std::vector<VkImageMemoryBarrier2> images = m_images;
+
+	if (IsCrossFamily())
+	{
+		for (auto& barrier : buffers) {
+			if (release)
+				barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE, barrier.dstAccessMask = VK_ACCESS_2_NONE;
+			else
+				barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE, barrier.srcAccessMask = VK_ACCESS_2_NONE;
+		}
+		for (auto& barrier : images) {
+			if (release)
+				barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE, barrier.dstAccessMask = VK_ACCESS_2_NONE;
+			else
+				barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE, barrier.srcAccessMask = VK_ACCESS_2_NONE;
+		}
+	}
+
+	VkDependencyInfo dependency{};
+	dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependency.bufferMemoryBarrierCount = static_cast<uint32_t>(buffers.size());
+	dependency.pBufferMemoryBarriers = buffers.data();
+	dependency.imageMemoryBarrierCount = static_cast<uint32_t>(images.size());
+	dependency.pImageMemoryBarriers = images.data();
+
+	vkCmdPipelineBarrier2(command_buffer, &dependency);
+}
\ No newline at end of file
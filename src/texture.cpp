@@ -0,0 +1,832 @@
+#include "texture.hpp"
+#include "vulkan.hpp"
+#include "memory.hpp"
+#include "asset_pack.hpp"
+#include "bindless.hpp"
+#include "frame.hpp"
+#include "frame_ring.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+#include <bit>
+#include <cmath>
+#include <numeric>
+#include <memory>
+
+#define THISFILE "texture.cpp"
+
+// Residency changes started per Update, so a burst of requests spreads over a few frames.
+static constexpr uint32_t s_MAX_CHANGES_PER_UPDATE = 8;
+
+// KTX2 layout, see the Khronos KTX 2.0 specification. Only what 2D textures need is read; the data format
+// descriptor is ignored in favour of the Vulkan format.
+static constexpr uint8_t s_KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct Ktx2Header
+{
+	uint8_t Identifier[12];
+	uint32_t Format;
+	uint32_t TypeSize;
+	uint32_t PixelWidth;
+	uint32_t PixelHeight;
+	uint32_t PixelDepth;
+	uint32_t LayerCount;
+	uint32_t FaceCount;
+	uint32_t LevelCount;
+	uint32_t SupercompressionScheme;
+	uint32_t DfdByteOffset;
+	uint32_t DfdByteLength;
+	uint32_t KvdByteOffset;
+	uint32_t KvdByteLength;
+	uint64_t SgdByteOffset;
+	uint64_t SgdByteLength;
+};
+
+struct Ktx2Level
+{
+	uint64_t ByteOffset;
+	uint64_t ByteLength;
+	uint64_t UncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80 && sizeof(Ktx2Level) == 24, "KTX2 layout must not depend on the compiler");
+
+struct BlockInfo
+{
+	uint32_t Bytes; // Zero for formats that cannot be streamed
+	uint32_t Width, Height;
+};
+
+static BlockInfo s_GetBlockInfo(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R8_SRGB:
+		return { 1, 1, 1 };
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R8G8_SRGB:
+		return { 2, 1, 1 };
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		return { 4, 1, 1 };
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+	case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+	case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+		return { 8, 4, 4 };
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+	case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+	case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+		return { 16, 4, 4 };
+	default:
+		return { 0, 0, 0 };
+	}
+}
+
+// Canonical Huffman code of a deflate block, as counts of codes per length and symbols in code order.
+struct InflateHuffman
+{
+	uint16_t Counts[16];
+	uint16_t Symbols[320];
+};
+
+struct InflateStream
+{
+	uint8_t const* Data;
+	size_t Size;
+	size_t Position;
+	uint32_t BitBuffer;
+	uint32_t BitCount;
+
+	// Deflate packs bits from the least significant end of each byte.
+	uint32_t Bits(uint32_t count)
+	{
+		uint32_t value = BitBuffer;
+		while (BitCount < count)
+		{
+			VALIDATE(Position < Size);
+			value |= static_cast<uint32_t>(Data[Position++]) << BitCount;
+			BitCount += 8;
+		}
+
+		BitBuffer = value >> count;
+		BitCount -= count;
+		return value & ((1u << count) - 1);
+	}
+};
+
+static void s_BuildHuffman(InflateHuffman& huffman, uint16_t const* lengths, uint32_t count)
+{
+	std::fill_n(huffman.Counts, 16, uint16_t(0));
+	for (uint32_t i = 0; i < count; i++)
+		huffman.Counts[lengths[i]]++;
+
+	uint16_t offsets[16];
+	offsets[1] = 0;
+	for (uint32_t length = 1; length < 15; length++)
+		offsets[length + 1] = offsets[length] + huffman.Counts[length];
+
+	for (uint32_t symbol = 0; symbol < count; symbol++)
+		if (lengths[symbol])
+			huffman.Symbols[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+}
+
+// Codes of each length are consecutive integers, so one comparison per bit finds the symbol.
+static uint32_t s_DecodeSymbol(InflateStream& stream, InflateHuffman const& huffman)
+{
+	int32_t code = 0, first = 0, index = 0;
+	for (uint32_t length = 1; length < 16; length++)
+	{
+		code |= static_cast<int32_t>(stream.Bits(1));
+		int32_t count = huffman.Counts[length];
+		if (code - count < first)
+			return huffman.Symbols[index + (code - first)];
+
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	VALIDATE(!"Invalid deflate code");
+	return 0;
+}
+
+// Zlib stream decoder (RFC 1950 and 1951), so zlib supercompressed textures need no external library.
+static std::vector<char> s_Inflate(void const* data, size_t size, size_t expected_size)
+{
+	static constexpr uint16_t s_LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static constexpr uint8_t s_LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static constexpr uint16_t s_DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+		4097, 6145, 8193, 12289, 16385, 24577 };
+	static constexpr uint8_t s_DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	static constexpr uint8_t s_CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	InflateStream stream{ static_cast<uint8_t const*>(data), size, 0, 0, 0 };
+
+	// Deflate with a window of at most 32 KiB and no preset dictionary.
+	uint32_t cmf = stream.Bits(8), flags = stream.Bits(8);
+	VALIDATE((cmf & 15) == 8 && (cmf >> 4) <= 7 && (cmf * 256 + flags) % 31 == 0 && !(flags & 32));
+
+	std::vector<char> out;
+	out.reserve(expected_size);
+
+	bool last;
+	do
+	{
+		last = stream.Bits(1);
+		uint32_t type = stream.Bits(2);
+
+		// Stored block, from the next byte boundary.
+		if (type == 0)
+		{
+			stream.BitBuffer = stream.BitCount = 0;
+			VALIDATE(stream.Position + 4 <= size);
+			uint8_t const* header = stream.Data + stream.Position;
+			uint32_t length = header[0] | header[1] << 8;
+			VALIDATE((length ^ 0xFFFF) == static_cast<uint32_t>(header[2] | header[3] << 8));
+			stream.Position += 4;
+			VALIDATE(stream.Position + length <= size);
+			out.insert(out.end(), stream.Data + stream.Position, stream.Data + stream.Position + length);
+			stream.Position += length;
+			continue;
+		}
+
+		VALIDATE(type != 3);
+		InflateHuffman literals, distances;
+		uint16_t lengths[320] = {};
+
+		if (type == 1)
+		{
+			std::fill_n(lengths, 144, uint16_t(8));
+			std::fill_n(lengths + 144, 112, uint16_t(9));
+			std::fill_n(lengths + 256, 24, uint16_t(7));
+			std::fill_n(lengths + 280, 8, uint16_t(8));
+			s_BuildHuffman(literals, lengths, 288);
+			std::fill_n(lengths, 30, uint16_t(5));
+			s_BuildHuffman(distances, lengths, 30);
+		}
+		else
+		{
+			uint32_t literal_count = stream.Bits(5) + 257, distance_count = stream.Bits(5) + 1, code_length_count = stream.Bits(4) + 4;
+			VALIDATE(literal_count <= 286 && distance_count <= 30);
+
+			uint16_t code_lengths[19] = {};
+			for (uint32_t i = 0; i < code_length_count; i++)
+				code_lengths[s_CODE_LENGTH_ORDER[i]] = static_cast<uint16_t>(stream.Bits(3));
+
+			InflateHuffman code_length_huffman;
+			s_BuildHuffman(code_length_huffman, code_lengths, 19);
+
+			// Literal and distance code lengths, run-length encoded together.
+			for (uint32_t i = 0; i < literal_count + distance_count;)
+			{
+				uint32_t symbol = s_DecodeSymbol(stream, code_length_huffman);
+				if (symbol < 16)
+				{
+					lengths[i++] = static_cast<uint16_t>(symbol);
+					continue;
+				}
+
+				uint16_t value = 0;
+				uint32_t repeat;
+				if (symbol == 16)
+				{
+					VALIDATE(i > 0);
+					value = lengths[i - 1];
+					repeat = 3 + stream.Bits(2);
+				}
+				else if (symbol == 17)
+					repeat = 3 + stream.Bits(3);
+				else
+					repeat = 11 + stream.Bits(7);
+
+				VALIDATE(i + repeat <= literal_count + distance_count);
+				std::fill_n(lengths + i, repeat, value);
+				i += repeat;
+			}
+
+			s_BuildHuffman(literals, lengths, literal_count);
+			s_BuildHuffman(distances, lengths + literal_count, distance_count);
+		}
+
+		for (;;)
+		{
+			uint32_t symbol = s_DecodeSymbol(stream, literals);
+			if (symbol < 256)
+			{
+				out.push_back(static_cast<char>(symbol));
+				continue;
+			}
+			if (symbol == 256)
+				break;
+
+			symbol -= 257;
+			VALIDATE(symbol < 29);
+			uint32_t length = s_LENGTH_BASE[symbol] + stream.Bits(s_LENGTH_EXTRA[symbol]);
+
+			uint32_t distance_symbol = s_DecodeSymbol(stream, distances);
+			VALIDATE(distance_symbol < 30);
+			uint32_t distance = s_DISTANCE_BASE[distance_symbol] + stream.Bits(s_DISTANCE_EXTRA[distance_symbol]);
+			VALIDATE(distance <= out.size());
+
+			// Byte by byte, since the match may overlap what it writes.
+			size_t from = out.size() - distance;
+			for (uint32_t i = 0; i < length; i++)
+				out.push_back(out[from + i]);
+		}
+	} while (!last);
+
+	// Adler-32 of the output, big endian, on the next byte boundary.
+	VALIDATE(stream.Position + 4 <= size);
+	uint8_t const* trailer = stream.Data + stream.Position;
+	uint32_t expected_adler = static_cast<uint32_t>(trailer[0]) << 24 | trailer[1] << 16 | trailer[2] << 8 | trailer[3];
+
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < out.size();)
+	{
+		// 5552 bytes is the most that can be summed before b overflows.
+		size_t end = std::min(out.size(), i + 5552);
+		for (; i < end; i++)
+		{
+			a += static_cast<uint8_t>(out[i]);
+			b += a;
+		}
+		a %= 65521, b %= 65521;
+	}
+	VALIDATE((b << 16 | a) == expected_adler);
+
+	return out;
+}
+
+TextureStreamer::TextureStreamer(GraphicsDevice const& device, AssetPack const& pack, Uploader& uploader, JobSystem* jobs,
+	VkDeviceSize budget, uint32_t tail_size)
+	: m_device(&device), m_pack(&pack), m_uploader(&uploader), m_jobs(jobs), m_budget(budget), m_tail_size(std::max(tail_size, 1u)),
+	m_requested_bytes(0), m_streamed_bytes(0), m_evicted_levels(0), m_failed_changes(0)
+{
+	m_transcoders.resize(TEXTURE_SUPERCOMPRESSION_ZLIB + 1, { VK_FORMAT_UNDEFINED, nullptr });
+	m_transcoders[TEXTURE_SUPERCOMPRESSION_ZLIB].Function = [](TextureSource const& source) {
+		return s_Inflate(source.Data, source.Size, source.UncompressedSize);
+	};
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device.GetPhysical(), &properties);
+
+	// The device is created with samplerAnisotropy, which is what keeps streamed mips sharp at grazing angles.
+	VkSamplerCreateInfo sampler_info{};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter = VK_FILTER_LINEAR;
+	sampler_info.minFilter = VK_FILTER_LINEAR;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sampler_info.anisotropyEnable = VK_TRUE;
+	sampler_info.maxAnisotropy = std::min(16.0f, properties.limits.maxSamplerAnisotropy);
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+	VALIDATE(vkCreateSampler(device.GetLogical(), &sampler_info, nullptr, &m_sampler) == VK_SUCCESS);
+	m_sampler_index = device.GetBindlessHeap()->AddSampler(m_sampler);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	VkDevice ld = m_device->GetLogical();
+	MemoryAllocator* allocator = m_device->GetAllocator();
+	BindlessHeap* heap = m_device->GetBindlessHeap();
+
+	for (Texture* texture : m_textures)
+	{
+		if (Change* change = texture->Pending)
+		{
+			if (m_jobs)
+				m_jobs->Wait(*change->Decoded);
+			vkDestroyImageView(ld, change->View, nullptr);
+			allocator->DestroyImage(change->Image, change->Memory);
+			delete change->Decoded;
+			delete change;
+		}
+
+		if (texture->Image)
+		{
+			heap->Free(BINDLESS_TEXTURE, texture->Slot);
+			vkDestroyImageView(ld, texture->View, nullptr);
+			allocator->DestroyImage(texture->Image, texture->Memory);
+		}
+
+		delete texture;
+	}
+
+	heap->Free(BINDLESS_SAMPLER, m_sampler_index);
+	vkDestroySampler(ld, m_sampler, nullptr);
+}
+
+void TextureStreamer::SetTranscoder(TextureSupercompression scheme, VkFormat format, TextureTranscoder transcoder)
+{
+	VALIDATE(scheme < m_transcoders.size());
+	m_transcoders[scheme] = { format, std::move(transcoder) };
+}
+
+TextureHandle TextureStreamer::Load(std::string_view name)
+{
+	AssetView asset = m_pack->Find(name);
+	VALIDATE(asset.Data && asset.Type == ASSET_TEXTURE && asset.Size >= sizeof(Ktx2Header));
+
+	char const* data = static_cast<char const*>(asset.Data);
+	Ktx2Header const& header = *reinterpret_cast<Ktx2Header const*>(data);
+	VALIDATE(std::equal(s_KTX2_IDENTIFIER, s_KTX2_IDENTIFIER + 12, header.Identifier));
+
+	// Plain 2D textures only: no arrays, cube maps or volumes.
+	uint32_t level_count = std::max(header.LevelCount, 1u);
+	VALIDATE(header.PixelWidth && header.PixelHeight && !header.PixelDepth && header.LayerCount <= 1 && header.FaceCount == 1);
+	VALIDATE(level_count <= static_cast<uint32_t>(std::bit_width(std::max(header.PixelWidth, header.PixelHeight))));
+	VALIDATE(sizeof(Ktx2Header) + level_count * sizeof(Ktx2Level) <= asset.Size);
+
+	VALIDATE(header.SupercompressionScheme < m_transcoders.size());
+	TextureSupercompression scheme = static_cast<TextureSupercompression>(header.SupercompressionScheme);
+	Transcoder const& transcoder = m_transcoders[scheme];
+	VALIDATE(scheme == TEXTURE_SUPERCOMPRESSION_NONE || transcoder.Function); // Register zstd and BasisLZ transcoders first
+
+	// Freed should anything below throw.
+	std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+	texture->File = data;
+	texture->FileSize = asset.Size;
+	texture->Scheme = scheme;
+	texture->SourceFormat = static_cast<VkFormat>(header.Format);
+	texture->Format = transcoder.Format != VK_FORMAT_UNDEFINED ? transcoder.Format : texture->SourceFormat;
+	texture->Width = header.PixelWidth;
+	texture->Height = header.PixelHeight;
+	texture->LevelCount = level_count;
+
+	BlockInfo block = s_GetBlockInfo(texture->Format);
+	VALIDATE(block.Bytes);
+
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(m_device->GetPhysical(), texture->Format, &format_properties);
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	VALIDATE((format_properties.optimalTilingFeatures & required) == required);
+
+	Ktx2Level const* levels = reinterpret_cast<Ktx2Level const*>(data + sizeof(Ktx2Header));
+	texture->Levels.resize(level_count);
+
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		VALIDATE(levels[i].ByteOffset <= asset.Size && levels[i].ByteLength <= asset.Size - levels[i].ByteOffset);
+
+		uint32_t width = std::max(texture->Width >> i, 1u), height = std::max(texture->Height >> i, 1u);
+		Level& level = texture->Levels[i];
+		level.Data = data + levels[i].ByteOffset;
+		level.Size = static_cast<size_t>(levels[i].ByteLength);
+		level.UncompressedSize = static_cast<size_t>(levels[i].UncompressedByteLength);
+		level.ResidentSize = VkDeviceSize((width + block.Width - 1) / block.Width) * ((height + block.Height - 1) / block.Height) * block.Bytes;
+
+		// Uploaded as is, straight from the pack.
+		if (!transcoder.Function)
+			VALIDATE(level.Size == level.ResidentSize);
+	}
+
+	// The tail is every level no larger than tail_size, or just the smallest level.
+	uint32_t tail_first = 0;
+	while (tail_first + 1 < level_count && std::max(texture->Width >> tail_first, texture->Height >> tail_first) > m_tail_size)
+		tail_first++;
+	texture->TailFirst = tail_first;
+	texture->Finest = 0;
+
+	texture->First = level_count;
+	texture->Slot = BINDLESS_INVALID_INDEX;
+	texture->Requested = level_count;
+	texture->LastRequested = 0;
+
+	StartChange(*texture, tail_first);
+	m_textures.push_back(texture.release());
+	return static_cast<TextureHandle>(m_textures.size() - 1);
+}
+
+void TextureStreamer::Request(TextureHandle texture, float screen_size)
+{
+	ASSERT(texture < m_textures.size());
+	Texture& target = *m_textures[texture];
+
+	// Each level halves the size, so the finest level needed is where it stops covering more than a texel per pixel.
+	float texels_per_pixel = std::max(target.Width, target.Height) / std::max(screen_size, 1.0f);
+	uint32_t level = texels_per_pixel > 1.0f ? static_cast<uint32_t>(std::log2(texels_per_pixel)) : 0;
+	level = std::min(level, target.TailFirst);
+
+	uint32_t requested = target.Requested.load(std::memory_order_relaxed);
+	while (level < requested && !target.Requested.compare_exchange_weak(requested, level, std::memory_order_relaxed));
+}
+
+VkDeviceAddress TextureStreamer::Update(VkCommandBuffer command_buffer, FrameScheduler& scheduler, FrameRing& ring)
+{
+	PROFILE_CPU("Stream textures");
+
+	uint64_t frame = scheduler.GetFrameIndex();
+	uint32_t texture_count = static_cast<uint32_t>(m_textures.size());
+
+	// Textures asked for finer mips get them, the others keep what they have until the budget says otherwise.
+	std::vector<uint32_t> current(texture_count), targets(texture_count);
+	VkDeviceSize total = 0;
+
+	for (uint32_t i = 0; i < texture_count; i++)
+	{
+		Texture& texture = *m_textures[i];
+		current[i] = texture.Pending ? texture.Pending->First : texture.First;
+		targets[i] = current[i];
+
+		uint32_t requested = texture.Requested.exchange(texture.LevelCount, std::memory_order_relaxed);
+		if (requested < texture.LevelCount)
+		{
+			texture.LastRequested = frame;
+			targets[i] = std::min(targets[i], std::max(requested, texture.Finest));
+		}
+
+		total += GetResidentSize(texture, targets[i]);
+	}
+
+	m_requested_bytes = total;
+
+	// Over budget, the least recently requested textures give up their finest mips first, down to their tails.
+	// Among textures requested in the same frame, the finest mips go first.
+	if (total > m_budget)
+	{
+		std::vector<uint32_t> order(texture_count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			if (m_textures[a]->LastRequested != m_textures[b]->LastRequested)
+				return m_textures[a]->LastRequested < m_textures[b]->LastRequested;
+			return targets[a] < targets[b];
+		});
+
+		for (uint32_t i : order)
+		{
+			Texture& texture = *m_textures[i];
+			for (; total > m_budget && targets[i] < texture.TailFirst; targets[i]++)
+			{
+				total -= texture.Levels[targets[i]].ResidentSize;
+				if (targets[i] >= current[i])
+					m_evicted_levels++;
+			}
+
+			if (total <= m_budget)
+				break;
+		}
+	}
+
+	// One change in flight per texture; a texture whose target moves meanwhile catches up once it lands.
+	uint32_t started = 0;
+	for (uint32_t i = 0; i < texture_count && started < s_MAX_CHANGES_PER_UPDATE; i++)
+	{
+		Texture& texture = *m_textures[i];
+		if (!texture.Pending && targets[i] != texture.First)
+		{
+			StartChange(texture, targets[i]);
+			started++;
+		}
+	}
+
+	FinishChanges(command_buffer, scheduler);
+
+	FrameSpan<uint32_t> table = ring.Allocate<uint32_t>(std::max(texture_count, 1u));
+	for (uint32_t i = 0; i < texture_count; i++)
+		table.Data[i] = m_textures[i]->Slot;
+	return table.Address;
+}
+
+TextureStreamStats TextureStreamer::GetStats() const
+{
+	TextureStreamStats stats{};
+	stats.BudgetBytes = m_budget;
+	stats.StreamedBytes = m_streamed_bytes.load(std::memory_order_relaxed);
+	stats.RequestedBytes = m_requested_bytes;
+	stats.EvictedLevels = m_evicted_levels;
+	stats.FailedChanges = m_failed_changes;
+	stats.TextureCount = static_cast<uint32_t>(m_textures.size());
+
+	for (Texture const* texture : m_textures)
+	{
+		uint32_t first = texture->Pending ? texture->Pending->First : texture->First;
+		stats.ResidentBytes += GetResidentSize(*texture, first);
+		stats.PendingCount += texture->Pending != nullptr;
+	}
+
+	return stats;
+}
+
+void TextureStreamer::PrintStats() const
+{
+	TextureStreamStats stats = GetStats();
+	std::cout << "[Textures] " << stats.TextureCount << " textures, " << stats.ResidentBytes / (1 << 20) << " of "
+		<< stats.BudgetBytes / (1 << 20) << " MiB resident, " << stats.PendingCount << " streaming, "
+		<< stats.StreamedBytes / (1 << 20) << " MiB streamed, " << stats.EvictedLevels << " mips evicted, " << stats.FailedChanges
+		<< " changes failed\n";
+}
+
+VkDeviceSize TextureStreamer::GetResidentSize(Texture const& texture, uint32_t first) const
+{
+	VkDeviceSize size = 0;
+	for (uint32_t i = first; i < texture.LevelCount; i++)
+		size += texture.Levels[i].ResidentSize;
+	return size;
+}
+
+void TextureStreamer::StartChange(Texture& texture, uint32_t first)
+{
+	uint32_t mip_count = texture.LevelCount - first;
+
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = texture.Format;
+	image_info.extent = { std::max(texture.Width >> first, 1u), std::max(texture.Height >> first, 1u), 1 };
+	image_info.mipLevels = mip_count;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	Allocation* memory;
+	VkImage image = m_device->GetAllocator()->CreateImage(image_info, GPU_ONLY_MEMORY, &memory);
+
+	VkImageViewCreateInfo view_info{};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = texture.Format;
+	view_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_count, 0, 1 };
+
+	VkImageView view;
+	VkResult result = vkCreateImageView(m_device->GetLogical(), &view_info, nullptr, &view);
+	if (result != VK_SUCCESS)
+		m_device->GetAllocator()->DestroyImage(image, memory);
+	VALIDATE(result == VK_SUCCESS);
+
+	Change* change = new Change{};
+	change->First = first;
+	change->Image = image;
+	change->Memory = memory;
+	change->View = view;
+	change->Decoded = new JobCounter();
+	change->LastTicket = 0;
+	change->FailedEnd = 0;
+	texture.Pending = change;
+
+	// Levels the current image already holds are copied over when the change finishes, the rest come from the pack.
+	for (uint32_t level = first; level < texture.First; level++)
+		UploadLevel(texture, *change, level);
+}
+
+void TextureStreamer::UploadLevel(Texture& texture, Change& change, uint32_t level)
+{
+	VkImageSubresourceLayers subresource{ VK_IMAGE_ASPECT_COLOR_BIT, level - change.First, 0, 1 };
+	VkExtent3D extent{ std::max(texture.Width >> level, 1u), std::max(texture.Height >> level, 1u), 1 };
+	Level const& source = texture.Levels[level];
+
+	// Decode jobs finish in any order, and the change is ready once the latest of its uploads is.
+	auto track = [&change](UploadTicket ticket) {
+		UploadTicket last = change.LastTicket.load(std::memory_order_relaxed);
+		while (ticket > last && !change.LastTicket.compare_exchange_weak(last, ticket, std::memory_order_relaxed));
+	};
+
+	// Failures stay with the change, for FinishChanges to drop it, rather than leaving a level never uploaded or
+	// surfacing at some unrelated JobSystem::Wait.
+	auto fail = [&change, level]() {
+		uint32_t failed = change.FailedEnd.load(std::memory_order_relaxed);
+		while (level + 1 > failed && !change.FailedEnd.compare_exchange_weak(failed, level + 1, std::memory_order_relaxed));
+	};
+
+	Transcoder const* transcoder = &m_transcoders[texture.Scheme];
+	if (!transcoder->Function)
+	{
+		try
+		{
+			track(m_uploader->UploadImage(change.Image, subresource, extent, source.Data, source.Size,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT));
+			m_streamed_bytes.fetch_add(source.Size, std::memory_order_relaxed);
+		}
+		catch (...) { fail(); }
+		return;
+	}
+
+	auto decode = [this, &texture, &change, &source, transcoder, track, fail, level, subresource, extent]() {
+		PROFILE_CPU("Decode texture level");
+
+		try
+		{
+			TextureSource input{ texture.File, texture.FileSize, level, source.Data, source.Size, source.UncompressedSize, extent.width, extent.height, texture.SourceFormat };
+			std::vector<char> data = transcoder->Function(input);
+			VALIDATE(data.size() == source.ResidentSize);
+
+			track(m_uploader->UploadImage(change.Image, subresource, extent, std::move(data),
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT));
+			m_streamed_bytes.fetch_add(source.ResidentSize, std::memory_order_relaxed);
+		}
+		catch (...) { fail(); }
+	};
+
+	if (m_jobs)
+		m_jobs->Submit(decode, change.Decoded);
+	else
+		decode();
+}
+
+void TextureStreamer::FinishChanges(VkCommandBuffer command_buffer, FrameScheduler& scheduler)
+{
+	std::vector<Texture*> finished;
+	for (Texture* texture : m_textures)
+		if (texture->Pending && texture->Pending->Decoded->IsDone() && m_uploader->IsReady(texture->Pending->LastTicket.load(std::memory_order_relaxed)))
+			finished.push_back(texture);
+
+	// A change missing a level is dropped, and the texture keeps what it had. Its uploads are done, but the image
+	// goes through the scheduler like any other.
+	std::erase_if(finished, [&](Texture* texture) {
+		Change* change = texture->Pending;
+		uint32_t failed_end = change->FailedEnd.load(std::memory_order_relaxed);
+		if (!failed_end)
+			return false;
+
+		GraphicsDevice const* device = m_device;
+		scheduler.Defer([device, image = change->Image, memory = change->Memory, view = change->View]() {
+			vkDestroyImageView(device->GetLogical(), view, nullptr);
+			device->GetAllocator()->DestroyImage(image, memory);
+		});
+
+		texture->Finest = std::max(texture->Finest, failed_end);
+		texture->Pending = nullptr;
+		m_failed_changes++;
+
+		delete change->Decoded;
+		delete change;
+		return true;
+	});
+
+	if (finished.empty())
+		return;
+
+	PROFILE_GPU(command_buffer, "Texture residency");
+
+	// Levels both images hold are copied from the old image to the new one, all textures in one batch of barriers.
+	std::vector<VkImageMemoryBarrier2> before, after;
+	auto barrier = [](VkImage image, uint32_t base_level, uint32_t level_count, VkImageLayout old_layout, VkImageLayout new_layout,
+		VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access) {
+		VkImageMemoryBarrier2 result{};
+		result.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+		result.srcStageMask = src_stage;
+		result.srcAccessMask = src_access;
+		result.dstStageMask = dst_stage;
+		result.dstAccessMask = dst_access;
+		result.oldLayout = old_layout;
+		result.newLayout = new_layout;
+		result.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		result.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		result.image = image;
+		result.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, base_level, level_count, 0, 1 };
+		return result;
+	};
+
+	for (Texture* texture : finished)
+	{
+		Change const& change = *texture->Pending;
+		if (!texture->Image)
+			continue;
+
+		uint32_t shared_first = std::max(change.First, texture->First);
+		uint32_t shared_count = texture->LevelCount - shared_first;
+
+		// Earlier frames only sampled the old image, so ordering after them is enough.
+		before.push_back(barrier(texture->Image, shared_first - texture->First, shared_count,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT));
+		before.push_back(barrier(change.Image, shared_first - change.First, shared_count,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT));
+		after.push_back(barrier(change.Image, shared_first - change.First, shared_count,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT));
+	}
+
+	auto submit_barriers = [command_buffer](std::vector<VkImageMemoryBarrier2> const& barriers) {
+		if (barriers.empty())
+			return;
+
+		VkDependencyInfo dependency{};
+		dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+		dependency.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+		dependency.pImageMemoryBarriers = barriers.data();
+		vkCmdPipelineBarrier2(command_buffer, &dependency);
+	};
+
+	submit_barriers(before);
+
+	std::vector<VkImageCopy> regions;
+	for (Texture* texture : finished)
+	{
+		Change const& change = *texture->Pending;
+		if (!texture->Image)
+			continue;
+
+		regions.clear();
+		for (uint32_t level = std::max(change.First, texture->First); level < texture->LevelCount; level++)
+		{
+			VkImageCopy region{};
+			region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - texture->First, 0, 1 };
+			region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - change.First, 0, 1 };
+			region.extent = { std::max(texture->Width >> level, 1u), std::max(texture->Height >> level, 1u), 1 };
+			regions.push_back(region);
+		}
+
+		vkCmdCopyImage(command_buffer, texture->Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, change.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	submit_barriers(after);
+
+	// Draws recorded from here on see the new image; the old one goes once the frames that sampled it retire.
+	BindlessHeap* heap = m_device->GetBindlessHeap();
+	for (Texture* texture : finished)
+	{
+		Change* change = texture->Pending;
+
+		if (texture->Image)
+		{
+			heap->Free(BINDLESS_TEXTURE, texture->Slot, scheduler);
+
+			GraphicsDevice const* device = m_device;
+			scheduler.Defer([device, image = texture->Image, memory = texture->Memory, view = texture->View]() {
+				vkDestroyImageView(device->GetLogical(), view, nullptr);
+				device->GetAllocator()->DestroyImage(image, memory);
+			});
+		}
+
+		texture->First = change->First;
+		texture->Image = change->Image;
+		texture->Memory = change->Memory;
+		texture->View = change->View;
+		texture->Slot = heap->AddTexture(change->View);
+		texture->Pending = nullptr;
+
+		delete change->Decoded;
+		delete change;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,416 @@
+#include "upload.hpp"
+#include "vulkan.hpp"
+#include "render.hpp"
+#include "frame.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
+
+#define THISFILE "upload.cpp"
+
+Uploader::Uploader(GraphicsDevice const& device, VkDeviceSize staging_size, VkDeviceSize frame_budget)
+	: m_device(&device), m_timeline(device), m_frame_budget(frame_budget), m_next_ticket(1), m_acquired_ticket(0),
+	m_budget_remaining(frame_budget ? static_cast<int64_t>(frame_budget) : std::numeric_limits<int64_t>::max()),
+	m_flushing(0), m_busy(false), m_stop(false), m_stats{}
+{
+	m_staging = new LinearPool(*device.GetAllocator(), staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, UPLOAD_MEMORY);
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(device.GetPhysical(), &props);
+	m_copy_alignment = std::max<VkDeviceSize>(props.limits.optimalBufferCopyOffsetAlignment, 16);
+
+	m_worker = std::thread(&Uploader::WorkerLoop, this);
+}
+
+Uploader::~Uploader()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_work_cv.notify_all();
+	m_worker.join();
+
+	m_timeline.Wait(m_timeline.GetLastValue());
+
+	{
+		std::lock_guard lock(m_mutex);
+		RetireCompleted();
+	}
+
+	for (UploadContext& context : m_free_contexts)
+		delete context.Pool;
+
+	delete m_staging;
+}
+
+UploadTicket Uploader::UploadBuffer(VkBuffer buffer, VkDeviceSize offset, std::vector<char> data,
+	VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	UploadRequest request{};
+	request.Buffer = buffer;
+	request.Offset = offset;
+	request.DstStage = dst_stage;
+	request.DstAccess = dst_access;
+	request.Data = std::move(data);
+	return Enqueue(std::move(request));
+}
+
+UploadTicket Uploader::UploadBuffer(VkBuffer buffer, VkDeviceSize offset, void const* data, VkDeviceSize size,
+	VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	UploadRequest request{};
+	request.Buffer = buffer;
+	request.Offset = offset;
+	request.DstStage = dst_stage;
+	request.DstAccess = dst_access;
+	request.External = static_cast<char const*>(data);
+	request.ExternalSize = size;
+	return Enqueue(std::move(request));
+}
+
+UploadTicket Uploader::UploadImage(VkImage image, VkImageSubresourceLayers const& subresource, VkExtent3D extent, std::vector<char> data,
+	VkImageLayout final_layout, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	// Images are copied in one piece, unlike buffers which are split to fit the ring.
+	VALIDATE(data.size() <= m_staging->GetSize() / 2);
+
+	UploadRequest request{};
+	request.Image = image;
+	request.Subresource = subresource;
+	request.Extent = extent;
+	request.FinalLayout = final_layout;
+	request.DstStage = dst_stage;
+	request.DstAccess = dst_access;
+	request.Data = std::move(data);
+	return Enqueue(std::move(request));
+}
+
+UploadTicket Uploader::UploadImage(VkImage image, VkImageSubresourceLayers const& subresource, VkExtent3D extent, void const* data, VkDeviceSize size,
+	VkImageLayout final_layout, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+{
+	VALIDATE(size <= m_staging->GetSize() / 2);
+
+	UploadRequest request{};
+	request.Image = image;
+	request.Subresource = subresource;
+	request.Extent = extent;
+	request.FinalLayout = final_layout;
+	request.DstStage = dst_stage;
+	request.DstAccess = dst_access;
+	request.External = static_cast<char const*>(data);
+	request.ExternalSize = size;
+	return Enqueue(std::move(request));
+}
+
+UploadTicket Uploader::Enqueue(UploadRequest request)
+{
+	UploadTicket ticket;
+
+	{
+		std::lock_guard lock(m_mutex);
+		ticket = request.Ticket = m_next_ticket++;
+		m_stats.PendingBytes += request.GetSize();
+		m_requests.push_back(std::move(request));
+	}
+
+	m_work_cv.notify_one();
+	return ticket;
+}
+
+void Uploader::BeginFrame(VkCommandBuffer command_buffer, FrameScheduler& scheduler)
+{
+	std::vector<UploadBatch> retired;
+
+	{
+		std::lock_guard lock(m_mutex);
+		RetireCompleted();
+		retired.swap(m_retired);
+
+		// Overshooting the budget (a single large request) is paid back by the next frame.
+		if (m_frame_budget)
+			m_budget_remaining = std::min<int64_t>(m_budget_remaining, 0) + static_cast<int64_t>(m_frame_budget);
+	}
+
+	m_work_cv.notify_one();
+
+	if (retired.empty())
+		return;
+
+	for (UploadBatch const& batch : retired)
+	{
+		batch.Transfer.RecordAcquire(command_buffer);
+		m_acquired_ticket = std::max<UploadTicket>(m_acquired_ticket, batch.LastTicket);
+	}
+
+	// Only executed batches are acquired, so this wait is already satisfied and never stalls the frame.
+	scheduler.AddWaitSemaphore(m_timeline.WaitInfo(retired.back().TimelineValue, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT));
+}
+
+void Uploader::Flush()
+{
+	uint64_t value;
+
+	{
+		std::unique_lock lock(m_mutex);
+		m_flushing++;
+		m_work_cv.notify_one();
+		m_idle_cv.wait(lock, [this]() { return m_requests.empty() && !m_busy; });
+		m_flushing--;
+		value = m_timeline.GetLastValue();
+	}
+
+	m_timeline.Wait(value);
+
+	std::lock_guard lock(m_mutex);
+	RetireCompleted();
+}
+
+UploadStats Uploader::GetStats() const
+{
+	std::lock_guard lock(m_mutex);
+	return m_stats;
+}
+
+void Uploader::WorkerLoop()
+{
+	while (true)
+	{
+		std::vector<UploadRequest> requests;
+
+		{
+			std::unique_lock lock(m_mutex);
+			m_busy = false;
+			m_idle_cv.notify_all();
+
+			m_work_cv.wait(lock, [this]() { return m_stop || (!m_requests.empty() && (m_budget_remaining > 0 || m_flushing)); });
+			if (m_stop)
+				return;
+
+			// The first request always goes, so one larger than the whole budget still makes progress.
+			m_busy = true;
+			while (!m_requests.empty() && (m_budget_remaining > 0 || m_flushing))
+			{
+				VkDeviceSize size = m_requests.front().GetSize();
+				if (m_frame_budget)
+					m_budget_remaining -= static_cast<int64_t>(size);
+				m_stats.PendingBytes -= size;
+
+				requests.push_back(std::move(m_requests.front()));
+				m_requests.pop_front();
+			}
+		}
+
+		Record(requests);
+	}
+}
+
+void Uploader::Record(std::vector<UploadRequest>& requests)
+{
+	PROFILE_CPU("Record uploads");
+
+	std::optional<UploadBatch> batch;
+	UploadTicket completed_ticket = 0;
+
+	// Copies are grouped per destination so each resource costs one copy command per batch.
+	std::unordered_map<VkBuffer, std::vector<VkBufferCopy>> buffer_copies;
+	std::unordered_map<VkImage, std::vector<VkBufferImageCopy>> image_copies;
+	std::vector<VkImageMemoryBarrier2> image_barriers;
+
+	auto submit = [&]() {
+		VkCommandBuffer cmd = batch->Context.CommandBuffer;
+
+		if (!image_barriers.empty())
+		{
+			VkDependencyInfo dependency{};
+			dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+			dependency.imageMemoryBarrierCount = static_cast<uint32_t>(image_barriers.size());
+			dependency.pImageMemoryBarriers = image_barriers.data();
+			vkCmdPipelineBarrier2(cmd, &dependency);
+		}
+
+		for (auto& [buffer, regions] : buffer_copies)
+			vkCmdCopyBuffer(cmd, m_staging->GetBuffer(), buffer, static_cast<uint32_t>(regions.size()), regions.data());
+		for (auto& [image, regions] : image_copies)
+			vkCmdCopyBufferToImage(cmd, m_staging->GetBuffer(), image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+		batch->LastTicket = completed_ticket;
+		SubmitBatch(*batch);
+
+		buffer_copies.clear();
+		image_copies.clear();
+		image_barriers.clear();
+		batch.reset();
+	};
+
+	// Make room in the ring, first by submitting what this batch already holds, then by waiting for older batches.
+	auto place = [&](VkDeviceSize size, VkDeviceSize* offset) {
+		while (!AllocateStaging(size, offset))
+		{
+			if (batch)
+			{
+				submit();
+				continue;
+			}
+
+			uint64_t oldest;
+			{
+				std::lock_guard lock(m_mutex);
+				VALIDATE(!m_in_flight.empty()); // Otherwise the request can never fit the ring
+				oldest = m_in_flight.front().TimelineValue;
+			}
+
+			m_timeline.Wait(oldest);
+
+			std::lock_guard lock(m_mutex);
+			RetireCompleted();
+		}
+
+		if (!batch)
+			batch.emplace(BeginBatch());
+	};
+
+	for (UploadRequest& request : requests)
+	{
+		VkDeviceSize size = request.GetSize();
+
+		if (request.Buffer)
+		{
+			// Large buffers are streamed through the ring in chunks.
+			VkDeviceSize chunk_size = m_staging->GetSize() / 4;
+
+			for (VkDeviceSize done = 0; done < size;)
+			{
+				VkDeviceSize chunk = std::min(chunk_size, size - done);
+				VkDeviceSize staging_offset;
+				place(chunk, &staging_offset);
+
+				std::memcpy(m_staging->GetMapped() + staging_offset, request.GetBytes() + done, chunk);
+				buffer_copies[request.Buffer].push_back({ staging_offset, request.Offset + done, chunk });
+
+				// The release only needs to cover the range copied in this batch.
+				batch->Transfer.AddBuffer(request.Buffer, request.Offset + done, chunk,
+					VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, request.DstStage, request.DstAccess);
+				done += chunk;
+			}
+		}
+		else
+		{
+			VkDeviceSize staging_offset;
+			place(size, &staging_offset);
+			std::memcpy(m_staging->GetMapped() + staging_offset, request.GetBytes(), size);
+
+			VkImageSubresourceRange range{};
+			range.aspectMask = request.Subresource.aspectMask;
+			range.baseMipLevel = request.Subresource.mipLevel;
+			range.levelCount = 1;
+			range.baseArrayLayer = request.Subresource.baseArrayLayer;
+			range.layerCount = request.Subresource.layerCount;
+
+			VkImageMemoryBarrier2 to_transfer{};
+			to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			to_transfer.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+			to_transfer.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+			to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			to_transfer.image = request.Image;
+			to_transfer.subresourceRange = range;
+			image_barriers.push_back(to_transfer);
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = staging_offset;
+			region.imageSubresource = request.Subresource;
+			region.imageExtent = request.Extent;
+			image_copies[request.Image].push_back(region);
+
+			batch->Transfer.AddImage(request.Image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, request.FinalLayout,
+				VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, request.DstStage, request.DstAccess);
+		}
+
+		completed_ticket = request.Ticket;
+
+		std::lock_guard lock(m_mutex);
+		m_stats.UploadedBytes += size;
+	}
+
+	if (batch)
+		submit();
+}
+
+Uploader::UploadBatch Uploader::BeginBatch()
+{
+	UploadContext context{};
+
+	{
+		std::lock_guard lock(m_mutex);
+		if (!m_free_contexts.empty())
+		{
+			context = m_free_contexts.back();
+			m_free_contexts.pop_back();
+		}
+	}
+
+	if (!context.Pool)
+	{
+		context.Pool = new CommandPool(*m_device, m_device->GetTransferQueue().FamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		context.CommandBuffer = context.Pool->Allocate();
+	}
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VALIDATE(vkBeginCommandBuffer(context.CommandBuffer, &begin_info) == VK_SUCCESS);
+
+	return { context, 0, 0, 0, QueueOwnershipTransfer(m_device->GetTransferQueue().FamilyIndex, m_device->GetGraphicsQueue().FamilyIndex) };
+}
+
+void Uploader::SubmitBatch(UploadBatch& batch)
+{
+	batch.Transfer.RecordRelease(batch.Context.CommandBuffer);
+	VALIDATE(vkEndCommandBuffer(batch.Context.CommandBuffer) == VK_SUCCESS);
+
+	uint64_t value = m_timeline.Advance();
+	VkSemaphoreSubmitInfo signal_info = m_timeline.SignalInfo(value);
+
+	VkCommandBufferSubmitInfo command_info{};
+	command_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+	command_info.commandBuffer = batch.Context.CommandBuffer;
+
+	VkSubmitInfo2 submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+	submit_info.commandBufferInfoCount = 1;
+	submit_info.pCommandBufferInfos = &command_info;
+	submit_info.signalSemaphoreInfoCount = 1;
+	submit_info.pSignalSemaphoreInfos = &signal_info;
+
+	VALIDATE(m_device->Submit(m_device->GetTransferQueue(), 1, &submit_info) == VK_SUCCESS);
+
+	std::lock_guard lock(m_mutex);
+	batch.TimelineValue = value;
+	batch.StagingMarker = m_staging->GetHead();
+	m_stats.Batches++;
+	m_in_flight.push_back(std::move(batch));
+}
+
+bool Uploader::AllocateStaging(VkDeviceSize size, VkDeviceSize* offset)
+{
+	std::lock_guard lock(m_mutex);
+	return m_staging->Allocate(size, m_copy_alignment, offset);
+}
+
+void Uploader::RetireCompleted()
+{
+	uint64_t completed = m_timeline.GetCompletedValue();
+
+	while (!m_in_flight.empty() && m_in_flight.front().TimelineValue <= completed)
+	{
+		UploadBatch& batch = m_in_flight.front();
+		m_staging->Release(batch.StagingMarker);
+		batch.Context.Pool->Reset();
+		m_free_contexts.push_back(batch.Context);
+		m_retired.push_back(std::move(batch));
+		m_in_flight.pop_front();
+	}
+}
\ No newline at end of file
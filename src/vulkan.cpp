@@ -1,13 +1,19 @@
 #include "vulkan.hpp"
 #include "window.hpp"
+#include "pipeline_cache.hpp"
+#include "memory.hpp"
+#include "bindless.hpp"
 
 #define THISFILE "vulkan.cpp"
 
 static VkInstance s_instance;
 static VkDebugUtilsMessengerEXT s_debug_messenger;
+static bool s_headless;
 
 static char const* s_VALIDATION_LAYER = "VK_LAYER_KHRONOS_validation"; // default vulkan validation layer
 
+static char const* s_PIPELINE_CACHE_PATH = "pipeline_cache.bin"; // relative to the working directory
+
 #ifndef NDEBUG
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL s_DebugMessageCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -31,10 +37,16 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL s_DebugMessageCallback(VkDebugUtilsMessage
 
 #endif
 
-void LaunchVulkan()
+void LaunchVulkan(bool headless)
 {
-	glfwInit();
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	s_headless = headless;
+
+	// Headless machines may not have a display at all, so GLFW is left untouched.
+	if (!headless)
+	{
+		glfwInit();
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	}
 
 	VkApplicationInfo app_info{};
 	app_info.sType					= VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -49,7 +61,7 @@ void LaunchVulkan()
 	create_info.pApplicationInfo = &app_info;
 
 	uint32_t glfw_extension_count = 0;
-	char const** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+	char const** glfw_extensions = headless ? nullptr : glfwGetRequiredInstanceExtensions(&glfw_extension_count);
 
 #ifndef NDEBUG
 
@@ -101,7 +113,8 @@ void LaunchVulkan()
 
 void EndVulkan()
 {
-	glfwTerminate();
+	if (!s_headless)
+		glfwTerminate();
 
 #ifndef NDEBUG
 
@@ -122,6 +135,7 @@ VkInstance GetVulkanInstance()
 GraphicsDevice::GraphicsDevice(Window const& window)
 {
 	auto surface = window.GetSurface();
+	bool headless = window.IsHeadless();
 
 	uint32_t gpu_count = 0;
 	vkEnumeratePhysicalDevices(s_instance, &gpu_count, nullptr);
@@ -129,29 +143,92 @@ GraphicsDevice::GraphicsDevice(Window const& window)
 	gpu_count = 1; // Only query the first GPU anyways.
 	vkEnumeratePhysicalDevices(s_instance, &gpu_count, &m_physical);
 
-	VkPhysicalDeviceFeatures supported_features;
-	vkGetPhysicalDeviceFeatures(m_physical, &supported_features);
-	VALIDATE(supported_features.samplerAnisotropy); // Ensure sampler anisotropy is supported.
-
-	uint32_t sfcount, spmcount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(m_physical, surface, &sfcount, nullptr);
-	vkGetPhysicalDeviceSurfacePresentModesKHR(m_physical, surface, &spmcount, nullptr);
-	VALIDATE(sfcount && spmcount); // Ensure there is at least one surface format and one surface present mode.
+	VkPhysicalDeviceVulkan13Features supported_13{};
+	supported_13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+
+	VkPhysicalDeviceVulkan12Features supported_12{};
+	supported_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	supported_12.pNext = &supported_13;
+
+	VkPhysicalDeviceFeatures2 supported_features{};
+	supported_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supported_features.pNext = &supported_12;
+	vkGetPhysicalDeviceFeatures2(m_physical, &supported_features);
+
+	VALIDATE(supported_features.features.samplerAnisotropy); // Ensure sampler anisotropy is supported.
+	VALIDATE(supported_12.timelineSemaphore); // Cross-queue synchronization is built on timeline semaphores.
+
+	// Every resource is reached through the bindless heap, see bindless.hpp.
+	VALIDATE(supported_12.descriptorIndexing && supported_12.runtimeDescriptorArray && supported_12.descriptorBindingPartiallyBound);
+	VALIDATE(supported_12.descriptorBindingSampledImageUpdateAfterBind && supported_12.descriptorBindingStorageImageUpdateAfterBind);
+	VALIDATE(supported_12.descriptorBindingStorageBufferUpdateAfterBind && supported_12.descriptorBindingUpdateUnusedWhilePending);
+	VALIDATE(supported_12.shaderSampledImageArrayNonUniformIndexing && supported_12.shaderStorageBufferArrayNonUniformIndexing);
+	VALIDATE(supported_12.bufferDeviceAddress); // Per-frame data is read through its address, see frame_ring.hpp.
+	VALIDATE(supported_12.drawIndirectCount && supported_features.features.multiDrawIndirect); // GPU culling, see culling.hpp.
+	VALIDATE(supported_features.features.drawIndirectFirstInstance);
+	VALIDATE(supported_12.samplerFilterMinmax); // Hi-Z pyramid reduction, see hiz.hpp.
+	VALIDATE(supported_13.synchronization2);
+	VALIDATE(supported_13.dynamicRendering);
+
+	std::vector<char const*> required_extensions;
+
+	// A headless device renders into its own images, so it neither needs a surface nor a swapchain.
+	if (!headless)
+	{
+		uint32_t sfcount, spmcount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(m_physical, surface, &sfcount, nullptr);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(m_physical, surface, &spmcount, nullptr);
+		VALIDATE(sfcount && spmcount); // Ensure there is at least one surface format and one surface present mode.
 
-	std::vector<char const*> required_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+		required_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
 
 	uint32_t extension_count;
 	vkEnumerateDeviceExtensionProperties(m_physical, nullptr, &extension_count, nullptr);
 	std::vector<VkExtensionProperties> available_extensions(extension_count);
 	vkEnumerateDeviceExtensionProperties(m_physical, nullptr, &extension_count, available_extensions.data());
 
+	auto extension_available = [&available_extensions](char const* name) {
+		return std::find_if(available_extensions.begin(), available_extensions.end(), [name](VkExtensionProperties const& aext) {
+			return std::strcmp(name, aext.extensionName) == 0; }) != available_extensions.end();
+	};
+
 	// Ensures all required extensions is presented in available extensions.
-	for (auto rext : required_extensions) {
-		VALIDATE(std::find_if(available_extensions.begin(), available_extensions.end(), [rext](VkExtensionProperties const& aext) {
-			return std::strcmp(rext, aext.extensionName) == 0; }) != available_extensions.end());
+	for (auto rext : required_extensions)
+		VALIDATE(extension_available(rext));
+
+	// Present wait is optional, it only enables present latency measurement and pacing on presentation.
+	VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features{};
+	present_wait_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+	VkPhysicalDevicePresentIdFeaturesKHR present_id_features{};
+	present_id_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+	present_id_features.pNext = &present_wait_features;
+
+	bool present_wait = false;
+	if (!headless && extension_available(VK_KHR_PRESENT_ID_EXTENSION_NAME) && extension_available(VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceFeatures2 present_features{};
+		present_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		present_features.pNext = &present_id_features;
+		vkGetPhysicalDeviceFeatures2(m_physical, &present_features);
+
+		// The same structs, still chained together, enable the features at device creation.
+		present_wait = present_id_features.presentId && present_wait_features.presentWait;
+		if (present_wait)
+		{
+			required_extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+			required_extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		}
 	}
 
-	// Find the indices of queue families that support graphics and present.
+	// Optional as well, the profiler only uses it to line GPU zones up with CPU zones.
+	m_calibrated_timestamps = extension_available(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+	if (m_calibrated_timestamps)
+		required_extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+	// Find the indices of queue families that support graphics and present, and preferably dedicated
+	// transfer and compute families so uploads and compute work run alongside rendering.
 
 	uint32_t qf_count = 0;
 	vkGetPhysicalDeviceQueueFamilyProperties(m_physical, &qf_count, nullptr);
@@ -159,28 +236,61 @@ GraphicsDevice::GraphicsDevice(Window const& window)
 	vkGetPhysicalDeviceQueueFamilyProperties(m_physical, &qf_count, families.data());
 
 	bool graphics_queue_found = false, present_queue_found = false;
+	bool compute_queue_found = false, transfer_queue_found = false, transfer_only = false;
 
 	for (int i = 0; i < families.size(); i++)
 	{
-		if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		VkQueueFlags flags = families[i].queueFlags;
+
+		if ((flags & VK_QUEUE_GRAPHICS_BIT) && !graphics_queue_found)
 			m_graphics_queue.FamilyIndex = i, graphics_queue_found = true;
 
-		VkBool32 present_support;
-		vkGetPhysicalDeviceSurfaceSupportKHR(m_physical, i, surface, &present_support);
-		if (present_support)
-			m_present_queue.FamilyIndex = i, present_queue_found = true;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !compute_queue_found)
+			m_compute_queue.FamilyIndex = i, compute_queue_found = true;
 
-		if (graphics_queue_found && present_queue_found)
-			break;
+		// Dedicated families may only copy whole mip levels, which is no use for uploads.
+		VkExtent3D granularity = families[i].minImageTransferGranularity;
+		bool fine_grained = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
+
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && fine_grained && !transfer_only)
+		{
+			m_transfer_queue.FamilyIndex = i, transfer_queue_found = true;
+			transfer_only = !(flags & VK_QUEUE_COMPUTE_BIT);
+		}
 	}
 
+	// Without a surface nothing is presented, the graphics queue stands in for the present queue. Otherwise prefer
+	// presenting from the graphics family, known by now, which saves an ownership transfer per frame.
+	if (headless)
+		m_present_queue.FamilyIndex = m_graphics_queue.FamilyIndex, present_queue_found = graphics_queue_found;
+	else
+	{
+		for (uint32_t i = 0; i < families.size(); i++)
+		{
+			VkBool32 present_support = VK_FALSE;
+			vkGetPhysicalDeviceSurfaceSupportKHR(m_physical, i, surface, &present_support);
+			if (present_support && (!present_queue_found || (graphics_queue_found && i == m_graphics_queue.FamilyIndex)))
+				m_present_queue.FamilyIndex = i, present_queue_found = true;
+		}
+	}
+
+	VALIDATE(graphics_queue_found && present_queue_found);
+
+	// Fall back to the graphics family, which always supports compute and transfer.
+	if (!compute_queue_found)
+		m_compute_queue.FamilyIndex = m_graphics_queue.FamilyIndex;
+	if (!transfer_queue_found)
+		m_transfer_queue.FamilyIndex = m_graphics_queue.FamilyIndex;
+
 	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
 	float priority = 1.0f;
 
 	// As queue indices may overlap, unordered_map is used to eliminate repeated values.
 	std::unordered_set<uint32_t> distinct_indices = {
 		m_graphics_queue.FamilyIndex,
-		m_present_queue.FamilyIndex
+		m_present_queue.FamilyIndex,
+		m_transfer_queue.FamilyIndex,
+		m_compute_queue.FamilyIndex
 	};
 
 	for (uint32_t index : distinct_indices)
@@ -193,15 +303,42 @@ GraphicsDevice::GraphicsDevice(Window const& window)
 		queue_create_infos.push_back(info);
 	}
 
-	// Enable sampler anisotropy
-	VkPhysicalDeviceFeatures device_features{};
-	device_features.samplerAnisotropy = VK_TRUE;
+	// Enable sampler anisotropy, timeline semaphores, descriptor indexing, synchronization2 and dynamic rendering
+	VkPhysicalDeviceVulkan13Features features_13{};
+	features_13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	features_13.synchronization2 = VK_TRUE;
+	features_13.dynamicRendering = VK_TRUE;
+	features_13.pNext = present_wait ? &present_id_features : nullptr;
+
+	VkPhysicalDeviceVulkan12Features features_12{};
+	features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features_12.pNext = &features_13;
+	features_12.timelineSemaphore = VK_TRUE;
+	features_12.descriptorIndexing = VK_TRUE;
+	features_12.runtimeDescriptorArray = VK_TRUE;
+	features_12.descriptorBindingPartiallyBound = VK_TRUE;
+	features_12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	features_12.descriptorBindingStorageImageUpdateAfterBind = VK_TRUE;
+	features_12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	features_12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	features_12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	features_12.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+	features_12.bufferDeviceAddress = VK_TRUE;
+	features_12.drawIndirectCount = VK_TRUE;
+	features_12.samplerFilterMinmax = VK_TRUE;
+
+	VkPhysicalDeviceFeatures2 device_features{};
+	device_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	device_features.pNext = &features_12;
+	device_features.features.samplerAnisotropy = VK_TRUE;
+	device_features.features.multiDrawIndirect = VK_TRUE;
+	device_features.features.drawIndirectFirstInstance = VK_TRUE;
 
 	VkDeviceCreateInfo create_info{};
 	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	create_info.pQueueCreateInfos = queue_create_infos.data();
 	create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
-	create_info.pEnabledFeatures = &device_features;
+	create_info.pNext = &device_features;
 	create_info.ppEnabledExtensionNames = required_extensions.data();
 	create_info.enabledExtensionCount = static_cast<uint32_t>(required_extensions.size());
 
@@ -221,9 +358,57 @@ GraphicsDevice::GraphicsDevice(Window const& window)
 	// Obtain device queue as well
 	vkGetDeviceQueue(m_logical, m_graphics_queue.FamilyIndex, 0, &m_graphics_queue.Queue);
 	vkGetDeviceQueue(m_logical, m_present_queue.FamilyIndex, 0, &m_present_queue.Queue);
+	vkGetDeviceQueue(m_logical, m_transfer_queue.FamilyIndex, 0, &m_transfer_queue.Queue);
+	vkGetDeviceQueue(m_logical, m_compute_queue.FamilyIndex, 0, &m_compute_queue.Queue);
+
+	for (CommandQueue const& queue : { m_graphics_queue, m_present_queue, m_transfer_queue, m_compute_queue })
+		m_queue_mutexes.try_emplace(queue.Queue);
+
+	// Extension entry points are not exported by the loader.
+	m_wait_for_present = present_wait ? reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(m_logical, "vkWaitForPresentKHR")) : nullptr;
+
+	m_allocator = new MemoryAllocator(*this);
+	m_pipeline_cache = new PipelineCache(*this, s_PIPELINE_CACHE_PATH);
+	m_bindless_heap = new BindlessHeap(*this);
 }
 
 GraphicsDevice::~GraphicsDevice()
 {
+	delete m_bindless_heap;
+	delete m_pipeline_cache;
+	delete m_allocator;
 	vkDestroyDevice(m_logical, nullptr);
+}
+
+uint32_t GraphicsDevice::FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags properties) const
+{
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(m_physical, &mem_props);
+
+	uint32_t index = 0;
+	for (; index < mem_props.memoryTypeCount; index++) {
+		if ((type_bits & (1u << index)) && (mem_props.memoryTypes[index].propertyFlags & properties) == properties)
+			break;
+	}
+
+	VALIDATE(index < mem_props.memoryTypeCount); // Ensure a suitable memory type exists.
+	return index;
+}
+
+VkResult GraphicsDevice::Submit(CommandQueue const& queue, uint32_t count, VkSubmitInfo2 const* submits, VkFence fence) const
+{
+	std::lock_guard lock(m_queue_mutexes.at(queue.Queue));
+	return vkQueueSubmit2(queue.Queue, count, submits, fence);
+}
+
+VkResult GraphicsDevice::Present(VkPresentInfoKHR const& present_info) const
+{
+	std::lock_guard lock(m_queue_mutexes.at(m_present_queue.Queue));
+	return vkQueuePresentKHR(m_present_queue.Queue, &present_info);
+}
+
+VkResult GraphicsDevice::WaitForPresent(VkSwapchainKHR swapchain, uint64_t present_id, uint64_t timeout) const
+{
+	ASSERT(m_wait_for_present);
+	return m_wait_for_present(m_logical, swapchain, present_id, timeout);
 }
\ No newline at end of file
@@ -1,22 +1,61 @@
 #include "window.hpp"
 #include "vulkan.hpp"
+#include "memory.hpp"
+#include "frame.hpp"
 
 #define THISFILE "window.cpp"
 
-Window::Window(int width, int height, bool fullscreen)
-	: m_width(width), m_height(height), m_fullscreen(fullscreen)
+Window::Window(int width, int height, bool fullscreen, bool headless)
+	: m_window(nullptr), m_surface(VK_NULL_HANDLE), m_width(width), m_height(height), m_fullscreen(fullscreen), m_headless(headless), m_resized(false)
 {
+	if (headless)
+		return;
+
 	m_window = glfwCreateWindow(width, height, "Have some GOD DAMN FAITH",
 		fullscreen ? glfwGetPrimaryMonitor() : 0, 0);
 	VALIDATE(glfwCreateWindowSurface(GetVulkanInstance(), m_window, nullptr, &m_surface) == VK_SUCCESS);
+
+	glfwSetWindowUserPointer(m_window, this);
+	glfwSetFramebufferSizeCallback(m_window, s_FramebufferSizeCallback);
 }
 
 Window::~Window()
 {
+	if (m_headless)
+		return;
+
 	vkDestroySurfaceKHR(GetVulkanInstance(), m_surface, nullptr);
 	glfwDestroyWindow(m_window);
 }
 
+bool Window::ConsumeResize()
+{
+	bool resized = m_resized;
+	m_resized = false;
+	return resized;
+}
+
+void Window::WaitWhileMinimized()
+{
+	if (m_headless)
+		return;
+
+	glfwGetFramebufferSize(m_window, &m_width, &m_height);
+	while ((m_width == 0 || m_height == 0) && !glfwWindowShouldClose(m_window))
+	{
+		glfwWaitEvents();
+		glfwGetFramebufferSize(m_window, &m_width, &m_height);
+	}
+}
+
+void Window::s_FramebufferSizeCallback(GLFWwindow* window, int width, int height)
+{
+	Window* self = static_cast<Window*>(glfwGetWindowUserPointer(window));
+	self->m_width = width;
+	self->m_height = height;
+	self->m_resized = true;
+}
+
 static VkSurfaceFormatKHR s_ChooseSurfaceFormat(VkPhysicalDevice device, VkSurfaceKHR surface)
 {
 	std::vector<VkSurfaceFormatKHR> formats;
@@ -33,7 +72,7 @@ static VkSurfaceFormatKHR s_ChooseSurfaceFormat(VkPhysicalDevice device, VkSurfa
 	return formats[0];
 }
 
-static VkPresentModeKHR s_ChoosePresentModes(VkPhysicalDevice device, VkSurfaceKHR surface)
+static VkPresentModeKHR s_ChoosePresentModes(VkPhysicalDevice device, VkSurfaceKHR surface, VkPresentModeKHR preferred)
 {
 	std::vector<VkPresentModeKHR> modes;
 	uint32_t count;
@@ -42,7 +81,7 @@ static VkPresentModeKHR s_ChoosePresentModes(VkPhysicalDevice device, VkSurfaceK
 	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &count, modes.data());
 
 	for (auto const& mode : modes) {
-		if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
+		if (mode == preferred)
 			return mode;
 	}
 
@@ -68,10 +107,44 @@ static VkExtent2D s_ChooseSwapExtent(GLFWwindow* window, VkSurfaceCapabilitiesKH
 	return actual;
 }
 
-Swapchain::Swapchain(Window const& window, GraphicsDevice const& device)
-	: m_device(&device)
+// Enough for every frame in flight plus one being recorded.
+static constexpr uint32_t s_HEADLESS_IMAGE_COUNT = 3;
+
+Swapchain::Swapchain(Window const& window, GraphicsDevice const& device, PresentPolicy const& policy)
+	: m_device(&device), m_swapchain(VK_NULL_HANDLE), m_policy(policy), m_present_mode(VK_PRESENT_MODE_FIFO_KHR), m_headless(window.IsHeadless())
+{
+	if (m_headless)
+	{
+		CreateHeadlessImages(window);
+		return;
+	}
+
+	Create(window, VK_NULL_HANDLE);
+}
+
+void Swapchain::Recreate(Window const& window, FrameScheduler& scheduler)
+{
+	// Headless images have a fixed size.
+	if (m_headless)
+		return;
+
+	VkDevice ld = m_device->GetLogical();
+	VkSwapchainKHR old_swapchain = m_swapchain;
+	std::vector<VkImageView> old_views = std::move(m_image_views);
+
+	Create(window, old_swapchain);
+
+	scheduler.Defer([ld, old_swapchain, old_views]() {
+		for (auto view : old_views)
+			vkDestroyImageView(ld, view, nullptr);
+		vkDestroySwapchainKHR(ld, old_swapchain, nullptr);
+	});
+}
+
+void Swapchain::Create(Window const& window, VkSwapchainKHR old_swapchain)
 {
 	auto surface = window.GetSurface();
+	auto& device = *m_device;
 
 	auto pd = device.GetPhysical();
 	auto ld = device.GetLogical();
@@ -82,10 +155,10 @@ Swapchain::Swapchain(Window const& window, GraphicsDevice const& device)
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(pd, surface, &caps);
 
 	VkSurfaceFormatKHR format			= s_ChooseSurfaceFormat(pd, surface);
-	VkPresentModeKHR present_mode		= s_ChoosePresentModes(pd, surface);
+	VkPresentModeKHR present_mode		= s_ChoosePresentModes(pd, surface, m_policy.PresentMode);
 	VkExtent2D extent					= s_ChooseSwapExtent(window.GetNativePointer(), caps);
 
-	uint32_t image_count = caps.minImageCount + 1;
+	uint32_t image_count = m_policy.ImageCount ? std::max(m_policy.ImageCount, caps.minImageCount) : caps.minImageCount + 1;
 	if (caps.maxImageCount > 0 && image_count > caps.maxImageCount)
 		image_count = caps.maxImageCount;
 
@@ -119,18 +192,72 @@ Swapchain::Swapchain(Window const& window, GraphicsDevice const& device)
 	create_info.clipped = VK_TRUE;
 	create_info.presentMode = present_mode;
 	create_info.clipped = VK_TRUE;
-	create_info.oldSwapchain = VK_NULL_HANDLE;
+	create_info.oldSwapchain = old_swapchain;
 
 	VALIDATE(vkCreateSwapchainKHR(ld, &create_info, nullptr, &m_swapchain) == VK_SUCCESS);
 
 	m_image_format = format.format;
 	m_extent = extent;
+	m_present_mode = present_mode;
 
 	std::vector<VkImage> images;
 	uint32_t imcount;
 	vkGetSwapchainImagesKHR(ld, m_swapchain, &imcount, nullptr);
 	images.resize(imcount);
 	vkGetSwapchainImagesKHR(ld, m_swapchain, &imcount, images.data());
+
+	CreateImageViews(images);
+}
+
+Swapchain::~Swapchain()
+{
+	auto ld = m_device->GetLogical();
+
+	for (auto view : m_image_views)
+		vkDestroyImageView(ld, view, nullptr);
+
+	for (size_t i = 0; i < m_headless_images.size(); i++)
+		m_device->GetAllocator()->DestroyImage(m_headless_images[i], m_headless_memory[i]);
+
+	if (m_swapchain)
+		vkDestroySwapchainKHR(ld, m_swapchain, nullptr);
+}
+
+void Swapchain::CreateHeadlessImages(Window const& window)
+{
+	m_image_format = VK_FORMAT_B8G8R8A8_SRGB;
+	m_extent = { static_cast<uint32_t>(window.GetWidth()), static_cast<uint32_t>(window.GetHeight()) };
+
+	m_headless_images.resize(s_HEADLESS_IMAGE_COUNT);
+	m_headless_memory.resize(s_HEADLESS_IMAGE_COUNT);
+
+	for (uint32_t i = 0; i < s_HEADLESS_IMAGE_COUNT; i++)
+	{
+		VkImageCreateInfo ici{};
+		ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		ici.imageType = VK_IMAGE_TYPE_2D;
+		ici.format = m_image_format;
+		ici.extent = { m_extent.width, m_extent.height, 1 };
+		ici.mipLevels = 1;
+		ici.arrayLayers = 1;
+		ici.samples = VK_SAMPLE_COUNT_1_BIT;
+		ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+		ici.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		m_headless_images[i] = m_device->GetAllocator()->CreateImage(ici, GPU_ONLY_MEMORY, &m_headless_memory[i]);
+	}
+
+	CreateImageViews(m_headless_images);
+}
+
+void Swapchain::CreateImageViews(std::vector<VkImage> const& images)
+{
+	m_images = images;
+
+	auto ld = m_device->GetLogical();
+	uint32_t imcount = static_cast<uint32_t>(images.size());
 	m_image_views.resize(imcount);
 
 	for (uint32_t i = 0; i < imcount; i++)
@@ -152,11 +279,4 @@ Swapchain::Swapchain(Window const& window, GraphicsDevice const& device)
 
 		VALIDATE(vkCreateImageView(ld, &ivci, nullptr, &m_image_views[i]) == VK_SUCCESS);
 	}
-}
-
-Swapchain::~Swapchain()
-{
-	for (auto view : m_image_views)
-		vkDestroyImageView(m_device->GetLogical(), view, nullptr);
-	vkDestroySwapchainKHR(m_device->GetLogical(), m_swapchain, nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+// Builds an asset pack (see asset_format.hpp) out of loose files.
+// Usage: AssetPacker <output> <root directory> <file relative to root>...
+// Assets are named by their path relative to the root, with forward slashes, e.g. "shaders/shader.vert.spv".
+
+#include "asset_format.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+
+struct PackInput
+{
+	std::string Name;
+	AssetType Type;
+	std::vector<char> Data;
+};
+
+static AssetType s_TypeFromExtension(std::filesystem::path const& path)
+{
+	std::string ext = path.extension().string();
+	if (ext == ".spv")
+		return ASSET_SPIRV;
+	if (ext == ".mesh")
+		return ASSET_MESH;
+	if (ext == ".ktx2" || ext == ".tex")
+		return ASSET_TEXTURE;
+	return ASSET_RAW;
+}
+
+static uint64_t s_AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <output> <root directory> <file>...\n";
+		return 1;
+	}
+
+	std::filesystem::path output = argv[1];
+	std::filesystem::path root = argv[2];
+
+	std::vector<PackInput> inputs;
+
+	for (int i = 3; i < argc; i++)
+	{
+		std::filesystem::path relative = argv[i];
+		std::ifstream ifs(root / relative, std::ios::ate | std::ios::binary);
+		if (!ifs.is_open())
+		{
+			std::cerr << "AssetPacker: cannot open " << (root / relative).string() << '\n';
+			return 1;
+		}
+
+		PackInput input;
+		input.Name = relative.generic_string();
+		input.Type = s_TypeFromExtension(relative);
+		input.Data.resize(static_cast<size_t>(ifs.tellg()));
+		ifs.seekg(0);
+		ifs.read(input.Data.data(), input.Data.size());
+
+		if (input.Type == ASSET_SPIRV && input.Data.size() % 4)
+		{
+			std::cerr << "AssetPacker: " << input.Name << " is not a whole number of SPIR-V words\n";
+			return 1;
+		}
+
+		inputs.push_back(std::move(input));
+	}
+
+	// Sorted input gives a reproducible file regardless of argument order.
+	std::sort(inputs.begin(), inputs.end(), [](PackInput const& a, PackInput const& b) { return a.Name < b.Name; });
+
+	for (size_t i = 1; i < inputs.size(); i++) {
+		if (inputs[i].Name == inputs[i - 1].Name)
+		{
+			std::cerr << "AssetPacker: duplicate asset " << inputs[i].Name << '\n';
+			return 1;
+		}
+	}
+
+	AssetPackHeader header{};
+	header.Magic = ASSET_PACK_MAGIC;
+	header.Version = ASSET_PACK_VERSION;
+	header.EntryCount = static_cast<uint32_t>(inputs.size());
+	header.TableSize = 1;
+	while (header.TableSize < 2 * header.EntryCount)
+		header.TableSize *= 2;
+
+	std::vector<AssetPackEntry> table(header.TableSize);
+	std::string names;
+
+	header.NamesOffset = sizeof(AssetPackHeader) + table.size() * sizeof(AssetPackEntry);
+
+	// Names first so the data offsets are known before the table is filled.
+	std::vector<uint32_t> name_offsets;
+	for (PackInput const& input : inputs)
+	{
+		name_offsets.push_back(static_cast<uint32_t>(names.size()));
+		names += input.Name;
+		names += '\0';
+	}
+
+	uint64_t offset = header.NamesOffset + names.size();
+	std::vector<uint64_t> data_offsets;
+
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		offset = s_AlignUp(offset, AssetAlignment(inputs[i].Type));
+		data_offsets.push_back(offset);
+		offset += inputs[i].Data.size();
+
+		uint64_t hash = AssetNameHash(inputs[i].Name);
+		uint32_t mask = header.TableSize - 1;
+		uint32_t slot = static_cast<uint32_t>(hash) & mask;
+		while (table[slot].Hash)
+			slot = (slot + 1) & mask;
+
+		table[slot] = { hash, data_offsets[i], inputs[i].Data.size(), name_offsets[i], inputs[i].Type };
+	}
+
+	header.FileSize = offset;
+
+	// Written next to the output and renamed over it, so a failed build never leaves a torn pack behind.
+	std::filesystem::path temp = output;
+	temp += ".tmp";
+
+	{
+		std::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+		if (!ofs.is_open())
+		{
+			std::cerr << "AssetPacker: cannot write " << temp.string() << '\n';
+			return 1;
+		}
+
+		ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		ofs.write(reinterpret_cast<char const*>(table.data()), table.size() * sizeof(AssetPackEntry));
+		ofs.write(names.data(), names.size());
+
+		uint64_t written = header.NamesOffset + names.size();
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			static char const padding[16] = {};
+			ofs.write(padding, data_offsets[i] - written);
+			ofs.write(inputs[i].Data.data(), inputs[i].Data.size());
+			written = data_offsets[i] + inputs[i].Data.size();
+		}
+
+		if (!ofs)
+		{
+			std::cerr << "AssetPacker: failed writing " << temp.string() << '\n';
+			return 1;
+		}
+	}
+
+	std::filesystem::rename(temp, output);
+	std::cout << "AssetPacker: packed " << inputs.size() << " assets (" << header.FileSize << " bytes) into " << output.string() << '\n';
+	return 0;
+}
\ No newline at end of file
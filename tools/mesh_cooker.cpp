@@ -0,0 +1,941 @@
+// Cooks a glTF 2.0 mesh (.gltf with embedded or external buffers, or .glb) into the runtime mesh format, see
+// mesh_format.hpp. Usage: MeshCooker <input> <output>
+//
+// Every triangle primitive of the first mesh is merged into one; node transforms, skins and morph targets are
+// ignored. Vertices are quantized to 16 bytes and deduplicated, a chain of coarser levels is built by vertex
+// clustering, each level's triangles are reordered for the post-transform vertex cache and then for overdraw, and
+// vertices are finally laid out in the order they are first used.
+
+#include "mesh_format.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+#include <array>
+
+// Vertices the reordering assumes the GPU keeps transformed. Real caches vary, the algorithm degrades gracefully.
+static constexpr uint32_t s_CACHE_SIZE = 32;
+
+// Cache size ACMR is reported with, roughly what current GPUs achieve.
+static constexpr uint32_t s_REPORT_CACHE_SIZE = 16;
+
+// A coarser level is only kept if it has at most this fraction of the previous level's triangles.
+static constexpr float s_LOD_MIN_REDUCTION = 0.75f;
+static constexpr uint32_t s_LOD_MIN_TRIANGLES = 16;
+
+struct SourceVertex
+{
+	float Position[3];
+	float Normal[3];
+	float Uv[2];
+};
+
+// Minimal JSON, enough for glTF.
+
+struct Json
+{
+	enum Kind { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } Type = NUL;
+	double Number = 0.0;
+	std::string String;
+	std::vector<Json> Items;
+	std::vector<std::pair<std::string, Json>> Members;
+
+	Json const* Find(std::string const& key) const
+	{
+		for (auto const& member : Members)
+			if (member.first == key)
+				return &member.second;
+		return nullptr;
+	}
+
+	Json const& operator[](std::string const& key) const
+	{
+		Json const* value = Find(key);
+		if (!value)
+			throw std::runtime_error("missing glTF property \"" + key + "\"");
+		return *value;
+	}
+
+	Json const& operator[](size_t index) const
+	{
+		if (index >= Items.size())
+			throw std::runtime_error("glTF index out of range");
+		return Items[index];
+	}
+
+	uint32_t Uint() const { return static_cast<uint32_t>(Number); }
+};
+
+class JsonParser
+{
+public:
+
+	JsonParser(std::string const& text) : m_text(text), m_pos(0) {}
+
+	Json Parse()
+	{
+		Json value = ParseValue();
+		SkipSpace();
+		if (m_pos != m_text.size())
+			Fail();
+		return value;
+	}
+
+private:
+
+	std::string const& m_text;
+	size_t m_pos;
+
+	[[noreturn]] void Fail() const { throw std::runtime_error("malformed JSON at offset " + std::to_string(m_pos)); }
+
+	void SkipSpace()
+	{
+		while (m_pos < m_text.size() && std::strchr(" \t\r\n", m_text[m_pos]))
+			m_pos++;
+	}
+
+	bool Consume(char c)
+	{
+		SkipSpace();
+		if (m_pos < m_text.size() && m_text[m_pos] == c)
+		{
+			m_pos++;
+			return true;
+		}
+		return false;
+	}
+
+	void Expect(char c)
+	{
+		if (!Consume(c))
+			Fail();
+	}
+
+	std::string ParseString()
+	{
+		Expect('"');
+		std::string result;
+		while (m_pos < m_text.size() && m_text[m_pos] != '"')
+		{
+			char c = m_text[m_pos++];
+			if (c != '\\')
+			{
+				result += c;
+				continue;
+			}
+
+			if (m_pos >= m_text.size())
+				Fail();
+			char escape = m_text[m_pos++];
+			switch (escape)
+			{
+			case 'n': result += '\n'; break;
+			case 't': result += '\t'; break;
+			case 'r': result += '\r'; break;
+			case 'b': result += '\b'; break;
+			case 'f': result += '\f'; break;
+			case 'u':
+			{
+				// Names and URIs only, so anything outside ASCII is kept as UTF-8 of the BMP code point.
+				if (m_pos + 4 > m_text.size())
+					Fail();
+				uint32_t code = std::stoul(m_text.substr(m_pos, 4), nullptr, 16);
+				m_pos += 4;
+				if (code < 0x80)
+					result += static_cast<char>(code);
+				else if (code < 0x800)
+					result += static_cast<char>(0xC0 | (code >> 6)), result += static_cast<char>(0x80 | (code & 0x3F));
+				else
+					result += static_cast<char>(0xE0 | (code >> 12)), result += static_cast<char>(0x80 | ((code >> 6) & 0x3F)),
+					result += static_cast<char>(0x80 | (code & 0x3F));
+				break;
+			}
+			default: result += escape; break;
+			}
+		}
+		Expect('"');
+		return result;
+	}
+
+	Json ParseValue()
+	{
+		SkipSpace();
+		if (m_pos >= m_text.size())
+			Fail();
+
+		Json value;
+		char c = m_text[m_pos];
+
+		if (c == '{')
+		{
+			value.Type = Json::OBJECT;
+			m_pos++;
+			if (Consume('}'))
+				return value;
+			do
+			{
+				SkipSpace();
+				std::string key = ParseString();
+				Expect(':');
+				value.Members.emplace_back(std::move(key), ParseValue());
+			} while (Consume(','));
+			Expect('}');
+		}
+		else if (c == '[')
+		{
+			value.Type = Json::ARRAY;
+			m_pos++;
+			if (Consume(']'))
+				return value;
+			do
+				value.Items.push_back(ParseValue());
+			while (Consume(','));
+			Expect(']');
+		}
+		else if (c == '"')
+		{
+			value.Type = Json::STRING;
+			value.String = ParseString();
+		}
+		else if (m_text.compare(m_pos, 4, "true") == 0 || m_text.compare(m_pos, 5, "false") == 0)
+		{
+			value.Type = Json::BOOLEAN;
+			value.Number = c == 't';
+			m_pos += c == 't' ? 4 : 5;
+		}
+		else if (m_text.compare(m_pos, 4, "null") == 0)
+			m_pos += 4;
+		else
+		{
+			value.Type = Json::NUMBER;
+			char const* begin = m_text.c_str() + m_pos;
+			char* end;
+			value.Number = std::strtod(begin, &end);
+			if (end == begin)
+				Fail();
+			m_pos += end - begin;
+		}
+
+		return value;
+	}
+};
+
+// glTF loading.
+
+static std::vector<char> s_ReadFile(std::filesystem::path const& path)
+{
+	std::ifstream ifs(path, std::ios::ate | std::ios::binary);
+	if (!ifs.is_open())
+		throw std::runtime_error("cannot open " + path.string());
+
+	std::vector<char> data(static_cast<size_t>(ifs.tellg()));
+	ifs.seekg(0);
+	ifs.read(data.data(), data.size());
+	return data;
+}
+
+static std::vector<char> s_DecodeBase64(std::string const& text)
+{
+	std::vector<char> data;
+	uint32_t bits = 0, bit_count = 0;
+
+	for (char c : text)
+	{
+		int value;
+		if (c >= 'A' && c <= 'Z') value = c - 'A';
+		else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') value = c - '0' + 52;
+		else if (c == '+') value = 62;
+		else if (c == '/') value = 63;
+		else continue; // Padding and whitespace
+
+		bits = (bits << 6) | value;
+		bit_count += 6;
+		if (bit_count >= 8)
+		{
+			bit_count -= 8;
+			data.push_back(static_cast<char>((bits >> bit_count) & 0xFF));
+		}
+	}
+
+	return data;
+}
+
+struct Gltf
+{
+	Json Document;
+	std::vector<std::vector<char>> Buffers;
+};
+
+static Gltf s_LoadGltf(std::filesystem::path const& path)
+{
+	std::vector<char> file = s_ReadFile(path);
+	Gltf gltf;
+	std::vector<char> binary_chunk;
+	std::string json;
+
+	// GLB: 12-byte header, then a JSON chunk and an optional binary chunk.
+	if (file.size() >= 12 && std::memcmp(file.data(), "glTF", 4) == 0)
+	{
+		size_t offset = 12;
+		while (offset + 8 <= file.size())
+		{
+			uint32_t length, type;
+			std::memcpy(&length, file.data() + offset, 4);
+			std::memcpy(&type, file.data() + offset + 4, 4);
+			if (offset + 8 + length > file.size())
+				throw std::runtime_error("truncated GLB chunk");
+
+			if (type == 0x4E4F534A) // "JSON"
+				json.assign(file.data() + offset + 8, length);
+			else if (type == 0x004E4942) // "BIN"
+				binary_chunk.assign(file.data() + offset + 8, file.data() + offset + 8 + length);
+			offset += 8 + ((length + 3) & ~3u);
+		}
+	}
+	else
+		json.assign(file.begin(), file.end());
+
+	gltf.Document = JsonParser(json).Parse();
+
+	if (Json const* buffers = gltf.Document.Find("buffers"))
+	{
+		for (Json const& buffer : buffers->Items)
+		{
+			Json const* uri = buffer.Find("uri");
+			if (!uri)
+				gltf.Buffers.push_back(binary_chunk);
+			else if (uri->String.rfind("data:", 0) == 0)
+				gltf.Buffers.push_back(s_DecodeBase64(uri->String.substr(uri->String.find(',') + 1)));
+			else
+				gltf.Buffers.push_back(s_ReadFile(path.parent_path() / uri->String));
+
+			if (gltf.Buffers.back().size() < buffer["byteLength"].Uint())
+				throw std::runtime_error("glTF buffer shorter than its byteLength");
+		}
+	}
+
+	return gltf;
+}
+
+// Element i of an accessor as floats, converting normalized integers. Sparse accessors are not supported.
+static std::vector<float> s_ReadAccessor(Gltf const& gltf, uint32_t index, uint32_t components)
+{
+	Json const& accessor = gltf.Document["accessors"][index];
+	if (accessor.Find("sparse"))
+		throw std::runtime_error("sparse accessors are not supported");
+
+	uint32_t count = accessor["count"].Uint();
+	uint32_t component_type = accessor["componentType"].Uint();
+	bool normalized = accessor.Find("normalized") && accessor["normalized"].Number != 0.0;
+
+	uint32_t component_size = component_type == 5126 || component_type == 5125 ? 4 : component_type == 5122 || component_type == 5123 ? 2 : 1;
+	std::vector<float> values(static_cast<size_t>(count) * components, 0.0f);
+
+	Json const* view_index = accessor.Find("bufferView");
+	if (!view_index)
+		return values; // All zeros, as the spec says
+
+	Json const& view = gltf.Document["bufferViews"][view_index->Uint()];
+	std::vector<char> const& buffer = gltf.Buffers.at(view["buffer"].Uint());
+	size_t offset = (view.Find("byteOffset") ? view["byteOffset"].Uint() : 0) + (accessor.Find("byteOffset") ? accessor["byteOffset"].Uint() : 0);
+	size_t stride = view.Find("byteStride") ? view["byteStride"].Uint() : component_size * components;
+
+	if (count && offset + (count - 1) * stride + component_size * components > buffer.size())
+		throw std::runtime_error("glTF accessor out of its buffer");
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char const* element = buffer.data() + offset + i * stride;
+		for (uint32_t c = 0; c < components; c++)
+		{
+			char const* source = element + c * component_size;
+			float& value = values[static_cast<size_t>(i) * components + c];
+
+			switch (component_type)
+			{
+			case 5126: std::memcpy(&value, source, 4); break;
+			case 5125: { uint32_t v; std::memcpy(&v, source, 4); value = static_cast<float>(v); break; }
+			case 5123: { uint16_t v; std::memcpy(&v, source, 2); value = normalized ? v / 65535.0f : v; break; }
+			case 5122: { int16_t v; std::memcpy(&v, source, 2); value = normalized ? std::max(v / 32767.0f, -1.0f) : v; break; }
+			case 5121: { uint8_t v = static_cast<uint8_t>(*source); value = normalized ? v / 255.0f : v; break; }
+			case 5120: { int8_t v = static_cast<int8_t>(*source); value = normalized ? std::max(v / 127.0f, -1.0f) : v; break; }
+			default: throw std::runtime_error("unknown glTF component type");
+			}
+		}
+	}
+
+	return values;
+}
+
+static void s_LoadMesh(Gltf const& gltf, std::vector<SourceVertex>& vertices, std::vector<uint32_t>& indices)
+{
+	Json const& mesh = gltf.Document["meshes"][0];
+
+	for (Json const& primitive : mesh["primitives"].Items)
+	{
+		if (primitive.Find("mode") && primitive["mode"].Uint() != 4)
+		{
+			std::cerr << "MeshCooker: skipping a primitive that is not a triangle list\n";
+			continue;
+		}
+
+		Json const& attributes = primitive["attributes"];
+		std::vector<float> positions = s_ReadAccessor(gltf, attributes["POSITION"].Uint(), 3);
+		uint32_t count = static_cast<uint32_t>(positions.size() / 3);
+
+		std::vector<float> normals = attributes.Find("NORMAL") ? s_ReadAccessor(gltf, attributes["NORMAL"].Uint(), 3) : std::vector<float>();
+		std::vector<float> uvs = attributes.Find("TEXCOORD_0") ? s_ReadAccessor(gltf, attributes["TEXCOORD_0"].Uint(), 2) : std::vector<float>(count * 2, 0.0f);
+
+		uint32_t base = static_cast<uint32_t>(vertices.size());
+		for (uint32_t i = 0; i < count; i++)
+		{
+			SourceVertex vertex{};
+			std::copy_n(&positions[i * 3], 3, vertex.Position);
+			if (!normals.empty())
+				std::copy_n(&normals[i * 3], 3, vertex.Normal);
+			std::copy_n(&uvs[i * 2], 2, vertex.Uv);
+			vertices.push_back(vertex);
+		}
+
+		size_t first_index = indices.size();
+		if (primitive.Find("indices"))
+		{
+			for (float index : s_ReadAccessor(gltf, primitive["indices"].Uint(), 1))
+			{
+				if (index >= count)
+					throw std::runtime_error("glTF index out of range");
+				indices.push_back(base + static_cast<uint32_t>(index));
+			}
+		}
+		else
+		{
+			for (uint32_t i = 0; i < count; i++)
+				indices.push_back(base + i);
+		}
+
+		if ((indices.size() - first_index) % 3)
+			throw std::runtime_error("glTF triangle list with a partial triangle");
+
+		// Smooth normals from the faces when the primitive has none.
+		if (normals.empty())
+		{
+			for (size_t t = first_index; t < indices.size(); t += 3)
+			{
+				float const* a = vertices[indices[t]].Position, * b = vertices[indices[t + 1]].Position, * c = vertices[indices[t + 2]].Position;
+				float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+				float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				for (uint32_t k = 0; k < 3; k++)
+					for (uint32_t axis = 0; axis < 3; axis++)
+						vertices[indices[t + k]].Normal[axis] += n[axis];
+			}
+		}
+	}
+
+	if (indices.empty())
+		throw std::runtime_error("no triangles in the first glTF mesh");
+}
+
+// Quantization.
+
+static int16_t s_Snorm16(float value)
+{
+	return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t s_Half(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, 4);
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0) // Too small, flushed to zero
+		return static_cast<uint16_t>(sign);
+	if (exponent >= 31) // Too large, clamped to the largest finite half
+		return static_cast<uint16_t>(sign | 0x7BFF);
+
+	// Round to nearest; a carry into the exponent is exactly the right result.
+	return static_cast<uint16_t>(sign | ((exponent << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+static void s_OctEncode(float const normal[3], int16_t out[2])
+{
+	float length = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+	if (length == 0.0f)
+	{
+		out[0] = out[1] = 0; // Decodes to +z
+		return;
+	}
+
+	float x = normal[0] / length, y = normal[1] / length;
+	if (normal[2] < 0.0f)
+	{
+		float folded_x = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float folded_y = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x, y = folded_y;
+	}
+
+	out[0] = s_Snorm16(x);
+	out[1] = s_Snorm16(y);
+}
+
+// Index reordering.
+
+// Average cache misses per triangle of a FIFO cache, 0.5 is ideal for regular grids and 3 the worst.
+static float s_Acmr(std::vector<uint32_t> const& indices, uint32_t vertex_count, uint32_t cache_size)
+{
+	std::vector<uint32_t> stamp(vertex_count, 0);
+	uint32_t misses = 0;
+
+	// A vertex is in the cache if it missed within the last cache_size misses.
+	for (uint32_t index : indices)
+	{
+		if (!stamp[index] || misses + 1 - stamp[index] > cache_size)
+			stamp[index] = ++misses;
+	}
+
+	return indices.empty() ? 0.0f : misses / (indices.size() / 3.0f);
+}
+
+// Tom Forsyth's linear-speed vertex cache optimization: greedily emit the triangle whose vertices score highest,
+// favouring vertices recently used (still in the cache) and vertices with few triangles left (so none is stranded).
+static std::vector<uint32_t> s_OptimizeVertexCache(std::vector<uint32_t> const& indices, uint32_t vertex_count)
+{
+	uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+
+	auto score = [](int32_t cache_position, uint32_t remaining) {
+		if (!remaining)
+			return -1.0f;
+		float value = 0.0f;
+		if (cache_position >= 0)
+			value = cache_position < 3 ? 0.75f : std::pow(1.0f - (cache_position - 3) / float(s_CACHE_SIZE - 3), 1.5f);
+		return value + 2.0f / std::sqrt(static_cast<float>(remaining));
+	};
+
+	// Triangles of each vertex.
+	std::vector<uint32_t> offsets(vertex_count + 1, 0), remaining(vertex_count, 0);
+	for (uint32_t index : indices)
+		remaining[index]++;
+	for (uint32_t v = 0; v < vertex_count; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<uint32_t> adjacency(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+	for (uint32_t t = 0; t < triangle_count; t++)
+		for (uint32_t k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = t;
+
+	std::vector<float> vertex_score(vertex_count), triangle_score(triangle_count, 0.0f);
+	std::vector<int32_t> cache_position(vertex_count, -1);
+	std::vector<bool> emitted(triangle_count, false);
+
+	for (uint32_t v = 0; v < vertex_count; v++)
+		vertex_score[v] = score(-1, remaining[v]);
+	for (uint32_t t = 0; t < triangle_count; t++)
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	std::vector<uint32_t> cache, next_cache;
+	uint32_t fallback = 0; // Triangles before this one have all been emitted
+
+	for (uint32_t emitted_count = 0; emitted_count < triangle_count; emitted_count++)
+	{
+		// Best triangle touching the cache, or the first one left when the cache has nothing to offer.
+		int64_t best = -1;
+		float best_score = -1.0f;
+		for (uint32_t v : cache)
+		{
+			for (uint32_t i = offsets[v]; i < offsets[v + 1]; i++)
+			{
+				uint32_t t = adjacency[i];
+				if (!emitted[t] && triangle_score[t] > best_score)
+					best = t, best_score = triangle_score[t];
+			}
+		}
+
+		if (best < 0)
+		{
+			while (emitted[fallback])
+				fallback++;
+			best = fallback;
+		}
+
+		uint32_t const* triangle = &indices[best * 3];
+		emitted[best] = true;
+		result.insert(result.end(), triangle, triangle + 3);
+
+		// Its vertices move to the front of the cache, in LRU order.
+		next_cache.assign(triangle, triangle + 3);
+		for (uint32_t v : cache)
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				next_cache.push_back(v);
+
+		for (uint32_t k = 0; k < 3; k++)
+			remaining[triangle[k]]--;
+
+		for (uint32_t v : cache)
+			cache_position[v] = -1;
+		for (uint32_t v : next_cache)
+			cache_position[v] = -1;
+
+		for (uint32_t i = 0; i < next_cache.size(); i++)
+			cache_position[next_cache[i]] = i < s_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+
+		// Rescore the vertices whose cache position changed, and their triangles.
+		for (uint32_t v : next_cache)
+		{
+			float new_score = score(cache_position[v], remaining[v]);
+			float delta = new_score - vertex_score[v];
+			vertex_score[v] = new_score;
+			for (uint32_t i = offsets[v]; i < offsets[v + 1]; i++)
+				triangle_score[adjacency[i]] += delta;
+		}
+
+		if (next_cache.size() > s_CACHE_SIZE)
+			next_cache.resize(s_CACHE_SIZE);
+		std::swap(cache, next_cache);
+	}
+
+	return result;
+}
+
+// Overdraw reordering after "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al.):
+// cut the cache-ordered list into clusters where the cache starts over anyway (a triangle of three misses), then
+// draw the clusters facing outwards from the mesh first, since they tend to hide the rest. Cache efficiency is kept
+// because the order within clusters is untouched.
+static std::vector<uint32_t> s_OptimizeOverdraw(std::vector<uint32_t> const& indices, std::vector<SourceVertex> const& vertices)
+{
+	uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+
+	std::vector<uint32_t> cluster_starts;
+	std::vector<uint32_t> stamp(vertices.size(), 0);
+	uint32_t misses = 0;
+
+	for (uint32_t t = 0; t < triangle_count; t++)
+	{
+		uint32_t triangle_misses = 0;
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			uint32_t index = indices[t * 3 + k];
+			if (!stamp[index] || misses + 1 - stamp[index] > s_REPORT_CACHE_SIZE)
+				stamp[index] = ++misses, triangle_misses++;
+		}
+
+		if (t == 0 || triangle_misses == 3)
+			cluster_starts.push_back(t);
+	}
+	cluster_starts.push_back(triangle_count);
+
+	// Area-weighted centroid and normal of every cluster and of the whole mesh.
+	float mesh_centroid[3] = {};
+	float mesh_area = 0.0f;
+
+	struct Cluster
+	{
+		uint32_t Begin, End;
+		float Centroid[3], Normal[3], Area;
+		float Sort;
+	};
+
+	std::vector<Cluster> clusters;
+	for (size_t c = 0; c + 1 < cluster_starts.size(); c++)
+	{
+		Cluster cluster{};
+		cluster.Begin = cluster_starts[c];
+		cluster.End = cluster_starts[c + 1];
+		for (uint32_t t = cluster.Begin; t < cluster.End; t++)
+		{
+			float const* a = vertices[indices[t * 3]].Position, * b = vertices[indices[t * 3 + 1]].Position, * p = vertices[indices[t * 3 + 2]].Position;
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e2[3] = { p[0] - a[0], p[1] - a[1], p[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = 0.5f * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (uint32_t axis = 0; axis < 3; axis++)
+			{
+				cluster.Centroid[axis] += (a[axis] + b[axis] + p[axis]) / 3.0f * area;
+				cluster.Normal[axis] += n[axis];
+			}
+			cluster.Area += area;
+		}
+
+		for (uint32_t axis = 0; axis < 3; axis++)
+			mesh_centroid[axis] += cluster.Centroid[axis];
+		mesh_area += cluster.Area;
+		clusters.push_back(cluster);
+	}
+
+	for (float& axis : mesh_centroid)
+		axis /= std::max(mesh_area, 1e-20f);
+
+	for (Cluster& cluster : clusters)
+	{
+		float normal_length = std::sqrt(cluster.Normal[0] * cluster.Normal[0] + cluster.Normal[1] * cluster.Normal[1] + cluster.Normal[2] * cluster.Normal[2]);
+		cluster.Sort = 0.0f;
+		for (uint32_t axis = 0; axis < 3; axis++)
+			cluster.Sort += (cluster.Centroid[axis] / std::max(cluster.Area, 1e-20f) - mesh_centroid[axis]) * cluster.Normal[axis] / std::max(normal_length, 1e-20f);
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](Cluster const& a, Cluster const& b) { return a.Sort > b.Sort; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (Cluster const& cluster : clusters)
+		result.insert(result.end(), indices.begin() + cluster.Begin * 3, indices.begin() + cluster.End * 3);
+	return result;
+}
+
+// Level of detail.
+
+// Vertex clustering: snap every vertex to a grid cell, let one vertex stand for the whole cell and drop the
+// triangles that collapse. Coarse, but it reuses the existing vertices, so every level shares one vertex buffer.
+static std::vector<uint32_t> s_Cluster(std::vector<uint32_t> const& indices, std::vector<SourceVertex> const& vertices,
+	float const min[3], float cell_size)
+{
+	std::unordered_map<uint64_t, uint32_t> cell_vertex;
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+
+	// Representatives are picked among the vertices the level still uses, in index order, so the result is deterministic.
+	for (uint32_t index : indices)
+	{
+		if (remap[index] != UINT32_MAX)
+			continue;
+
+		uint64_t key = 0;
+		for (uint32_t axis = 0; axis < 3; axis++)
+			key = key << 21 | (static_cast<uint64_t>((vertices[index].Position[axis] - min[axis]) / cell_size) & 0x1FFFFF);
+
+		remap[index] = cell_vertex.emplace(key, index).first->second;
+	}
+
+	std::vector<uint32_t> result;
+	std::unordered_map<uint64_t, bool> seen;
+
+	for (size_t t = 0; t < indices.size(); t += 3)
+	{
+		uint32_t a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+		if (a == b || b == c || a == c)
+			continue;
+
+		// Two triangles over the same cells would be drawn on top of each other.
+		std::array<uint32_t, 3> sorted = { a, b, c };
+		std::sort(sorted.begin(), sorted.end());
+		uint64_t key = (static_cast<uint64_t>(sorted[0]) * 0x9E3779B97F4A7C15ull) ^ (static_cast<uint64_t>(sorted[1]) << 21) ^ (static_cast<uint64_t>(sorted[2]) << 42);
+		if (!seen.emplace(key, true).second)
+			continue;
+
+		result.insert(result.end(), { a, b, c });
+	}
+
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <input .gltf or .glb> <output>\n";
+		return 1;
+	}
+
+	std::vector<SourceVertex> source_vertices;
+	std::vector<uint32_t> source_indices;
+
+	try
+	{
+		s_LoadMesh(s_LoadGltf(argv[1]), source_vertices, source_indices);
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << "MeshCooker: " << argv[1] << ": " << e.what() << '\n';
+		return 1;
+	}
+
+	// Bounding sphere around the box centre, which positions are quantized within.
+	float min[3] = { INFINITY, INFINITY, INFINITY }, max[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (SourceVertex const& vertex : source_vertices)
+		for (uint32_t axis = 0; axis < 3; axis++)
+			min[axis] = std::min(min[axis], vertex.Position[axis]), max[axis] = std::max(max[axis], vertex.Position[axis]);
+
+	MeshHeader header{};
+	header.Magic = MESH_MAGIC;
+	header.Version = MESH_VERSION;
+	for (uint32_t axis = 0; axis < 3; axis++)
+		header.Center[axis] = 0.5f * (min[axis] + max[axis]);
+
+	for (SourceVertex const& vertex : source_vertices)
+	{
+		float d[3] = { vertex.Position[0] - header.Center[0], vertex.Position[1] - header.Center[1], vertex.Position[2] - header.Center[2] };
+		header.Radius = std::max(header.Radius, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+	}
+	header.Radius = std::max(header.Radius, 1e-6f);
+
+	// Quantize, then merge vertices that became identical. The source vertices of the survivors are kept for the
+	// geometric work below.
+	std::vector<PackedVertex> packed;
+	std::vector<SourceVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::unordered_map<std::string, uint32_t> unique;
+
+	std::vector<uint32_t> vertex_remap(source_vertices.size());
+	for (size_t i = 0; i < source_vertices.size(); i++)
+	{
+		SourceVertex const& source = source_vertices[i];
+		PackedVertex vertex{};
+		for (uint32_t axis = 0; axis < 3; axis++)
+			vertex.Position[axis] = s_Snorm16((source.Position[axis] - header.Center[axis]) / header.Radius);
+		vertex.Position[3] = 32767;
+		s_OctEncode(source.Normal, vertex.Normal);
+		vertex.Uv[0] = s_Half(source.Uv[0]);
+		vertex.Uv[1] = s_Half(source.Uv[1]);
+
+		auto [it, inserted] = unique.emplace(std::string(reinterpret_cast<char const*>(&vertex), sizeof(vertex)), static_cast<uint32_t>(packed.size()));
+		if (inserted)
+		{
+			packed.push_back(vertex);
+			vertices.push_back(source);
+		}
+		vertex_remap[i] = it->second;
+	}
+
+	for (uint32_t index : source_indices)
+		indices.push_back(vertex_remap[index]);
+
+	uint32_t vertex_count = static_cast<uint32_t>(packed.size());
+	float acmr_before = s_Acmr(indices, vertex_count, s_REPORT_CACHE_SIZE);
+
+	// Levels of detail, each with about half the triangles of the one before. The grid is refined by bisection
+	// until the level lands at or just below its target.
+	std::vector<std::vector<uint32_t>> levels = { indices };
+	std::vector<float> errors = { 0.0f };
+	float extent = std::max({ max[0] - min[0], max[1] - min[1], max[2] - min[2], 1e-6f });
+
+	while (levels.size() < MESH_MAX_LODS)
+	{
+		std::vector<uint32_t> const& previous = levels.back();
+		size_t target = previous.size() / 3 / 2;
+		if (target < s_LOD_MIN_TRIANGLES)
+			break;
+
+		// Cells per extent: fewer cells, fewer triangles.
+		float lo = 1.0f, hi = 1024.0f;
+		std::vector<uint32_t> best;
+		float best_cell = 0.0f;
+
+		for (uint32_t step = 0; step < 16; step++)
+		{
+			float cells = 0.5f * (lo + hi);
+			std::vector<uint32_t> level = s_Cluster(previous, vertices, min, extent / cells);
+			if (level.size() / 3 <= target)
+			{
+				best = std::move(level);
+				best_cell = extent / cells;
+				lo = cells;
+			}
+			else
+				hi = cells;
+		}
+
+		if (best.size() < s_LOD_MIN_TRIANGLES * 3 || best.size() > previous.size() * s_LOD_MIN_REDUCTION)
+			break;
+
+		levels.push_back(std::move(best));
+
+		// A vertex moves at most a cell diagonal, on top of what the previous levels moved it.
+		errors.push_back(errors.back() + best_cell * std::sqrt(3.0f));
+	}
+
+	for (std::vector<uint32_t>& level : levels)
+		level = s_OptimizeOverdraw(s_OptimizeVertexCache(level, vertex_count), vertices);
+
+	float acmr_after = s_Acmr(levels[0], vertex_count, s_REPORT_CACHE_SIZE);
+
+	// Vertices in order of first use, so the vertex fetcher reads memory front to back.
+	std::vector<uint32_t> fetch_remap(vertex_count, UINT32_MAX);
+	std::vector<PackedVertex> ordered;
+	for (std::vector<uint32_t>& level : levels)
+	{
+		for (uint32_t& index : level)
+		{
+			if (fetch_remap[index] == UINT32_MAX)
+			{
+				fetch_remap[index] = static_cast<uint32_t>(ordered.size());
+				ordered.push_back(packed[index]);
+			}
+			index = fetch_remap[index];
+		}
+	}
+
+	std::vector<MeshLodRange> lods;
+	std::vector<uint32_t> all_indices;
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		lods.push_back({ static_cast<uint32_t>(levels[i].size()), static_cast<uint32_t>(all_indices.size()), errors[i], 0 });
+		all_indices.insert(all_indices.end(), levels[i].begin(), levels[i].end());
+	}
+
+	header.VertexCount = static_cast<uint32_t>(ordered.size());
+	header.IndexCount = static_cast<uint32_t>(all_indices.size());
+	header.LodCount = static_cast<uint32_t>(lods.size());
+	header.IndexSize = header.VertexCount <= 0x10000 ? 2 : 4;
+	header.VertexOffset = (sizeof(MeshHeader) + lods.size() * sizeof(MeshLodRange) + 15) & ~15ull;
+	header.IndexOffset = header.VertexOffset + ordered.size() * sizeof(PackedVertex);
+
+	std::vector<char> index_data(all_indices.size() * header.IndexSize);
+	for (size_t i = 0; i < all_indices.size(); i++)
+	{
+		if (header.IndexSize == 2)
+		{
+			uint16_t index = static_cast<uint16_t>(all_indices[i]);
+			std::memcpy(index_data.data() + i * 2, &index, 2);
+		}
+		else
+			std::memcpy(index_data.data() + i * 4, &all_indices[i], 4);
+	}
+
+	// Written next to the output and renamed over it, so a failed build never leaves a torn mesh behind.
+	std::filesystem::path output = argv[2];
+	std::filesystem::path temp = output;
+	temp += ".tmp";
+
+	{
+		std::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+		if (!ofs.is_open())
+		{
+			std::cerr << "MeshCooker: cannot write " << temp.string() << '\n';
+			return 1;
+		}
+
+		static char const padding[16] = {};
+		ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		ofs.write(reinterpret_cast<char const*>(lods.data()), lods.size() * sizeof(MeshLodRange));
+		ofs.write(padding, header.VertexOffset - sizeof(header) - lods.size() * sizeof(MeshLodRange));
+		ofs.write(reinterpret_cast<char const*>(ordered.data()), ordered.size() * sizeof(PackedVertex));
+		ofs.write(index_data.data(), index_data.size());
+
+		if (!ofs)
+		{
+			std::cerr << "MeshCooker: failed writing " << temp.string() << '\n';
+			return 1;
+		}
+	}
+
+	std::filesystem::rename(temp, output);
+
+	std::cout << "MeshCooker: " << output.string() << ": " << source_vertices.size() << " -> " << header.VertexCount << " vertices ("
+		<< source_vertices.size() * sizeof(SourceVertex) << " -> " << header.VertexCount * sizeof(PackedVertex) << " bytes), ACMR "
+		<< acmr_before << " -> " << acmr_after << ", LOD triangles";
+	for (MeshLodRange const& lod : lods)
+		std::cout << ' ' << lod.IndexCount / 3;
+	std::cout << '\n';
+	return 0;
+}
\ No newline at end of file